@@ -46,6 +46,7 @@ int main(int argc, char** argv)
 {
     const char* requestedTa = DEFAULT_TA_ID;
     const char* unneededTa = NULL;
+    int waitForPush = 0;
     int simulated_tee = 0;
     teep_signature_kind_t signatureKind = TEEP_SIGNATURE_ES256;
 
@@ -70,13 +71,19 @@ int main(int argc, char** argv)
         argc -= 2;
         argv += 2;
     }
+    if ((argc > 1) && (strcmp(argv[1], "-w") == 0)) {
+        waitForPush = 1;
+        argc--;
+        argv++;
+    }
 
     if (argc < 2) {
-        printf("Usage: DeviceHost [-s] [-e] [-r <TA ID>] [-u <TA ID>] <TAM URI>\n");
+        printf("Usage: DeviceHost [-s] [-e] [-r <TA ID>] [-u <TA ID>] [-w] <TAM URI>\n");
         printf("       where -s if present means to only simulate a TEE\n");
         printf("             -e if present means to use EdDSA instead of ES256\n");
         printf("             -r <TA ID> if present is a TA ID to request (%s if absent)\n", DEFAULT_TA_ID);
         printf("             -u <TA ID> if present is a TA ID that is no longer needed by any normal app\n");
+        printf("             -w if present means to then wait for the TAM to push policy changes\n");
         printf("             <TAM URI> is the default TAM URI to use\n");
         return 0;
     }
@@ -116,6 +123,13 @@ int main(int argc, char** argv)
         }
     }
 
+    if (waitForPush) {
+        printf("Waiting for policy changes\n");
+        do {
+            err = AgentBrokerWaitForPolicyCheck(defaultTamUri);
+        } while (err == 0);
+    }
+
 exit:
     StopAgentBroker();
 
@@ -0,0 +1,81 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <chrono>
+#include <stdint.h>
+#include <thread>
+#include "catch.hpp"
+#include "AdmissionControl.h"
+#include "HttpConnectionPool.h"
+#include "LoopbackTam.h"
+
+TEST_CASE("TAM admission control turns requests away past its limits", "[admission]")
+{
+    TamAdmissionConfigure(1, 20);
+    uint64_t rejected = TamAdmissionGetRejected();
+
+    // The queue holds one request.
+    TamAdmissionTicket first;
+    TamAdmissionTicket second;
+    uint32_t retryAfterSeconds;
+    REQUIRE(TamAdmitRequest(&first, &retryAfterSeconds) == TEEP_ERR_SUCCESS);
+    REQUIRE(retryAfterSeconds == 0);
+    REQUIRE(TamAdmitRequest(&second, &retryAfterSeconds) == TEEP_ERR_TEMPORARY_ERROR);
+    REQUIRE(retryAfterSeconds >= 1);
+    REQUIRE(TamAdmissionGetQueued() == 1);
+
+    // Once taken up, it makes room for another.
+    REQUIRE(TamStartAdmittedRequest(&first, &retryAfterSeconds) == TEEP_ERR_SUCCESS);
+    REQUIRE(TamAdmitRequest(&second, &retryAfterSeconds) == TEEP_ERR_SUCCESS);
+    TamFinishAdmittedRequest(&first);
+
+    // A request that waited too long is turned away when its turn comes.
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    REQUIRE(TamStartAdmittedRequest(&second, &retryAfterSeconds) == TEEP_ERR_TEMPORARY_ERROR);
+    REQUIRE(retryAfterSeconds >= 1);
+    REQUIRE(TamAdmissionGetQueued() == 0);
+    REQUIRE(TamAdmissionGetRejected() == rejected + 2);
+
+    TamAdmissionConfigure(TAM_ADMISSION_DEFAULT_MAX_QUEUED, TAM_ADMISSION_DEFAULT_MAX_DELAY_MILLISECONDS);
+}
+
+TEST_CASE("HTTP client backs off while the TAM is overloaded", "[admission]")
+{
+    // The wait is at least the Retry-After, and grows with each try.
+    for (unsigned int tries = 1; tries <= HTTP_POOL_MAX_TRIES; tries++) {
+        uint32_t backoff = HttpPoolGetBackoffMilliseconds(tries, 0);
+        REQUIRE(backoff <= ((uint32_t)HTTP_POOL_BACKOFF_BASE_MILLISECONDS << (tries - 1)));
+        backoff = HttpPoolGetBackoffMilliseconds(tries, 2);
+        REQUIRE(backoff >= 2000);
+        REQUIRE(backoff <= 4000);
+    }
+
+    LoopbackTam tam(false);
+    char authority[64];
+    char path[64];
+    REQUIRE(HttpParseUri(tam.GetUri(), authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_SUCCESS);
+    HttpPoolRequest request = { "application/teep+cbor", "QueryResponse", 13 };
+
+    // A full TAM says when to come back.
+    TamAdmissionConfigure(0, TAM_ADMISSION_DEFAULT_MAX_DELAY_MILLISECONDS);
+    HttpPoolResponse response;
+    REQUIRE(HttpPoolPost(authority, path, "application/teep+cbor", &request, 1, &response) == TEEP_ERR_SUCCESS);
+    REQUIRE(response.StatusCode == 503);
+    REQUIRE(response.RetryAfterSeconds >= 1);
+    HttpPoolFreeResponse(&response);
+
+    // A client that backs off gets its answer once the TAM has room.
+    uint64_t retries = HttpPoolGetRetries();
+    std::thread reopen([] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        TamAdmissionConfigure(TAM_ADMISSION_DEFAULT_MAX_QUEUED, TAM_ADMISSION_DEFAULT_MAX_DELAY_MILLISECONDS);
+    });
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(HttpPoolPostWithBackoff(authority, path, "application/teep+cbor", &request, 1, &response) == TEEP_ERR_SUCCESS);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    reopen.join();
+    REQUIRE(response.StatusCode == 200);
+    REQUIRE(std::string(response.Body, response.BodyLength) == "Re:QueryResponse");
+    HttpPoolFreeResponse(&response);
+    REQUIRE(HttpPoolGetRetries() > retries);
+    REQUIRE(elapsed.count() >= 1.0);
+}
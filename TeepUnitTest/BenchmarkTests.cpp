@@ -0,0 +1,518 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+
+// Benchmarks are hidden by default; run them with "TeepUnitTest [benchmark]".
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "catch.hpp"
+extern "C" {
+#include "openssl/evp.h"
+};
+#include "qcbor/UsefulBuf.h"
+#include "AdmissionControl.h"
+#include "delta.h"
+#include "coap.h"
+#include "BundleClient.h"
+#include "CoapClient.h"
+#include "CoapServer.h"
+#include "HttpConnectionPool.h"
+#include "LoopbackTam.h"
+#include "TeepAgentLib.h"
+#include "Manifest.h"
+#include "ManifestTransaction.h"
+#include "SuitParser.h"
+#include "TestManifests.h"
+#ifdef __linux__
+#include "UnixForwarder.h"
+#include "UnixServer.h"
+#endif
+#define TEEP_AGENT_DATA_DIRECTORY "../../../agent"
+
+TEST_CASE("Install synthetic multi-manifest Update", "[.][benchmark]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    REQUIRE(TrustTestSigner() == TEEP_ERR_SUCCESS);
+
+    const size_t manifestCount = 64;
+    std::vector<std::vector<uint8_t>> envelopes;
+    std::vector<UsefulBufC> manifestList;
+    for (uint32_t i = 0; i < manifestCount; i++) {
+        envelopes.push_back(SignWithTestSigner(ComposeSyntheticEnvelope(i, 64 * 1024)));
+    }
+    for (const std::vector<uint8_t>& envelope : envelopes) {
+        manifestList.push_back(UsefulBufC{ envelope.data(), envelope.size() });
+    }
+
+    BENCHMARK("Serial")
+    {
+        std::ostringstream errorMessage;
+        ManifestTransaction transaction;
+        teep_error_code_t errorCode = SuitProcessEnvelopes(manifestList, 1, transaction, errorMessage);
+        return (errorCode == TEEP_ERR_SUCCESS) ? transaction.Commit(errorMessage) : errorCode;
+    };
+
+    BENCHMARK("Worker pool")
+    {
+        std::ostringstream errorMessage;
+        ManifestTransaction transaction;
+        teep_error_code_t errorCode = SuitProcessEnvelopes(manifestList, 0, transaction, errorMessage);
+        return (errorCode == TEEP_ERR_SUCCESS) ? transaction.Commit(errorMessage) : errorCode;
+    };
+
+    UninstallSyntheticEnvelopes(envelopes);
+    TeepAgentShutdown();
+}
+
+TEST_CASE("Install a large fetched payload", "[.][benchmark]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    REQUIRE(TrustTestSigner() == TEEP_ERR_SUCCESS);
+    SuitSetPayloadFetcher(TestPayloadFetcher);
+
+    const uint64_t payloadSize = 512ull * 1024 * 1024;
+    uint8_t digest[TEEP_SHA256_SIZE];
+    ComputeTestPayloadDigest(11, payloadSize, digest);
+    std::vector<std::vector<uint8_t>> envelopes;
+    envelopes.push_back(SignWithTestSigner(ComposeFetchEnvelope(2000, MakeTestPayloadUri(11, payloadSize), payloadSize, digest)));
+    UsefulBufC envelope = { envelopes[0].data(), envelopes[0].size() };
+
+    // Each run uninstalls again so that the next one has to fetch.
+    BENCHMARK("Fetch, hash, and store")
+    {
+        std::ostringstream errorMessage;
+        ManifestTransaction transaction;
+        teep_error_code_t errorCode = SuitStageEnvelope(envelope, transaction, errorMessage);
+        if (errorCode == TEEP_ERR_SUCCESS) {
+            errorCode = transaction.Commit(errorMessage);
+        }
+        UninstallSyntheticEnvelopes(envelopes);
+        return errorCode;
+    };
+    REQUIRE(GetLargestFetchRequest() <= 64 * 1024);
+
+    SuitSetPayloadFetcher(TeepAgentFetchPayload);
+    TeepAgentShutdown();
+}
+
+TEST_CASE("Upgrade with a delta payload", "[.][benchmark]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    REQUIRE(TrustTestSigner() == TEEP_ERR_SUCCESS);
+    SuitSetPayloadFetcher(TestPayloadFetcher);
+
+    // A 16 MiB image with a few dozen small changes between versions.
+    std::vector<uint8_t> base = GenerateTestPayload(13, 16 * 1024 * 1024);
+    std::vector<uint8_t> target = MakeTestUpgrade(base, 64);
+    uint8_t baseDigest[TEEP_SHA256_SIZE];
+    uint8_t targetDigest[TEEP_SHA256_SIZE];
+    teep_compute_sha256({ base.data(), base.size() }, baseDigest);
+    teep_compute_sha256({ target.data(), target.size() }, targetDigest);
+    std::vector<uint8_t> delta;
+    REQUIRE(teep_delta_encode({ base.data(), base.size() }, { target.data(), target.size() }, delta) == TEEP_ERR_SUCCESS);
+
+    std::vector<std::vector<uint8_t>> envelopes;
+    envelopes.push_back(SignWithTestSigner(ComposeUpgradeEnvelope(2001, 1, RegisterTestPayload(base), base.size(), baseDigest)));
+    std::string targetUri = RegisterTestPayload(target);
+    std::vector<uint8_t> fullUpgrade = SignWithTestSigner(ComposeUpgradeEnvelope(2001, 2, targetUri, target.size(), targetDigest));
+    std::vector<uint8_t> deltaUpgrade = SignWithTestSigner(ComposeUpgradeEnvelope(2001, 2, targetUri, target.size(), targetDigest, baseDigest, RegisterTestPayload(delta)));
+
+    // Each run reinstalls the base first, and returns the bytes fetched
+    // by the upgrade alone.
+    auto upgrade = [&](const std::vector<uint8_t>& envelope) -> uint64_t {
+        const std::vector<uint8_t>* steps[] = { &envelopes[0], &envelope };
+        for (const std::vector<uint8_t>* step : steps) {
+            ResetFetchStatistics();
+            std::ostringstream errorMessage;
+            ManifestTransaction transaction;
+            if (SuitStageEnvelope({ step->data(), step->size() }, transaction, errorMessage) != TEEP_ERR_SUCCESS ||
+                transaction.Commit(errorMessage) != TEEP_ERR_SUCCESS) {
+                return UINT64_MAX;
+            }
+        }
+        return GetFetchedPayloadBytes();
+    };
+
+    uint64_t fullBytes = upgrade(fullUpgrade);
+    uint64_t deltaBytes = upgrade(deltaUpgrade);
+    REQUIRE(deltaBytes < fullBytes);
+    std::cout << "Bytes transferred per upgrade: full image " << fullBytes << ", delta " << deltaBytes << std::endl;
+
+    BENCHMARK("Full image")
+    {
+        return upgrade(fullUpgrade);
+    };
+
+    BENCHMARK("Delta")
+    {
+        return upgrade(deltaUpgrade);
+    };
+
+    UninstallSyntheticEnvelopes(envelopes);
+    SuitSetPayloadFetcher(TeepAgentFetchPayload);
+    TeepAgentShutdown();
+}
+
+TEST_CASE("Load a large TAM manifest repository", "[.][benchmark]")
+{
+    // A chain of manifests, each depending on the one before it.
+    const uint32_t manifestCount = 4096;
+    std::vector<std::vector<uint8_t>> envelopes;
+    std::vector<teep_uuid_t> componentIds(manifestCount);
+    for (uint32_t i = 0; i < manifestCount; i++) {
+        std::vector<uint32_t> dependencies;
+        if (i > 0) {
+            dependencies.push_back(3000 + i - 1);
+        }
+        envelopes.push_back(ComposeDependentEnvelope(3000 + i, 1024, dependencies));
+        SuitEnvelopeOffsets offsets;
+        std::ostringstream errorMessage;
+        REQUIRE(SuitParseEnvelope({ envelopes[i].data(), envelopes[i].size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+        REQUIRE(offsets.ComponentId.len == sizeof(teep_uuid_t));
+        memcpy(&componentIds[i], offsets.ComponentId.ptr, sizeof(teep_uuid_t));
+    }
+    auto load = [&]() {
+        for (uint32_t i = 0; i < manifestCount; i++) {
+            Manifest::AddManifest(componentIds[i], (const char*)envelopes[i].data(), envelopes[i].size(), true);
+        }
+    };
+
+    BENCHMARK("Load")
+    {
+        load();
+        Manifest::ClearManifests();
+        return manifestCount;
+    };
+
+    // Memory held for each manifest, apart from the heap's own overhead.
+    load();
+    size_t contentBytes = 0;
+    size_t metadataBytes = 0;
+    for (const Manifest* manifest = Manifest::First(); manifest != nullptr; manifest = manifest->Next) {
+        contentBytes += manifest->ManifestContents.len + manifest->CompressedContents.len;
+        if (manifest->WireContents.ptr != manifest->ManifestContents.ptr) {
+            contentBytes += manifest->WireContents.len;
+        }
+        metadataBytes += manifest->Metadata.Dependencies.capacity() * sizeof(UsefulBufC);
+    }
+    std::cout << "Bytes per manifest: " << sizeof(Manifest) << " object, of which " << sizeof(ManifestMetadata)
+              << " metadata, plus " << metadataBytes / manifestCount << " dependencies and "
+              << contentBytes / manifestCount << " contents" << std::endl;
+
+    // A policy check touches only the metadata.
+    BENCHMARK("Find upgrades")
+    {
+        size_t upgrades = 0;
+        for (const Manifest* manifest = Manifest::First(); manifest != nullptr; manifest = manifest->Next) {
+            upgrades += (manifest->Metadata.SequenceNumber > 0 && manifest->Metadata.Dependencies.size() <= 1) ? 1 : 0;
+        }
+        return upgrades;
+    };
+    Manifest::ClearManifests();
+}
+
+TEST_CASE("Hash SUIT payloads", "[.][benchmark]")
+{
+    // One 64 MiB payload, and 4096 16 KiB manifests hashed as a batch.
+    std::vector<uint8_t> buffer(64 * 1024 * 1024);
+    for (size_t i = 0; i < buffer.size(); i++) {
+        buffer[i] = (uint8_t)(i * 31);
+    }
+    UsefulBufC payload = { buffer.data(), buffer.size() };
+    std::vector<UsefulBufC> batch;
+    for (size_t offset = 0; offset < buffer.size(); offset += 16 * 1024) {
+        batch.push_back({ buffer.data() + offset, 16 * 1024 });
+    }
+    std::vector<teep_sha256_digest_t> digests(batch.size());
+
+    BENCHMARK("OpenSSL")
+    {
+        unsigned int length = 0;
+        return EVP_Digest(payload.ptr, payload.len, digests[0], &length, EVP_sha256(), NULL);
+    };
+
+    BENCHMARK("OpenSSL batch")
+    {
+        int result = 1;
+        for (size_t i = 0; i < batch.size(); i++) {
+            unsigned int length = 0;
+            result &= EVP_Digest(batch[i].ptr, batch[i].len, digests[i], &length, EVP_sha256(), NULL);
+        }
+        return result;
+    };
+
+    const struct {
+        teep_sha256_engine_t Engine;
+        const char* Name;
+    } engines[] = {
+        { TEEP_SHA256_ENGINE_PORTABLE, "Portable" },
+        { TEEP_SHA256_ENGINE_SHA_NI, "SHA-NI" },
+        { TEEP_SHA256_ENGINE_AVX2, "AVX2" },
+    };
+    for (const auto& engine : engines) {
+        if (teep_sha256_use_engine(engine.Engine) != TEEP_ERR_SUCCESS) {
+            continue;
+        }
+        BENCHMARK(std::string(engine.Name))
+        {
+            return teep_compute_sha256(payload, digests[0]);
+        };
+        BENCHMARK(std::string(engine.Name) + " batch")
+        {
+            return teep_compute_sha256_many(batch.data(), batch.size(), digests.data());
+        };
+    }
+    teep_sha256_use_engine(TEEP_SHA256_ENGINE_AUTO);
+}
+
+static void IgnoreBundleResponse(void* context, const char* deviceId, const char* mediaType, const char* message, size_t messageLength)
+{
+}
+
+TEST_CASE("Send messages from many devices in one bundle", "[.][benchmark]")
+{
+    LoopbackTam httpTam(false);
+    char authority[64];
+    char path[64];
+    REQUIRE(HttpParseUri(httpTam.GetUri(), authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_SUCCESS);
+
+    // A gateway with a QueryResponse from each of its devices.
+    const int deviceCount = 100;
+    std::string message(200, 'm');
+    std::vector<std::string> deviceIds;
+    for (int i = 0; i < deviceCount; i++) {
+        deviceIds.push_back("device-" + std::to_string(i));
+    }
+    HttpPoolRequest request = { "application/teep+cbor", message.data(), message.size() };
+
+    auto sendSeparately = [&] {
+        for (int i = 0; i < deviceCount; i++) {
+            HttpPoolResponse response;
+            teep_error_code_t result = HttpPoolPost(authority, path, "application/teep+cbor", &request, 1, &response);
+            if (result != TEEP_ERR_SUCCESS) {
+                return result;
+            }
+            HttpPoolFreeResponse(&response);
+        }
+        return TEEP_ERR_SUCCESS;
+    };
+    auto sendBundled = [&] {
+        for (const std::string& deviceId : deviceIds) {
+            BundleQueueMessage(httpTam.GetUri(), deviceId.c_str(), "application/teep+cbor", message.data(), message.size());
+        }
+        return BundleFlush(IgnoreBundleResponse, nullptr);
+    };
+
+    BENCHMARK(std::to_string(deviceCount) + " devices separately")
+    {
+        return sendSeparately();
+    };
+
+    BENCHMARK(std::to_string(deviceCount) + " devices in one bundle")
+    {
+        return sendBundled();
+    };
+
+    // Bytes of TCP payload per device, leaving out TCP's own overhead.
+    uint64_t separateBytes = httpTam.BytesReceived + httpTam.BytesSent;
+    REQUIRE(sendSeparately() == TEEP_ERR_SUCCESS);
+    separateBytes = httpTam.BytesReceived + httpTam.BytesSent - separateBytes;
+
+    uint64_t bundledBytes = httpTam.BytesReceived + httpTam.BytesSent;
+    REQUIRE(sendBundled() == TEEP_ERR_SUCCESS);
+    bundledBytes = httpTam.BytesReceived + httpTam.BytesSent - bundledBytes;
+
+    std::cout << "Bytes on the wire per device: separately " << separateBytes / deviceCount << ", bundled " << bundledBytes / deviceCount << std::endl;
+}
+
+// Run a fleet of agents against a TAM for a while, each sending its next
+// message as soon as the last is answered, or after backing off if it was
+// turned away.  An agent gives up on an answer that takes longer than the
+// deadline.  Returns the number of answers per second in time to be used.
+static double RunAgentFleet(const char* tamUri, int agentCount, std::chrono::milliseconds deadline, std::chrono::seconds duration)
+{
+    char authority[64];
+    char path[64];
+    REQUIRE(HttpParseUri(tamUri, authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_SUCCESS);
+    std::atomic<bool> stopping{ false };
+    std::atomic<uint64_t> answeredInTime{ 0 };
+
+    std::vector<std::thread> agents;
+    for (int i = 0; i < agentCount; i++) {
+        agents.emplace_back([&] {
+            HttpPoolRequest request = { "application/teep+cbor", "QueryResponse", 13 };
+            unsigned int failedTries = 0;
+            while (!stopping) {
+                auto sent = std::chrono::steady_clock::now();
+                HttpPoolResponse response;
+                int statusCode = 0;
+                uint32_t retryAfterSeconds = 0;
+                if (HttpPoolPost(authority, path, "application/teep+cbor", &request, 1, &response) == TEEP_ERR_SUCCESS) {
+                    statusCode = response.StatusCode;
+                    retryAfterSeconds = response.RetryAfterSeconds;
+                    HttpPoolFreeResponse(&response);
+                }
+                if (statusCode == 200) {
+                    failedTries = 0;
+                    if (std::chrono::steady_clock::now() - sent <= deadline) {
+                        answeredInTime++;
+                    }
+                    continue;
+                }
+                auto retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(HttpPoolGetBackoffMilliseconds(++failedTries, retryAfterSeconds));
+                while (!stopping && std::chrono::steady_clock::now() < retryAt) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+            }
+        });
+    }
+    std::this_thread::sleep_for(duration);
+    stopping = true;
+    for (std::thread& agent : agents) {
+        agent.join();
+    }
+    return (double)answeredInTime / duration.count();
+}
+
+TEST_CASE("Serve a fleet of agents past the TAM's capacity", "[.][benchmark]")
+{
+    LoopbackTam tam(false);
+    tam.ServiceMicroseconds = 5000; // 200 messages a second.
+    const std::chrono::milliseconds deadline(500);
+    const std::chrono::seconds duration(3);
+
+    // Up to 100 agents can wait their turn within the deadline.
+    for (int agentCount : { 16, 64, 128, 256, 512 }) {
+        TamAdmissionConfigure(SIZE_MAX, UINT32_MAX);
+        double unlimited = RunAgentFleet(tam.GetUri(), agentCount, deadline, duration);
+        TamAdmissionConfigure(TAM_ADMISSION_DEFAULT_MAX_QUEUED, (uint32_t)deadline.count() / 2);
+        double limited = RunAgentFleet(tam.GetUri(), agentCount, deadline, duration);
+        std::cout << agentCount << " agents, answers in time per second: without admission control " << (uint64_t)unlimited
+                  << ", with " << (uint64_t)limited << std::endl;
+    }
+
+    TamAdmissionConfigure(TAM_ADMISSION_DEFAULT_MAX_QUEUED, TAM_ADMISSION_DEFAULT_MAX_DELAY_MILLISECONDS);
+    HttpPoolCloseIdleConnections();
+}
+
+TEST_CASE("Round trip a TEEP message over CoAP and HTTP on loopback", "[.][benchmark]")
+{
+    LoopbackTam httpTam(false);
+    char authority[64];
+    char path[64];
+    REQUIRE(HttpParseUri(httpTam.GetUri(), authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_SUCCESS);
+    REQUIRE(StartCoapServer("56832", HandleLoopbackMessage) == 0);
+    const char* coapUri = "coap://127.0.0.1:56832/" TEEP_COAP_PATH;
+
+    // About the size of a QueryResponse, and of an Update with a payload.
+    for (size_t size : { (size_t)200, (size_t)64 * 1024 }) {
+        std::string message(size, 'm');
+        HttpPoolRequest request = { "application/teep+cbor", message.data(), message.size() };
+
+        BENCHMARK("CoAP " + std::to_string(size) + " bytes")
+        {
+            CoapResponse response;
+            teep_error_code_t result = CoapPost(coapUri, message.data(), message.size(), &response);
+            CoapFreeResponse(&response);
+            return result;
+        };
+
+        BENCHMARK("HTTP " + std::to_string(size) + " bytes")
+        {
+            HttpPoolResponse response;
+            teep_error_code_t result = HttpPoolPost(authority, path, "application/teep+cbor", &request, 1, &response);
+            if (result == TEEP_ERR_SUCCESS) {
+                HttpPoolFreeResponse(&response);
+            }
+            return result;
+        };
+
+        // Bytes of UDP and TCP payload, leaving out the transport headers
+        // and TCP's handshakes and acknowledgements.
+        uint64_t coapBytes = CoapGetBytesSent() + CoapGetBytesReceived();
+        CoapResponse coapResponse;
+        REQUIRE(CoapPost(coapUri, message.data(), message.size(), &coapResponse) == TEEP_ERR_SUCCESS);
+        CoapFreeResponse(&coapResponse);
+        coapBytes = CoapGetBytesSent() + CoapGetBytesReceived() - coapBytes;
+
+        uint64_t httpBytes = httpTam.BytesReceived + httpTam.BytesSent;
+        HttpPoolResponse httpResponse;
+        REQUIRE(HttpPoolPost(authority, path, "application/teep+cbor", &request, 1, &httpResponse) == TEEP_ERR_SUCCESS);
+        HttpPoolFreeResponse(&httpResponse);
+        httpBytes = httpTam.BytesReceived + httpTam.BytesSent - httpBytes;
+
+        std::cout << "Bytes on the wire per " << size << "-byte message: CoAP " << coapBytes << ", HTTP " << httpBytes << std::endl;
+    }
+
+    CoapCloseSockets();
+    StopCoapServer();
+}
+
+#ifdef __linux__
+TEST_CASE("Round trip a TEEP message over a Unix socket and HTTP on loopback", "[.][benchmark]")
+{
+    LoopbackTam httpTam(false);
+    char authority[64];
+    char path[64];
+    REQUIRE(HttpParseUri(httpTam.GetUri(), authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_SUCCESS);
+    const char* socketPath = "/tmp/teep-benchmark.sock";
+    REQUIRE(StartUnixServer(socketPath, HandleLoopbackMessage) == 0);
+    std::thread server(RunUnixServer);
+
+    // A QueryResponse, an Update with a payload, and one too large to go
+    // inline.
+    for (size_t size : { (size_t)200, (size_t)64 * 1024, (size_t)1024 * 1024 }) {
+        std::string message(size, 'm');
+        HttpPoolRequest request = { "application/teep+cbor", message.data(), message.size() };
+
+        auto unixRoundTrip = [&] {
+            UnixForwardResponse response;
+            teep_error_code_t result = UnixForwardMessage(socketPath, 1, "application/teep+cbor", message.data(), message.size(), &response);
+            if (result == TEEP_ERR_SUCCESS) {
+                UnixForwarderFreeResponse(&response);
+            }
+            return result;
+        };
+        auto httpRoundTrip = [&] {
+            HttpPoolResponse response;
+            teep_error_code_t result = HttpPoolPost(authority, path, "application/teep+cbor", &request, 1, &response);
+            if (result == TEEP_ERR_SUCCESS) {
+                HttpPoolFreeResponse(&response);
+            }
+            return result;
+        };
+
+        BENCHMARK("Unix socket " + std::to_string(size) + " bytes")
+        {
+            return unixRoundTrip();
+        };
+
+        BENCHMARK("HTTP " + std::to_string(size) + " bytes")
+        {
+            return httpRoundTrip();
+        };
+
+        // Messages each way per second, one exchange at a time.
+        const int roundTrips = 200;
+        double rates[2];
+        for (int i = 0; i < 2; i++) {
+            auto start = std::chrono::steady_clock::now();
+            for (int j = 0; j < roundTrips; j++) {
+                REQUIRE(((i == 0) ? unixRoundTrip() : httpRoundTrip()) == TEEP_ERR_SUCCESS);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            rates[i] = roundTrips / elapsed.count();
+        }
+        std::cout << size << "-byte messages: Unix socket " << (uint64_t)rates[0] << "/s (" << (uint64_t)(rates[0] * size / (1024 * 1024)) << " MB/s), HTTP "
+                  << (uint64_t)rates[1] << "/s (" << (uint64_t)(rates[1] * size / (1024 * 1024)) << " MB/s)" << std::endl;
+    }
+
+    UnixForwarderCloseConnections();
+    StopUnixServer();
+    server.join();
+}
+#endif
@@ -0,0 +1,83 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <string.h>
+#include <map>
+#include <string>
+#include "catch.hpp"
+#include "BundleClient.h"
+#include "LoopbackTam.h"
+#include "bundle.h"
+
+static teep_bundle_part_t MakePart(const char* deviceId, const char* mediaType, const std::string& body)
+{
+    teep_bundle_part_t part = {};
+    snprintf(part.device_id, sizeof(part.device_id), "%s", deviceId);
+    snprintf(part.media_type, sizeof(part.media_type), "%s", mediaType);
+    part.body = body.data();
+    part.body_length = body.size();
+    return part;
+}
+
+TEST_CASE("Bundles carry any message for each device in order", "[bundle]")
+{
+    // Bodies that look like the framing must come through untouched.
+    std::string bodies[] = { std::string("\r\n--teep-\r\n\r\n--", 16), std::string(), std::string("\0\xff", 2) };
+    teep_bundle_part_t parts[] = {
+        MakePart("device-1", "application/teep+cbor", bodies[0]),
+        MakePart("device-2", "", bodies[1]),
+        MakePart("device-3", "application/teep+cbor", bodies[2]),
+    };
+
+    teep_buffer_t bundle;
+    size_t bundleLength;
+    char mediaType[TEEP_BUNDLE_MAX_MEDIA_TYPE_SIZE];
+    REQUIRE(teep_bundle_encode(parts, 3, &bundle, &bundleLength, mediaType) == TEEP_ERR_SUCCESS);
+    REQUIRE(teep_bundle_is_media_type(mediaType));
+    REQUIRE_FALSE(teep_bundle_is_media_type("application/teep+cbor"));
+
+    teep_bundle_part_t parsed[3];
+    size_t count;
+    REQUIRE(teep_bundle_parse(mediaType, bundle.data, bundleLength, parsed, 3, &count) == TEEP_ERR_SUCCESS);
+    REQUIRE(count == 3);
+    for (size_t i = 0; i < count; i++) {
+        REQUIRE(std::string(parsed[i].device_id) == parts[i].device_id);
+        REQUIRE(std::string(parsed[i].media_type) == parts[i].media_type);
+        REQUIRE(std::string(parsed[i].body, parsed[i].body_length) == bodies[i]);
+    }
+
+    // Too many parts for the caller, or a truncated bundle, is an error.
+    REQUIRE(teep_bundle_parse(mediaType, bundle.data, bundleLength, parsed, 2, &count) != TEEP_ERR_SUCCESS);
+    REQUIRE(teep_bundle_parse(mediaType, bundle.data, bundleLength - 8, parsed, 3, &count) != TEEP_ERR_SUCCESS);
+    teep_buffer_release(&bundle);
+
+    // A header value that would break the framing is refused.
+    teep_bundle_part_t bad = MakePart("device\r\nX-Injected: 1", "application/teep+cbor", bodies[2]);
+    REQUIRE(teep_bundle_encode(&bad, 1, &bundle, &bundleLength, mediaType) != TEEP_ERR_SUCCESS);
+}
+
+static void CollectResponse(void* context, const char* deviceId, const char* mediaType, const char* message, size_t messageLength)
+{
+    std::map<std::string, std::string>* responses = (std::map<std::string, std::string>*)context;
+    (*responses)[deviceId] = std::string(message, messageLength);
+}
+
+TEST_CASE("A gateway sends many devices' messages to a TAM in one POST", "[bundle]")
+{
+    LoopbackTam tam(false);
+    REQUIRE(BundleQueueMessage(tam.GetUri(), "device-1", "application/teep+cbor", "", 0) == TEEP_ERR_SUCCESS);
+    REQUIRE(BundleQueueMessage(tam.GetUri(), "device-2", "application/teep+cbor", "QueryResponse", 13) == TEEP_ERR_SUCCESS);
+    REQUIRE(BundleQueueMessage(tam.GetUri(), "device-3", "application/teep+cbor", "Success", 7) == TEEP_ERR_SUCCESS);
+    REQUIRE(BundleGetQueuedCount() == 3);
+
+    uint64_t postsSent = BundleGetPostsSent();
+    std::map<std::string, std::string> responses;
+    REQUIRE(BundleFlush(CollectResponse, &responses) == TEEP_ERR_SUCCESS);
+    REQUIRE(BundleGetQueuedCount() == 0);
+    REQUIRE(BundleGetPostsSent() == postsSent + 1);
+    REQUIRE(tam.RequestsHandled == 1);
+
+    REQUIRE(responses.size() == 3);
+    REQUIRE(responses["device-1"] == "QueryRequest");
+    REQUIRE(responses["device-2"] == "Re:QueryResponse");
+    REQUIRE(responses["device-3"] == "Re:Success");
+}
@@ -0,0 +1,214 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "catch.hpp"
+#include "coap.h"
+#include "CoapClient.h"
+#include "CoapServer.h"
+#include "LoopbackTam.h"
+
+#define TEST_COAP_PORT "56830"
+#define TEST_COAP_URI "coap://127.0.0.1:" TEST_COAP_PORT "/" TEEP_COAP_PATH
+
+static std::string GetBody(const CoapResponse& response)
+{
+    return std::string(response.Body, response.BodyLength);
+}
+
+// Open a UDP socket on the loopback interface, bound to a port if given.
+static SOCKET OpenLoopbackSocket(uint16_t port)
+{
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    bind(s, (struct sockaddr*)&address, sizeof(address));
+    return s;
+}
+
+TEST_CASE("CoAP messages survive encoding and decoding", "[coap]")
+{
+    std::string body(300, 'b');
+    teep_coap_message_t message;
+    teep_coap_message_init(&message);
+    message.type = TEEP_COAP_TYPE_CONFIRMABLE;
+    message.code = TEEP_COAP_CODE_POST;
+    message.message_id = 0xBEEF;
+    message.token_length = 3;
+    memcpy(message.token, "tok", 3);
+    snprintf(message.uri_path, sizeof(message.uri_path), "tam/teep");
+    message.content_format = TEEP_COAP_CONTENT_FORMAT;
+    message.block1 = teep_coap_block_encode(5, 1, 1024);
+    message.size1 = 100000;
+    message.payload = (const uint8_t*)body.data();
+    message.payload_length = body.size();
+
+    uint8_t datagram[TEEP_COAP_MAX_DATAGRAM_SIZE];
+    size_t length = teep_coap_serialize(&message, datagram, sizeof(datagram));
+    REQUIRE(length > body.size());
+    REQUIRE(teep_coap_serialize(&message, datagram, body.size()) == 0);
+
+    teep_coap_message_t decoded;
+    REQUIRE(teep_coap_parse(datagram, length, &decoded) == TEEP_ERR_SUCCESS);
+    REQUIRE(decoded.type == TEEP_COAP_TYPE_CONFIRMABLE);
+    REQUIRE(decoded.code == TEEP_COAP_CODE_POST);
+    REQUIRE(decoded.message_id == 0xBEEF);
+    REQUIRE(std::string((const char*)decoded.token, decoded.token_length) == "tok");
+    REQUIRE(std::string(decoded.uri_path) == "tam/teep");
+    REQUIRE(decoded.content_format == TEEP_COAP_CONTENT_FORMAT);
+    REQUIRE(decoded.accept == TEEP_COAP_OPTION_ABSENT);
+    REQUIRE(decoded.size1 == 100000);
+    REQUIRE(std::string((const char*)decoded.payload, decoded.payload_length) == body);
+    REQUIRE(!decoded.unrecognized_critical_option);
+
+    uint32_t number;
+    int more;
+    size_t size;
+    teep_coap_block_decode(decoded.block1, &number, &more, &size);
+    REQUIRE(number == 5);
+    REQUIRE(more);
+    REQUIRE(size == 1024);
+
+    // Cut short anywhere in its options, it is rejected.
+    REQUIRE(teep_coap_parse(datagram, 2, &decoded) == TEEP_ERR_PERMANENT_ERROR);
+    REQUIRE(teep_coap_parse(datagram, 10, &decoded) == TEEP_ERR_PERMANENT_ERROR);
+
+    // Option 9 is critical, and unknown.
+    const uint8_t unknown[] = { 0x40, 0x02, 0x00, 0x01, 0x91, 0x00 };
+    REQUIRE(teep_coap_parse(unknown, sizeof(unknown), &decoded) == TEEP_ERR_SUCCESS);
+    REQUIRE(decoded.unrecognized_critical_option);
+}
+
+TEST_CASE("CoAP client and server move large messages in blocks", "[coap]")
+{
+    REQUIRE(StartCoapServer(TEST_COAP_PORT, HandleLoopbackMessage) == 0);
+    uint64_t handled = GetCoapServerMessagesHandled();
+
+    CoapResponse response;
+    REQUIRE(CoapPost(TEST_COAP_URI, nullptr, 0, &response) == TEEP_ERR_SUCCESS);
+    REQUIRE(response.Code == TEEP_COAP_CODE_CHANGED);
+    REQUIRE(GetBody(response) == "QueryRequest");
+    CoapFreeResponse(&response);
+
+    std::string large(100 * 1024 + 17, 'x');
+    for (size_t i = 0; i < large.size(); i++) {
+        large[i] = (char)('a' + i % 26);
+    }
+    for (const std::string& message : { std::string("QueryResponse"), large }) {
+        uint64_t datagrams = CoapGetDatagramsSent();
+        REQUIRE(CoapPost(TEST_COAP_URI, message.data(), message.size(), &response) == TEEP_ERR_SUCCESS);
+        REQUIRE(GetBody(response) == "Re:" + message);
+        REQUIRE(response.Body[response.BodyLength] == '\0');
+        CoapFreeResponse(&response);
+
+        // Blocks of the message, then the rest of the response's blocks.
+        size_t blocks = (message.size() + TEEP_COAP_BLOCK_SIZE - 1) / TEEP_COAP_BLOCK_SIZE;
+        size_t responseBlocks = (message.size() + 3 + TEEP_COAP_BLOCK_SIZE - 1) / TEEP_COAP_BLOCK_SIZE;
+        REQUIRE(CoapGetDatagramsSent() - datagrams == blocks + responseBlocks - 1);
+    }
+
+    // Each message reached the handler once.
+    REQUIRE(GetCoapServerMessagesHandled() - handled == 3);
+
+    REQUIRE(CoapPost("coap://127.0.0.1:" TEST_COAP_PORT "/other", nullptr, 0, &response) == TEEP_ERR_SUCCESS);
+    REQUIRE(response.Code == TEEP_COAP_CODE_NOT_FOUND);
+    CoapFreeResponse(&response);
+
+    CoapCloseSockets();
+    StopCoapServer();
+}
+
+TEST_CASE("CoAP server answers a retransmitted request without handling it again", "[coap]")
+{
+    REQUIRE(StartCoapServer(TEST_COAP_PORT, HandleLoopbackMessage) == 0);
+    uint64_t handled = GetCoapServerMessagesHandled();
+
+    teep_coap_message_t request;
+    teep_coap_message_init(&request);
+    request.type = TEEP_COAP_TYPE_CONFIRMABLE;
+    request.code = TEEP_COAP_CODE_POST;
+    request.message_id = 42;
+    snprintf(request.uri_path, sizeof(request.uri_path), "%s", TEEP_COAP_PATH);
+    request.content_format = TEEP_COAP_CONTENT_FORMAT;
+    request.payload = (const uint8_t*)"Success";
+    request.payload_length = 7;
+    uint8_t datagram[TEEP_COAP_MAX_DATAGRAM_SIZE];
+    size_t length = teep_coap_serialize(&request, datagram, sizeof(datagram));
+
+    SOCKET s = OpenLoopbackSocket(0);
+    struct sockaddr_in server = {};
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons((uint16_t)atoi(TEST_COAP_PORT));
+    std::vector<std::string> replies;
+    for (int i = 0; i < 2; i++) {
+        sendto(s, (const char*)datagram, (int)length, 0, (struct sockaddr*)&server, sizeof(server));
+        uint8_t received[TEEP_COAP_MAX_DATAGRAM_SIZE];
+        int count = (int)recv(s, (char*)received, sizeof(received), 0);
+        REQUIRE(count > 0);
+        replies.push_back(std::string((const char*)received, count));
+    }
+    closesocket(s);
+    StopCoapServer();
+
+    REQUIRE(replies[0] == replies[1]);
+    teep_coap_message_t reply;
+    REQUIRE(teep_coap_parse((const uint8_t*)replies[0].data(), replies[0].size(), &reply) == TEEP_ERR_SUCCESS);
+    REQUIRE(reply.type == TEEP_COAP_TYPE_ACKNOWLEDGEMENT);
+    REQUIRE(reply.message_id == 42);
+    REQUIRE(std::string((const char*)reply.payload, reply.payload_length) == "Re:Success");
+    REQUIRE(GetCoapServerMessagesHandled() - handled == 1);
+}
+
+TEST_CASE("CoAP client retransmits until acknowledged", "[coap]")
+{
+    // A TAM that misses the first transmission of each request.
+    SOCKET tam = OpenLoopbackSocket(56831);
+    std::thread thread([tam] {
+        uint8_t received[TEEP_COAP_MAX_DATAGRAM_SIZE];
+        struct sockaddr_storage client;
+        socklen_t clientLength = sizeof(client);
+        teep_coap_message_t first;
+        teep_coap_message_t again;
+        int count = (int)recvfrom(tam, (char*)received, sizeof(received), 0, (struct sockaddr*)&client, &clientLength);
+        if (count <= 0 || teep_coap_parse(received, count, &first) != TEEP_ERR_SUCCESS) {
+            return;
+        }
+        uint16_t firstId = first.message_id;
+        count = (int)recvfrom(tam, (char*)received, sizeof(received), 0, (struct sockaddr*)&client, &clientLength);
+        if (count <= 0 || teep_coap_parse(received, count, &again) != TEEP_ERR_SUCCESS || again.message_id != firstId) {
+            return;
+        }
+
+        teep_coap_message_t reply;
+        teep_coap_message_init(&reply);
+        reply.type = TEEP_COAP_TYPE_ACKNOWLEDGEMENT;
+        reply.code = TEEP_COAP_CODE_CHANGED;
+        reply.message_id = again.message_id;
+        reply.token_length = again.token_length;
+        memcpy(reply.token, again.token, again.token_length);
+        reply.payload = (const uint8_t*)"QueryRequest";
+        reply.payload_length = 12;
+        uint8_t datagram[TEEP_COAP_MAX_DATAGRAM_SIZE];
+        size_t length = teep_coap_serialize(&reply, datagram, sizeof(datagram));
+        sendto(tam, (const char*)datagram, (int)length, 0, (struct sockaddr*)&client, clientLength);
+    });
+
+    CoapSetAckTimeout(50);
+    uint64_t datagrams = CoapGetDatagramsSent();
+    CoapResponse response;
+    teep_error_code_t result = CoapPost("coap://127.0.0.1:56831/" TEEP_COAP_PATH, nullptr, 0, &response);
+    thread.join();
+    closesocket(tam);
+    CoapSetAckTimeout(TEEP_COAP_ACK_TIMEOUT_MS);
+    CoapCloseSockets();
+
+    REQUIRE(result == TEEP_ERR_SUCCESS);
+    REQUIRE(GetBody(response) == "QueryRequest");
+    REQUIRE(CoapGetDatagramsSent() - datagrams == 2);
+    CoapFreeResponse(&response);
+}
@@ -0,0 +1,89 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <memory>
+#include <vector>
+#include "catch.hpp"
+#include "compress.h"
+#include "TestManifests.h"
+
+static teep_error_code_t AppendTestOutput(void* context, UsefulBufC data)
+{
+    std::vector<uint8_t>* output = (std::vector<uint8_t>*)context;
+    const uint8_t* bytes = (const uint8_t*)data.ptr;
+    output->insert(output->end(), bytes, bytes + data.len);
+    return TEEP_ERR_SUCCESS;
+}
+
+// Feed compressed bytes to a decompressor in pieces of the given size.
+static teep_error_code_t DecompressInPieces(
+    const std::vector<uint8_t>& compressed,
+    size_t pieceSize,
+    std::vector<uint8_t>& output)
+{
+    output.clear();
+    std::unique_ptr<teep_decompressor_t> decompressor = std::make_unique<teep_decompressor_t>();
+    teep_decompressor_init(decompressor.get(), UINT32_MAX, AppendTestOutput, &output);
+    for (size_t offset = 0; offset < compressed.size(); offset += pieceSize) {
+        size_t length = std::min(pieceSize, compressed.size() - offset);
+        teep_error_code_t result = teep_decompress(decompressor.get(), UsefulBufC{ compressed.data() + offset, length });
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+    }
+    return teep_decompressor_finish(decompressor.get());
+}
+
+TEST_CASE("Compressed buffers expand to the original", "[compress]")
+{
+    // A manifest-like mix of repeats, long runs, and random bytes.
+    std::vector<uint8_t> input = ComposeSyntheticEnvelope(7, 5000);
+    std::vector<uint8_t> random = GenerateTestPayload(30, 3000);
+    input.insert(input.end(), random.begin(), random.end());
+    input.insert(input.end(), input.begin(), input.begin() + 2000);
+
+    std::vector<uint8_t> compressed;
+    REQUIRE(teep_compress({ input.data(), input.size() }, compressed) == TEEP_ERR_SUCCESS);
+    REQUIRE(compressed.size() < input.size() / 2);
+
+    for (size_t pieceSize : { (size_t)1, (size_t)3, (size_t)1000, compressed.size() }) {
+        CAPTURE(pieceSize);
+        std::vector<uint8_t> output;
+        REQUIRE(DecompressInPieces(compressed, pieceSize, output) == TEEP_ERR_SUCCESS);
+        REQUIRE(output == input);
+    }
+
+    // Empty input still round-trips.
+    REQUIRE(teep_compress(NULLUsefulBufC, compressed) == TEEP_ERR_SUCCESS);
+    std::vector<uint8_t> output;
+    REQUIRE(teep_decompress_buffer({ compressed.data(), compressed.size() }, 0, output) == TEEP_ERR_SUCCESS);
+    REQUIRE(output.empty());
+}
+
+TEST_CASE("Malformed compressed buffers are rejected", "[compress]")
+{
+    std::vector<uint8_t> output;
+
+    SECTION("Larger than allowed")
+    {
+        std::vector<uint8_t> input(100, 'a');
+        std::vector<uint8_t> compressed;
+        REQUIRE(teep_compress({ input.data(), input.size() }, compressed) == TEEP_ERR_SUCCESS);
+        REQUIRE(teep_decompress_buffer({ compressed.data(), compressed.size() }, 99, output) == TEEP_ERR_PERMANENT_ERROR);
+        REQUIRE(output.empty());
+    }
+    SECTION("Offset before the start")
+    {
+        std::vector<uint8_t> compressed = { 8, 0, 0, 0, 0x10, 'a', 2, 0 };
+        REQUIRE(teep_decompress_buffer({ compressed.data(), compressed.size() }, 8, output) == TEEP_ERR_PERMANENT_ERROR);
+    }
+    SECTION("More output than promised")
+    {
+        std::vector<uint8_t> compressed = { 2, 0, 0, 0, 0x30, 'a', 'b', 'c' };
+        REQUIRE(teep_decompress_buffer({ compressed.data(), compressed.size() }, 8, output) == TEEP_ERR_PERMANENT_ERROR);
+    }
+    SECTION("Truncated")
+    {
+        std::vector<uint8_t> compressed = { 5, 0, 0, 0, 0x10, 'a', 1, 0 };
+        REQUIRE(teep_decompress_buffer({ compressed.data(), compressed.size() }, 8, output) == TEEP_ERR_PERMANENT_ERROR);
+    }
+}
@@ -0,0 +1,99 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <string.h>
+#include <vector>
+#include "catch.hpp"
+#include "delta.h"
+#include "TestManifests.h"
+
+// Applies deltas against an in-memory base.
+typedef struct {
+    const std::vector<uint8_t>* Base;
+    std::vector<uint8_t> Output;
+} TestDeltaTarget;
+
+static teep_error_code_t ReadTestBase(void* context, uint64_t offset, UsefulBuf buffer)
+{
+    TestDeltaTarget* target = (TestDeltaTarget*)context;
+    memcpy(buffer.ptr, target->Base->data() + offset, buffer.len);
+    return TEEP_ERR_SUCCESS;
+}
+
+static teep_error_code_t WriteTestTarget(void* context, UsefulBufC data)
+{
+    TestDeltaTarget* target = (TestDeltaTarget*)context;
+    const uint8_t* bytes = (const uint8_t*)data.ptr;
+    target->Output.insert(target->Output.end(), bytes, bytes + data.len);
+    return TEEP_ERR_SUCCESS;
+}
+
+// Feed a delta to a decoder in pieces of the given size.
+static teep_error_code_t ApplyTestDelta(
+    const std::vector<uint8_t>& base,
+    const std::vector<uint8_t>& delta,
+    size_t pieceSize,
+    std::vector<uint8_t>& output)
+{
+    TestDeltaTarget target = { &base };
+    teep_delta_decoder_t decoder;
+    teep_delta_decoder_init(&decoder, base.size(), ReadTestBase, WriteTestTarget, &target);
+    for (size_t offset = 0; offset < delta.size(); offset += pieceSize) {
+        size_t length = std::min(pieceSize, delta.size() - offset);
+        teep_error_code_t result = teep_delta_decode(&decoder, UsefulBufC{ delta.data() + offset, length });
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+    }
+    output = target.Output;
+    return teep_delta_decoder_finish(&decoder);
+}
+
+TEST_CASE("Deltas rebuild the target from the base", "[delta]")
+{
+    std::vector<uint8_t> base = GenerateTestPayload(20, 200 * 1024);
+    std::vector<uint8_t> target = MakeTestUpgrade(base, 12);
+    std::vector<uint8_t> delta;
+    REQUIRE(teep_delta_encode({ base.data(), base.size() }, { target.data(), target.size() }, delta) == TEEP_ERR_SUCCESS);
+    REQUIRE(delta.size() < target.size() / 50);
+
+    for (size_t pieceSize : { (size_t)1, (size_t)7, (size_t)4096, delta.size() }) {
+        CAPTURE(pieceSize);
+        std::vector<uint8_t> output;
+        REQUIRE(ApplyTestDelta(base, delta, pieceSize, output) == TEEP_ERR_SUCCESS);
+        REQUIRE(output == target);
+    }
+
+    // Unrelated contents are carried as literals.
+    std::vector<uint8_t> unrelated = GenerateTestPayload(21, 1000);
+    REQUIRE(teep_delta_encode({ base.data(), base.size() }, { unrelated.data(), unrelated.size() }, delta) == TEEP_ERR_SUCCESS);
+    std::vector<uint8_t> output;
+    REQUIRE(ApplyTestDelta(base, delta, delta.size(), output) == TEEP_ERR_SUCCESS);
+    REQUIRE(output == unrelated);
+}
+
+TEST_CASE("Malformed deltas are rejected", "[delta]")
+{
+    std::vector<uint8_t> base = GenerateTestPayload(22, 4096);
+    std::vector<uint8_t> output;
+
+    SECTION("Bad magic")
+    {
+        std::vector<uint8_t> delta = { 'T', 'D', 'L', '0' };
+        REQUIRE(ApplyTestDelta(base, delta, delta.size(), output) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+    }
+    SECTION("Unknown opcode")
+    {
+        std::vector<uint8_t> delta = { 'T', 'D', 'L', '1', 9, 0, 0, 0, 0 };
+        REQUIRE(ApplyTestDelta(base, delta, delta.size(), output) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+    }
+    SECTION("Copy past the end of the base")
+    {
+        std::vector<uint8_t> delta = { 'T', 'D', 'L', '1', TEEP_DELTA_COPY, 0x01, 0, 0, 0, 0x00, 0x10, 0, 0, 0, 0, 0, 0 };
+        REQUIRE(ApplyTestDelta(base, delta, delta.size(), output) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+    }
+    SECTION("Truncated insert")
+    {
+        std::vector<uint8_t> delta = { 'T', 'D', 'L', '1', TEEP_DELTA_INSERT, 4, 0, 0, 0, 'a', 'b' };
+        REQUIRE(ApplyTestDelta(base, delta, delta.size(), output) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+    }
+}
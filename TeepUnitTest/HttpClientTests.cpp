@@ -0,0 +1,123 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <chrono>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "catch.hpp"
+#include "HttpConnectionPool.h"
+#include "LoopbackTam.h"
+
+static std::string GetBody(const HttpPoolResponse& response)
+{
+    return std::string(response.Body, response.BodyLength);
+}
+
+TEST_CASE("HTTP URIs split into authority and path", "[http]")
+{
+    char authority[64];
+    char path[64];
+    REQUIRE(HttpParseUri("http://tam.example:8080/tam?x=1", authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_SUCCESS);
+    REQUIRE(std::string(authority) == "tam.example:8080");
+    REQUIRE(std::string(path) == "/tam?x=1");
+
+    REQUIRE(HttpParseUri("HTTP://[::1]", authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_SUCCESS);
+    REQUIRE(std::string(authority) == "[::1]:80");
+    REQUIRE(std::string(path) == "/");
+
+    REQUIRE(HttpParseUri("https://tam.example/", authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_PERMANENT_ERROR);
+    REQUIRE(HttpParseUri("http:///tam", authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_PERMANENT_ERROR);
+}
+
+TEST_CASE("HTTP client reuses one connection per TAM", "[http]")
+{
+    LoopbackTam tam(false);
+    char authority[64];
+    char path[64];
+    REQUIRE(HttpParseUri(tam.GetUri(), authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_SUCCESS);
+    uint64_t opened = HttpPoolGetConnectionsOpened();
+
+    // Connect, then two messages, as in a TEEP exchange.
+    HttpPoolRequest request = { nullptr, nullptr, 0 };
+    HttpPoolResponse response;
+    REQUIRE(HttpPoolPost(authority, path, "application/teep+cbor", &request, 1, &response) == TEEP_ERR_SUCCESS);
+    REQUIRE(response.StatusCode == 200);
+    REQUIRE(GetBody(response) == "QueryRequest");
+    REQUIRE(std::string(response.MediaType) == "application/teep+cbor");
+    HttpPoolFreeResponse(&response);
+
+    for (const char* message : { "QueryResponse", "Success" }) {
+        request = { "application/teep+cbor", message, strlen(message) };
+        REQUIRE(HttpPoolPost(authority, path, "application/teep+cbor", &request, 1, &response) == TEEP_ERR_SUCCESS);
+        REQUIRE(GetBody(response) == std::string("Re:") + message);
+        REQUIRE(response.Body[response.BodyLength] == '\0');
+        HttpPoolFreeResponse(&response);
+    }
+
+    REQUIRE(HttpPoolGetConnectionsOpened() - opened == 1);
+    REQUIRE(tam.RequestsHandled == 3);
+}
+
+TEST_CASE("HTTP client pipelines requests in order", "[http]")
+{
+    LoopbackTam tam(false);
+    char authority[64];
+    char path[64];
+    REQUIRE(HttpParseUri(tam.GetUri(), authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_SUCCESS);
+    uint64_t opened = HttpPoolGetConnectionsOpened();
+
+    // Enough requests, and a body large enough, that responses cross
+    // receive boundaries.
+    std::string large(300000, 'x');
+    for (size_t i = 0; i < large.size(); i++) {
+        large[i] = (char)('a' + i % 26);
+    }
+    std::vector<std::string> messages = { "one", large, "two", "", "three" };
+    std::vector<HttpPoolRequest> requests;
+    for (const std::string& message : messages) {
+        requests.push_back({ "application/teep+cbor", message.data(), message.size() });
+    }
+    std::vector<HttpPoolResponse> responses(requests.size());
+    REQUIRE(HttpPoolPost(authority, path, "application/teep+cbor", requests.data(), requests.size(), responses.data()) == TEEP_ERR_SUCCESS);
+
+    for (size_t i = 0; i < messages.size(); i++) {
+        CAPTURE(i);
+        REQUIRE(responses[i].StatusCode == 200);
+        REQUIRE(GetBody(responses[i]) == (messages[i].empty() ? "QueryRequest" : "Re:" + messages[i]));
+        HttpPoolFreeResponse(&responses[i]);
+    }
+    REQUIRE(HttpPoolGetConnectionsOpened() - opened == 1);
+    REQUIRE(tam.ConnectionsAccepted == 1);
+}
+
+TEST_CASE("HTTP client replaces connections the TAM closed", "[http]")
+{
+    LoopbackTam tam(true);
+    char authority[64];
+    char path[64];
+    REQUIRE(HttpParseUri(tam.GetUri(), authority, sizeof(authority), path, sizeof(path)) == TEEP_ERR_SUCCESS);
+    uint64_t opened = HttpPoolGetConnectionsOpened();
+
+    HttpPoolRequest request = { "application/teep+cbor", "QueryResponse", 13 };
+    HttpPoolResponse response;
+    REQUIRE(HttpPoolPost(authority, path, "application/teep+cbor", &request, 1, &response) == TEEP_ERR_SUCCESS);
+    HttpPoolFreeResponse(&response);
+
+    // A request is not written to a pooled connection the TAM is known to
+    // have closed.  Give the close time to arrive, as it has long before
+    // an idle connection is reused.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(HttpPoolPost(authority, path, "application/teep+cbor", &request, 1, &response) == TEEP_ERR_SUCCESS);
+    REQUIRE(GetBody(response) == "Re:QueryResponse");
+    HttpPoolFreeResponse(&response);
+
+    // Pipelined requests written but left unanswered may have been acted
+    // on, so they are not sent again.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    HttpPoolRequest requests[3] = { request, request, request };
+    HttpPoolResponse responses[3];
+    REQUIRE(HttpPoolPost(authority, path, "application/teep+cbor", requests, 3, responses) == TEEP_ERR_PERMANENT_ERROR);
+    REQUIRE(HttpPoolGetConnectionsOpened() - opened == 3);
+    REQUIRE(tam.RequestsHandled == 3);
+}
@@ -0,0 +1,317 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#define SHUT_WR SD_SEND
+#else
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define closesocket close
+typedef int SOCKET;
+#endif
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include "AdmissionControl.h"
+#include "BundleServer.h"
+#include "CoapServer.h"
+#include "bundle.h"
+#include "HttpConnectionPool.h"
+#include "PushChannel.h"
+#include "TeepTamLib.h"
+
+// How the stand-in for a TAM answers one message, as a handler for the
+// CoAP server and for the parts of a bundle.
+inline teep_error_code_t HandleLoopbackMessage(
+    _Inout_ TamBrokerSession* session,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    std::string reply = (messageLength == 0) ? "QueryRequest" : "Re:" + std::string(message, messageLength);
+    teep_error_code_t result = teep_buffer_acquire(reply.size(), &session->OutboundBuffer);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    memcpy(session->OutboundBuffer.data, reply.data(), reply.size());
+    snprintf(session->OutboundMediaType, sizeof(session->OutboundMediaType), "%s", mediaType);
+    session->OutboundMessageLength = reply.size();
+    return TEEP_ERR_SUCCESS;
+}
+
+// A stand-in for a TAM on the loopback interface.  It answers an empty
+// POST with a fixed body, and any other POST by echoing the body back
+// after "Re:", answering each part of a bundle the same way.  A POST to
+// the push path waits on the push channel, once the TAM has verified it.
+// Each connection is served by a thread of its own, but the TAM handles
+// one POST at a time, in order, behind admission control, as the Windows
+// server's worker does.
+class LoopbackTam {
+public:
+    LoopbackTam(bool closeAfterEachResponse) : _closeAfterEachResponse(closeAfterEachResponse)
+    {
+#ifdef _WIN32
+        WSADATA wsaData;
+        (void)WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+        _listener = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(_listener, (struct sockaddr*)&address, sizeof(address));
+        listen(_listener, SOMAXCONN);
+        socklen_t length = sizeof(address);
+        getsockname(_listener, (struct sockaddr*)&address, &length);
+        snprintf(_uri, sizeof(_uri), "http://127.0.0.1:%d/tam", ntohs(address.sin_port));
+        _thread = std::thread([this] { Run(); });
+    }
+
+    ~LoopbackTam()
+    {
+        HttpPoolCloseIdleConnections();
+        _stopping = true;
+        _thread.join();
+        closesocket(_listener);
+    }
+
+    const char* GetUri() const { return _uri; }
+
+    std::atomic<int> ConnectionsAccepted{ 0 };
+    std::atomic<int> RequestsHandled{ 0 };
+    std::atomic<int> ServiceMicroseconds{ 0 }; // Time the TAM spends on each POST.
+    std::atomic<uint64_t> BytesReceived{ 0 };
+    std::atomic<uint64_t> BytesSent{ 0 };
+
+private:
+    struct Connection {
+        std::thread Thread;
+        std::atomic<bool> Done{ false };
+    };
+
+    struct PushWait {
+        std::mutex Lock;
+        std::condition_variable Done;
+        bool Completed = false;
+        int Changed = 0;
+    };
+
+    static void CompletePushWait(void* context, int changed)
+    {
+        PushWait* wait = (PushWait*)context;
+        std::lock_guard<std::mutex> lock(wait->Lock);
+        wait->Completed = true;
+        wait->Changed = changed;
+        wait->Done.notify_one();
+    }
+
+    // Hold a push request until its wait completes, expiring waits as a
+    // TAM's transport server would.  Returns the status to answer with.
+    std::string WaitForWake(const std::string& request)
+    {
+        char deviceId[TEEP_PUSH_MAX_DEVICE_ID_LENGTH + 1];
+        if (TamVerifyPushRequest(request.data(), request.size(), deviceId) != TEEP_ERR_SUCCESS) {
+            return "403 Forbidden";
+        }
+        PushWait wait;
+        if (TamPushAddWaiter(deviceId, CompletePushWait, &wait) != TEEP_ERR_SUCCESS) {
+            return "503 Service Unavailable";
+        }
+        std::unique_lock<std::mutex> lock(wait.Lock);
+        while (!wait.Completed) {
+            if (!wait.Done.wait_for(lock, std::chrono::milliseconds(10), [&wait] { return wait.Completed; })) {
+                lock.unlock();
+                if (_stopping) {
+                    TamPushCancelAll();
+                } else {
+                    TamPushExpireWaiters();
+                }
+                lock.lock();
+            }
+        }
+        return wait.Changed ? "200 OK" : "204 No Content";
+    }
+
+    // Wait until a socket is readable or the server is stopping.
+    bool WaitReadable(SOCKET s)
+    {
+        while (!_stopping) {
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(s, &readable);
+            struct timeval timeout = { 0, 10000 };
+            if (select((int)s + 1, &readable, nullptr, nullptr, &timeout) > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Have the TAM answer a POST once its turn comes, unless it is turned
+    // away.  Returns the Retry-After if it was.
+    uint32_t HandlePost(std::string& mediaType, const std::string& body, std::string& status, std::string& reply)
+    {
+        TamAdmissionTicket ticket;
+        uint32_t retryAfterSeconds;
+        if (TamAdmitRequest(&ticket, &retryAfterSeconds) != TEEP_ERR_SUCCESS) {
+            status = "503 Service Unavailable";
+            return retryAfterSeconds;
+        }
+        {
+            std::unique_lock<std::mutex> lock(_tamLock);
+            uint64_t turn = _nextTurn++;
+            _tamTurn.wait(lock, [this, turn] { return _currentTurn == turn; });
+        }
+        if (TamStartAdmittedRequest(&ticket, &retryAfterSeconds) != TEEP_ERR_SUCCESS) {
+            status = "503 Service Unavailable";
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(ServiceMicroseconds));
+            if (teep_bundle_is_media_type(mediaType.c_str())) {
+                TamBrokerSession session = {};
+                if (TamProcessBundle(&session, mediaType.c_str(), body.data(), body.size(), HandleLoopbackMessage) == TEEP_ERR_SUCCESS) {
+                    mediaType = session.OutboundMediaType;
+                    reply.assign(session.OutboundBuffer.data, session.OutboundMessageLength);
+                } else {
+                    status = "400 Bad Request";
+                }
+                teep_buffer_release(&session.OutboundBuffer);
+            } else {
+                reply = body.empty() ? "QueryRequest" : "Re:" + body;
+            }
+            TamFinishAdmittedRequest(&ticket);
+        }
+        {
+            std::lock_guard<std::mutex> lock(_tamLock);
+            _currentTurn++;
+        }
+        _tamTurn.notify_all();
+        return retryAfterSeconds;
+    }
+
+    // Serve requests on a connection until the client closes it.
+    void Serve(SOCKET s)
+    {
+        std::string received;
+        char buffer[4096];
+        for (;;) {
+            size_t headerEnd;
+            while ((headerEnd = received.find("\r\n\r\n")) == std::string::npos) {
+                if (!WaitReadable(s)) {
+                    return;
+                }
+                int count = (int)recv(s, buffer, sizeof(buffer), 0);
+                if (count <= 0) {
+                    return;
+                }
+                received.append(buffer, count);
+                BytesReceived += count;
+            }
+            std::string header = received.substr(0, headerEnd + 4);
+            size_t field = header.find("Content-Length: ");
+            size_t bodyLength = (field == std::string::npos) ? 0 : strtoul(header.c_str() + field + 16, nullptr, 10);
+            std::string mediaType = "application/teep+cbor";
+            field = header.find("Content-Type: ");
+            if (field != std::string::npos) {
+                mediaType = header.substr(field + 14, header.find("\r\n", field) - field - 14);
+            }
+            while (received.size() < header.size() + bodyLength) {
+                if (!WaitReadable(s)) {
+                    return;
+                }
+                int count = (int)recv(s, buffer, sizeof(buffer), 0);
+                if (count <= 0) {
+                    return;
+                }
+                received.append(buffer, count);
+                BytesReceived += count;
+            }
+            std::string body = received.substr(header.size(), bodyLength);
+            received.erase(0, header.size() + bodyLength);
+            RequestsHandled++;
+
+            std::string status = "200 OK";
+            std::string reply;
+            uint32_t retryAfterSeconds = 0;
+            if (header.find(TEEP_PUSH_PATH " HTTP/1.1\r\n") < header.find("\r\n")) {
+                status = WaitForWake(body);
+            } else {
+                retryAfterSeconds = HandlePost(mediaType, body, status, reply);
+            }
+            std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: " + mediaType + "\r\n";
+            if (retryAfterSeconds > 0) {
+                response += "Retry-After: " + std::to_string(retryAfterSeconds) + "\r\n";
+            }
+            response += "Content-Length: " + std::to_string(reply.size()) + "\r\n\r\n" + reply;
+            BytesSent += response.size();
+            for (size_t sent = 0; sent < response.size();) {
+                int count = (int)send(s, response.data() + sent, (int)(response.size() - sent), 0);
+                if (count <= 0) {
+                    return;
+                }
+                sent += count;
+            }
+
+            // Close without saying so, as a server does when an idle
+            // connection times out, but only once the client has seen
+            // the response.
+            if (_closeAfterEachResponse) {
+                shutdown(s, SHUT_WR);
+                while (WaitReadable(s) && recv(s, buffer, sizeof(buffer), 0) > 0) {
+                }
+                return;
+            }
+        }
+    }
+
+    void Run()
+    {
+        while (WaitReadable(_listener)) {
+            SOCKET s = accept(_listener, nullptr, nullptr);
+            ConnectionsAccepted++;
+
+            // Forget connections already closed.
+            _connections.remove_if([](std::unique_ptr<Connection>& connection) {
+                if (!connection->Done) {
+                    return false;
+                }
+                connection->Thread.join();
+                return true;
+            });
+
+            _connections.push_back(std::make_unique<Connection>());
+            Connection* connection = _connections.back().get();
+            connection->Thread = std::thread([this, s, connection] {
+                Serve(s);
+                closesocket(s);
+                connection->Done = true;
+            });
+        }
+        for (std::unique_ptr<Connection>& connection : _connections) {
+            connection->Thread.join();
+        }
+    }
+
+    bool _closeAfterEachResponse;
+    std::atomic<bool> _stopping{ false };
+    SOCKET _listener;
+    char _uri[64];
+    std::thread _thread;
+    std::list<std::unique_ptr<Connection>> _connections;
+
+    // The TAM takes POSTs in turn.
+    std::mutex _tamLock;
+    std::condition_variable _tamTurn;
+    uint64_t _nextTurn = 0;
+    uint64_t _currentTurn = 0;
+};
@@ -23,6 +23,13 @@ uint64_t GetOutboundMessagesSent()
     return g_Session.Basic.OutboundMessagesSent;
 }
 
+static size_t g_InboundChunkSize = 0;
+
+void SetInboundChunkSize(size_t chunkSize)
+{
+    g_InboundChunkSize = chunkSize;
+}
+
 // The caller is responsible for freeing the buffer if one is returned.
 _Success_(return == NO_ERROR)
 int
@@ -75,6 +82,15 @@ teep_error_code_t TeepAgentQueueOutboundTeepMessage(
         messageLength);
 }
 
+teep_error_code_t TeepAgentConnectWithMessage(
+    _In_z_ const char* tamUri,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    return TeepAgentQueueOutboundTeepMessage(&g_Session, mediaType, message, messageLength);
+}
+
 // The caller is responsible for freeing the returned buffer if non-null.
 const char* TeepAgentSendMessage(TeepAgentSession* session, char** pResponseMediaType, int* pResponseLength)
 {
@@ -86,7 +102,7 @@ int RunHttpServer(int argc, const wchar_t** argv)
     return ERROR_NOT_SUPPORTED;
 }
 
-teep_error_code_t TamQueueOutboundTeepMessage(void* sessionHandle, const char* mediaType, const char* message, size_t messageLength)
+static teep_error_code_t DeliverTamMessage(void* sessionHandle, const char* mediaType, const char* message, size_t messageLength)
 {
     g_Session.Basic.OutboundMessagesSent++;
 
@@ -96,5 +112,35 @@ teep_error_code_t TamQueueOutboundTeepMessage(void* sessionHandle, const char* m
         return TeepAgentProcessError(&g_Session);
     }
 
-    return TeepAgentProcessTeepMessage(sessionHandle, mediaType, message, messageLength);
+    if (g_InboundChunkSize == 0) {
+        return TeepAgentProcessTeepMessage(sessionHandle, mediaType, message, messageLength);
+    }
+    for (;;) {
+        size_t chunkLength = min(messageLength, g_InboundChunkSize);
+        int isFinalChunk = (chunkLength == messageLength);
+        teep_error_code_t err = TeepAgentProcessTeepMessageChunk(sessionHandle, mediaType, message, chunkLength, isFinalChunk);
+        if (err != TEEP_ERR_SUCCESS || isFinalChunk) {
+            return err;
+        }
+        message += chunkLength;
+        messageLength -= chunkLength;
+    }
+}
+
+teep_error_code_t TamAcquireOutboundTeepBuffer(void* sessionHandle, size_t size, teep_buffer_t* buffer)
+{
+    return teep_buffer_acquire(size, buffer);
+}
+
+void TamReleaseOutboundTeepBuffer(void* sessionHandle, teep_buffer_t* buffer)
+{
+    teep_buffer_release(buffer);
+}
+
+// Deliver a message from the TAM straight from the buffer it was composed in.
+teep_error_code_t TamQueueOutboundTeepBuffer(void* sessionHandle, const char* mediaType, teep_buffer_t* buffer, size_t messageLength)
+{
+    teep_error_code_t err = DeliverTamMessage(sessionHandle, mediaType, buffer->data, messageLength);
+    teep_buffer_release(buffer);
+    return err;
 }
\ No newline at end of file
@@ -3,4 +3,7 @@
 #pragma once
 
 void ScheduleTransportError(int count);
-uint64_t GetOutboundMessagesSent();
\ No newline at end of file
+uint64_t GetOutboundMessagesSent();
+
+// Deliver messages to the agent in chunks of this size, or whole if 0.
+void SetInboundChunkSize(size_t chunkSize);
\ No newline at end of file
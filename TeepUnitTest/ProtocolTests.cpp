@@ -1,10 +1,12 @@
 // Copyright (c) TEEP contributors
 // SPDX-License-Identifier: MIT
 #include <filesystem>
+#include <fstream>
 #include <optional>
 #include <sstream>
 #include "catch.hpp"
 #include "MockHttpTransport.h"
+#include "SuitAuthentication.h"
 #include "qcbor/qcbor_decode.h"
 #include "qcbor/qcbor_encode.h"
 #include "qcbor/UsefulBuf.h"
@@ -98,6 +100,24 @@ static void TestInstallComponent(_In_ const char* type, _In_ const char* taId)
     CopyFile(sourcePath.string().c_str(), destinationPath.string().c_str());
 }
 
+// The sample manifests name payloads at example.com by digests that
+// stand in for real images, so no server could supply them.  Register
+// objects under those digests in the agent's store instead, as an earlier
+// install would have left them, so that installing a sample fetches
+// nothing.
+static void TestRegisterSamplePayloads()
+{
+    const char* digests[] = {
+        "00112233445566778899aabbccddeeff0123456789abcdeffedcba9876543210",
+        "0123456789abcdeffedcba987654321000112233445566778899aabbccddeeff",
+    };
+    std::filesystem::path objectDirectory = std::filesystem::path(TEEP_AGENT_DATA_DIRECTORY) / "objects";
+    std::filesystem::create_directories(objectDirectory);
+    for (const char* digest : digests) {
+        std::ofstream(objectDirectory / digest, std::ios::binary) << "sample payload";
+    }
+}
+
 static void TestVerifyComponentInstalled(_In_ const char* taId, bool expected_result)
 {
     std::filesystem::path destinationPath = std::filesystem::path(TEEP_AGENT_DATA_DIRECTORY) / "manifests";
@@ -186,13 +206,18 @@ static void TestRequestAllowedComponent(_In_z_ const char* taId)
     TestConfigureKeys(TEEP_SIGNATURE_ES256);
     REQUIRE(StartTamBroker(TAM_DATA_DIRECTORY, TRUE) == 0);
     REQUIRE(StartAgentBroker(TEEP_AGENT_DATA_DIRECTORY, TRUE, TEEP_SIGNATURE_ES256, nullptr) == 0);
+    TestRegisterSamplePayloads();
 
     uint64_t counter1 = GetOutboundMessagesSent();
 
     teep_uuid_t requestedTaid;
     int err = ConvertStringToUUID(&requestedTaid, taId);
     REQUIRE(err == 0);
+
+    // The sample manifests are not signed.
+    SuitSetUnsignedEnvelopesAllowed(true);
     teep_error_code_t teep_error = TeepAgentRequestTA(requestedTaid, DEFAULT_TAM_URI);
+    SuitSetUnsignedEnvelopesAllowed(false);
     REQUIRE(teep_error == TEEP_ERR_SUCCESS);
 
     // Verify 4 messages sent (QueryRequest, QueryResponse, Update, Success).
@@ -215,6 +240,14 @@ TEST_CASE("RequestTA for optional TA", "[protocol][install]")
     TestRequestAllowedComponent(OPTIONAL_TA_ID);
 }
 
+TEST_CASE("RequestTA for required TA with chunked delivery", "[protocol][install]")
+{
+    // Small chunks split every envelope and header across several calls.
+    SetInboundChunkSize(7);
+    TestRequestAllowedComponent(REQUIRED_TA_ID);
+    SetInboundChunkSize(0);
+}
+
 TEST_CASE("RequestTA for unknown TA", "[protocol][install]")
 {
     TestUninstallAllComponents();
@@ -260,6 +293,37 @@ TEST_CASE("PolicyCheck with no policy change", "[protocol]")
     StopTamBroker();
 }
 
+TEST_CASE("PolicyCheck answers the last QueryRequest without waiting for another", "[protocol]")
+{
+    TestUninstallAllComponents();
+    TestInstallComponent("required", REQUIRED_TA_ID);
+    TestConfigureKeys(TEEP_SIGNATURE_ES256);
+    REQUIRE(StartTamBroker(TAM_DATA_DIRECTORY, TRUE) == 0);
+    REQUIRE(StartAgentBroker(TEEP_AGENT_DATA_DIRECTORY, TRUE, TEEP_SIGNATURE_ES256, nullptr) == 0);
+
+    // Verify 2 messages sent (QueryRequest, QueryResponse).
+    uint64_t counter1 = GetOutboundMessagesSent();
+    REQUIRE(TeepAgentRequestPolicyCheck(DEFAULT_TAM_URI) == TEEP_ERR_SUCCESS);
+    uint64_t counter2 = GetOutboundMessagesSent();
+    REQUIRE(counter2 == counter1 + 2);
+
+    // Verify only the QueryResponse is sent, and nothing comes back.
+    REQUIRE(TeepAgentRequestPolicyCheck(DEFAULT_TAM_URI) == TEEP_ERR_SUCCESS);
+    uint64_t counter3 = GetOutboundMessagesSent();
+    REQUIRE(counter3 == counter2 + 1);
+
+    // A TAM that has forgotten its QueryRequest asks again, so verify 3
+    // messages sent (QueryResponse, QueryRequest, QueryResponse).
+    StopTamBroker();
+    REQUIRE(StartTamBroker(TAM_DATA_DIRECTORY, TRUE) == 0);
+    REQUIRE(TeepAgentRequestPolicyCheck(DEFAULT_TAM_URI) == TEEP_ERR_SUCCESS);
+    uint64_t counter4 = GetOutboundMessagesSent();
+    REQUIRE(counter4 == counter3 + 3);
+
+    StopAgentBroker();
+    StopTamBroker();
+}
+
 // TODO: implement a test for a PolicyCheck when there is a policy change.
 
 TEST_CASE("Unexpected ProcessError", "[protocol]")
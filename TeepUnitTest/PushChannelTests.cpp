@@ -0,0 +1,165 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include "catch.hpp"
+#include "LoopbackTam.h"
+#include "PushChannel.h"
+#include "PushClient.h"
+#include "TeepAgentBrokerLib.h"
+#include "TeepTamBrokerLib.h"
+#define TRUE 1
+#define TAM_DATA_DIRECTORY "../../../tam"
+#define TEEP_AGENT_DATA_DIRECTORY "../../../agent"
+
+static std::vector<std::string> g_Completions;
+
+static void RecordCompletion(void* context, int changed)
+{
+    g_Completions.push_back(std::string((const char*)context) + (changed ? ":changed" : ":unchanged"));
+}
+
+// Start both brokers, with the TAM trusting the agent's key.
+static void StartBrokersWithKeys(void)
+{
+    REQUIRE(StartTamBroker(TAM_DATA_DIRECTORY, TRUE) == 0);
+    char agentPublicKeyFilename[256];
+    REQUIRE(StartAgentBroker(TEEP_AGENT_DATA_DIRECTORY, TRUE, TEEP_SIGNATURE_ES256, agentPublicKeyFilename) == 0);
+    std::filesystem::copy(agentPublicKeyFilename, TAM_DATA_DIRECTORY "/trusted", std::filesystem::copy_options::overwrite_existing);
+    StopTamBroker();
+    REQUIRE(StartTamBroker(TAM_DATA_DIRECTORY, TRUE) == 0);
+}
+
+TEST_CASE("TAM push channel wakes the devices waiting on it", "[push]")
+{
+    g_Completions.clear();
+    REQUIRE(TamPushAddWaiter("a", RecordCompletion, (void*)"a") == TEEP_ERR_SUCCESS);
+    REQUIRE(TamPushAddWaiter("b", RecordCompletion, (void*)"b") == TEEP_ERR_SUCCESS);
+    REQUIRE(TamPushAddWaiter("", RecordCompletion, (void*)"") == TEEP_ERR_PERMANENT_ERROR);
+    REQUIRE(TamPushGetWaiterCount() == 2);
+
+    REQUIRE(TamWakeDevice("a") == 1);
+    REQUIRE(g_Completions == std::vector<std::string>{ "a:changed" });
+
+    // A wake for a device between waits is kept for its next one.
+    REQUIRE(TamWakeDevice("c") == 0);
+    REQUIRE(TamPushAddWaiter("c", RecordCompletion, (void*)"c") == TEEP_ERR_SUCCESS);
+    REQUIRE(g_Completions.back() == "c:changed");
+
+    // Waits end with nothing to report once their time is up.
+    TamPushExpireWaiters();
+    REQUIRE(TamPushGetWaiterCount() == 1);
+    TamPushSetWaitTimeout(0);
+    TamPushExpireWaiters();
+    TamPushSetWaitTimeout(TEEP_PUSH_WAIT_SECONDS * 1000);
+    REQUIRE(g_Completions.back() == "b:unchanged");
+    REQUIRE(TamPushGetWaiterCount() == 0);
+
+    TamPushCancelAll();
+}
+
+TEST_CASE("TAM push channel holds a bounded number of waits", "[push]")
+{
+    g_Completions.clear();
+    TamPushSetMaxWaiters(2);
+    REQUIRE(TamPushAddWaiter("a", RecordCompletion, (void*)"a") == TEEP_ERR_SUCCESS);
+    REQUIRE(TamPushAddWaiter("b", RecordCompletion, (void*)"b") == TEEP_ERR_SUCCESS);
+    REQUIRE(TamPushAddWaiter("c", RecordCompletion, (void*)"c") == TEEP_ERR_TEMPORARY_ERROR);
+    REQUIRE(g_Completions.empty());
+
+    // A device's new wait takes the place of its old one.
+    REQUIRE(TamPushAddWaiter("a", RecordCompletion, (void*)"a2") == TEEP_ERR_SUCCESS);
+    REQUIRE(g_Completions == std::vector<std::string>{ "a:unchanged" });
+    REQUIRE(TamPushGetWaiterCount() == 2);
+
+    // A change for every device wakes those waiting, and those that were
+    // just between waits when it happened.
+    TamPushSetWaitTimeout(0);
+    TamPushExpireWaiters();
+    TamPushSetWaitTimeout(TEEP_PUSH_WAIT_SECONDS * 1000);
+    REQUIRE(TamPushAddWaiter("a", RecordCompletion, (void*)"a3") == TEEP_ERR_SUCCESS);
+    REQUIRE(TamWakeAllDevices() == 1);
+    REQUIRE(g_Completions.back() == "a3:changed");
+    REQUIRE(TamPushAddWaiter("b", RecordCompletion, (void*)"b2") == TEEP_ERR_SUCCESS);
+    REQUIRE(g_Completions.back() == "b2:changed");
+    REQUIRE(TamPushGetWaiterCount() == 0);
+
+    TamPushSetMaxWaiters(TAM_PUSH_DEFAULT_MAX_WAITERS);
+    TamPushCancelAll();
+}
+
+TEST_CASE("TAM only holds push requests signed by a trusted agent", "[push]")
+{
+    StartBrokersWithKeys();
+
+    char request[TEEP_PUSH_MAX_REQUEST_SIZE];
+    size_t length;
+    REQUIRE(TeepAgentComposePushRequest(request, sizeof(request), &length) == TEEP_ERR_SUCCESS);
+    char deviceId[TEEP_PUSH_MAX_DEVICE_ID_LENGTH + 1];
+    REQUIRE(TamVerifyPushRequest(request, length, deviceId) == TEEP_ERR_SUCCESS);
+    REQUIRE(strlen(deviceId) == 2 * TEEP_SHA256_SIZE);
+
+    // The same request cannot be used again.
+    char otherDeviceId[TEEP_PUSH_MAX_DEVICE_ID_LENGTH + 1];
+    REQUIRE(TamVerifyPushRequest(request, length, otherDeviceId) != TEEP_ERR_SUCCESS);
+
+    // Nor can one that has been tampered with, or a bare device ID.
+    REQUIRE(TeepAgentComposePushRequest(request, sizeof(request), &length) == TEEP_ERR_SUCCESS);
+    request[length - 1] ^= 1;
+    REQUIRE(TamVerifyPushRequest(request, length, otherDeviceId) != TEEP_ERR_SUCCESS);
+    REQUIRE(TamVerifyPushRequest(deviceId, strlen(deviceId), otherDeviceId) != TEEP_ERR_SUCCESS);
+
+    // A new request names the same device.
+    REQUIRE(TeepAgentComposePushRequest(request, sizeof(request), &length) == TEEP_ERR_SUCCESS);
+    REQUIRE(TamVerifyPushRequest(request, length, otherDeviceId) == TEEP_ERR_SUCCESS);
+    REQUIRE(std::string(otherDeviceId) == deviceId);
+
+    StopAgentBroker();
+    StopTamBroker();
+}
+
+TEST_CASE("Agent broker holds a push channel open until woken", "[push]")
+{
+    StartBrokersWithKeys();
+    char request[TEEP_PUSH_MAX_REQUEST_SIZE];
+    size_t length;
+    REQUIRE(TeepAgentComposePushRequest(request, sizeof(request), &length) == TEEP_ERR_SUCCESS);
+    char deviceId[TEEP_PUSH_MAX_DEVICE_ID_LENGTH + 1];
+    REQUIRE(TamVerifyPushRequest(request, length, deviceId) == TEEP_ERR_SUCCESS);
+
+    LoopbackTam tam(false);
+    uint64_t opened = HttpPoolGetConnectionsOpened();
+
+    int woken = 0;
+    teep_error_code_t result = TEEP_ERR_PERMANENT_ERROR;
+    std::thread agent([&] { result = PushWaitForWake(tam.GetUri(), &woken); });
+    while (TamPushGetWaiterCount() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    REQUIRE(TamWakeDevice("device-2") == 0);
+    REQUIRE(TamWakeDevice(deviceId) == 1);
+    agent.join();
+    REQUIRE(result == TEEP_ERR_SUCCESS);
+    REQUIRE(woken == 1);
+
+    // A wait with nothing to report ends, and the same connection is used
+    // again.
+    TamPushSetWaitTimeout(50);
+    REQUIRE(PushWaitForWake(tam.GetUri(), &woken) == TEEP_ERR_SUCCESS);
+    REQUIRE(woken == 0);
+    TamPushSetWaitTimeout(TEEP_PUSH_WAIT_SECONDS * 1000);
+
+    // A wake kept while the device was not waiting answers at once.
+    REQUIRE(TamWakeDevice(deviceId) == 0);
+    REQUIRE(PushWaitForWake(tam.GetUri(), &woken) == TEEP_ERR_SUCCESS);
+    REQUIRE(woken == 1);
+
+    REQUIRE(HttpPoolGetConnectionsOpened() - opened == 1);
+    REQUIRE(tam.RequestsHandled == 3);
+    TamPushCancelAll();
+    StopAgentBroker();
+    StopTamBroker();
+}
@@ -0,0 +1,121 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <string.h>
+#include <vector>
+#include "catch.hpp"
+#include "common.h"
+
+static const teep_sha256_engine_t g_Engines[] = {
+    TEEP_SHA256_ENGINE_PORTABLE,
+    TEEP_SHA256_ENGINE_SHA_NI,
+    TEEP_SHA256_ENGINE_AVX2,
+};
+
+static std::vector<uint8_t> MakeTestBuffer(size_t length)
+{
+    std::vector<uint8_t> buffer(length);
+    for (size_t i = 0; i < length; i++) {
+        buffer[i] = (uint8_t)(i * 31 + length);
+    }
+    return buffer;
+}
+
+TEST_CASE("SHA-256 engines match known answers", "[sha256]")
+{
+    // FIPS 180-2 appendix B.1 and B.2.
+    const char* shortMessage = "abc";
+    const uint8_t shortDigest[TEEP_SHA256_SIZE] = {
+        0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+        0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad
+    };
+    const char* longMessage = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    const uint8_t longDigest[TEEP_SHA256_SIZE] = {
+        0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+        0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1
+    };
+
+    for (teep_sha256_engine_t engine : g_Engines) {
+        if (!teep_sha256_engine_available(engine)) {
+            continue;
+        }
+        REQUIRE(teep_sha256_use_engine(engine) == TEEP_ERR_SUCCESS);
+
+        uint8_t digest[TEEP_SHA256_SIZE];
+        REQUIRE(teep_compute_sha256({ shortMessage, strlen(shortMessage) }, digest) == TEEP_ERR_SUCCESS);
+        REQUIRE(memcmp(digest, shortDigest, sizeof(digest)) == 0);
+
+        UsefulBufC messages[] = { { shortMessage, strlen(shortMessage) }, { longMessage, strlen(longMessage) } };
+        teep_sha256_digest_t digests[2];
+        REQUIRE(teep_compute_sha256_many(messages, 2, digests) == TEEP_ERR_SUCCESS);
+        REQUIRE(memcmp(digests[0], shortDigest, sizeof(digest)) == 0);
+        REQUIRE(memcmp(digests[1], longDigest, sizeof(digest)) == 0);
+    }
+    REQUIRE(teep_sha256_use_engine(TEEP_SHA256_ENGINE_AUTO) == TEEP_ERR_SUCCESS);
+}
+
+TEST_CASE("SHA-256 engines agree on every padding boundary", "[sha256]")
+{
+    // Lengths around each block boundary, hashed as one batch so that
+    // multi-buffer lanes finish at different times.
+    std::vector<std::vector<uint8_t>> buffers;
+    std::vector<UsefulBufC> batch;
+    for (size_t length = 0; length <= 200; length++) {
+        buffers.push_back(MakeTestBuffer(length));
+    }
+    buffers.push_back(MakeTestBuffer(100000));
+    for (const std::vector<uint8_t>& buffer : buffers) {
+        batch.push_back({ buffer.data(), buffer.size() });
+    }
+
+    REQUIRE(teep_sha256_use_engine(TEEP_SHA256_ENGINE_PORTABLE) == TEEP_ERR_SUCCESS);
+    std::vector<teep_sha256_digest_t> expected(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+        REQUIRE(teep_compute_sha256(batch[i], expected[i]) == TEEP_ERR_SUCCESS);
+    }
+
+    for (teep_sha256_engine_t engine : g_Engines) {
+        if (!teep_sha256_engine_available(engine)) {
+            continue;
+        }
+        REQUIRE(teep_sha256_use_engine(engine) == TEEP_ERR_SUCCESS);
+
+        std::vector<teep_sha256_digest_t> digests(batch.size());
+        REQUIRE(teep_compute_sha256_many(batch.data(), batch.size(), digests.data()) == TEEP_ERR_SUCCESS);
+        for (size_t i = 0; i < batch.size(); i++) {
+            REQUIRE(memcmp(digests[i], expected[i], TEEP_SHA256_SIZE) == 0);
+        }
+
+        // Feed the largest buffer in uneven pieces.
+        const std::vector<uint8_t>& large = buffers.back();
+        teep_sha256_ctx_t ctx;
+        REQUIRE(teep_sha256_init(&ctx) == TEEP_ERR_SUCCESS);
+        for (size_t offset = 0, piece = 1; offset < large.size(); piece = piece * 3 % 97 + 1) {
+            size_t length = std::min(piece, large.size() - offset);
+            REQUIRE(teep_sha256_update(&ctx, { large.data() + offset, length }) == TEEP_ERR_SUCCESS);
+            offset += length;
+        }
+        uint8_t digest[TEEP_SHA256_SIZE];
+        REQUIRE(teep_sha256_final(&ctx, digest) == TEEP_ERR_SUCCESS);
+        teep_sha256_free(&ctx);
+        REQUIRE(memcmp(digest, expected.back(), TEEP_SHA256_SIZE) == 0);
+    }
+    REQUIRE(teep_sha256_use_engine(TEEP_SHA256_ENGINE_AUTO) == TEEP_ERR_SUCCESS);
+}
+
+TEST_CASE("HMAC-SHA256 matches known answers", "[sha256]")
+{
+    // RFC 4231 test case 2.
+    const char* key = "Jefe";
+    const char* data = "what do ya want for nothing?";
+    const uint8_t expected[TEEP_SHA256_SIZE] = {
+        0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+        0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43
+    };
+    uint8_t mac[TEEP_SHA256_SIZE];
+    REQUIRE(teep_hmac_sha256({ key, strlen(key) }, { data, strlen(data) }, mac) == TEEP_ERR_SUCCESS);
+    REQUIRE(memcmp(mac, expected, sizeof(mac)) == 0);
+
+    // Longer keys would first need hashing, which is not supported.
+    std::vector<uint8_t> longKey = MakeTestBuffer(65);
+    REQUIRE(teep_hmac_sha256({ longKey.data(), longKey.size() }, { data, strlen(data) }, mac) != TEEP_ERR_SUCCESS);
+}
@@ -0,0 +1,711 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+#include "catch.hpp"
+#include "qcbor/UsefulBuf.h"
+#include "t_cose/t_cose_common.h"
+#include "delta.h"
+#include "TeepAgentLib.h"
+#include "ManifestTransaction.h"
+#include "ObjectStore.h"
+#include "SuitAuthentication.h"
+#include "SuitParser.h"
+#include "AgentKeys.h"
+#include "TestManifests.h"
+#define TAM_DATA_DIRECTORY "../../../tam"
+#define TEEP_AGENT_DATA_DIRECTORY "../../../agent"
+#define REQUIRED_TA_ID "f1a2c3bb-7c62-4b19-a030-5d9f1758f10a"
+
+static std::vector<uint8_t> ReadManifestFile(_In_z_ const char* type, _In_z_ const char* taId)
+{
+    std::filesystem::path path = std::filesystem::path(TAM_DATA_DIRECTORY) / "manifests";
+    path /= type;
+    path /= taId + std::string(".cbor");
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static bool IsWithin(UsefulBufC inner, UsefulBufC outer)
+{
+    const uint8_t* innerStart = (const uint8_t*)inner.ptr;
+    const uint8_t* outerStart = (const uint8_t*)outer.ptr;
+    return (innerStart >= outerStart) && (innerStart + inner.len <= outerStart + outer.len);
+}
+
+TEST_CASE("SuitParseEnvelope records member offsets", "[suit]")
+{
+    std::vector<uint8_t> manifest = ReadManifestFile("required", REQUIRED_TA_ID);
+    REQUIRE(manifest.size() > 0);
+    UsefulBufC encoded = { manifest.data(), manifest.size() };
+
+    SuitEnvelopeOffsets offsets;
+    std::ostringstream errorMessage;
+    REQUIRE(SuitParseEnvelope(encoded, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+
+    // Every member must be located inside its parent.
+    REQUIRE(IsWithin(offsets.AuthenticationWrapper, encoded));
+    REQUIRE(IsWithin(offsets.Digest, offsets.AuthenticationWrapper));
+    REQUIRE(IsWithin(offsets.DigestBytes, offsets.Digest));
+    REQUIRE(IsWithin(offsets.Manifest, encoded));
+    REQUIRE(IsWithin(offsets.Common, offsets.Manifest));
+    REQUIRE(IsWithin(offsets.ComponentId, offsets.Common));
+
+    REQUIRE(offsets.DigestBytes.len == 32);
+    REQUIRE(offsets.SequenceNumber == 7);
+    REQUIRE(offsets.ComponentCount == 4);
+
+    const uint8_t expectedComponentId[] = {
+        0xf1, 0xa2, 0xc3, 0xbb, 0x7c, 0x62, 0x4b, 0x19,
+        0xa0, 0x30, 0x5d, 0x9f, 0x17, 0x58, 0xf1, 0x0a };
+    REQUIRE(offsets.ComponentId.len == sizeof(expectedComponentId));
+    REQUIRE(memcmp(offsets.ComponentId.ptr, expectedComponentId, sizeof(expectedComponentId)) == 0);
+}
+
+TEST_CASE("SuitParseEnvelope rejects malformed envelopes", "[suit]")
+{
+    SuitEnvelopeOffsets offsets;
+    std::ostringstream errorMessage;
+
+    // An array instead of a map.
+    const uint8_t notAMap[] = { 0x80 };
+    REQUIRE(SuitParseEnvelope({ notAMap, sizeof(notAMap) }, offsets, errorMessage) != TEEP_ERR_SUCCESS);
+
+    // A map with no suit-manifest.
+    const uint8_t noManifest[] = { 0xa0 };
+    REQUIRE(SuitParseEnvelope({ noManifest, sizeof(noManifest) }, offsets, errorMessage) != TEEP_ERR_SUCCESS);
+
+    // A suit-manifest that is not a bstr.
+    const uint8_t badManifest[] = { 0xa1, 0x03, 0x01 };
+    REQUIRE(SuitParseEnvelope({ badManifest, sizeof(badManifest) }, offsets, errorMessage) != TEEP_ERR_SUCCESS);
+}
+
+TEST_CASE("Severed SUIT members are checked against their digests", "[suit]")
+{
+    uint8_t digest[TEEP_SHA256_SIZE] = { 0 };
+    std::vector<uint8_t> envelope = ComposeSeveredEnvelope(1400, "http://localhost/severed", 100, digest, 300);
+    UsefulBufC encoded = { envelope.data(), envelope.size() };
+
+    SuitEnvelopeOffsets offsets;
+    std::ostringstream errorMessage;
+    REQUIRE(SuitParseEnvelope(encoded, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    REQUIRE(IsWithin(offsets.Install, encoded));
+    REQUIRE_FALSE(IsWithin(offsets.Install, offsets.Manifest));
+
+    // Change the last command of the severed install sequence.
+    size_t lastByte = (const uint8_t*)offsets.Install.ptr - envelope.data() + offsets.Install.len - 1;
+    envelope[lastByte] ^= 1;
+    REQUIRE(SuitParseEnvelope(encoded, offsets, errorMessage) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+}
+
+static std::string MakeHexString(UsefulBufC bytes)
+{
+    std::string hex;
+    for (size_t i = 0; i < bytes.len; i++) {
+        hex += "0123456789abcdef"[((const uint8_t*)bytes.ptr)[i] >> 4];
+        hex += "0123456789abcdef"[((const uint8_t*)bytes.ptr)[i] & 0xf];
+    }
+    return hex;
+}
+
+TEST_CASE("SUIT signatures are verified once per manifest and signer", "[suit]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    SuitClearVerificationCache();
+
+    // Trust only a signer made for this test.
+    std::filesystem::create_directories("suit-signer/trusted");
+    struct t_cose_key signer;
+    struct t_cose_key stranger;
+    REQUIRE(teep_load_signing_key_pair(&signer, "suit-signer/signer-private-key-pair.pem",
+        "suit-signer/trusted/signer-es256-public-key.pem", TEEP_SIGNATURE_ES256) == TEEP_ERR_SUCCESS);
+    REQUIRE(teep_load_signing_key_pair(&stranger, "suit-signer/stranger-private-key-pair.pem",
+        "suit-signer/stranger-es256-public-key.pem", TEEP_SIGNATURE_ES256) == TEEP_ERR_SUCCESS);
+    REQUIRE(TeepAgentConfigureTamKeys("suit-signer/trusted") == TEEP_ERR_SUCCESS);
+
+    std::vector<uint8_t> envelope = SignTestEnvelope(ComposeSyntheticEnvelope(1500, 16), &signer);
+    REQUIRE_FALSE(envelope.empty());
+    SuitEnvelopeOffsets offsets;
+    std::ostringstream errorMessage;
+    REQUIRE(SuitParseEnvelope({ envelope.data(), envelope.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    REQUIRE(SuitVerifyAuthentication(offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    filesystem::path cacheFilename;
+    TeepAgentGetVerificationCacheFilename(cacheFilename);
+    REQUIRE(std::filesystem::file_size(cacheFilename) > 0);
+
+    // The signature ends the authentication wrapper.  Once the manifest
+    // has been verified, a spoiled signature is not even looked at, until
+    // the cache is cleared.
+    std::vector<uint8_t> spoiled = envelope;
+    spoiled[(const uint8_t*)offsets.AuthenticationWrapper.ptr - envelope.data() + offsets.AuthenticationWrapper.len - 1] ^= 1;
+    REQUIRE(SuitParseEnvelope({ spoiled.data(), spoiled.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    REQUIRE(SuitVerifyAuthentication(offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    SuitClearVerificationCache();
+    REQUIRE(SuitVerifyAuthentication(offsets, errorMessage) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+
+    // Nor is it vouched for by a line written into the cache file by
+    // anyone but the agent.
+    uint8_t signerDigest[TEEP_SHA256_SIZE];
+    REQUIRE(teep_compute_public_key_digest(&signer, signerDigest) == TEEP_ERR_SUCCESS);
+    std::string forgedPair = MakeHexString(offsets.DigestBytes) + " " + MakeHexString({ signerDigest, sizeof(signerDigest) });
+    SuitClearVerificationCache();
+    {
+        std::ofstream forged(cacheFilename);
+        forged << forgedPair << "\n";
+        forged << forgedPair << " " << std::string(2 * TEEP_SHA256_SIZE, '0') << "\n";
+    }
+    REQUIRE(SuitVerifyAuthentication(offsets, errorMessage) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+    SuitClearVerificationCache();
+
+    // A manifest changed after signing no longer matches its digest.
+    std::vector<uint8_t> tampered = envelope;
+    tampered.back() ^= 1;
+    REQUIRE(SuitParseEnvelope({ tampered.data(), tampered.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    REQUIRE(SuitVerifyAuthentication(offsets, errorMessage) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+
+    // Nor is a manifest signed by a key that is not trusted accepted.
+    std::vector<uint8_t> untrusted = SignTestEnvelope(ComposeSyntheticEnvelope(1501, 16), &stranger);
+    REQUIRE(SuitParseEnvelope({ untrusted.data(), untrusted.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    REQUIRE(SuitVerifyAuthentication(offsets, errorMessage) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+
+    // Nor is one that is not signed at all, unless a test allows it.
+    std::vector<uint8_t> unsignedEnvelope = ComposeSyntheticEnvelope(1502, 16);
+    REQUIRE(SuitParseEnvelope({ unsignedEnvelope.data(), unsignedEnvelope.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    REQUIRE(SuitVerifyAuthentication(offsets, errorMessage) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+    SuitSetUnsignedEnvelopesAllowed(true);
+    REQUIRE(SuitVerifyAuthentication(offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    SuitSetUnsignedEnvelopesAllowed(false);
+
+    SuitClearVerificationCache();
+    TeepAgentConfigureTamKeys(TEEP_AGENT_DATA_DIRECTORY "/trusted");
+    std::filesystem::remove_all("suit-signer");
+    TeepAgentShutdown();
+}
+
+static bool IsSyntheticEnvelopeInstalled(const std::vector<uint8_t>& envelope)
+{
+    SuitEnvelopeOffsets offsets;
+    std::ostringstream errorMessage;
+    REQUIRE(SuitParseEnvelope({ envelope.data(), envelope.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    filesystem::path filename;
+    TeepAgentMakeManifestFilename(filename, (const char*)offsets.ComponentId.ptr, offsets.ComponentId.len);
+    return std::filesystem::exists(filename);
+}
+
+TEST_CASE("SuitProcessEnvelopes stops at the first error", "[suit]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    REQUIRE(TrustTestSigner() == TEEP_ERR_SUCCESS);
+
+    std::vector<std::vector<uint8_t>> envelopes;
+    for (uint32_t i = 0; i < 8; i++) {
+        envelopes.push_back(SignWithTestSigner(ComposeSyntheticEnvelope(i, 16)));
+    }
+    const uint8_t badEnvelope[] = { 0xa1, 0x03, 0x01 };
+    std::vector<UsefulBufC> manifestList;
+    for (const std::vector<uint8_t>& envelope : envelopes) {
+        manifestList.push_back({ envelope.data(), envelope.size() });
+    }
+    manifestList[5] = { badEnvelope, sizeof(badEnvelope) };
+
+    std::ostringstream errorMessage;
+    ManifestTransaction transaction;
+    REQUIRE(SuitProcessEnvelopes(manifestList, 4, transaction, errorMessage) != TEEP_ERR_SUCCESS);
+    REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+    for (uint32_t i = 0; i < envelopes.size(); i++) {
+        if (i != 5) {
+            REQUIRE(IsSyntheticEnvelopeInstalled(envelopes[i]) == (i < 5));
+        }
+    }
+
+    UninstallSyntheticEnvelopes(envelopes);
+    TeepAgentShutdown();
+}
+
+TEST_CASE("SuitProcessEnvelopes installs dependencies first", "[suit]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    REQUIRE(TrustTestSigner() == TEEP_ERR_SUCCESS);
+    std::ostringstream errorMessage;
+
+    // Listed with each manifest ahead of the ones it depends on.
+    std::vector<std::vector<uint8_t>> envelopes = {
+        SignWithTestSigner(ComposeDependentEnvelope(200, 16, { 201, 202 })),
+        SignWithTestSigner(ComposeDependentEnvelope(201, 16, { 202 })),
+        SignWithTestSigner(ComposeSyntheticEnvelope(202, 16)),
+        SignWithTestSigner(ComposeSyntheticEnvelope(203, 16)),
+    };
+    SuitEnvelopeOffsets offsets;
+    REQUIRE(SuitParseEnvelope({ envelopes[0].data(), envelopes[0].size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    REQUIRE(offsets.Dependencies.size() == 2);
+    REQUIRE(IsWithin(offsets.Dependencies[0], offsets.Common));
+
+    std::vector<UsefulBufC> manifestList;
+    for (const std::vector<uint8_t>& envelope : envelopes) {
+        manifestList.push_back({ envelope.data(), envelope.size() });
+    }
+    {
+        ManifestTransaction transaction;
+        REQUIRE(SuitProcessEnvelopes(manifestList, 4, transaction, errorMessage) == TEEP_ERR_SUCCESS);
+        REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+    }
+    for (const std::vector<uint8_t>& envelope : envelopes) {
+        REQUIRE(IsSyntheticEnvelopeInstalled(envelope));
+    }
+
+    // A dependency must be in the list or already installed.
+    std::vector<std::vector<uint8_t>> orphans = { SignWithTestSigner(ComposeDependentEnvelope(204, 16, { 205 })) };
+    {
+        ManifestTransaction transaction;
+        REQUIRE(SuitProcessEnvelopes({ { orphans[0].data(), orphans[0].size() } }, 4, transaction, errorMessage) != TEEP_ERR_SUCCESS);
+        REQUIRE(SuitStageEnvelope({ orphans[0].data(), orphans[0].size() }, transaction, errorMessage) != TEEP_ERR_SUCCESS);
+        REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+    }
+    REQUIRE_FALSE(IsSyntheticEnvelopeInstalled(orphans[0]));
+
+    // Manifests that depend on each other are never installed.
+    std::vector<std::vector<uint8_t>> cycle = {
+        SignWithTestSigner(ComposeDependentEnvelope(206, 16, { 207 })),
+        SignWithTestSigner(ComposeDependentEnvelope(207, 16, { 206 })),
+    };
+    {
+        ManifestTransaction transaction;
+        REQUIRE(SuitProcessEnvelopes({ { cycle[0].data(), cycle[0].size() }, { cycle[1].data(), cycle[1].size() } }, 4, transaction, errorMessage) != TEEP_ERR_SUCCESS);
+        REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+    }
+    REQUIRE_FALSE(IsSyntheticEnvelopeInstalled(cycle[0]));
+    REQUIRE_FALSE(IsSyntheticEnvelopeInstalled(cycle[1]));
+
+    UninstallSyntheticEnvelopes(envelopes);
+    TeepAgentShutdown();
+}
+
+TEST_CASE("ManifestTransaction publishes only on commit", "[suit]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    REQUIRE(TrustTestSigner() == TEEP_ERR_SUCCESS);
+    std::vector<std::vector<uint8_t>> envelopes = { SignWithTestSigner(ComposeSyntheticEnvelope(100, 16)) };
+    UsefulBufC envelope = { envelopes[0].data(), envelopes[0].size() };
+    std::ostringstream errorMessage;
+
+    // A transaction that is never committed leaves nothing behind.
+    {
+        ManifestTransaction transaction;
+        REQUIRE(SuitProcessEnvelopes({ envelope }, 1, transaction, errorMessage) == TEEP_ERR_SUCCESS);
+        REQUIRE_FALSE(IsSyntheticEnvelopeInstalled(envelopes[0]));
+    }
+    REQUIRE_FALSE(IsSyntheticEnvelopeInstalled(envelopes[0]));
+
+    // Committing publishes the manifest.
+    {
+        ManifestTransaction transaction;
+        REQUIRE(SuitProcessEnvelopes({ envelope }, 1, transaction, errorMessage) == TEEP_ERR_SUCCESS);
+        REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+    }
+    REQUIRE(IsSyntheticEnvelopeInstalled(envelopes[0]));
+
+    // A staged deletion only takes effect on commit.
+    SuitEnvelopeOffsets offsets;
+    REQUIRE(SuitParseEnvelope(envelope, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    {
+        ManifestTransaction transaction;
+        REQUIRE(SuitUninstallComponent(offsets.ComponentId, transaction) == TEEP_ERR_SUCCESS);
+        REQUIRE(IsSyntheticEnvelopeInstalled(envelopes[0]));
+        REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+    }
+    REQUIRE_FALSE(IsSyntheticEnvelopeInstalled(envelopes[0]));
+
+    TeepAgentShutdown();
+}
+
+TEST_CASE("ManifestTransaction stores identical contents once", "[suit]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    const uint8_t contents[] = { 0xa0, 0x01, 0x02, 0x03 };
+    const char firstId[] = { 0x01 };
+    const char secondId[] = { 0x02 };
+    filesystem::path firstEntry;
+    filesystem::path secondEntry;
+    filesystem::path objectPath;
+    TeepAgentMakeManifestFilename(firstEntry, firstId, sizeof(firstId));
+    TeepAgentMakeManifestFilename(secondEntry, secondId, sizeof(secondId));
+    REQUIRE(ObjectStoreGetObjectPath({ contents, sizeof(contents) }, objectPath) == TEEP_ERR_SUCCESS);
+    std::ostringstream errorMessage;
+
+    {
+        ManifestTransaction transaction;
+        REQUIRE(transaction.StageWrite(firstEntry, { contents, sizeof(contents) }, errorMessage) == TEEP_ERR_SUCCESS);
+        REQUIRE(transaction.StageWrite(secondEntry, { contents, sizeof(contents) }, errorMessage) == TEEP_ERR_SUCCESS);
+        REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+    }
+    REQUIRE(ObjectStoreGetReferenceCount(objectPath) == 2);
+    REQUIRE(std::filesystem::equivalent(firstEntry, objectPath));
+    REQUIRE(std::filesystem::equivalent(secondEntry, objectPath));
+
+    // Reinstalling the same contents leaves the entry as it was.
+    {
+        ManifestTransaction transaction;
+        REQUIRE(transaction.StageWrite(firstEntry, { contents, sizeof(contents) }, errorMessage) == TEEP_ERR_SUCCESS);
+        REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+    }
+    REQUIRE(ObjectStoreGetReferenceCount(objectPath) == 2);
+
+    // The object goes away with its last entry.
+    {
+        ManifestTransaction transaction;
+        transaction.StageDelete(firstEntry);
+        REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+    }
+    REQUIRE(ObjectStoreGetReferenceCount(objectPath) == 1);
+    {
+        ManifestTransaction transaction;
+        transaction.StageDelete(secondEntry);
+        REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+    }
+    REQUIRE_FALSE(std::filesystem::exists(objectPath));
+
+    TeepAgentShutdown();
+}
+
+TEST_CASE("Garbage collection leaves objects an open transaction may still link", "[suit]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    const uint8_t contents[] = { 0xa0, 0x04, 0x05 };
+    filesystem::path objectPath;
+    REQUIRE(ObjectStoreGetObjectPath({ contents, sizeof(contents) }, objectPath) == TEEP_ERR_SUCCESS);
+    filesystem::path tempPath = objectPath;
+    tempPath += ".tmp";
+    std::filesystem::create_directories(objectPath.parent_path());
+    std::ofstream(objectPath) << "orphan";
+    std::ofstream(tempPath) << "partial";
+
+    {
+        ManifestTransaction transaction;
+        ObjectStoreCollectGarbage();
+        REQUIRE(std::filesystem::exists(objectPath));
+    }
+    REQUIRE_FALSE(std::filesystem::exists(objectPath));
+
+    // Names with an extension are never objects.
+    REQUIRE(std::filesystem::exists(tempPath));
+    std::filesystem::remove(tempPath);
+
+    TeepAgentShutdown();
+}
+
+static void GetPayloadFilename(_In_ const std::vector<uint8_t>& envelope, _Out_ filesystem::path& payloadPath)
+{
+    SuitEnvelopeOffsets offsets;
+    std::ostringstream errorMessage;
+    REQUIRE(SuitParseEnvelope({ envelope.data(), envelope.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    TeepAgentMakeManifestFilename(payloadPath, (const char*)offsets.ComponentId.ptr, offsets.ComponentId.len);
+    payloadPath.replace_extension(".0.payload");
+}
+
+TEST_CASE("SUIT install streams fetched payloads", "[suit]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    REQUIRE(TrustTestSigner() == TEEP_ERR_SUCCESS);
+    SuitSetPayloadFetcher(TestPayloadFetcher);
+
+    // Large enough to span many fetch requests, and not a multiple of them.
+    const uint64_t payloadSize = 32 * 1024 * 1024 + 123;
+    uint8_t digest[TEEP_SHA256_SIZE];
+    ComputeTestPayloadDigest(7, payloadSize, digest);
+    std::ostringstream errorMessage;
+
+    SECTION("A matching payload is installed")
+    {
+        std::vector<uint8_t> envelope = SignWithTestSigner(ComposeFetchEnvelope(1000, MakeTestPayloadUri(7, payloadSize), payloadSize, digest));
+        filesystem::path payloadPath;
+        GetPayloadFilename(envelope, payloadPath);
+        {
+            ManifestTransaction transaction;
+            REQUIRE(SuitStageEnvelope({ envelope.data(), envelope.size() }, transaction, errorMessage) == TEEP_ERR_SUCCESS);
+            REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+        }
+        REQUIRE(std::filesystem::file_size(payloadPath) == payloadSize);
+        REQUIRE(GetLargestFetchRequest() <= 64 * 1024);
+
+        // Uninstalling the component removes its payload too.
+        UninstallSyntheticEnvelopes({ envelope });
+        REQUIRE_FALSE(std::filesystem::exists(payloadPath));
+    }
+
+    SECTION("A payload that does not match its digest is rejected")
+    {
+        digest[0] ^= 0xff;
+        std::vector<uint8_t> envelope = SignWithTestSigner(ComposeFetchEnvelope(1001, MakeTestPayloadUri(7, payloadSize), payloadSize, digest));
+        filesystem::path payloadPath;
+        GetPayloadFilename(envelope, payloadPath);
+        {
+            ManifestTransaction transaction;
+            REQUIRE(SuitStageEnvelope({ envelope.data(), envelope.size() }, transaction, errorMessage) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+            REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+        }
+        REQUIRE_FALSE(std::filesystem::exists(payloadPath));
+    }
+
+    SECTION("A payload larger than its image size is rejected")
+    {
+        std::vector<uint8_t> envelope = SignWithTestSigner(ComposeFetchEnvelope(1002, MakeTestPayloadUri(7, payloadSize), payloadSize - 1, digest));
+        ManifestTransaction transaction;
+        REQUIRE(SuitStageEnvelope({ envelope.data(), envelope.size() }, transaction, errorMessage) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+    }
+
+    SECTION("A payload cannot be fetched without a fetcher")
+    {
+        SuitSetPayloadFetcher(nullptr);
+        std::vector<uint8_t> envelope = SignWithTestSigner(ComposeFetchEnvelope(1003, MakeTestPayloadUri(7, payloadSize), payloadSize, digest));
+        ManifestTransaction transaction;
+        REQUIRE(SuitStageEnvelope({ envelope.data(), envelope.size() }, transaction, errorMessage) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+    }
+
+    SECTION("A payload in a reserved domain is fetched like any other")
+    {
+        std::vector<uint8_t> envelope = SignWithTestSigner(ComposeFetchEnvelope(1004, "http://tam.invalid/file.bin", payloadSize, digest));
+        filesystem::path payloadPath;
+        GetPayloadFilename(envelope, payloadPath);
+        ManifestTransaction transaction;
+        REQUIRE(SuitStageEnvelope({ envelope.data(), envelope.size() }, transaction, errorMessage) == TEEP_ERR_TEMPORARY_ERROR);
+        REQUIRE_FALSE(std::filesystem::exists(payloadPath));
+    }
+
+    SuitSetPayloadFetcher(TeepAgentFetchPayload);
+    TeepAgentShutdown();
+}
+
+static teep_error_code_t StageAndCommit(const std::vector<uint8_t>& envelope)
+{
+    std::ostringstream errorMessage;
+    ManifestTransaction transaction;
+    teep_error_code_t errorCode = SuitStageEnvelope({ envelope.data(), envelope.size() }, transaction, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+    return transaction.Commit(errorMessage);
+}
+
+TEST_CASE("SUIT chunk trees resume interrupted fetches", "[suit]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    REQUIRE(TrustTestSigner() == TEEP_ERR_SUCCESS);
+    SuitSetPayloadFetcher(TestPayloadFetcher);
+
+    const uint64_t chunkSize = 64 * 1024;
+    const uint64_t payloadSize = 20 * chunkSize + 321;
+    uint8_t digest[TEEP_SHA256_SIZE];
+    uint8_t root[TEEP_SHA256_SIZE];
+    ComputeTestPayloadDigest(9, payloadSize, digest);
+    ComputeTestChunkTreeRoot(9, payloadSize, chunkSize, root);
+    std::string uri = MakeTestPayloadUri(9, payloadSize, chunkSize);
+    std::vector<uint8_t> envelope = SignWithTestSigner(ComposeFetchEnvelope(1100, uri, payloadSize, digest, chunkSize, root));
+    filesystem::path payloadPath;
+    GetPayloadFilename(envelope, payloadPath);
+
+    // Interrupt or corrupt the transfer at various points, including chunk
+    // boundaries and the final partial chunk.
+    for (uint64_t faultOffset : { (uint64_t)0, (uint64_t)1, chunkSize - 1, chunkSize, 7 * chunkSize + 4321, payloadSize - 1 }) {
+        for (bool corrupt : { false, true }) {
+            CAPTURE(faultOffset, corrupt);
+            if (corrupt) {
+                ScheduleFetchCorruption(faultOffset);
+                REQUIRE(StageAndCommit(envelope) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+            } else {
+                ScheduleFetchError(faultOffset);
+                REQUIRE(StageAndCommit(envelope) == TEEP_ERR_TEMPORARY_ERROR);
+            }
+            REQUIRE_FALSE(std::filesystem::exists(payloadPath));
+
+            // The retry picks up at the start of the chunk that failed.
+            uint64_t resumeOffset = (faultOffset / chunkSize) * chunkSize;
+            ResetFetchStatistics();
+            REQUIRE(StageAndCommit(envelope) == TEEP_ERR_SUCCESS);
+            REQUIRE(GetFirstFetchOffset() == resumeOffset);
+            REQUIRE(GetFetchedPayloadBytes() == payloadSize - resumeOffset);
+            REQUIRE(std::filesystem::file_size(payloadPath) == payloadSize);
+
+            UninstallSyntheticEnvelopes({ envelope });
+        }
+    }
+
+    // Leaves that do not match the root are caught before any payload
+    // bytes are fetched.
+    root[0] ^= 0xff;
+    std::vector<uint8_t> badEnvelope = SignWithTestSigner(ComposeFetchEnvelope(1101, uri, payloadSize, digest, chunkSize, root));
+    ResetFetchStatistics();
+    REQUIRE(StageAndCommit(badEnvelope) == TEEP_ERR_MANIFEST_PROCESSING_FAILED);
+    REQUIRE(GetFetchedPayloadBytes() == 0);
+
+    SuitSetPayloadFetcher(TeepAgentFetchPayload);
+    TeepAgentShutdown();
+}
+
+TEST_CASE("SUIT chunked payloads shared by several manifests are written once", "[suit]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    REQUIRE(TrustTestSigner() == TEEP_ERR_SUCCESS);
+    SuitSetPayloadFetcher(TestPayloadFetcher);
+
+    const uint64_t chunkSize = 64 * 1024;
+    const uint64_t payloadSize = 40 * chunkSize + 17;
+    uint8_t digest[TEEP_SHA256_SIZE];
+    uint8_t root[TEEP_SHA256_SIZE];
+    ComputeTestPayloadDigest(11, payloadSize, digest);
+    ComputeTestChunkTreeRoot(11, payloadSize, chunkSize, root);
+    std::string uri = MakeTestPayloadUri(11, payloadSize, chunkSize);
+    std::vector<std::vector<uint8_t>> envelopes = {
+        SignWithTestSigner(ComposeFetchEnvelope(1105, uri, payloadSize, digest, chunkSize, root)),
+        SignWithTestSigner(ComposeFetchEnvelope(1106, uri, payloadSize, digest, chunkSize, root)),
+    };
+
+    // Both manifests fetch the payload at once on separate workers.
+    std::ostringstream errorMessage;
+    {
+        ManifestTransaction transaction;
+        REQUIRE(SuitProcessEnvelopes({ { envelopes[0].data(), envelopes[0].size() }, { envelopes[1].data(), envelopes[1].size() } }, 2, transaction, errorMessage) == TEEP_ERR_SUCCESS);
+        REQUIRE(transaction.Commit(errorMessage) == TEEP_ERR_SUCCESS);
+    }
+    filesystem::path firstPath;
+    filesystem::path secondPath;
+    GetPayloadFilename(envelopes[0], firstPath);
+    GetPayloadFilename(envelopes[1], secondPath);
+    REQUIRE(std::filesystem::file_size(firstPath) == payloadSize);
+    REQUIRE(std::filesystem::equivalent(firstPath, secondPath));
+    filesystem::path objectPath;
+    TeepAgentMakeObjectFilename(objectPath, digest, sizeof(digest));
+    REQUIRE(ObjectStoreGetReferenceCount(objectPath) == 2);
+
+    // Nothing is left to resume.
+    filesystem::path partialPath;
+    ObjectStoreGetPartialPath(digest, ".partial", partialPath);
+    REQUIRE_FALSE(std::filesystem::exists(partialPath));
+
+    UninstallSyntheticEnvelopes(envelopes);
+    SuitSetPayloadFetcher(TeepAgentFetchPayload);
+    TeepAgentShutdown();
+}
+
+TEST_CASE("Background verification removes corrupt payloads", "[suit]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    REQUIRE(TrustTestSigner() == TEEP_ERR_SUCCESS);
+    SuitSetPayloadFetcher(TestPayloadFetcher);
+
+    const uint64_t payloadSize = 300 * 1024;
+    uint8_t digest[TEEP_SHA256_SIZE];
+    ComputeTestPayloadDigest(10, payloadSize, digest);
+    std::vector<uint8_t> envelope = SignWithTestSigner(ComposeFetchEnvelope(1102, MakeTestPayloadUri(10, payloadSize), payloadSize, digest));
+    filesystem::path payloadPath;
+    GetPayloadFilename(envelope, payloadPath);
+    REQUIRE(StageAndCommit(envelope) == TEEP_ERR_SUCCESS);
+
+    // Finish any pass already in progress, then check that an intact
+    // store is left alone.
+    int complete = 0;
+    while (!complete) {
+        REQUIRE(TeepAgentVerifyInstalledComponents(16 * 1024, &complete) == TEEP_ERR_SUCCESS);
+    }
+    do {
+        REQUIRE(TeepAgentVerifyInstalledComponents(16 * 1024, &complete) == TEEP_ERR_SUCCESS);
+    } while (!complete);
+    REQUIRE(std::filesystem::exists(payloadPath));
+
+    // Flip a byte of the installed payload, which is shared with its object.
+    {
+        std::fstream file(payloadPath, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(payloadSize / 2);
+        char value = (char)file.get();
+        file.seekp(payloadSize / 2);
+        file.put((char)(value ^ 1));
+    }
+
+    // Nothing is removed while a transaction may be linking entries to the
+    // object.
+    {
+        ManifestTransaction transaction;
+        do {
+            REQUIRE(TeepAgentVerifyInstalledComponents(16 * 1024, &complete) == TEEP_ERR_SUCCESS);
+        } while (!complete);
+        REQUIRE(std::filesystem::exists(payloadPath));
+    }
+    size_t calls = 0;
+    do {
+        REQUIRE(TeepAgentVerifyInstalledComponents(16 * 1024, &complete) == TEEP_ERR_SUCCESS);
+        calls++;
+    } while (!complete);
+    REQUIRE(calls > 1);
+    REQUIRE_FALSE(std::filesystem::exists(payloadPath));
+    REQUIRE_FALSE(std::filesystem::exists(filesystem::path(payloadPath).replace_extension().replace_extension(".cbor")));
+
+    UninstallSyntheticEnvelopes({ envelope });
+    SuitSetPayloadFetcher(TeepAgentFetchPayload);
+    TeepAgentShutdown();
+}
+
+TEST_CASE("SUIT delta payloads upgrade installed components", "[suit]")
+{
+    REQUIRE(TeepAgentLoadConfiguration(TEEP_AGENT_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    REQUIRE(TrustTestSigner() == TEEP_ERR_SUCCESS);
+    SuitSetPayloadFetcher(TestPayloadFetcher);
+
+    std::vector<uint8_t> base = GenerateTestPayload(12, 256 * 1024);
+    std::vector<uint8_t> target = MakeTestUpgrade(base, 8);
+    uint8_t baseDigest[TEEP_SHA256_SIZE];
+    uint8_t targetDigest[TEEP_SHA256_SIZE];
+    teep_compute_sha256({ base.data(), base.size() }, baseDigest);
+    teep_compute_sha256({ target.data(), target.size() }, targetDigest);
+    std::vector<uint8_t> delta;
+    REQUIRE(teep_delta_encode({ base.data(), base.size() }, { target.data(), target.size() }, delta) == TEEP_ERR_SUCCESS);
+
+    std::vector<uint8_t> baseEnvelope = SignWithTestSigner(ComposeUpgradeEnvelope(1103, 1, RegisterTestPayload(base), base.size(), baseDigest));
+    REQUIRE(StageAndCommit(baseEnvelope) == TEEP_ERR_SUCCESS);
+    std::string targetUri = RegisterTestPayload(target);
+    filesystem::path payloadPath;
+    GetPayloadFilename(baseEnvelope, payloadPath);
+
+    SECTION("The delta is applied to the installed base")
+    {
+        std::vector<uint8_t> upgrade = SignWithTestSigner(ComposeUpgradeEnvelope(1103, 2, targetUri, target.size(), targetDigest, baseDigest, RegisterTestPayload(delta)));
+        ResetFetchStatistics();
+        REQUIRE(StageAndCommit(upgrade) == TEEP_ERR_SUCCESS);
+        REQUIRE(GetFetchedPayloadBytes() == delta.size());
+    }
+    SECTION("A delta that does not produce the image falls back to the full image")
+    {
+        std::vector<uint8_t> wrongTarget = MakeTestUpgrade(target, 1);
+        std::vector<uint8_t> wrongDelta;
+        REQUIRE(teep_delta_encode({ base.data(), base.size() }, { wrongTarget.data(), wrongTarget.size() }, wrongDelta) == TEEP_ERR_SUCCESS);
+        std::vector<uint8_t> upgrade = SignWithTestSigner(ComposeUpgradeEnvelope(1103, 2, targetUri, target.size(), targetDigest, baseDigest, RegisterTestPayload(wrongDelta)));
+        ResetFetchStatistics();
+        REQUIRE(StageAndCommit(upgrade) == TEEP_ERR_SUCCESS);
+        REQUIRE(GetFetchedPayloadBytes() == wrongDelta.size() + target.size());
+    }
+    SECTION("A delta that cannot be fetched falls back to the full image")
+    {
+        std::vector<uint8_t> upgrade = SignWithTestSigner(ComposeUpgradeEnvelope(1103, 2, targetUri, target.size(), targetDigest, baseDigest, "http://localhost/missing"));
+        ResetFetchStatistics();
+        REQUIRE(StageAndCommit(upgrade) == TEEP_ERR_SUCCESS);
+        REQUIRE(GetFetchedPayloadBytes() == target.size());
+    }
+    SECTION("Without the base installed, the full image is fetched")
+    {
+        UninstallSyntheticEnvelopes({ baseEnvelope });
+        std::vector<uint8_t> upgrade = SignWithTestSigner(ComposeUpgradeEnvelope(1103, 2, targetUri, target.size(), targetDigest, baseDigest, RegisterTestPayload(delta)));
+        ResetFetchStatistics();
+        REQUIRE(StageAndCommit(upgrade) == TEEP_ERR_SUCCESS);
+        REQUIRE(GetFetchedPayloadBytes() == target.size());
+    }
+
+    std::ifstream file(payloadPath, std::ios::binary);
+    std::vector<uint8_t> installed((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    REQUIRE(installed == target);
+    file.close();
+
+    UninstallSyntheticEnvelopes({ baseEnvelope });
+    SuitSetPayloadFetcher(TeepAgentFetchPayload);
+    TeepAgentShutdown();
+}
@@ -1,11 +1,274 @@
 // Copyright (c) TEEP contributors
 // SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string.h>
+#include <vector>
 #include "catch.hpp"
+#include "compress.h"
+#include "t_cose/t_cose_common.h"
 #include "TeepTamBrokerLib.h"
+#include "TeepTamLib.h"
+#include "Manifest.h"
+#include "TamKeys.h"
+#include "SuitParser.h"
+#include "TestManifests.h"
 #define TRUE 1
 #define TAM_DATA_DIRECTORY "../../../tam"
 
 TEST_CASE("Start-Stop TAM Broker", "[tam]") {
     REQUIRE(StartTamBroker(TAM_DATA_DIRECTORY, TRUE) == 0);
     StopTamBroker();
-}
\ No newline at end of file
+}
+
+TEST_CASE("TAM ignores manifests whose digest does not match", "[tam]")
+{
+    REQUIRE(TamLoadConfiguration(TAM_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    Manifest* original = Manifest::First();
+    REQUIRE(original != nullptr);
+
+    // Copy a valid manifest under another component id, then flip a byte
+    // at the end, which is inside suit-manifest.
+    teep_uuid_t component_id = { { 0xee, 0xee, 0xee, 0xee } };
+    UsefulBufC component_id_buffer = { &component_id, sizeof(component_id) };
+    std::vector<char> tampered((const char*)original->ManifestContents.ptr,
+                               (const char*)original->ManifestContents.ptr + original->ManifestContents.len);
+    tampered.back() ^= 1;
+    Manifest::AddManifest(component_id, tampered.data(), tampered.size(), false);
+    REQUIRE(Manifest::FindManifest(&component_id_buffer) != nullptr);
+
+    REQUIRE(Manifest::ValidateManifests(nullptr) == TEEP_ERR_SUCCESS);
+    REQUIRE(Manifest::FindManifest(&component_id_buffer) == nullptr);
+    REQUIRE(Manifest::First() != nullptr);
+    Manifest::ClearManifests();
+}
+
+TEST_CASE("TAM refuses manifests not signed by its keys", "[tam]")
+{
+    REQUIRE(TamInitializeKeys(TAM_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    std::map<teep_signature_kind_t, struct t_cose_key> key_pairs;
+    REQUIRE(TamGetSigningKeyPairs(key_pairs) == TEEP_ERR_SUCCESS);
+    REQUIRE(key_pairs.count(TEEP_SIGNATURE_ES256) == 1);
+    struct t_cose_key stranger;
+    REQUIRE(teep_load_signing_key_pair(&stranger, "tam-stranger-private-key-pair.pem",
+        "tam-stranger-es256-public-key.pem", TEEP_SIGNATURE_ES256) == TEEP_ERR_SUCCESS);
+
+    REQUIRE(TamLoadConfiguration(TAM_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    Manifest* original = Manifest::First();
+    REQUIRE(original != nullptr);
+    const uint8_t* contents = (const uint8_t*)original->ManifestContents.ptr;
+    std::vector<uint8_t> envelope(contents, contents + original->ManifestContents.len);
+    std::vector<uint8_t> signedByTam = SignTestEnvelope(envelope, &key_pairs[TEEP_SIGNATURE_ES256]);
+    std::vector<uint8_t> signedByStranger = SignTestEnvelope(envelope, &stranger);
+    REQUIRE(!signedByTam.empty());
+    REQUIRE(!signedByStranger.empty());
+    Manifest::ClearManifests();
+
+    teep_uuid_t tam_id = { { 0xcc, 0xcc, 0xcc, 0xcc } };
+    teep_uuid_t stranger_id = { { 0xee, 0xee, 0xee, 0xee } };
+    UsefulBufC tam_id_buffer = { &tam_id, sizeof(tam_id) };
+    UsefulBufC stranger_id_buffer = { &stranger_id, sizeof(stranger_id) };
+    Manifest::AddManifest(tam_id, (const char*)signedByTam.data(), signedByTam.size(), false);
+    Manifest::AddManifest(stranger_id, (const char*)signedByStranger.data(), signedByStranger.size(), false);
+    REQUIRE(Manifest::ValidateManifests(nullptr) == TEEP_ERR_SUCCESS);
+    REQUIRE(Manifest::FindManifest(&tam_id_buffer) != nullptr);
+    REQUIRE(Manifest::FindManifest(&stranger_id_buffer) == nullptr);
+    Manifest::ClearManifests();
+}
+
+static std::string ReadTestFile(const char* filename)
+{
+    std::ifstream file(filename);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+TEST_CASE("TAM remembers which manifests it has validated", "[tam]")
+{
+    const char* cacheFilename = "tam-validation-test.cache";
+    remove(cacheFilename);
+    REQUIRE(TamLoadConfiguration(TAM_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    Manifest* original = Manifest::First();
+    REQUIRE(original != nullptr);
+    std::vector<char> contents((const char*)original->ManifestContents.ptr,
+                               (const char*)original->ManifestContents.ptr + original->ManifestContents.len);
+    std::vector<char> tampered = contents;
+    tampered.back() ^= 1;
+    Manifest::ClearManifests();
+
+    teep_uuid_t valid_id = { { 0xdd, 0xdd, 0xdd, 0xdd } };
+    teep_uuid_t tampered_id = { { 0xee, 0xee, 0xee, 0xee } };
+    UsefulBufC valid_id_buffer = { &valid_id, sizeof(valid_id) };
+    UsefulBufC tampered_id_buffer = { &tampered_id, sizeof(tampered_id) };
+    Manifest::AddManifest(valid_id, contents.data(), contents.size(), false);
+    Manifest::AddManifest(tampered_id, tampered.data(), tampered.size(), false);
+    REQUIRE(Manifest::ValidateManifests(cacheFilename) == TEEP_ERR_SUCCESS);
+    REQUIRE(Manifest::FindManifest(&valid_id_buffer) != nullptr);
+    REQUIRE(Manifest::FindManifest(&tampered_id_buffer) == nullptr);
+
+    // One result was recorded for each manifest.
+    std::string cache = ReadTestFile(cacheFilename);
+    size_t validLine = cache.find(" 1\n");
+    REQUIRE(validLine != std::string::npos);
+    REQUIRE(cache.find(" 0\n") != std::string::npos);
+    REQUIRE(std::count(cache.begin(), cache.end(), '\n') == 2);
+
+    // A recorded result is used without checking the manifest again, so
+    // marking the valid manifest invalid in the cache has it refused.
+    cache[validLine + 1] = '0';
+    {
+        std::ofstream file(cacheFilename);
+        file << cache;
+    }
+    Manifest::ClearManifests();
+    Manifest::AddManifest(valid_id, contents.data(), contents.size(), false);
+    REQUIRE(Manifest::ValidateManifests(cacheFilename) == TEEP_ERR_SUCCESS);
+    REQUIRE(Manifest::FindManifest(&valid_id_buffer) == nullptr);
+
+    // Results for manifests no longer configured are dropped.
+    cache = ReadTestFile(cacheFilename);
+    REQUIRE(std::count(cache.begin(), cache.end(), '\n') == 1);
+
+    Manifest::ClearManifests();
+    remove(cacheFilename);
+}
+
+TEST_CASE("TAM decodes manifest metadata when loading", "[tam]")
+{
+    REQUIRE(TamLoadConfiguration(TAM_DATA_DIRECTORY) == TEEP_ERR_SUCCESS);
+    const uint8_t requiredComponentId[] = { 0xf1, 0xa2, 0xc3, 0xbb, 0x7c, 0x62, 0x4b, 0x19,
+                                            0xa0, 0x30, 0x5d, 0x9f, 0x17, 0x58, 0xf1, 0x0a };
+    UsefulBufC component_id_buffer = { requiredComponentId, sizeof(requiredComponentId) };
+    Manifest* manifest = Manifest::FindManifest(&component_id_buffer);
+    REQUIRE(manifest != nullptr);
+
+    const ManifestMetadata& metadata = manifest->Metadata;
+    REQUIRE(metadata.SequenceNumber == 7);
+    REQUIRE(metadata.ImageSize == 34768);
+    REQUIRE(metadata.Digest.len == TEEP_SHA256_SIZE);
+    REQUIRE(metadata.ImageDigest.len == TEEP_SHA256_SIZE);
+    REQUIRE(((const uint8_t*)metadata.ImageDigest.ptr)[1] == 0x11);
+    REQUIRE(metadata.Dependencies.empty());
+    Manifest::ClearManifests();
+}
+
+TEST_CASE("TAM picks delta manifests by the reported version", "[tam]")
+{
+    uint8_t digest[TEEP_SHA256_SIZE] = { 0 };
+    std::vector<uint8_t> full = ComposeUpgradeEnvelope(1200, 3, "http://localhost/v3", 1000, digest);
+    std::vector<uint8_t> fromTwo = ComposeUpgradeEnvelope(1200, 3, "http://localhost/v3", 1000, digest, digest, "http://localhost/v2-v3");
+    std::vector<uint8_t> stale = ComposeUpgradeEnvelope(1200, 2, "http://localhost/v2", 1000, digest, digest, "http://localhost/v1-v2");
+
+    SuitEnvelopeOffsets offsets;
+    std::ostringstream errorMessage;
+    REQUIRE(SuitParseEnvelope({ full.data(), full.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    teep_uuid_t component_id;
+    REQUIRE(offsets.ComponentId.len == sizeof(component_id));
+    memcpy(&component_id, offsets.ComponentId.ptr, sizeof(component_id));
+    UsefulBufC component_id_buffer = { &component_id, sizeof(component_id) };
+
+    Manifest::AddManifest(component_id, (const char*)full.data(), full.size(), true);
+    Manifest::AddDeltaManifest(component_id, 2, (const char*)fromTwo.data(), fromTwo.size());
+    Manifest::AddDeltaManifest(component_id, 1, (const char*)stale.data(), stale.size());
+
+    Manifest* manifest = Manifest::FindManifest(&component_id_buffer);
+    REQUIRE(manifest != nullptr);
+    REQUIRE(manifest->Metadata.SequenceNumber == 3);
+    Manifest* delta = manifest->FindDeltaManifest(2);
+    REQUIRE(delta != nullptr);
+    REQUIRE(delta->ManifestContents.len == fromTwo.size());
+
+    // A delta to an older version is no use, so the full manifest is sent.
+    REQUIRE(manifest->FindDeltaManifest(1) == nullptr);
+    REQUIRE(manifest->FindDeltaManifest(3) == nullptr);
+    Manifest::ClearManifests();
+}
+
+TEST_CASE("TAM lists dependencies ahead of the manifests that need them", "[tam]")
+{
+    std::vector<std::vector<uint8_t>> envelopes = {
+        ComposeDependentEnvelope(1300, 16, { 1302 }),
+        ComposeSyntheticEnvelope(1301, 16),
+        ComposeDependentEnvelope(1302, 16, { 1303 }),
+        ComposeSyntheticEnvelope(1303, 16),
+    };
+    std::vector<Manifest*> manifests;
+    for (const std::vector<uint8_t>& envelope : envelopes) {
+        SuitEnvelopeOffsets offsets;
+        std::ostringstream errorMessage;
+        REQUIRE(SuitParseEnvelope({ envelope.data(), envelope.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+        teep_uuid_t component_id;
+        REQUIRE(offsets.ComponentId.len == sizeof(component_id));
+        memcpy(&component_id, offsets.ComponentId.ptr, sizeof(component_id));
+        UsefulBufC component_id_buffer = { &component_id, sizeof(component_id) };
+        Manifest::AddManifest(component_id, (const char*)envelope.data(), envelope.size(), true);
+        manifests.push_back(Manifest::FindManifest(&component_id_buffer));
+        REQUIRE(manifests.back() != nullptr);
+    }
+    REQUIRE(manifests[0]->Metadata.Dependencies.size() == 1);
+    REQUIRE(manifests[1]->Metadata.Dependencies.empty());
+
+    std::vector<Manifest*> sorted = manifests;
+    Manifest::SortByDependencies(sorted);
+    REQUIRE(sorted == std::vector<Manifest*>{ manifests[3], manifests[2], manifests[0], manifests[1] });
+    Manifest::ClearManifests();
+}
+
+TEST_CASE("TAM keeps a compressed form of each manifest", "[tam]")
+{
+    teep_uuid_t component_id = { { 0xcc, 0xcc, 0xcc, 0xcc } };
+    UsefulBufC component_id_buffer = { &component_id, sizeof(component_id) };
+    std::vector<uint8_t> envelope = ComposeSyntheticEnvelope(1300, 4000);
+    Manifest::AddManifest(component_id, (const char*)envelope.data(), envelope.size(), true);
+
+    Manifest* manifest = Manifest::FindManifest(&component_id_buffer);
+    REQUIRE(manifest != nullptr);
+    REQUIRE(manifest->CompressedContents.len < manifest->ManifestContents.len);
+    std::vector<uint8_t> expanded;
+    REQUIRE(teep_decompress_buffer(manifest->CompressedContents, envelope.size(), expanded) == TEEP_ERR_SUCCESS);
+    REQUIRE(expanded == envelope);
+
+    // Nothing is kept when compression would not save anything.
+    teep_uuid_t random_id = { { 0xcd, 0xcd, 0xcd, 0xcd } };
+    UsefulBufC random_id_buffer = { &random_id, sizeof(random_id) };
+    std::vector<uint8_t> random = GenerateTestPayload(31, 2000);
+    Manifest::AddManifest(random_id, (const char*)random.data(), random.size(), true);
+    manifest = Manifest::FindManifest(&random_id_buffer);
+    REQUIRE(manifest != nullptr);
+    REQUIRE(UsefulBuf_IsNULLC(manifest->CompressedContents));
+    Manifest::ClearManifests();
+}
+
+TEST_CASE("TAM leaves suit-text out of the manifests it sends", "[tam]")
+{
+    uint8_t digest[TEEP_SHA256_SIZE] = { 0 };
+    std::vector<uint8_t> envelope = ComposeSeveredEnvelope(1401, "http://localhost/severed", 100, digest, 2000);
+    SuitEnvelopeOffsets offsets;
+    std::ostringstream errorMessage;
+    REQUIRE(SuitParseEnvelope({ envelope.data(), envelope.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    teep_uuid_t component_id;
+    REQUIRE(offsets.ComponentId.len == sizeof(component_id));
+    memcpy(&component_id, offsets.ComponentId.ptr, sizeof(component_id));
+    UsefulBufC component_id_buffer = { &component_id, sizeof(component_id) };
+    Manifest::AddManifest(component_id, (const char*)envelope.data(), envelope.size(), true);
+
+    // The severed install sequence is kept and still matches its digest.
+    Manifest* manifest = Manifest::FindManifest(&component_id_buffer);
+    REQUIRE(manifest != nullptr);
+    REQUIRE(manifest->WireContents.len < envelope.size() - 2000);
+    REQUIRE(SuitParseEnvelope(manifest->WireContents, offsets, errorMessage) == TEEP_ERR_SUCCESS);
+    REQUIRE_FALSE(UsefulBuf_IsNULLC(offsets.Install));
+
+    // Envelopes with nothing to leave out are sent as they are.
+    std::vector<uint8_t> plain = ComposeFetchEnvelope(1402, "http://localhost/plain", 100, digest);
+    teep_uuid_t plain_id = { { 0xcf, 0xcf, 0xcf, 0xcf } };
+    UsefulBufC plain_id_buffer = { &plain_id, sizeof(plain_id) };
+    Manifest::AddManifest(plain_id, (const char*)plain.data(), plain.size(), true);
+    manifest = Manifest::FindManifest(&plain_id_buffer);
+    REQUIRE(manifest != nullptr);
+    REQUIRE(manifest->WireContents.ptr == manifest->ManifestContents.ptr);
+    Manifest::ClearManifests();
+}
@@ -0,0 +1,187 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "catch.hpp"
+#include "common.h"
+#include "buffer_pool.h"
+#include "tcp_frame.h"
+
+typedef struct {
+    uint32_t SessionId;
+    std::string Message;
+} ReceivedFrame;
+
+static teep_error_code_t CollectFrame(void* context, uint32_t sessionId, _Inout_ teep_buffer_t* message, size_t messageLength)
+{
+    std::vector<ReceivedFrame>* frames = (std::vector<ReceivedFrame>*)context;
+    REQUIRE(message->data[messageLength] == '\0');
+    frames->push_back({ sessionId, std::string(message->data, messageLength) });
+    teep_buffer_release(message);
+    return TEEP_ERR_SUCCESS;
+}
+
+static void AppendFrame(std::string& stream, uint32_t sessionId, const std::string& message)
+{
+    uint8_t header[TEEP_TCP_FRAME_HEADER_SIZE];
+    teep_frame_encode_header(header, sessionId, message.size());
+    stream.append((const char*)header, sizeof(header));
+    stream.append(message);
+}
+
+// Feed a stream to a reader the way readv() would, at most chunkSize
+// bytes at a time.
+static teep_error_code_t FeedStream(teep_frame_reader_t* reader, const std::string& stream, size_t chunkSize, std::vector<ReceivedFrame>* frames)
+{
+    size_t offset = 0;
+    while (offset < stream.size()) {
+        teep_io_vector_t vectors[2];
+        size_t count = teep_frame_reader_get_vectors(reader, vectors);
+        size_t received = 0;
+        for (size_t i = 0; i < count && received < chunkSize && offset < stream.size(); i++) {
+            size_t piece = vectors[i].length;
+            piece = (piece < chunkSize - received) ? piece : chunkSize - received;
+            piece = (piece < stream.size() - offset) ? piece : stream.size() - offset;
+            memcpy(vectors[i].data, stream.data() + offset, piece);
+            offset += piece;
+            received += piece;
+            if (piece < vectors[i].length) {
+                break;
+            }
+        }
+        teep_error_code_t result = teep_frame_reader_consume(reader, received, CollectFrame, frames);
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+TEST_CASE("TCP frames interleave sessions on one stream", "[tcp]")
+{
+    std::string large(100 * 1024, 'x');
+    std::string stream;
+    AppendFrame(stream, 1, "");
+    AppendFrame(stream, 2, "QueryResponse");
+    AppendFrame(stream, 1, large);
+    AppendFrame(stream, 0xFFFFFFFF, "Update");
+
+    for (size_t chunkSize : { (size_t)1, (size_t)3, (size_t)8, (size_t)1000, stream.size() }) {
+        teep_frame_reader_t reader;
+        teep_frame_reader_init(&reader);
+        std::vector<ReceivedFrame> frames;
+        REQUIRE(FeedStream(&reader, stream, chunkSize, &frames) == TEEP_ERR_SUCCESS);
+        teep_frame_reader_free(&reader);
+
+        REQUIRE(frames.size() == 4);
+        REQUIRE(frames[0].SessionId == 1);
+        REQUIRE(frames[0].Message.empty());
+        REQUIRE(frames[1].SessionId == 2);
+        REQUIRE(frames[1].Message == "QueryResponse");
+        REQUIRE(frames[2].SessionId == 1);
+        REQUIRE(frames[2].Message == large);
+        REQUIRE(frames[3].SessionId == 0xFFFFFFFF);
+        REQUIRE(frames[3].Message == "Update");
+    }
+}
+
+TEST_CASE("TCP frame reader rejects oversize messages", "[tcp]")
+{
+    uint8_t header[TEEP_TCP_FRAME_HEADER_SIZE];
+    teep_frame_encode_header(header, 1, (size_t)TEEP_TCP_MAX_MESSAGE_SIZE + 1);
+    std::string stream((const char*)header, sizeof(header));
+
+    teep_frame_reader_t reader;
+    teep_frame_reader_init(&reader);
+    std::vector<ReceivedFrame> frames;
+    REQUIRE(FeedStream(&reader, stream, stream.size(), &frames) == TEEP_ERR_PERMANENT_ERROR);
+    REQUIRE(frames.empty());
+    teep_frame_reader_free(&reader);
+}
+
+TEST_CASE("Buffer pool reuses released buffers", "[tcp]")
+{
+    teep_buffer_t buffer;
+    REQUIRE(teep_buffer_acquire(100, &buffer) == TEEP_ERR_SUCCESS);
+    REQUIRE(buffer.capacity == 4 * 1024);
+    teep_buffer_release(&buffer);
+    REQUIRE(buffer.data == nullptr);
+
+    // Steady traffic in one size class allocates nothing new.
+    uint64_t allocations = teep_buffer_pool_get_allocations();
+    for (int i = 0; i < 100; i++) {
+        REQUIRE(teep_buffer_acquire(3000, &buffer) == TEEP_ERR_SUCCESS);
+        teep_buffer_release(&buffer);
+    }
+    REQUIRE(teep_buffer_pool_get_allocations() == allocations);
+
+    // Larger sizes go to larger classes, or past them to a buffer of their own.
+    REQUIRE(teep_buffer_acquire(20 * 1024, &buffer) == TEEP_ERR_SUCCESS);
+    REQUIRE(buffer.capacity == 64 * 1024);
+    teep_buffer_release(&buffer);
+    REQUIRE(teep_buffer_acquire(2 * 1024 * 1024, &buffer) == TEEP_ERR_SUCCESS);
+    REQUIRE(buffer.capacity == 2 * 1024 * 1024);
+    teep_buffer_release(&buffer);
+
+    teep_buffer_pool_trim();
+}
+
+// Receive a message into a chain in pieces of at most the given size.
+static void ReceiveIntoChain(teep_buffer_chain_t* chain, const std::string& message, size_t sizeHint, size_t pieceSize)
+{
+    size_t offset = 0;
+    while (offset < message.size()) {
+        char* space;
+        size_t spaceLength;
+        REQUIRE(teep_buffer_chain_reserve(chain, sizeHint, &space, &spaceLength) == TEEP_ERR_SUCCESS);
+        size_t length = std::min(std::min(spaceLength, pieceSize), message.size() - offset);
+        memcpy(space, message.data() + offset, length);
+        teep_buffer_chain_commit(chain, length);
+        offset += length;
+    }
+}
+
+TEST_CASE("Buffer chains grow by size class and flatten to one buffer", "[tcp]")
+{
+    std::string large(100 * 1024 + 3, 'x');
+    for (size_t i = 0; i < large.size(); i++) {
+        large[i] = (char)('a' + i % 26);
+    }
+
+    // A message of unknown size spans a link of each class.
+    teep_buffer_chain_t chain;
+    teep_buffer_chain_init(&chain);
+    ReceiveIntoChain(&chain, large, 0, 5000);
+    REQUIRE(chain.link_count == 4);
+    REQUIRE(chain.links[1].capacity == 16 * 1024);
+    REQUIRE(chain.length == large.size());
+    teep_buffer_t buffer;
+    REQUIRE(teep_buffer_chain_flatten(&chain, &buffer) == TEEP_ERR_SUCCESS);
+    REQUIRE(std::string(buffer.data) == large);
+    REQUIRE(chain.link_count == 0);
+    teep_buffer_release(&buffer);
+
+    // A message whose size is known fits one link, which is handed over.
+    ReceiveIntoChain(&chain, large, large.size() + 1, 5000);
+    REQUIRE(chain.link_count == 1);
+    char* data = chain.links[0].data;
+    REQUIRE(teep_buffer_chain_flatten(&chain, &buffer) == TEEP_ERR_SUCCESS);
+    REQUIRE(buffer.data == data);
+    REQUIRE(std::string(buffer.data) == large);
+    teep_buffer_release(&buffer);
+
+    // Once warm, receiving the same messages again allocates nothing new.
+    uint64_t allocations = teep_buffer_pool_get_allocations();
+    ReceiveIntoChain(&chain, large, 0, 5000);
+    REQUIRE(teep_buffer_chain_flatten(&chain, &buffer) == TEEP_ERR_SUCCESS);
+    teep_buffer_release(&buffer);
+    ReceiveIntoChain(&chain, "", 0, 5000);
+    REQUIRE(teep_buffer_chain_flatten(&chain, &buffer) == TEEP_ERR_SUCCESS);
+    REQUIRE(buffer.data[0] == 0);
+    teep_buffer_release(&buffer);
+    REQUIRE(teep_buffer_pool_get_allocations() == allocations);
+
+    teep_buffer_pool_trim();
+}
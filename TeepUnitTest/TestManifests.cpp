@@ -0,0 +1,685 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <filesystem>
+#include <mutex>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include "qcbor/qcbor_decode.h"
+#include "qcbor/qcbor_encode.h"
+#include "qcbor/UsefulBuf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_sign1_sign.h"
+#include "common.h"
+extern "C" {
+#include "suit_manifest.h"
+};
+#include "AgentKeys.h"
+#include "ManifestTransaction.h"
+#include "SuitParser.h"
+#include "TestManifests.h"
+
+static void MakeSyntheticComponentId(uint32_t index, _Out_writes_(TEEP_UUID_SIZE) uint8_t* componentId)
+{
+    static const uint8_t prefix[] = { 0xbe, 0x7c, 0x4a, 0x11 };
+    memset(componentId, 0, TEEP_UUID_SIZE);
+    memcpy(componentId, prefix, sizeof(prefix));
+    componentId[12] = (uint8_t)(index >> 24);
+    componentId[13] = (uint8_t)(index >> 16);
+    componentId[14] = (uint8_t)(index >> 8);
+    componentId[15] = (uint8_t)index;
+}
+
+// Add an authentication wrapper whose suit-digest is zero until
+// SetSyntheticManifestDigest fills it in.
+static void AddSyntheticAuthenticationWrapper(_Inout_ QCBOREncodeContext* context)
+{
+    uint8_t digest[32] = { 0 };
+    UsefulBufC wrapped;
+    QCBOREncode_BstrWrapInMapN(context, SUIT_ENVELOPE_LABEL_AUTHENTICATION_WRAPPER);
+    QCBOREncode_OpenArray(context);
+    {
+        QCBOREncode_BstrWrap(context);
+        QCBOREncode_OpenArray(context);
+        QCBOREncode_AddInt64(context, SUIT_DIGEST_ALGORITHM_SHA256);
+        QCBOREncode_AddBytes(context, UsefulBufC{ digest, sizeof(digest) });
+        QCBOREncode_CloseArray(context);
+        QCBOREncode_CloseBstrWrap2(context, false, &wrapped);
+    }
+    QCBOREncode_CloseArray(context);
+    QCBOREncode_CloseBstrWrap2(context, false, &wrapped);
+}
+
+// Fill in the suit-digest of an encoded envelope, now that suit-manifest
+// is known.
+static void SetSyntheticManifestDigest(_Inout_ std::vector<uint8_t>& envelope)
+{
+    SuitEnvelopeOffsets offsets;
+    std::ostringstream errorMessage;
+    uint8_t digest[TEEP_SHA256_SIZE];
+    if (SuitParseEnvelope({ envelope.data(), envelope.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS &&
+        offsets.DigestBytes.len == sizeof(digest) &&
+        SuitComputeManifestDigest(offsets, digest) == TEEP_ERR_SUCCESS) {
+        memcpy((uint8_t*)offsets.DigestBytes.ptr, digest, sizeof(digest));
+    }
+}
+
+// Add suit-components, listing the synthetic components with the given
+// indices after the one being installed, along with suit-dependencies
+// naming each of them.
+static void AddSyntheticComponents(
+    _Inout_ QCBOREncodeContext* context,
+    _In_reads_(TEEP_UUID_SIZE) const uint8_t* componentId,
+    const std::vector<uint32_t>& dependencies = std::vector<uint32_t>())
+{
+    std::vector<uint8_t> dependencyIds(dependencies.size() * TEEP_UUID_SIZE);
+    if (!dependencies.empty()) {
+        QCBOREncode_OpenMapInMapN(context, SUIT_COMMON_LABEL_DEPENDENCIES);
+        for (size_t i = 0; i < dependencies.size(); i++) {
+            MakeSyntheticComponentId(dependencies[i], dependencyIds.data() + i * TEEP_UUID_SIZE);
+            QCBOREncode_OpenMapInMapN(context, (int64_t)(i + 1));
+            QCBOREncode_CloseMap(context);
+        }
+        QCBOREncode_CloseMap(context);
+    }
+    QCBOREncode_OpenArrayInMapN(context, SUIT_COMMON_LABEL_COMPONENTS);
+    QCBOREncode_OpenArray(context);
+    QCBOREncode_AddBytes(context, UsefulBufC{ componentId, TEEP_UUID_SIZE });
+    QCBOREncode_CloseArray(context);
+    for (size_t i = 0; i < dependencies.size(); i++) {
+        QCBOREncode_OpenArray(context);
+        QCBOREncode_AddBytes(context, UsefulBufC{ dependencyIds.data() + i * TEEP_UUID_SIZE, TEEP_UUID_SIZE });
+        QCBOREncode_CloseArray(context);
+    }
+    QCBOREncode_CloseArray(context);
+}
+
+// Compose a minimal SUIT_Envelope for a component whose 16-byte ID is
+// derived from the index, with a payload of the given size embedded in
+// the manifest so that parsing cost scales with it.
+std::vector<uint8_t> ComposeSyntheticEnvelope(uint32_t index, size_t payloadSize)
+{
+    return ComposeDependentEnvelope(index, payloadSize, std::vector<uint32_t>());
+}
+
+std::vector<uint8_t> ComposeDependentEnvelope(uint32_t index, size_t payloadSize, const std::vector<uint32_t>& dependencies)
+{
+    uint8_t componentId[TEEP_UUID_SIZE];
+    MakeSyntheticComponentId(index, componentId);
+    std::vector<uint8_t> payload(payloadSize, (uint8_t)index);
+
+    std::vector<uint8_t> buffer(payloadSize + 512 + dependencies.size() * 32);
+    QCBOREncodeContext context;
+    QCBOREncode_Init(&context, UsefulBuf{ buffer.data(), buffer.size() });
+    QCBOREncode_OpenMap(&context);
+    {
+        UsefulBufC wrapped;
+        AddSyntheticAuthenticationWrapper(&context);
+
+        QCBOREncode_BstrWrapInMapN(&context, SUIT_ENVELOPE_LABEL_MANIFEST);
+        QCBOREncode_OpenMap(&context);
+        {
+            QCBOREncode_AddInt64ToMapN(&context, SUIT_MANIFEST_LABEL_VERSION, 1);
+            QCBOREncode_AddInt64ToMapN(&context, SUIT_MANIFEST_LABEL_SEQUENCE_NUMBER, 1);
+            QCBOREncode_BstrWrapInMapN(&context, SUIT_MANIFEST_LABEL_COMMON);
+            QCBOREncode_OpenMap(&context);
+            AddSyntheticComponents(&context, componentId, dependencies);
+            QCBOREncode_CloseMap(&context);
+            QCBOREncode_CloseBstrWrap2(&context, false, &wrapped);
+            QCBOREncode_AddBytesToMapN(&context, SUIT_MANIFEST_LABEL_INVOKE, UsefulBufC{ payload.data(), payload.size() });
+        }
+        QCBOREncode_CloseMap(&context);
+        QCBOREncode_CloseBstrWrap2(&context, false, &wrapped);
+    }
+    QCBOREncode_CloseMap(&context);
+
+    UsefulBufC encoded;
+    if (QCBOREncode_Finish(&context, &encoded) != QCBOR_SUCCESS) {
+        return std::vector<uint8_t>();
+    }
+    buffer.resize(encoded.len);
+    SetSyntheticManifestDigest(buffer);
+    return buffer;
+}
+
+static void AddSyntheticDigest(_Inout_ QCBOREncodeContext* context, _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest)
+{
+    UsefulBufC wrapped;
+    QCBOREncode_BstrWrap(context);
+    QCBOREncode_OpenArray(context);
+    QCBOREncode_AddInt64(context, SUIT_DIGEST_ALGORITHM_SHA256);
+    QCBOREncode_AddBytes(context, UsefulBufC{ digest, TEEP_SHA256_SIZE });
+    QCBOREncode_CloseArray(context);
+    QCBOREncode_CloseBstrWrap2(context, false, &wrapped);
+}
+
+// Encode a command sequence that fetches component 0 from a URI and
+// checks that it matches.
+static std::vector<uint8_t> EncodeFetchSequence(const std::string& uri)
+{
+    std::vector<uint8_t> buffer(uri.size() + 64);
+    QCBOREncodeContext context;
+    QCBOREncode_Init(&context, UsefulBuf{ buffer.data(), buffer.size() });
+    QCBOREncode_OpenArray(&context);
+    QCBOREncode_AddInt64(&context, SUIT_DIRECTIVE_SET_COMPONENT_INDEX);
+    QCBOREncode_AddInt64(&context, 0);
+    QCBOREncode_AddInt64(&context, SUIT_DIRECTIVE_OVERRIDE_PARAMETERS);
+    QCBOREncode_OpenMap(&context);
+    QCBOREncode_AddSZStringToMapN(&context, SUIT_PARAMETER_URI, uri.c_str());
+    QCBOREncode_CloseMap(&context);
+    QCBOREncode_AddInt64(&context, SUIT_DIRECTIVE_FETCH);
+    QCBOREncode_AddInt64(&context, 2);
+    QCBOREncode_AddInt64(&context, SUIT_CONDITION_IMAGE_MATCH);
+    QCBOREncode_AddInt64(&context, 15);
+    QCBOREncode_CloseArray(&context);
+    UsefulBufC encoded;
+    if (QCBOREncode_Finish(&context, &encoded) != QCBOR_SUCCESS) {
+        return std::vector<uint8_t>();
+    }
+    buffer.resize(encoded.len);
+    return buffer;
+}
+
+// Add the SUIT_Digest of a severed member, which covers its bstr head.
+static void AddSeveredMemberDigest(_Inout_ QCBOREncodeContext* context, int64_t label, const std::vector<uint8_t>& member)
+{
+    std::vector<uint8_t> buffer(member.size() + 16);
+    QCBOREncodeContext wrapper;
+    QCBOREncode_Init(&wrapper, UsefulBuf{ buffer.data(), buffer.size() });
+    QCBOREncode_AddBytes(&wrapper, UsefulBufC{ member.data(), member.size() });
+    UsefulBufC wrapped;
+    QCBOREncode_Finish(&wrapper, &wrapped);
+    uint8_t digest[TEEP_SHA256_SIZE];
+    teep_compute_sha256(wrapped, digest);
+
+    QCBOREncode_OpenArrayInMapN(context, label);
+    QCBOREncode_AddInt64(context, SUIT_DIGEST_ALGORITHM_SHA256);
+    QCBOREncode_AddBytes(context, UsefulBufC{ digest, sizeof(digest) });
+    QCBOREncode_CloseArray(context);
+}
+
+// Compose a SUIT_Envelope whose install sequence fetches a payload from
+// a URI and checks it against the given size and SHA-256 digest.  The
+// install sequence and a suit-text of textSize bytes can be severed.
+static std::vector<uint8_t> ComposeEnvelope(
+    uint32_t index,
+    uint64_t sequenceNumber,
+    const std::string& uri,
+    uint64_t imageSize,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    uint64_t chunkSize,
+    _In_reads_opt_(TEEP_SHA256_SIZE) const uint8_t* chunkTreeRoot,
+    _In_reads_opt_(TEEP_SHA256_SIZE) const uint8_t* deltaBaseDigest,
+    const std::string& deltaUri,
+    bool severInstall,
+    size_t textSize)
+{
+    uint8_t componentId[TEEP_UUID_SIZE];
+    MakeSyntheticComponentId(index, componentId);
+    std::vector<uint8_t> install = EncodeFetchSequence(uri);
+    std::vector<uint8_t> text(textSize, 'T');
+
+    std::vector<uint8_t> buffer(2 * uri.size() + deltaUri.size() + textSize + 512);
+    QCBOREncodeContext context;
+    QCBOREncode_Init(&context, UsefulBuf{ buffer.data(), buffer.size() });
+    QCBOREncode_OpenMap(&context);
+    {
+        UsefulBufC wrapped;
+        AddSyntheticAuthenticationWrapper(&context);
+
+        QCBOREncode_BstrWrapInMapN(&context, SUIT_ENVELOPE_LABEL_MANIFEST);
+        QCBOREncode_OpenMap(&context);
+        {
+            QCBOREncode_AddInt64ToMapN(&context, SUIT_MANIFEST_LABEL_VERSION, 1);
+            QCBOREncode_AddUInt64ToMapN(&context, SUIT_MANIFEST_LABEL_SEQUENCE_NUMBER, sequenceNumber);
+            QCBOREncode_BstrWrapInMapN(&context, SUIT_MANIFEST_LABEL_COMMON);
+            QCBOREncode_OpenMap(&context);
+            {
+                AddSyntheticComponents(&context, componentId);
+
+                // Set the image digest and size of component 0.
+                QCBOREncode_BstrWrapInMapN(&context, SUIT_COMMON_LABEL_SEQUENCE);
+                QCBOREncode_OpenArray(&context);
+                QCBOREncode_AddInt64(&context, SUIT_DIRECTIVE_SET_COMPONENT_INDEX);
+                QCBOREncode_AddInt64(&context, 0);
+                QCBOREncode_AddInt64(&context, SUIT_DIRECTIVE_OVERRIDE_PARAMETERS);
+                QCBOREncode_OpenMap(&context);
+                QCBOREncode_BstrWrapInMapN(&context, SUIT_PARAMETER_IMAGE_DIGEST);
+                QCBOREncode_OpenArray(&context);
+                QCBOREncode_AddInt64(&context, SUIT_DIGEST_ALGORITHM_SHA256);
+                QCBOREncode_AddBytes(&context, UsefulBufC{ digest, TEEP_SHA256_SIZE });
+                QCBOREncode_CloseArray(&context);
+                QCBOREncode_CloseBstrWrap2(&context, false, &wrapped);
+                QCBOREncode_AddUInt64ToMapN(&context, SUIT_PARAMETER_IMAGE_SIZE, imageSize);
+                if (chunkTreeRoot != nullptr) {
+                    QCBOREncode_BstrWrapInMapN(&context, SUIT_PARAMETER_CHUNK_TREE);
+                    QCBOREncode_OpenArray(&context);
+                    QCBOREncode_AddUInt64(&context, chunkSize);
+                    QCBOREncode_AddBytes(&context, UsefulBufC{ chunkTreeRoot, TEEP_SHA256_SIZE });
+                    QCBOREncode_CloseArray(&context);
+                    QCBOREncode_CloseBstrWrap2(&context, false, &wrapped);
+                }
+                if (deltaBaseDigest != nullptr) {
+                    QCBOREncode_BstrWrapInMapN(&context, SUIT_PARAMETER_DELTA);
+                    QCBOREncode_OpenArray(&context);
+                    AddSyntheticDigest(&context, deltaBaseDigest);
+                    QCBOREncode_AddSZString(&context, deltaUri.c_str());
+                    QCBOREncode_CloseArray(&context);
+                    QCBOREncode_CloseBstrWrap2(&context, false, &wrapped);
+                }
+                QCBOREncode_CloseMap(&context);
+                QCBOREncode_CloseArray(&context);
+                QCBOREncode_CloseBstrWrap2(&context, false, &wrapped);
+            }
+            QCBOREncode_CloseMap(&context);
+            QCBOREncode_CloseBstrWrap2(&context, false, &wrapped);
+
+            if (severInstall) {
+                AddSeveredMemberDigest(&context, SUIT_MANIFEST_LABEL_INSTALL, install);
+            } else {
+                QCBOREncode_AddBytesToMapN(&context, SUIT_MANIFEST_LABEL_INSTALL, UsefulBufC{ install.data(), install.size() });
+            }
+            if (textSize > 0) {
+                AddSeveredMemberDigest(&context, SUIT_MANIFEST_LABEL_TEXT, text);
+            }
+        }
+        QCBOREncode_CloseMap(&context);
+        QCBOREncode_CloseBstrWrap2(&context, false, &wrapped);
+
+        if (severInstall) {
+            QCBOREncode_AddBytesToMapN(&context, SUIT_ENVELOPE_LABEL_INSTALL, UsefulBufC{ install.data(), install.size() });
+        }
+        if (textSize > 0) {
+            QCBOREncode_AddBytesToMapN(&context, SUIT_ENVELOPE_LABEL_TEXT, UsefulBufC{ text.data(), text.size() });
+        }
+    }
+    QCBOREncode_CloseMap(&context);
+
+    UsefulBufC encoded;
+    if (QCBOREncode_Finish(&context, &encoded) != QCBOR_SUCCESS) {
+        return std::vector<uint8_t>();
+    }
+    buffer.resize(encoded.len);
+    SetSyntheticManifestDigest(buffer);
+    return buffer;
+}
+
+std::vector<uint8_t> ComposeFetchEnvelope(
+    uint32_t index,
+    const std::string& uri,
+    uint64_t imageSize,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    uint64_t chunkSize,
+    _In_reads_opt_(TEEP_SHA256_SIZE) const uint8_t* chunkTreeRoot)
+{
+    return ComposeEnvelope(index, 1, uri, imageSize, digest, chunkSize, chunkTreeRoot, nullptr, std::string(), false, 0);
+}
+
+std::vector<uint8_t> ComposeUpgradeEnvelope(
+    uint32_t index,
+    uint64_t sequenceNumber,
+    const std::string& uri,
+    uint64_t imageSize,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    _In_reads_opt_(TEEP_SHA256_SIZE) const uint8_t* deltaBaseDigest,
+    const std::string& deltaUri)
+{
+    return ComposeEnvelope(index, sequenceNumber, uri, imageSize, digest, 0, nullptr, deltaBaseDigest, deltaUri, false, 0);
+}
+
+std::vector<uint8_t> ComposeSeveredEnvelope(
+    uint32_t index,
+    const std::string& uri,
+    uint64_t imageSize,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    size_t textSize)
+{
+    return ComposeEnvelope(index, 1, uri, imageSize, digest, 0, nullptr, nullptr, std::string(), true, textSize);
+}
+
+std::vector<uint8_t> SignTestEnvelope(const std::vector<uint8_t>& envelope, _In_ const struct t_cose_key* signer)
+{
+    SuitEnvelopeOffsets offsets;
+    std::ostringstream errorMessage;
+    if (SuitParseEnvelope({ envelope.data(), envelope.size() }, offsets, errorMessage) != TEEP_ERR_SUCCESS) {
+        return std::vector<uint8_t>();
+    }
+
+    // The signature covers the SUIT_Digest, which is not carried in the
+    // COSE_Sign1 itself.
+    struct t_cose_sign1_sign_ctx signContext;
+    t_cose_sign1_sign_init(&signContext, 0, T_COSE_ALGORITHM_ES256);
+    t_cose_sign1_set_signing_key(&signContext, *signer, NULLUsefulBufC);
+    std::vector<uint8_t> signature(512);
+    UsefulBufC block;
+    if (t_cose_sign1_sign_detached(&signContext, NULLUsefulBufC, offsets.Digest,
+            UsefulBuf{ signature.data(), signature.size() }, &block) != T_COSE_SUCCESS) {
+        return std::vector<uint8_t>();
+    }
+
+    // Copy every member but the authentication wrapper, which gains the
+    // block.
+    QCBORDecodeContext decoder;
+    QCBORDecode_Init(&decoder, UsefulBufC{ envelope.data(), envelope.size() }, QCBOR_DECODE_MODE_NORMAL);
+    QCBORItem item;
+    QCBORDecode_GetNext(&decoder, &item);
+    uint16_t entryCount = item.val.uCount;
+
+    std::vector<uint8_t> buffer(envelope.size() + block.len + 64);
+    QCBOREncodeContext context;
+    QCBOREncode_Init(&context, UsefulBuf{ buffer.data(), buffer.size() });
+    QCBOREncode_OpenMap(&context);
+    for (uint16_t i = 0; i < entryCount; i++) {
+        QCBORDecode_GetNext(&decoder, &item);
+        if (item.label.int64 != SUIT_ENVELOPE_LABEL_AUTHENTICATION_WRAPPER) {
+            QCBOREncode_AddBytesToMapN(&context, item.label.int64, item.val.string);
+            continue;
+        }
+        UsefulBufC wrapped;
+        QCBOREncode_BstrWrapInMapN(&context, SUIT_ENVELOPE_LABEL_AUTHENTICATION_WRAPPER);
+        QCBOREncode_OpenArray(&context);
+        QCBOREncode_AddBytes(&context, offsets.Digest);
+        QCBOREncode_AddBytes(&context, block);
+        QCBOREncode_CloseArray(&context);
+        QCBOREncode_CloseBstrWrap2(&context, false, &wrapped);
+    }
+    QCBOREncode_CloseMap(&context);
+
+    UsefulBufC encoded;
+    if (QCBOREncode_Finish(&context, &encoded) != QCBOR_SUCCESS) {
+        return std::vector<uint8_t>();
+    }
+    buffer.resize(encoded.len);
+    return buffer;
+}
+
+#define TEST_SIGNER_DIRECTORY "test-signer"
+
+static const struct t_cose_key* GetTestSigner()
+{
+    static struct t_cose_key signer;
+    static bool loaded = false;
+    if (!loaded) {
+        std::filesystem::create_directories(TEST_SIGNER_DIRECTORY "/trusted");
+        loaded = (teep_load_signing_key_pair(&signer, TEST_SIGNER_DIRECTORY "/signer-private-key-pair.pem",
+            TEST_SIGNER_DIRECTORY "/trusted/signer-es256-public-key.pem", TEEP_SIGNATURE_ES256) == TEEP_ERR_SUCCESS);
+    }
+    return loaded ? &signer : nullptr;
+}
+
+std::vector<uint8_t> SignWithTestSigner(const std::vector<uint8_t>& envelope)
+{
+    const struct t_cose_key* signer = GetTestSigner();
+    if (signer == nullptr) {
+        return std::vector<uint8_t>();
+    }
+    return SignTestEnvelope(envelope, signer);
+}
+
+teep_error_code_t TrustTestSigner()
+{
+    if (GetTestSigner() == nullptr) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    return TeepAgentConfigureTamKeys(TEST_SIGNER_DIRECTORY "/trusted");
+}
+
+// Test payloads stand in for files on an HTTP server.  Their contents
+// are generated from the URI, "http://localhost/<seed>/<size>", so a
+// payload of any size can be served without being held in memory.  A URI
+// ending in "/<chunk size>" also has its chunk tree leaves served at
+// "<uri>.chunks".  Payloads with given contents are registered and served
+// at "http://localhost/registered/<n>".
+static std::vector<std::vector<uint8_t>> g_RegisteredPayloads;
+static size_t g_LargestFetchRequest = 0;
+static uint64_t g_FetchErrorOffset = UINT64_MAX;
+static uint64_t g_FetchCorruptionOffset = UINT64_MAX;
+static uint64_t g_FetchedPayloadBytes = 0;
+static uint64_t g_FirstFetchOffset = UINT64_MAX;
+static std::mutex g_FetchLock; // Manifests may be processed on several threads.
+
+static bool ParseTestPayloadUri(_In_z_ const char* uri, _Out_ uint32_t* seed, _Out_ uint64_t* size, _Out_ uint64_t* chunkSize, _Out_ bool* isLeaves)
+{
+    unsigned long long parsedSize;
+    unsigned long long parsedChunkSize = 0;
+    int consumed = 0;
+    int fields = sscanf(uri, "http://localhost/%u/%llu%n/%llu%n", seed, &parsedSize, &consumed, &parsedChunkSize, &consumed);
+    if (fields < 2) {
+        return false;
+    }
+    *size = parsedSize;
+    *chunkSize = (fields == 3) ? parsedChunkSize : 0;
+    *isLeaves = (strcmp(uri + consumed, ".chunks") == 0);
+    return (uri[consumed] == 0) || (*isLeaves && *chunkSize != 0);
+}
+
+static uint8_t GetTestPayloadByte(uint32_t seed, uint64_t offset)
+{
+    uint64_t value = (offset + seed) * 0x9e3779b97f4a7c15ull;
+    return (uint8_t)(value >> 56);
+}
+
+static void ComputeTestChunkLeaf(uint32_t seed, uint64_t size, uint64_t chunkSize, uint64_t chunkIndex, _Out_writes_(TEEP_SHA256_SIZE) uint8_t* leaf)
+{
+    uint64_t offset = chunkIndex * chunkSize;
+    std::vector<uint8_t> chunk(1 + (size_t)std::min(chunkSize, size - offset));
+    chunk[0] = 0; // Leaf prefix.
+    for (size_t i = 1; i < chunk.size(); i++) {
+        chunk[i] = GetTestPayloadByte(seed, offset + i - 1);
+    }
+    teep_compute_sha256(UsefulBufC{ chunk.data(), chunk.size() }, leaf);
+}
+
+std::vector<uint8_t> GenerateTestPayload(uint32_t seed, size_t size)
+{
+    std::vector<uint8_t> payload(size);
+    for (size_t i = 0; i < size; i++) {
+        payload[i] = GetTestPayloadByte(seed, i);
+    }
+    return payload;
+}
+
+std::vector<uint8_t> MakeTestUpgrade(const std::vector<uint8_t>& base, size_t editCount)
+{
+    // Spread the edits evenly, cycling through a patched byte, an
+    // inserted run, and a deleted run, as a rebuilt image might have.
+    std::vector<uint8_t> target = base;
+    for (size_t edit = editCount; edit > 0; edit--) {
+        size_t offset = (size_t)((uint64_t)target.size() * edit / (editCount + 1));
+        switch (edit % 3) {
+        case 0:
+            target[offset] ^= 0x5a;
+            break;
+        case 1:
+            target.insert(target.begin() + offset, 40, (uint8_t)edit);
+            break;
+        case 2:
+            target.erase(target.begin() + offset, target.begin() + std::min(target.size(), offset + 24));
+            break;
+        }
+    }
+    return target;
+}
+
+std::string RegisterTestPayload(const std::vector<uint8_t>& contents)
+{
+    g_RegisteredPayloads.push_back(contents);
+    return "http://localhost/registered/" + std::to_string(g_RegisteredPayloads.size() - 1);
+}
+
+std::string MakeTestPayloadUri(uint32_t seed, uint64_t size, uint64_t chunkSize)
+{
+    std::string uri = "http://localhost/" + std::to_string(seed) + "/" + std::to_string(size);
+    if (chunkSize != 0) {
+        uri += "/" + std::to_string(chunkSize);
+    }
+    return uri;
+}
+
+void ComputeTestPayloadDigest(uint32_t seed, uint64_t size, _Out_writes_(TEEP_SHA256_SIZE) uint8_t* digest)
+{
+    teep_sha256_ctx_t ctx;
+    teep_sha256_init(&ctx);
+    std::vector<uint8_t> chunk(64 * 1024);
+    for (uint64_t offset = 0; offset < size; offset += chunk.size()) {
+        size_t length = (size_t)std::min<uint64_t>(chunk.size(), size - offset);
+        for (size_t i = 0; i < length; i++) {
+            chunk[i] = GetTestPayloadByte(seed, offset + i);
+        }
+        teep_sha256_update(&ctx, UsefulBufC{ chunk.data(), length });
+    }
+    teep_sha256_final(&ctx, digest);
+    teep_sha256_free(&ctx);
+}
+
+void ComputeTestChunkTreeRoot(uint32_t seed, uint64_t size, uint64_t chunkSize, _Out_writes_(TEEP_SHA256_SIZE) uint8_t* root)
+{
+    // Combine pairs level by level, carrying an odd node up unchanged,
+    // which gives the same tree as splitting at the largest power of two.
+    std::vector<std::vector<uint8_t>> level;
+    for (uint64_t chunkIndex = 0; chunkIndex * chunkSize < size; chunkIndex++) {
+        std::vector<uint8_t> leaf(TEEP_SHA256_SIZE);
+        ComputeTestChunkLeaf(seed, size, chunkSize, chunkIndex, leaf.data());
+        level.push_back(leaf);
+    }
+    while (level.size() > 1) {
+        std::vector<std::vector<uint8_t>> parents;
+        for (size_t i = 0; i < level.size(); i += 2) {
+            if (i + 1 == level.size()) {
+                parents.push_back(level[i]);
+                continue;
+            }
+            std::vector<uint8_t> node(1, 1); // Node prefix.
+            node.insert(node.end(), level[i].begin(), level[i].end());
+            node.insert(node.end(), level[i + 1].begin(), level[i + 1].end());
+            std::vector<uint8_t> parent(TEEP_SHA256_SIZE);
+            teep_compute_sha256(UsefulBufC{ node.data(), node.size() }, parent.data());
+            parents.push_back(parent);
+        }
+        level = parents;
+    }
+    memcpy(root, level[0].data(), TEEP_SHA256_SIZE);
+}
+
+teep_error_code_t TestPayloadFetcher(
+    _In_z_ const char* uri,
+    uint64_t offset,
+    _Out_writes_bytes_to_(bufferSize, *bytesRead) uint8_t* buffer,
+    size_t bufferSize,
+    _Out_ size_t* bytesRead)
+{
+    std::lock_guard<std::mutex> lock(g_FetchLock);
+    *bytesRead = 0;
+    uint32_t seed;
+    uint64_t size;
+    uint64_t chunkSize;
+    bool isLeaves;
+    const std::vector<uint8_t>* registered = nullptr;
+    unsigned int registeredIndex;
+    int consumed = 0;
+    if (sscanf(uri, "http://localhost/registered/%u%n", &registeredIndex, &consumed) == 1 && uri[consumed] == 0) {
+        if (registeredIndex >= g_RegisteredPayloads.size()) {
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+        registered = &g_RegisteredPayloads[registeredIndex];
+        seed = 0;
+        size = registered->size();
+        chunkSize = 0;
+        isLeaves = false;
+    } else if (!ParseTestPayloadUri(uri, &seed, &size, &chunkSize, &isLeaves)) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    g_LargestFetchRequest = std::max(g_LargestFetchRequest, bufferSize);
+
+    if (isLeaves) {
+        uint64_t leavesSize = ((size + chunkSize - 1) / chunkSize) * TEEP_SHA256_SIZE;
+        size_t length = (offset < leavesSize) ? (size_t)std::min<uint64_t>(bufferSize, leavesSize - offset) : 0;
+        for (size_t i = 0; i < length;) {
+            uint64_t chunkIndex = (offset + i) / TEEP_SHA256_SIZE;
+            size_t leafOffset = (size_t)((offset + i) % TEEP_SHA256_SIZE);
+            uint8_t leaf[TEEP_SHA256_SIZE];
+            ComputeTestChunkLeaf(seed, size, chunkSize, chunkIndex, leaf);
+            size_t copyLength = std::min(length - i, TEEP_SHA256_SIZE - leafOffset);
+            memcpy(buffer + i, leaf + leafOffset, copyLength);
+            i += copyLength;
+        }
+        *bytesRead = length;
+        return TEEP_ERR_SUCCESS;
+    }
+
+    if (offset >= size) {
+        return TEEP_ERR_SUCCESS;
+    }
+    size_t length = (size_t)std::min<uint64_t>(bufferSize, size - offset);
+
+    // Cut the transfer off at a scheduled error.
+    if (offset + length > g_FetchErrorOffset) {
+        if (offset >= g_FetchErrorOffset) {
+            g_FetchErrorOffset = UINT64_MAX;
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+        length = (size_t)(g_FetchErrorOffset - offset);
+    }
+
+    if (registered != nullptr) {
+        memcpy(buffer, registered->data() + offset, length);
+    } else {
+        for (size_t i = 0; i < length; i++) {
+            buffer[i] = GetTestPayloadByte(seed, offset + i);
+        }
+    }
+    if (g_FetchCorruptionOffset >= offset && g_FetchCorruptionOffset < offset + length) {
+        buffer[g_FetchCorruptionOffset - offset] ^= 1;
+        g_FetchCorruptionOffset = UINT64_MAX;
+    }
+    g_FetchedPayloadBytes += length;
+    g_FirstFetchOffset = std::min(g_FirstFetchOffset, offset);
+    *bytesRead = length;
+    return TEEP_ERR_SUCCESS;
+}
+
+size_t GetLargestFetchRequest()
+{
+    return g_LargestFetchRequest;
+}
+
+void ScheduleFetchError(uint64_t offset)
+{
+    g_FetchErrorOffset = offset;
+}
+
+void ScheduleFetchCorruption(uint64_t offset)
+{
+    g_FetchCorruptionOffset = offset;
+}
+
+void ResetFetchStatistics()
+{
+    g_FetchedPayloadBytes = 0;
+    g_FirstFetchOffset = UINT64_MAX;
+}
+
+uint64_t GetFetchedPayloadBytes()
+{
+    return g_FetchedPayloadBytes;
+}
+
+uint64_t GetFirstFetchOffset()
+{
+    return g_FirstFetchOffset;
+}
+
+void UninstallSyntheticEnvelopes(const std::vector<std::vector<uint8_t>>& envelopes)
+{
+    ManifestTransaction transaction;
+    for (const std::vector<uint8_t>& envelope : envelopes) {
+        SuitEnvelopeOffsets offsets;
+        std::ostringstream errorMessage;
+        if (SuitParseEnvelope(UsefulBufC{ envelope.data(), envelope.size() }, offsets, errorMessage) == TEEP_ERR_SUCCESS) {
+            SuitUninstallComponent(offsets.ComponentId, transaction);
+        }
+    }
+    std::ostringstream errorMessage;
+    transaction.Commit(errorMessage);
+}
@@ -0,0 +1,80 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "common.h"
+
+std::vector<uint8_t> ComposeSyntheticEnvelope(uint32_t index, size_t payloadSize);
+// Compose a synthetic envelope whose manifest depends on the synthetic
+// components with the given indices.
+std::vector<uint8_t> ComposeDependentEnvelope(uint32_t index, size_t payloadSize, const std::vector<uint32_t>& dependencies);
+std::vector<uint8_t> ComposeFetchEnvelope(
+    uint32_t index,
+    const std::string& uri,
+    uint64_t imageSize,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    uint64_t chunkSize = 0,
+    _In_reads_opt_(TEEP_SHA256_SIZE) const uint8_t* chunkTreeRoot = nullptr);
+// Compose an envelope that upgrades a component to the given sequence
+// number.  With a base digest, the image is built from that base and the
+// delta at deltaUri if the base is installed.
+std::vector<uint8_t> ComposeUpgradeEnvelope(
+    uint32_t index,
+    uint64_t sequenceNumber,
+    const std::string& uri,
+    uint64_t imageSize,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    _In_reads_opt_(TEEP_SHA256_SIZE) const uint8_t* deltaBaseDigest = nullptr,
+    const std::string& deltaUri = std::string());
+// Compose an envelope like ComposeFetchEnvelope whose install sequence is
+// severed into the envelope, along with a suit-text of textSize bytes.
+std::vector<uint8_t> ComposeSeveredEnvelope(
+    uint32_t index,
+    const std::string& uri,
+    uint64_t imageSize,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    size_t textSize);
+// Add a COSE_Sign1 authentication block to an envelope, signed with an
+// ES256 key.
+std::vector<uint8_t> SignTestEnvelope(const std::vector<uint8_t>& envelope, _In_ const struct t_cose_key* signer);
+// The agent only installs signed envelopes.  Sign one with a key made for
+// the tests, which TrustTestSigner has the agent trust in place of the
+// TAM's keys until they are next loaded.
+std::vector<uint8_t> SignWithTestSigner(const std::vector<uint8_t>& envelope);
+teep_error_code_t TrustTestSigner();
+void UninstallSyntheticEnvelopes(const std::vector<std::vector<uint8_t>>& envelopes);
+
+// Payloads with arbitrary contents, served at the returned URI.
+std::vector<uint8_t> GenerateTestPayload(uint32_t seed, size_t size);
+std::string RegisterTestPayload(const std::vector<uint8_t>& contents);
+
+// Make a new version of a payload with a few small changes scattered
+// through it.
+std::vector<uint8_t> MakeTestUpgrade(const std::vector<uint8_t>& base, size_t editCount);
+
+// Generated payloads served by TestPayloadFetcher in place of an HTTP server.
+// A non-zero chunkSize also serves the leaves of the payload's chunk
+// tree at "<uri>.chunks".
+std::string MakeTestPayloadUri(uint32_t seed, uint64_t size, uint64_t chunkSize = 0);
+void ComputeTestPayloadDigest(uint32_t seed, uint64_t size, _Out_writes_(TEEP_SHA256_SIZE) uint8_t* digest);
+void ComputeTestChunkTreeRoot(uint32_t seed, uint64_t size, uint64_t chunkSize, _Out_writes_(TEEP_SHA256_SIZE) uint8_t* root);
+teep_error_code_t TestPayloadFetcher(
+    _In_z_ const char* uri,
+    uint64_t offset,
+    _Out_writes_bytes_to_(bufferSize, *bytesRead) uint8_t* buffer,
+    size_t bufferSize,
+    _Out_ size_t* bytesRead);
+size_t GetLargestFetchRequest();
+
+// Faults injected into the next payload fetch that reaches the given
+// offset: either the transfer fails there, or the byte there is flipped.
+void ScheduleFetchError(uint64_t offset);
+void ScheduleFetchCorruption(uint64_t offset);
+
+// Payload bytes served, and the lowest offset asked for, since the last
+// reset.  Requests for chunk tree leaves are not counted.
+void ResetFetchStatistics();
+uint64_t GetFetchedPayloadBytes();
+uint64_t GetFirstFetchOffset();
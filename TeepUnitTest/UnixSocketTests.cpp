@@ -0,0 +1,112 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef __linux__
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "catch.hpp"
+#include "LoopbackTam.h"
+#include "UnixForwarder.h"
+#include "UnixServer.h"
+#include "unix_frame.h"
+
+#define TEST_UNIX_SOCKET_PATH "/tmp/teep-unit-test.sock"
+
+static std::string MakeLargeMessage(size_t size)
+{
+    std::string large(size, 'x');
+    for (size_t i = 0; i < large.size(); i++) {
+        large[i] = (char)('a' + i % 26);
+    }
+    return large;
+}
+
+TEST_CASE("Unix socket records carry large messages in a region passed once", "[unix]")
+{
+    int pair[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) == 0);
+    teep_unix_channel_t sender;
+    teep_unix_channel_t receiver;
+    teep_unix_channel_init(&sender, pair[0]);
+    teep_unix_channel_init(&receiver, pair[1]);
+
+    std::string large = MakeLargeMessage(TEEP_UNIX_MAX_INLINE_MESSAGE_SIZE + 1);
+    std::string larger = MakeLargeMessage(2 * 1024 * 1024);
+    std::vector<const char*> regions;
+    for (const std::string& sent : { std::string(), std::string("QueryResponse"), large, large, larger }) {
+        REQUIRE(teep_unix_send(&sender, 7, "application/teep+cbor", sent.data(), sent.size()) == TEEP_ERR_SUCCESS);
+        teep_unix_message_t message;
+        REQUIRE(teep_unix_receive(&receiver, &message) == TEEP_ERR_SUCCESS);
+        REQUIRE(message.session_id == 7);
+        REQUIRE(std::string(message.media_type) == "application/teep+cbor");
+        REQUIRE(std::string(message.message, message.message_length) == sent);
+        REQUIRE(message.message[message.message_length] == '\0');
+        REQUIRE(message.message == message.buffer.data);
+        regions.push_back(receiver.inbound.data);
+        teep_unix_message_release(&message);
+    }
+
+    // The region was mapped once, and replaced only when outgrown.
+    REQUIRE(regions[1] == nullptr);
+    REQUIRE(regions[2] != nullptr);
+    REQUIRE(regions[2] == regions[3]);
+    REQUIRE(receiver.inbound.capacity >= larger.size());
+
+    // A message composed in the region is sent from there.
+    char* space;
+    REQUIRE(teep_unix_reserve(&sender, large.size(), &space) == TEEP_ERR_SUCCESS);
+    memcpy(space, large.data(), large.size());
+    REQUIRE(teep_unix_send(&sender, 8, "application/teep+cbor", space, large.size()) == TEEP_ERR_SUCCESS);
+    teep_unix_message_t message;
+    REQUIRE(teep_unix_receive(&receiver, &message) == TEEP_ERR_SUCCESS);
+    REQUIRE(std::string(message.message, message.message_length) == large);
+
+    // Writing to the region afterwards does not change what was received.
+    space[0] ^= 1;
+    REQUIRE(std::string(message.message, message.message_length) == large);
+    teep_unix_message_release(&message);
+
+    teep_unix_channel_free(&sender);
+    REQUIRE(teep_unix_receive(&receiver, &message) == TEEP_ERR_TEMPORARY_ERROR);
+    teep_unix_channel_free(&receiver);
+}
+
+TEST_CASE("Unix socket back end answers each forwarded message once", "[unix]")
+{
+    REQUIRE(StartUnixServer(TEST_UNIX_SOCKET_PATH, HandleLoopbackMessage) == 0);
+    std::thread server(RunUnixServer);
+    uint64_t handled = GetUnixServerMessagesHandled();
+    uint64_t opened = UnixForwarderGetConnectionsOpened();
+
+    UnixForwardResponse response;
+    REQUIRE(UnixForwardMessage(TEST_UNIX_SOCKET_PATH, 1, "application/teep+cbor", nullptr, 0, &response) == TEEP_ERR_SUCCESS);
+    REQUIRE(std::string(response.Body, response.BodyLength) == "QueryRequest");
+    UnixForwarderFreeResponse(&response);
+
+    std::string large = MakeLargeMessage(1024 * 1024 + 17);
+    for (const std::string& message : { std::string("QueryResponse"), large, large }) {
+        REQUIRE(UnixForwardMessage(TEST_UNIX_SOCKET_PATH, 2, "application/teep+cbor", message.data(), message.size(), &response) == TEEP_ERR_SUCCESS);
+        REQUIRE(response.SessionId == 2);
+        REQUIRE(std::string(response.Body, response.BodyLength) == "Re:" + message);
+        UnixForwarderFreeResponse(&response);
+    }
+
+    // Through the handler a front-end server would use.
+    UnixForwarderSetPath(TEST_UNIX_SOCKET_PATH);
+    TamBrokerSession session = {};
+    REQUIRE(ForwardToUnixBackend(&session, "application/teep+cbor", "Success", 7) == TEEP_ERR_SUCCESS);
+    REQUIRE(std::string(session.OutboundBuffer.data, session.OutboundMessageLength) == "Re:Success");
+    teep_buffer_release(&session.OutboundBuffer);
+
+    REQUIRE(GetUnixServerMessagesHandled() - handled == 5);
+    REQUIRE(UnixForwarderGetConnectionsOpened() - opened == 1);
+
+    UnixForwarderSetPath(TEEP_UNIX_SOCKET_PATH);
+    UnixForwarderCloseConnections();
+    StopUnixServer();
+    server.join();
+}
+#endif
@@ -0,0 +1,199 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <assert.h>
+#include <deque>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+extern "C" {
+#include "TeepSession.h"
+#include "HttpClient.h"
+};
+#include "HttpConnectionPool.h"
+#include "TeepAgentBrokerLib.h"
+
+TeepAgentSession g_Session = { 0 };
+
+// An outbound message, and its response once it has been sent.
+typedef struct {
+    char MediaType[80];
+    char* Message;
+    size_t MessageLength;
+    bool Sent;
+    HttpPoolResponse Response;
+} OutboundEntry;
+
+// Messages queued by the agent, oldest first.  Every message sent comes
+// before every message not yet sent.  The oldest is also the session's
+// OutboundMessage until its response is handed to the broker.
+static std::deque<OutboundEntry> g_OutboundQueue;
+
+static void ExposeOldestOutboundMessage(_Inout_ TeepBasicSession* session)
+{
+    if (g_OutboundQueue.empty()) {
+        session->OutboundMessage = nullptr;
+        session->OutboundMessageLength = 0;
+        return;
+    }
+    OutboundEntry& entry = g_OutboundQueue.front();
+    snprintf(session->OutboundMediaType, sizeof(session->OutboundMediaType), "%s", entry.MediaType);
+    session->OutboundMessage = entry.Message;
+    session->OutboundMessageLength = entry.MessageLength;
+}
+
+static void DiscardOutboundMessages(_Inout_ TeepBasicSession* session)
+{
+    for (OutboundEntry& entry : g_OutboundQueue) {
+        free(entry.Message);
+        HttpPoolFreeResponse(&entry.Response);
+    }
+    g_OutboundQueue.clear();
+    ExposeOldestOutboundMessage(session);
+}
+
+// Send an empty POST to the indicated URI.
+teep_error_code_t TeepAgentConnect(_In_z_ const char* tamUri, _In_z_ const char* acceptMediaType)
+{
+    char authority[266];
+    char path[256];
+    teep_error_code_t result = HttpParseUri(tamUri, authority, sizeof(authority), path, sizeof(path));
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    // Create session state.
+    TeepAgentSession* session = &g_Session;
+    snprintf(session->TamUri, sizeof(session->TamUri), "%s", tamUri);
+
+    HttpPoolRequest request = { nullptr, nullptr, 0 };
+    HttpPoolResponse response;
+    result = HttpPoolPostWithBackoff(authority, path, acceptMediaType, &request, 1, &response);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    int statusCode = response.StatusCode;
+    if (statusCode != 200) {
+        HttpPoolFreeResponse(&response);
+        if (statusCode == 204) {
+            return TEEP_ERR_SUCCESS; // Nothing to do.
+        }
+        return (statusCode >= 500) ? TEEP_ERR_TEMPORARY_ERROR : TEEP_ERR_PERMANENT_ERROR;
+    }
+
+    // Hand the body over as is, to be freed once it has been processed.
+    assert(session->InboundMessage == nullptr);
+    session->InboundMessage = response.Body;
+    session->InboundMessageLength = response.BodyLength;
+    snprintf(session->InboundMediaType, sizeof(session->InboundMediaType), "%s", response.MediaType);
+    free(response.MediaType);
+
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t TeepAgentQueueOutboundTeepMessage(
+    _In_ void* sessionHandle,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    TeepBasicSession* session = (TeepBasicSession*)sessionHandle;
+
+    // Save message for later transmission after the ECALL returns.  Any
+    // number may be queued before then, and they are sent together.
+    OutboundEntry entry = {};
+    snprintf(entry.MediaType, sizeof(entry.MediaType), "%s", mediaType);
+    entry.Message = (char*)malloc((messageLength > 0) ? messageLength : 1);
+    if (entry.Message == nullptr) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    memcpy(entry.Message, message, messageLength);
+    entry.MessageLength = messageLength;
+    g_OutboundQueue.push_back(entry);
+    if (session->OutboundMessage == nullptr) {
+        ExposeOldestOutboundMessage(session);
+    }
+    printf("Sending %zd bytes...\n", messageLength);
+    return TEEP_ERR_SUCCESS;
+}
+
+// Start a session with a POST carrying the given message, which is sent
+// with any others queued once the ECALL returns.
+teep_error_code_t TeepAgentConnectWithMessage(
+    _In_z_ const char* tamUri,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    char authority[266];
+    char path[256];
+    teep_error_code_t result = HttpParseUri(tamUri, authority, sizeof(authority), path, sizeof(path));
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    // Create session state.
+    TeepAgentSession* session = &g_Session;
+    snprintf(session->TamUri, sizeof(session->TamUri), "%s", tamUri);
+
+    return TeepAgentQueueOutboundTeepMessage(&session->Basic, mediaType, message, messageLength);
+}
+
+// Get the response to the oldest outbound message, first pipelining every
+// message not yet sent over a pooled connection if that one is among them,
+// and backing off while the TAM is overloaded.
+// The caller is responsible for freeing the returned buffer and media type
+// if non-null.
+const char* TeepAgentSendMessage(TeepAgentSession* session, char** pResponseMediaType, int* pResponseLength)
+{
+    *pResponseMediaType = nullptr;
+    *pResponseLength = 0;
+    if (g_OutboundQueue.empty()) {
+        return nullptr;
+    }
+
+    if (!g_OutboundQueue.front().Sent) {
+        char authority[266];
+        char path[256];
+        if (HttpParseUri(session->TamUri, authority, sizeof(authority), path, sizeof(path)) != TEEP_ERR_SUCCESS) {
+            DiscardOutboundMessages(&session->Basic);
+            return nullptr;
+        }
+
+        std::vector<HttpPoolRequest> requests;
+        for (const OutboundEntry& entry : g_OutboundQueue) {
+            requests.push_back({ entry.MediaType, entry.Message, entry.MessageLength });
+        }
+        std::vector<HttpPoolResponse> responses(requests.size());
+        teep_error_code_t result = HttpPoolPostWithBackoff(
+            authority,
+            path,
+            g_OutboundQueue.front().MediaType,
+            requests.data(),
+            requests.size(),
+            responses.data());
+        if (result != TEEP_ERR_SUCCESS) {
+            DiscardOutboundMessages(&session->Basic);
+            return nullptr;
+        }
+        for (size_t i = 0; i < responses.size(); i++) {
+            g_OutboundQueue[i].Sent = true;
+            g_OutboundQueue[i].Response = responses[i];
+        }
+        session->Basic.OutboundMessagesSent += responses.size();
+    }
+
+    OutboundEntry entry = g_OutboundQueue.front();
+    g_OutboundQueue.pop_front();
+    free(entry.Message);
+    ExposeOldestOutboundMessage(&session->Basic);
+
+    // An empty body means the TAM is done.
+    if (entry.Response.StatusCode != 200 && entry.Response.StatusCode != 204) {
+        HttpPoolFreeResponse(&entry.Response);
+        return nullptr;
+    }
+    *pResponseMediaType = entry.Response.MediaType;
+    *pResponseLength = (int)entry.Response.BodyLength;
+    return entry.Response.Body;
+}
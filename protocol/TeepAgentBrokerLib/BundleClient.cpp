@@ -0,0 +1,180 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "BundleClient.h"
+#include "HttpConnectionPool.h"
+#include "bundle.h"
+
+typedef struct {
+    std::string DeviceId;
+    std::string MediaType;
+    std::string Message;
+} BundleEntry;
+
+static struct {
+    std::mutex Lock;
+    std::map<std::string, std::vector<BundleEntry>> Queued; // By TAM URI.
+    size_t QueuedCount;
+    uint64_t PostsSent;
+} g_BundleClient;
+
+teep_error_code_t BundleQueueMessage(
+    _In_z_ const char* tamUri,
+    _In_z_ const char* deviceId,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    if (deviceId[0] == '\0' || strlen(deviceId) > TEEP_BUNDLE_MAX_DEVICE_ID_LENGTH) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    BundleEntry entry;
+    entry.DeviceId = deviceId;
+    entry.MediaType = mediaType;
+    entry.Message.assign(message, messageLength);
+
+    std::lock_guard<std::mutex> lock(g_BundleClient.Lock);
+    g_BundleClient.Queued[tamUri].push_back(std::move(entry));
+    g_BundleClient.QueuedCount++;
+    return TEEP_ERR_SUCCESS;
+}
+
+// Hand the parts of one bundle of responses to the handler, once sure
+// there is one for each message sent, in order.
+static teep_error_code_t DeliverResponses(
+    _In_ const HttpPoolResponse* response,
+    _In_reads_(count) const BundleEntry* entries,
+    size_t count,
+    _In_ BundleResponseHandler handler,
+    _In_opt_ void* context)
+{
+    if (response->StatusCode != 200) {
+        return (response->StatusCode >= 500) ? TEEP_ERR_TEMPORARY_ERROR : TEEP_ERR_PERMANENT_ERROR;
+    }
+    std::vector<teep_bundle_part_t> parts(count);
+    size_t partCount;
+    teep_error_code_t result = teep_bundle_parse(response->MediaType, response->Body, response->BodyLength, parts.data(), parts.size(), &partCount);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    if (partCount != count) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].DeviceId != parts[i].device_id) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+    }
+    for (const teep_bundle_part_t& part : parts) {
+        const char* mediaType = (part.media_type[0] != '\0') ? part.media_type : TEEP_CBOR_MEDIA_TYPE;
+        handler(context, part.device_id, mediaType, part.body, part.body_length);
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+// Send everything queued for one TAM, as few bundles as will hold it, all
+// pipelined on one connection, backing off while the TAM is overloaded.
+static teep_error_code_t FlushTam(
+    _In_z_ const char* tamUri,
+    _In_ const std::vector<BundleEntry>& entries,
+    _In_ BundleResponseHandler handler,
+    _In_opt_ void* context)
+{
+    char authority[266];
+    char path[256];
+    teep_error_code_t result = HttpParseUri(tamUri, authority, sizeof(authority), path, sizeof(path));
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    size_t bundleCount = (entries.size() + TEEP_BUNDLE_MAX_PARTS - 1) / TEEP_BUNDLE_MAX_PARTS;
+    std::vector<teep_buffer_t> bundles(bundleCount);
+    std::vector<std::string> mediaTypes(bundleCount);
+    std::vector<HttpPoolRequest> requests(bundleCount);
+    for (size_t i = 0; i < bundleCount && result == TEEP_ERR_SUCCESS; i++) {
+        size_t first = i * TEEP_BUNDLE_MAX_PARTS;
+        size_t count = std::min(entries.size() - first, (size_t)TEEP_BUNDLE_MAX_PARTS);
+        std::vector<teep_bundle_part_t> parts(count);
+        for (size_t j = 0; j < count; j++) {
+            const BundleEntry& entry = entries[first + j];
+            memset(&parts[j], 0, sizeof(parts[j]));
+            snprintf(parts[j].device_id, sizeof(parts[j].device_id), "%s", entry.DeviceId.c_str());
+            if (!entry.Message.empty()) {
+                snprintf(parts[j].media_type, sizeof(parts[j].media_type), "%s", entry.MediaType.c_str());
+            }
+            parts[j].body = entry.Message.data();
+            parts[j].body_length = entry.Message.size();
+        }
+        char mediaType[TEEP_BUNDLE_MAX_MEDIA_TYPE_SIZE];
+        size_t length;
+        result = teep_bundle_encode(parts.data(), count, &bundles[i], &length, mediaType);
+        mediaTypes[i] = mediaType;
+        requests[i] = { mediaTypes[i].c_str(), bundles[i].data, length };
+    }
+
+    std::vector<HttpPoolResponse> responses(bundleCount);
+    if (result == TEEP_ERR_SUCCESS) {
+        result = HttpPoolPostWithBackoff(authority, path, TEEP_BUNDLE_MEDIA_TYPE, requests.data(), requests.size(), responses.data());
+    }
+    for (teep_buffer_t& bundle : bundles) {
+        teep_buffer_release(&bundle);
+    }
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_BundleClient.Lock);
+        g_BundleClient.PostsSent += bundleCount;
+    }
+
+    for (size_t i = 0; i < bundleCount; i++) {
+        size_t first = i * TEEP_BUNDLE_MAX_PARTS;
+        size_t count = std::min(entries.size() - first, (size_t)TEEP_BUNDLE_MAX_PARTS);
+        teep_error_code_t delivered = DeliverResponses(&responses[i], &entries[first], count, handler, context);
+        if (result == TEEP_ERR_SUCCESS) {
+            result = delivered;
+        }
+        HttpPoolFreeResponse(&responses[i]);
+    }
+    return result;
+}
+
+teep_error_code_t BundleFlush(_In_ BundleResponseHandler handler, _In_opt_ void* context)
+{
+    std::map<std::string, std::vector<BundleEntry>> queued;
+    {
+        std::lock_guard<std::mutex> lock(g_BundleClient.Lock);
+        queued.swap(g_BundleClient.Queued);
+        g_BundleClient.QueuedCount = 0;
+    }
+
+    teep_error_code_t result = TEEP_ERR_SUCCESS;
+    for (const auto& tam : queued) {
+        teep_error_code_t tamResult = FlushTam(tam.first.c_str(), tam.second, handler, context);
+        if (tamResult != TEEP_ERR_SUCCESS) {
+            printf("Error %d sending a bundle to %s\n", tamResult, tam.first.c_str());
+            if (result == TEEP_ERR_SUCCESS) {
+                result = tamResult;
+            }
+        }
+    }
+    return result;
+}
+
+size_t BundleGetQueuedCount(void)
+{
+    std::lock_guard<std::mutex> lock(g_BundleClient.Lock);
+    return g_BundleClient.QueuedCount;
+}
+
+uint64_t BundleGetPostsSent(void)
+{
+    std::lock_guard<std::mutex> lock(g_BundleClient.Lock);
+    return g_BundleClient.PostsSent;
+}
@@ -0,0 +1,47 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+// Message bundling for a gateway that hosts many agents, described in
+// TeepTransport.h.  The gateway queues each agent's outbound messages
+// rather than sending them, and a flush sends everything queued for each
+// TAM as one bundle over a pooled HTTP connection, so that a device costs
+// a part of a POST instead of a POST of its own.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // Queue a message from a device's agent, or an empty one to start a
+    // session, for a TAM.
+    teep_error_code_t BundleQueueMessage(
+        _In_z_ const char* tamUri,
+        _In_z_ const char* deviceId,
+        _In_z_ const char* mediaType,
+        _In_reads_(messageLength) const char* message,
+        size_t messageLength);
+
+    // Called with each response, which is empty if the TAM is done with
+    // the device.  The message is only valid during the call.
+    typedef void (*BundleResponseHandler)(
+        _In_opt_ void* context,
+        _In_z_ const char* deviceId,
+        _In_z_ const char* mediaType,
+        _In_reads_(messageLength) const char* message,
+        size_t messageLength);
+
+    // Send every queued message, and hand each response to the handler.
+    // Messages for a TAM that cannot be reached are dropped, and the first
+    // such error is returned once every other TAM has been tried.
+    teep_error_code_t BundleFlush(_In_ BundleResponseHandler handler, _In_opt_ void* context);
+
+    // Get the number of messages queued, and of POSTs sent so far.
+    size_t BundleGetQueuedCount(void);
+    uint64_t BundleGetPostsSent(void);
+
+#ifdef __cplusplus
+};
+#endif
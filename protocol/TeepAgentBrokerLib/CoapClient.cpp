@@ -0,0 +1,572 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+#include <assert.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "CoapClient.h"
+#include "coap.h"
+#ifdef USE_COAP
+extern "C" {
+#include "TeepSession.h"
+#include "HttpClient.h"
+};
+#include "TeepAgentBrokerLib.h"
+#endif
+
+#define COAP_URI_SCHEME "coap://"
+#define COAP_TOKEN_LENGTH 4
+
+#ifndef _WIN32
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+static struct {
+    std::mutex Lock;
+    std::map<std::string, SOCKET> Sockets; // By authority.
+    std::mt19937 Random;
+    bool Seeded;
+    uint16_t NextMessageId;
+    unsigned int AckTimeoutMs = TEEP_COAP_ACK_TIMEOUT_MS;
+    uint64_t DatagramsSent;
+    uint64_t BytesSent;
+    uint64_t BytesReceived;
+} g_CoapClient;
+
+// Split a "coap://" URI into its authority and its path, without the
+// leading '/'.
+static teep_error_code_t ParseCoapUri(_In_z_ const char* uri, _Out_ std::string* authority, _Out_ std::string* path)
+{
+    size_t schemeLength = strlen(COAP_URI_SCHEME);
+    if (strncmp(uri, COAP_URI_SCHEME, schemeLength) != 0) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    const char* start = uri + schemeLength;
+    size_t authorityLength = strcspn(start, "/");
+    if (authorityLength == 0) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    authority->assign(start, authorityLength);
+    path->assign(start + authorityLength + (start[authorityLength] == '/'));
+    if (path->size() >= TEEP_COAP_MAX_URI_PATH_LENGTH) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+// Get the socket for an authority, opening it if need be.
+static SOCKET GetSocket(_In_ const std::string& authority)
+{
+    auto it = g_CoapClient.Sockets.find(authority);
+    if (it != g_CoapClient.Sockets.end()) {
+        return it->second;
+    }
+#ifdef _WIN32
+    static std::once_flag started;
+    std::call_once(started, [] {
+        WSADATA wsaData;
+        (void)WSAStartup(MAKEWORD(2, 2), &wsaData);
+    });
+#endif
+
+    // Split the authority into host and port, allowing for an IPv6
+    // literal in brackets.
+    std::string host = authority;
+    std::string port = TEEP_COAP_PORT;
+    size_t colon = host.rfind(':');
+    size_t bracket = host.rfind(']');
+    if (colon != std::string::npos && (bracket == std::string::npos || colon > bracket)) {
+        port = host.substr(colon + 1);
+        host.resize(colon);
+    }
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo* addresses;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return INVALID_SOCKET;
+    }
+
+    // Connect the socket, so that only datagrams from the TAM arrive.
+    SOCKET s = INVALID_SOCKET;
+    for (struct addrinfo* ai = addresses; ai != nullptr; ai = ai->ai_next) {
+        s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s == INVALID_SOCKET) {
+            continue;
+        }
+        if (connect(s, ai->ai_addr, (int)ai->ai_addrlen) == 0) {
+            break;
+        }
+        closesocket(s);
+        s = INVALID_SOCKET;
+    }
+    freeaddrinfo(addresses);
+    if (s != INVALID_SOCKET) {
+        g_CoapClient.Sockets[authority] = s;
+    }
+    return s;
+}
+
+static void CloseSocket(_In_ const std::string& authority)
+{
+    auto it = g_CoapClient.Sockets.find(authority);
+    if (it != g_CoapClient.Sockets.end()) {
+        closesocket(it->second);
+        g_CoapClient.Sockets.erase(it);
+    }
+}
+
+// Wait until a socket is readable or a deadline passes.
+static bool WaitReadable(SOCKET s, std::chrono::steady_clock::time_point deadline)
+{
+    auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+    if (remaining.count() < 0) {
+        return false;
+    }
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(s, &readable);
+    struct timeval timeout = { (long)(remaining.count() / 1000000), (long)(remaining.count() % 1000000) };
+    return select((int)s + 1, &readable, nullptr, nullptr, &timeout) > 0;
+}
+
+static void SendDatagram(SOCKET s, _In_reads_(length) const uint8_t* datagram, size_t length)
+{
+    if (send(s, (const char*)datagram, (int)length, 0) == (int)length) {
+        g_CoapClient.DatagramsSent++;
+        g_CoapClient.BytesSent += length;
+    }
+}
+
+// Acknowledge a confirmable response that came separately from the
+// acknowledgement of its request.
+static void AcknowledgeResponse(SOCKET s, _In_ const teep_coap_message_t* response)
+{
+    teep_coap_message_t ack;
+    teep_coap_message_init(&ack);
+    ack.type = TEEP_COAP_TYPE_ACKNOWLEDGEMENT;
+    ack.message_id = response->message_id;
+    uint8_t datagram[16];
+    size_t length = teep_coap_serialize(&ack, datagram, sizeof(datagram));
+    SendDatagram(s, datagram, length);
+}
+
+// Send a confirmable request until it is acknowledged, and get the
+// response, which is decoded from the received buffer.
+static teep_error_code_t ExchangeMessages(
+    SOCKET s,
+    _In_ const teep_coap_message_t* request,
+    _Out_writes_(TEEP_COAP_MAX_DATAGRAM_SIZE) uint8_t* received,
+    _Out_ teep_coap_message_t* response)
+{
+    uint8_t datagram[TEEP_COAP_MAX_DATAGRAM_SIZE];
+    size_t length = teep_coap_serialize(request, datagram, sizeof(datagram));
+    if (length == 0) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+
+    // The first timeout is picked at random between the ACK timeout and
+    // that times the random factor, and doubles with each retransmission.
+    std::uniform_int_distribution<unsigned int> spread(0, g_CoapClient.AckTimeoutMs * (TEEP_COAP_ACK_RANDOM_FACTOR_PERCENT - 100) / 100);
+    auto timeout = std::chrono::milliseconds(g_CoapClient.AckTimeoutMs + spread(g_CoapClient.Random));
+    bool acknowledged = false;
+    for (int transmission = 0; transmission <= TEEP_COAP_MAX_RETRANSMIT; transmission++) {
+        SendDatagram(s, datagram, length);
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (WaitReadable(s, deadline)) {
+            int count = (int)recv(s, (char*)received, TEEP_COAP_MAX_DATAGRAM_SIZE, 0);
+            if (count < 0) {
+                return TEEP_ERR_TEMPORARY_ERROR; // For example, nothing listening.
+            }
+            g_CoapClient.BytesReceived += count;
+            if (teep_coap_parse(received, count, response) != TEEP_ERR_SUCCESS) {
+                continue;
+            }
+            bool sameMessage = (response->message_id == request->message_id);
+            bool sameToken = (response->token_length == request->token_length &&
+                              memcmp(response->token, request->token, request->token_length) == 0);
+            if (response->type == TEEP_COAP_TYPE_RESET && sameMessage) {
+                return TEEP_ERR_PERMANENT_ERROR;
+            }
+            if (response->type == TEEP_COAP_TYPE_ACKNOWLEDGEMENT && sameMessage) {
+                if (response->code != TEEP_COAP_CODE_EMPTY) {
+                    return TEEP_ERR_SUCCESS; // Piggybacked.
+                }
+                // Only the response is to come, and that is the TAM's
+                // to retransmit.
+                acknowledged = true;
+                deadline = std::chrono::steady_clock::now() + std::chrono::seconds(TEEP_COAP_EXCHANGE_LIFETIME_SECONDS);
+                continue;
+            }
+            if ((response->type == TEEP_COAP_TYPE_CONFIRMABLE || response->type == TEEP_COAP_TYPE_NON_CONFIRMABLE) &&
+                sameToken && response->code != TEEP_COAP_CODE_EMPTY) {
+                if (response->type == TEEP_COAP_TYPE_CONFIRMABLE) {
+                    AcknowledgeResponse(s, response);
+                }
+                return TEEP_ERR_SUCCESS; // Separate.
+            }
+        }
+        if (acknowledged) {
+            break;
+        }
+        timeout *= 2;
+    }
+    return TEEP_ERR_TEMPORARY_ERROR;
+}
+
+static void InitializeRequest(_Out_ teep_coap_message_t* request, _In_ const std::string& path, _In_reads_(COAP_TOKEN_LENGTH) const uint8_t* token)
+{
+    teep_coap_message_init(request);
+    request->type = TEEP_COAP_TYPE_CONFIRMABLE;
+    request->code = TEEP_COAP_CODE_POST;
+    request->message_id = g_CoapClient.NextMessageId++;
+    request->token_length = COAP_TOKEN_LENGTH;
+    memcpy(request->token, token, COAP_TOKEN_LENGTH);
+    memcpy(request->uri_path, path.c_str(), path.size() + 1);
+}
+
+// Add a payload to a body being received, growing its buffer if need be.
+static teep_error_code_t AppendToBody(
+    _Inout_ CoapResponse* response,
+    _Inout_ size_t* capacity,
+    _In_reads_(length) const uint8_t* payload,
+    size_t length)
+{
+    if (response->Body == nullptr || response->BodyLength + length + 1 > *capacity) {
+        size_t newCapacity = *capacity * 2;
+        if (newCapacity < response->BodyLength + length + 1) {
+            newCapacity = response->BodyLength + length + 1;
+        }
+        char* body = (char*)realloc(response->Body, newCapacity);
+        if (body == nullptr) {
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+        response->Body = body;
+        *capacity = newCapacity;
+    }
+    if (length > 0) {
+        memcpy(response->Body + response->BodyLength, payload, length);
+        response->BodyLength += length;
+    }
+    response->Body[response->BodyLength] = '\0';
+    return TEEP_ERR_SUCCESS;
+}
+
+static teep_error_code_t PostOnSocket(
+    SOCKET s,
+    _In_ const std::string& path,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength,
+    _Inout_ CoapResponse* response)
+{
+    uint8_t token[COAP_TOKEN_LENGTH];
+    for (uint8_t& byte : token) {
+        byte = (uint8_t)g_CoapClient.Random();
+    }
+    uint8_t received[TEEP_COAP_MAX_DATAGRAM_SIZE];
+    teep_coap_message_t request;
+    teep_coap_message_t reply;
+
+    // Send the message, in blocks if it does not fit in one.  The TAM may
+    // ask for smaller blocks, which still line up with those sent so far.
+    size_t blockSize = TEEP_COAP_BLOCK_SIZE;
+    bool blockwise = (messageLength > blockSize);
+    size_t offset = 0;
+    for (;;) {
+        InitializeRequest(&request, path, token);
+        size_t length = messageLength - offset;
+        if (length > blockSize) {
+            length = blockSize;
+        }
+        bool more = (offset + length < messageLength);
+        if (messageLength > 0) {
+            request.content_format = TEEP_COAP_CONTENT_FORMAT;
+        } else {
+            request.accept = TEEP_COAP_CONTENT_FORMAT;
+        }
+        if (blockwise) {
+            request.block1 = teep_coap_block_encode((uint32_t)(offset / blockSize), more, blockSize);
+            if (offset == 0) {
+                request.size1 = (uint32_t)messageLength;
+            }
+        }
+        request.payload = (const uint8_t*)message + offset;
+        request.payload_length = length;
+        teep_error_code_t result = ExchangeMessages(s, &request, received, &reply);
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+        if (!more || reply.code != TEEP_COAP_CODE_CONTINUE) {
+            break;
+        }
+        offset += length;
+        if (reply.block1 != TEEP_COAP_OPTION_ABSENT) {
+            uint32_t number;
+            int moreBlocks;
+            size_t replySize;
+            teep_coap_block_decode(reply.block1, &number, &moreBlocks, &replySize);
+            if (replySize < blockSize) {
+                blockSize = replySize;
+            }
+        }
+    }
+
+    // Get the response, in blocks if it does not fit in one.
+    // The size of the whole response, if given, saves growing the buffer.
+    response->Code = reply.code;
+    size_t capacity = 0;
+    if (reply.size2 != TEEP_COAP_OPTION_ABSENT && reply.size2 <= TEEP_COAP_MAX_MESSAGE_SIZE) {
+        capacity = (size_t)reply.size2 + 1;
+        response->Body = (char*)malloc(capacity);
+        if (response->Body == nullptr) {
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+    }
+    teep_error_code_t result = AppendToBody(response, &capacity, reply.payload, reply.payload_length);
+    uint32_t number = 0;
+    while (result == TEEP_ERR_SUCCESS && reply.block2 != TEEP_COAP_OPTION_ABSENT) {
+        int more;
+        size_t size;
+        uint32_t replyNumber;
+        teep_coap_block_decode(reply.block2, &replyNumber, &more, &size);
+        if (replyNumber != number || TEEP_COAP_CODE_CLASS(reply.code) != 2) {
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+        if (!more) {
+            break;
+        }
+        if (response->BodyLength + size > TEEP_COAP_MAX_MESSAGE_SIZE) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        number++;
+        InitializeRequest(&request, path, token);
+        request.block2 = teep_coap_block_encode(number, 0, size);
+        result = ExchangeMessages(s, &request, received, &reply);
+        if (result == TEEP_ERR_SUCCESS) {
+            result = AppendToBody(response, &capacity, reply.payload, reply.payload_length);
+        }
+    }
+    return result;
+}
+
+teep_error_code_t CoapPost(
+    _In_z_ const char* uri,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength,
+    _Out_ CoapResponse* response)
+{
+    response->Code = TEEP_COAP_CODE_EMPTY;
+    response->Body = nullptr;
+    response->BodyLength = 0;
+
+    std::string authority;
+    std::string path;
+    teep_error_code_t result = ParseCoapUri(uri, &authority, &path);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    std::lock_guard<std::mutex> lock(g_CoapClient.Lock);
+    if (!g_CoapClient.Seeded) {
+        std::random_device seed;
+        g_CoapClient.Random.seed(seed());
+        g_CoapClient.NextMessageId = (uint16_t)g_CoapClient.Random();
+        g_CoapClient.Seeded = true;
+    }
+    SOCKET s = GetSocket(authority);
+    if (s == INVALID_SOCKET) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    result = PostOnSocket(s, path, message, messageLength, response);
+    if (result != TEEP_ERR_SUCCESS) {
+        // Start afresh next time, in case the TAM moved.
+        CloseSocket(authority);
+        CoapFreeResponse(response);
+    }
+    return result;
+}
+
+void CoapFreeResponse(_Inout_ CoapResponse* response)
+{
+    free(response->Body);
+    response->Body = nullptr;
+    response->BodyLength = 0;
+}
+
+void CoapSetAckTimeout(unsigned int milliseconds)
+{
+    std::lock_guard<std::mutex> lock(g_CoapClient.Lock);
+    g_CoapClient.AckTimeoutMs = milliseconds;
+}
+
+void CoapCloseSockets(void)
+{
+    std::lock_guard<std::mutex> lock(g_CoapClient.Lock);
+    for (auto& [authority, s] : g_CoapClient.Sockets) {
+        closesocket(s);
+    }
+    g_CoapClient.Sockets.clear();
+}
+
+uint64_t CoapGetDatagramsSent(void)
+{
+    std::lock_guard<std::mutex> lock(g_CoapClient.Lock);
+    return g_CoapClient.DatagramsSent;
+}
+
+uint64_t CoapGetBytesSent(void)
+{
+    std::lock_guard<std::mutex> lock(g_CoapClient.Lock);
+    return g_CoapClient.BytesSent;
+}
+
+uint64_t CoapGetBytesReceived(void)
+{
+    std::lock_guard<std::mutex> lock(g_CoapClient.Lock);
+    return g_CoapClient.BytesReceived;
+}
+
+#ifdef USE_COAP
+TeepAgentSession g_Session = { 0 };
+
+// Hand a response to the agent broker, or return null if there was none.
+static const char* TakeResponseBody(teep_error_code_t result, _Inout_ CoapResponse* response, _Out_ size_t* length)
+{
+    *length = 0;
+    if (result != TEEP_ERR_SUCCESS) {
+        return nullptr;
+    }
+    if (TEEP_COAP_CODE_CLASS(response->Code) != 2) {
+        printf("Received CoAP response %d.%02d\n", TEEP_COAP_CODE_CLASS(response->Code), response->Code & 0x1F);
+        CoapFreeResponse(response);
+        return nullptr;
+    }
+    *length = response->BodyLength;
+    return response->Body;
+}
+
+// Send an empty POST to the indicated URI.
+teep_error_code_t TeepAgentConnect(_In_z_ const char* tamUri, _In_z_ const char* acceptMediaType)
+{
+    if (strcmp(acceptMediaType, TEEP_CBOR_MEDIA_TYPE) != 0) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+
+    // Create session state.
+    TeepAgentSession* session = &g_Session;
+    snprintf(session->TamUri, sizeof(session->TamUri), "%s", tamUri);
+
+    CoapResponse response;
+    teep_error_code_t result = CoapPost(tamUri, nullptr, 0, &response);
+    size_t length;
+    const char* body = TakeResponseBody(result, &response, &length);
+    if (body == nullptr) {
+        return (result != TEEP_ERR_SUCCESS) ? result : TEEP_ERR_TEMPORARY_ERROR;
+    }
+    if (length == 0) {
+        free((void*)body);
+        return TEEP_ERR_SUCCESS; // Nothing to do.
+    }
+
+    // Hand the buffer over as is, to be freed once it has been processed.
+    assert(session->InboundMessage == nullptr);
+    session->InboundMessage = body;
+    session->InboundMessageLength = length;
+    snprintf(session->InboundMediaType, sizeof(session->InboundMediaType), "%s", TEEP_CBOR_MEDIA_TYPE);
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t TeepAgentQueueOutboundTeepMessage(
+    _In_ void* sessionHandle,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    TeepBasicSession* session = (TeepBasicSession*)sessionHandle;
+
+    assert(session->OutboundMessage == nullptr);
+    if (strcmp(mediaType, TEEP_CBOR_MEDIA_TYPE) != 0) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+
+    // Save message for later transmission after the ECALL returns.
+    char* data = (char*)malloc(messageLength);
+    if (data == nullptr) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    memcpy(data, message, messageLength);
+    snprintf(session->OutboundMediaType, sizeof(session->OutboundMediaType), "%s", mediaType);
+    session->OutboundMessage = data;
+    session->OutboundMessageLength = messageLength;
+    printf("Sending %zd bytes...\n", messageLength);
+    return TEEP_ERR_SUCCESS;
+}
+
+// Start a session with a POST carrying the given message, which is sent
+// once the ECALL returns.
+teep_error_code_t TeepAgentConnectWithMessage(
+    _In_z_ const char* tamUri,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    // Create session state.
+    TeepAgentSession* session = &g_Session;
+    snprintf(session->TamUri, sizeof(session->TamUri), "%s", tamUri);
+
+    return TeepAgentQueueOutboundTeepMessage(&session->Basic, mediaType, message, messageLength);
+}
+
+// The caller is responsible for freeing the returned buffer and media type
+// if non-null.
+const char* TeepAgentSendMessage(TeepAgentSession* session, char** pResponseMediaType, int* pResponseLength)
+{
+    *pResponseMediaType = nullptr;
+    *pResponseLength = 0;
+
+    CoapResponse response;
+    teep_error_code_t result = CoapPost(session->TamUri, session->Basic.OutboundMessage, session->Basic.OutboundMessageLength, &response);
+    free((void*)session->Basic.OutboundMessage);
+    session->Basic.OutboundMessage = nullptr;
+    session->Basic.OutboundMessageLength = 0;
+    session->Basic.OutboundMessagesSent++;
+
+    size_t length;
+    const char* body = TakeResponseBody(result, &response, &length);
+    if (body == nullptr) {
+        return nullptr;
+    }
+    *pResponseMediaType = (char*)malloc(sizeof(TEEP_CBOR_MEDIA_TYPE));
+    if (*pResponseMediaType == nullptr) {
+        free((void*)body);
+        return nullptr;
+    }
+    memcpy(*pResponseMediaType, TEEP_CBOR_MEDIA_TYPE, sizeof(TEEP_CBOR_MEDIA_TYPE));
+
+    // An empty message means the TAM is done.
+    *pResponseLength = (int)length;
+    return body;
+}
+#endif
@@ -0,0 +1,50 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+// A portable CoAP client for TEEP agents on constrained devices.  Each
+// message is a confirmable POST, retransmitted with exponential backoff
+// until acknowledged, and messages larger than one datagram move in
+// blocks (RFC 7959) in both directions.  One UDP socket is kept per TAM.
+
+typedef struct {
+    uint8_t Code; // A TEEP_COAP_CODE value.
+    char* Body;   // NUL-terminated, and never null on success.
+    size_t BodyLength;
+} CoapResponse;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // POST a TEEP message, or an empty one to connect, to a "coap://" URI.
+    // On success the caller owns the response body, which was allocated
+    // with malloc and can be freed with CoapFreeResponse or handed on as
+    // is.
+    teep_error_code_t CoapPost(
+        _In_z_ const char* uri,
+        _In_reads_(messageLength) const char* message,
+        size_t messageLength,
+        _Out_ CoapResponse* response);
+
+    void CoapFreeResponse(_Inout_ CoapResponse* response);
+
+    // Set the initial retransmission timeout, which is otherwise
+    // TEEP_COAP_ACK_TIMEOUT_MS.
+    void CoapSetAckTimeout(unsigned int milliseconds);
+
+    // Close the socket kept for each TAM.
+    void CoapCloseSockets(void);
+
+    // Get the number of datagrams sent, including retransmissions, and the
+    // bytes in all datagrams sent and received.
+    uint64_t CoapGetDatagramsSent(void);
+    uint64_t CoapGetBytesSent(void);
+    uint64_t CoapGetBytesReceived(void);
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,806 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#include <chrono>
+#include <ctype.h>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HttpConnectionPool.h"
+
+#define HTTP_DEFAULT_PORT "80"
+#define HTTP_POOL_MAX_BUFFERS_PER_SEND 64
+#define HTTP_POOL_UNTIL_CLOSE_CHUNK_SIZE (16 * 1024)
+
+#ifdef _WIN32
+typedef WSABUF HttpBuffer;
+#define HTTP_BUFFER_DATA(b) ((b).buf)
+#define HTTP_BUFFER_LENGTH(b) ((b).len)
+#else
+typedef int SOCKET;
+typedef struct iovec HttpBuffer;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#define HTTP_BUFFER_DATA(b) ((char*&)(b).iov_base)
+#define HTTP_BUFFER_LENGTH(b) ((b).iov_len)
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+struct HttpConnection {
+    SOCKET Socket;
+    bool Reused; // Taken from the idle list rather than newly opened.
+
+    // Response bytes received but not yet consumed.  Pipelined responses
+    // arrive back to back, so this can hold the start of the next one.
+    char Received[HTTP_POOL_HEADER_BUFFER_SIZE];
+    size_t Start;
+    size_t End;
+};
+
+static struct {
+    std::mutex Lock;
+    std::map<std::string, std::vector<HttpConnection*>> Idle; // By authority.
+    uint64_t ConnectionsOpened;
+    uint64_t Retries;
+} g_HttpPool;
+
+static void CloseConnection(_In_ HttpConnection* connection)
+{
+    closesocket(connection->Socket);
+    delete connection;
+}
+
+// An idle connection is readable only if the server closed it or sent
+// something unasked, and either way it cannot be used.
+static bool IsConnectionStale(_In_ const HttpConnection* connection)
+{
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(connection->Socket, &readable);
+    struct timeval timeout = { 0, 0 };
+    return select((int)connection->Socket + 1, &readable, nullptr, nullptr, &timeout) != 0;
+}
+
+static void SetSocketOptions(SOCKET s)
+{
+    int noDelay = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+#ifdef _WIN32
+    DWORD timeout = HTTP_POOL_RECEIVE_TIMEOUT_SECONDS * 1000;
+#else
+    struct timeval timeout = { HTTP_POOL_RECEIVE_TIMEOUT_SECONDS, 0 };
+#endif
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+}
+
+static HttpConnection* OpenConnection(_In_z_ const char* authority)
+{
+#ifdef _WIN32
+    static std::once_flag started;
+    std::call_once(started, [] {
+        WSADATA wsaData;
+        (void)WSAStartup(MAKEWORD(2, 2), &wsaData);
+    });
+#endif
+
+    // Split the authority into host and port, allowing for an IPv6
+    // literal in brackets.
+    std::string host = authority;
+    std::string port = HTTP_DEFAULT_PORT;
+    size_t colon = host.rfind(':');
+    size_t bracket = host.rfind(']');
+    if (colon != std::string::npos && (bracket == std::string::npos || colon > bracket)) {
+        port = host.substr(colon + 1);
+        host.resize(colon);
+    }
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return nullptr;
+    }
+
+    SOCKET s = INVALID_SOCKET;
+    for (struct addrinfo* ai = addresses; ai != nullptr; ai = ai->ai_next) {
+        s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s == INVALID_SOCKET) {
+            continue;
+        }
+        if (connect(s, ai->ai_addr, (int)ai->ai_addrlen) == 0) {
+            break;
+        }
+        closesocket(s);
+        s = INVALID_SOCKET;
+    }
+    freeaddrinfo(addresses);
+    if (s == INVALID_SOCKET) {
+        return nullptr;
+    }
+    SetSocketOptions(s);
+
+    HttpConnection* connection = new HttpConnection;
+    connection->Socket = s;
+    connection->Reused = false;
+    connection->Start = 0;
+    connection->End = 0;
+
+    std::lock_guard<std::mutex> lock(g_HttpPool.Lock);
+    g_HttpPool.ConnectionsOpened++;
+    return connection;
+}
+
+// Take an idle connection to the authority, or open a new one.
+static HttpConnection* AcquireConnection(_In_z_ const char* authority)
+{
+    for (;;) {
+        HttpConnection* connection = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(g_HttpPool.Lock);
+            auto it = g_HttpPool.Idle.find(authority);
+            if (it == g_HttpPool.Idle.end() || it->second.empty()) {
+                break;
+            }
+            connection = it->second.back();
+            it->second.pop_back();
+        }
+        if (!IsConnectionStale(connection)) {
+            return connection;
+        }
+        CloseConnection(connection);
+    }
+    return OpenConnection(authority);
+}
+
+static void ReleaseConnection(_In_z_ const char* authority, _In_ HttpConnection* connection)
+{
+    connection->Reused = true;
+    {
+        std::lock_guard<std::mutex> lock(g_HttpPool.Lock);
+        std::vector<HttpConnection*>& idle = g_HttpPool.Idle[authority];
+        if (idle.size() < HTTP_POOL_MAX_IDLE_CONNECTIONS) {
+            idle.push_back(connection);
+            return;
+        }
+    }
+    CloseConnection(connection);
+}
+
+void HttpPoolCloseIdleConnections(void)
+{
+    std::lock_guard<std::mutex> lock(g_HttpPool.Lock);
+    for (auto& [authority, idle] : g_HttpPool.Idle) {
+        for (HttpConnection* connection : idle) {
+            CloseConnection(connection);
+        }
+    }
+    g_HttpPool.Idle.clear();
+}
+
+uint64_t HttpPoolGetConnectionsOpened(void)
+{
+    std::lock_guard<std::mutex> lock(g_HttpPool.Lock);
+    return g_HttpPool.ConnectionsOpened;
+}
+
+uint64_t HttpPoolGetRetries(void)
+{
+    std::lock_guard<std::mutex> lock(g_HttpPool.Lock);
+    return g_HttpPool.Retries;
+}
+
+// Send every buffer, in as few calls as the socket allows.  On failure,
+// buffersSent tells how many were sent in full.
+static bool SendBuffers(SOCKET s, _Inout_ std::vector<HttpBuffer>& buffers, _Out_ size_t* buffersSent)
+{
+    size_t first = 0;
+    *buffersSent = 0;
+    while (first < buffers.size()) {
+        size_t count = buffers.size() - first;
+        if (count > HTTP_POOL_MAX_BUFFERS_PER_SEND) {
+            count = HTTP_POOL_MAX_BUFFERS_PER_SEND;
+        }
+#ifdef _WIN32
+        DWORD sent;
+        if (WSASend(s, &buffers[first], (DWORD)count, &sent, 0, nullptr, nullptr) == SOCKET_ERROR) {
+            *buffersSent = first;
+            return false;
+        }
+#else
+        struct msghdr message = {};
+        message.msg_iov = &buffers[first];
+        message.msg_iovlen = count;
+        ssize_t sent = sendmsg(s, &message, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *buffersSent = first;
+            return false;
+        }
+#endif
+        size_t remaining = (size_t)sent;
+        while (first < buffers.size() && remaining >= HTTP_BUFFER_LENGTH(buffers[first])) {
+            remaining -= HTTP_BUFFER_LENGTH(buffers[first]);
+            first++;
+        }
+        if (remaining > 0) {
+            HTTP_BUFFER_DATA(buffers[first]) += remaining;
+            HTTP_BUFFER_LENGTH(buffers[first]) -= remaining;
+        }
+    }
+    *buffersSent = first;
+    return true;
+}
+
+// Receive into a buffer.  Returns the number of bytes received, 0 at the
+// end of the stream, or -1 on error or timeout.
+static int ReceiveBytes(SOCKET s, _Out_writes_(length) char* buffer, size_t length)
+{
+    if (length > INT32_MAX) {
+        length = INT32_MAX;
+    }
+    for (;;) {
+        int received = (int)recv(s, buffer, (int)length, 0);
+#ifndef _WIN32
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        return (received < 0) ? -1 : received;
+    }
+}
+
+// Receive more bytes after those not yet consumed.
+static int FillReceiveBuffer(_Inout_ HttpConnection* connection)
+{
+    if (connection->Start > 0) {
+        memmove(connection->Received, connection->Received + connection->Start, connection->End - connection->Start);
+        connection->End -= connection->Start;
+        connection->Start = 0;
+    }
+    if (connection->End == sizeof(connection->Received)) {
+        return -1; // Header too large.
+    }
+    int received = ReceiveBytes(
+        connection->Socket,
+        connection->Received + connection->End,
+        sizeof(connection->Received) - connection->End);
+    if (received > 0) {
+        connection->End += received;
+    }
+    return received;
+}
+
+static bool HeaderNameIs(_In_reads_(length) const char* name, size_t length, _In_z_ const char* expected)
+{
+    if (strlen(expected) != length) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (tolower((unsigned char)name[i]) != tolower((unsigned char)expected[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool HeaderValueHas(_In_ const std::string& value, _In_z_ const char* token)
+{
+    std::string lower;
+    for (char c : value) {
+        lower += (char)tolower((unsigned char)c);
+    }
+    return lower.find(token) != std::string::npos;
+}
+
+struct HttpResponseHeader {
+    int StatusCode;
+    bool KeepAlive;
+    bool HasContentLength;
+    uint64_t ContentLength;
+    std::string MediaType;
+    uint32_t RetryAfterSeconds;
+};
+
+// Parse a status line and header fields, which end with an empty line.
+static bool ParseResponseHeader(_In_reads_(length) const char* text, size_t length, _Out_ HttpResponseHeader& header)
+{
+    header.StatusCode = 0;
+    header.HasContentLength = false;
+    header.ContentLength = 0;
+    header.MediaType.clear();
+    header.RetryAfterSeconds = 0;
+
+    const char* end = text + length;
+    const char* lineEnd = (const char*)memchr(text, '\n', length);
+    std::string line(text, lineEnd - text);
+    if (line.compare(0, 7, "HTTP/1.") != 0 || line.size() < 12 || !isdigit((unsigned char)line[7]) || line[8] != ' ') {
+        return false;
+    }
+    header.StatusCode = atoi(line.c_str() + 9);
+    if (header.StatusCode < 100 || header.StatusCode > 999) {
+        return false;
+    }
+    header.KeepAlive = (line[7] != '0');
+
+    for (const char* p = lineEnd + 1; p < end; p = lineEnd + 1) {
+        lineEnd = (const char*)memchr(p, '\n', end - p);
+        if (lineEnd == nullptr) {
+            return false;
+        }
+        size_t lineLength = lineEnd - p;
+        if (lineLength > 0 && p[lineLength - 1] == '\r') {
+            lineLength--;
+        }
+        if (lineLength == 0) {
+            break;
+        }
+        const char* colon = (const char*)memchr(p, ':', lineLength);
+        if (colon == nullptr) {
+            return false;
+        }
+        const char* value = colon + 1;
+        const char* valueEnd = p + lineLength;
+        while (value < valueEnd && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) {
+            valueEnd--;
+        }
+        std::string fieldValue(value, valueEnd - value);
+        size_t nameLength = colon - p;
+
+        if (HeaderNameIs(p, nameLength, "Content-Length")) {
+            char* numberEnd;
+            header.ContentLength = strtoull(fieldValue.c_str(), &numberEnd, 10);
+            if (fieldValue.empty() || *numberEnd != '\0') {
+                return false;
+            }
+            header.HasContentLength = true;
+        } else if (HeaderNameIs(p, nameLength, "Content-Type")) {
+            header.MediaType = fieldValue;
+        } else if (HeaderNameIs(p, nameLength, "Retry-After")) {
+            // An HTTP-date is left as 0, to back off as if there were none.
+            char* numberEnd;
+            unsigned long long seconds = strtoull(fieldValue.c_str(), &numberEnd, 10);
+            if (!fieldValue.empty() && *numberEnd == '\0') {
+                header.RetryAfterSeconds = (seconds < UINT32_MAX) ? (uint32_t)seconds : UINT32_MAX;
+            }
+        } else if (HeaderNameIs(p, nameLength, "Connection")) {
+            if (HeaderValueHas(fieldValue, "close")) {
+                header.KeepAlive = false;
+            } else if (HeaderValueHas(fieldValue, "keep-alive")) {
+                header.KeepAlive = true;
+            }
+        } else if (HeaderNameIs(p, nameLength, "Transfer-Encoding")) {
+            // A TAM knows the length of each message it sends, so chunked
+            // responses are not supported.
+            if (!HeaderValueHas(fieldValue, "identity")) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Receive one response from a connection.  The body is received straight
+// into the buffer handed back to the caller, apart from any bytes that
+// arrived along with the header.
+static teep_error_code_t ReceiveResponse(
+    _Inout_ HttpConnection* connection,
+    _Out_ HttpPoolResponse* response,
+    _Out_ bool* receivedAny,
+    _Out_ bool* keepAlive)
+{
+    memset(response, 0, sizeof(*response));
+    *receivedAny = (connection->End > connection->Start);
+    *keepAlive = false;
+
+    HttpResponseHeader header;
+    for (;;) {
+        // Find the end of the header.
+        const char* headerEnd = nullptr;
+        size_t searched = 0;
+        for (;;) {
+            const char* text = connection->Received + connection->Start;
+            size_t length = connection->End - connection->Start;
+            for (size_t i = (searched >= 3) ? searched - 3 : 0; i + 4 <= length; i++) {
+                if (memcmp(text + i, "\r\n\r\n", 4) == 0) {
+                    headerEnd = text + i + 4;
+                    break;
+                }
+            }
+            if (headerEnd != nullptr) {
+                break;
+            }
+            searched = length;
+            if (FillReceiveBuffer(connection) <= 0) {
+                return TEEP_ERR_TEMPORARY_ERROR;
+            }
+            *receivedAny = true;
+        }
+
+        const char* text = connection->Received + connection->Start;
+        if (!ParseResponseHeader(text, headerEnd - text, header)) {
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+        connection->Start = headerEnd - connection->Received;
+
+        // Skip interim responses such as 100 Continue.
+        if (header.StatusCode >= 200) {
+            break;
+        }
+    }
+
+    bool untilClose = false;
+    uint64_t length = header.ContentLength;
+    if (header.StatusCode == 204 || header.StatusCode == 304) {
+        length = 0;
+    } else if (!header.HasContentLength) {
+        untilClose = true;
+        header.KeepAlive = false;
+    }
+    if (length > HTTP_POOL_MAX_BODY_SIZE) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+
+    size_t capacity = untilClose ? HTTP_POOL_UNTIL_CLOSE_CHUNK_SIZE : (size_t)length;
+    size_t buffered = connection->End - connection->Start;
+    if (buffered > capacity) {
+        if (untilClose) {
+            capacity = buffered;
+        } else {
+            buffered = capacity;
+        }
+    }
+    char* body = (char*)malloc(capacity + 1);
+    char* mediaType = (char*)malloc(header.MediaType.size() + 1);
+    if (body == nullptr || mediaType == nullptr) {
+        free(body);
+        free(mediaType);
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    memcpy(mediaType, header.MediaType.c_str(), header.MediaType.size() + 1);
+
+    // Take whatever part of the body came with the header, then receive
+    // the rest.
+    memcpy(body, connection->Received + connection->Start, buffered);
+    connection->Start += buffered;
+    size_t received = buffered;
+    bool complete = !untilClose && (received == capacity);
+    while (!complete) {
+        if (received == capacity) {
+            // A body received until close is held to the same limit as
+            // one with a Content-Length.
+            if (capacity >= HTTP_POOL_MAX_BODY_SIZE) {
+                char extra;
+                complete = (ReceiveBytes(connection->Socket, &extra, 1) == 0);
+                break;
+            }
+            size_t larger = (capacity < HTTP_POOL_MAX_BODY_SIZE / 2) ? 2 * capacity : HTTP_POOL_MAX_BODY_SIZE;
+            char* grown = (char*)realloc(body, larger + 1);
+            if (grown == nullptr) {
+                break;
+            }
+            body = grown;
+            capacity = larger;
+        }
+        int count = ReceiveBytes(connection->Socket, body + received, capacity - received);
+        if (count <= 0) {
+            complete = (count == 0 && untilClose);
+            break;
+        }
+        received += count;
+        complete = !untilClose && (received == capacity);
+    }
+    if (!complete) {
+        free(body);
+        free(mediaType);
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    body[received] = '\0';
+
+    response->StatusCode = header.StatusCode;
+    response->MediaType = mediaType;
+    response->Body = body;
+    response->BodyLength = received;
+    response->RetryAfterSeconds = header.RetryAfterSeconds;
+    *keepAlive = header.KeepAlive;
+    return TEEP_ERR_SUCCESS;
+}
+
+void HttpPoolFreeResponse(_Inout_ HttpPoolResponse* response)
+{
+    free(response->Body);
+    free(response->MediaType);
+    memset(response, 0, sizeof(*response));
+}
+
+// Send requests, each a header and a body, and receive their responses.
+static teep_error_code_t ExchangeRequests(
+    _In_z_ const char* authority,
+    _In_ const std::vector<std::string>& headers,
+    _In_reads_(count) const HttpPoolRequest* requests,
+    size_t count,
+    bool idempotent,
+    _Out_writes_(count) HttpPoolResponse* responses)
+{
+    memset(responses, 0, count * sizeof(*responses));
+
+    // A server may close a connection once it has answered some of the
+    // requests on it, or while it sits idle in the pool, and not say so.
+    // Requests never written in full are sent again on a new connection,
+    // as long as each try gets some answered, or for a pooled connection,
+    // once.  A request that was written but not answered may have been
+    // acted on, so it is only sent again if it is idempotent.
+    bool retried = false;
+    bool written = false; // Whether any request was written in full.
+    size_t next = 0;      // First request not yet answered.
+    teep_error_code_t result = TEEP_ERR_SUCCESS;
+    while (next < count) {
+        HttpConnection* connection = AcquireConnection(authority);
+        if (connection == nullptr) {
+            result = TEEP_ERR_TEMPORARY_ERROR;
+            break;
+        }
+        size_t first = next;
+
+        // Write the unanswered requests back to back, each body straight
+        // from the caller's buffer.
+        std::vector<HttpBuffer> buffers((count - next) * 2);
+        for (size_t i = next; i < count; i++) {
+            HttpBuffer* pair = &buffers[(i - next) * 2];
+            HTTP_BUFFER_DATA(pair[0]) = (char*)headers[i].data();
+            HTTP_BUFFER_LENGTH(pair[0]) = headers[i].size();
+            HTTP_BUFFER_DATA(pair[1]) = (char*)requests[i].Body;
+            HTTP_BUFFER_LENGTH(pair[1]) = (requests[i].Body != nullptr) ? requests[i].BodyLength : 0;
+        }
+        size_t buffersSent;
+        SendBuffers(connection->Socket, buffers, &buffersSent);
+        size_t unwritten = first + buffersSent / 2; // First request not written in full.
+        if (unwritten > first) {
+            written = true;
+        }
+
+        bool keepAlive = true;
+        bool receivedAny = false;
+        result = TEEP_ERR_SUCCESS;
+        while (keepAlive && next < unwritten) {
+            result = ReceiveResponse(connection, &responses[next], &receivedAny, &keepAlive);
+            if (result != TEEP_ERR_SUCCESS) {
+                break;
+            }
+            next++;
+        }
+        if (result == TEEP_ERR_SUCCESS && next < count) {
+            result = TEEP_ERR_TEMPORARY_ERROR;
+        }
+        bool resend = (next == unwritten) || (idempotent && !receivedAny);
+        if (result != TEEP_ERR_SUCCESS && resend) {
+            if (next > first) {
+                result = TEEP_ERR_SUCCESS;
+            } else if (connection->Reused && !retried) {
+                retried = true;
+                result = TEEP_ERR_SUCCESS;
+            }
+        }
+
+        if (result == TEEP_ERR_SUCCESS && keepAlive && next == count && connection->Start == connection->End) {
+            ReleaseConnection(authority, connection);
+        } else {
+            CloseConnection(connection);
+        }
+        if (result != TEEP_ERR_SUCCESS) {
+            break;
+        }
+    }
+
+    if (result != TEEP_ERR_SUCCESS) {
+        for (size_t i = 0; i < next; i++) {
+            HttpPoolFreeResponse(&responses[i]);
+        }
+
+        // Once the server may have acted on a request, trying the whole
+        // call again could repeat it.
+        if (written && !idempotent) {
+            result = TEEP_ERR_PERMANENT_ERROR;
+        }
+    }
+    return result;
+}
+
+teep_error_code_t HttpPoolPost(
+    _In_z_ const char* authority,
+    _In_z_ const char* path,
+    _In_z_ const char* acceptMediaType,
+    _In_reads_(count) const HttpPoolRequest* requests,
+    size_t count,
+    _Out_writes_(count) HttpPoolResponse* responses)
+{
+    std::vector<std::string> headers(count);
+    for (size_t i = 0; i < count; i++) {
+        char contentLength[32];
+        snprintf(contentLength, sizeof(contentLength), "%zu", requests[i].BodyLength);
+        headers[i] = std::string("POST ") + path + " HTTP/1.1\r\n" +
+                     "Host: " + authority + "\r\n" +
+                     "User-Agent: " HTTP_POOL_USER_AGENT "\r\n" +
+                     "Accept: " + acceptMediaType + "\r\n";
+        if (requests[i].MediaType != nullptr) {
+            headers[i] += std::string("Content-Type: ") + requests[i].MediaType + "\r\n";
+        }
+        headers[i] += std::string("Content-Length: ") + contentLength + "\r\n\r\n";
+    }
+    return ExchangeRequests(authority, headers, requests, count, false, responses);
+}
+
+teep_error_code_t HttpPoolGetRange(
+    _In_z_ const char* authority,
+    _In_z_ const char* path,
+    uint64_t offset,
+    size_t length,
+    _Out_ HttpPoolResponse* response)
+{
+    if (length == 0) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    char range[64];
+    snprintf(range, sizeof(range), "bytes=%llu-%llu", (unsigned long long)offset, (unsigned long long)(offset + length - 1));
+    std::vector<std::string> headers(1);
+    headers[0] = std::string("GET ") + path + " HTTP/1.1\r\n" +
+                 "Host: " + authority + "\r\n" +
+                 "User-Agent: " HTTP_POOL_USER_AGENT "\r\n" +
+                 "Range: " + range + "\r\n\r\n";
+    HttpPoolRequest request = { nullptr, nullptr, 0 };
+    return ExchangeRequests(authority, headers, &request, 1, true, response);
+}
+
+uint32_t HttpPoolGetBackoffMilliseconds(unsigned int failedTries, uint32_t retryAfterSeconds)
+{
+    static thread_local std::minstd_rand random(std::random_device{}());
+
+    uint64_t ceiling = HTTP_POOL_BACKOFF_BASE_MILLISECONDS;
+    for (unsigned int i = 1; i < failedTries && ceiling < HTTP_POOL_BACKOFF_MAX_MILLISECONDS; i++) {
+        ceiling *= 2;
+    }
+    if (ceiling > HTTP_POOL_BACKOFF_MAX_MILLISECONDS) {
+        ceiling = HTTP_POOL_BACKOFF_MAX_MILLISECONDS;
+    }
+
+    // Spread the agents out over at least as long again as the TAM asked
+    // them to wait.
+    uint64_t floor = retryAfterSeconds * 1000ULL;
+    uint64_t spread = (floor > ceiling) ? floor : ceiling;
+    uint64_t backoff = floor + std::uniform_int_distribution<uint64_t>(0, spread)(random);
+    return (backoff < UINT32_MAX) ? (uint32_t)backoff : UINT32_MAX;
+}
+
+teep_error_code_t HttpPoolPostWithBackoff(
+    _In_z_ const char* authority,
+    _In_z_ const char* path,
+    _In_z_ const char* acceptMediaType,
+    _In_reads_(count) const HttpPoolRequest* requests,
+    size_t count,
+    _Out_writes_(count) HttpPoolResponse* responses)
+{
+    memset(responses, 0, count * sizeof(*responses));
+
+    std::vector<size_t> pending(count); // Requests not yet answered.
+    for (size_t i = 0; i < count; i++) {
+        pending[i] = i;
+    }
+    teep_error_code_t result = TEEP_ERR_SUCCESS;
+    for (unsigned int tries = 1; !pending.empty(); tries++) {
+        std::vector<HttpPoolRequest> sent;
+        for (size_t i : pending) {
+            sent.push_back(requests[i]);
+        }
+        std::vector<HttpPoolResponse> received(sent.size());
+        result = HttpPoolPost(authority, path, acceptMediaType, sent.data(), sent.size(), received.data());
+        bool lastTry = (tries == HTTP_POOL_MAX_TRIES);
+        if (result != TEEP_ERR_SUCCESS && (result != TEEP_ERR_TEMPORARY_ERROR || lastTry)) {
+            break;
+        }
+
+        // Keep the answers, apart from those asking to try again later.
+        uint32_t retryAfterSeconds = 0;
+        std::vector<size_t> refused;
+        for (size_t j = 0; j < received.size() && result == TEEP_ERR_SUCCESS; j++) {
+            if (received[j].StatusCode == 503 && !lastTry) {
+                refused.push_back(pending[j]);
+                if (received[j].RetryAfterSeconds > retryAfterSeconds) {
+                    retryAfterSeconds = received[j].RetryAfterSeconds;
+                }
+                HttpPoolFreeResponse(&received[j]);
+            } else {
+                responses[pending[j]] = received[j];
+            }
+        }
+        if (result == TEEP_ERR_SUCCESS) {
+            pending.swap(refused);
+        }
+        if (pending.empty()) {
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(g_HttpPool.Lock);
+            g_HttpPool.Retries += pending.size();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(HttpPoolGetBackoffMilliseconds(tries, retryAfterSeconds)));
+    }
+
+    if (result != TEEP_ERR_SUCCESS) {
+        for (size_t i = 0; i < count; i++) {
+            HttpPoolFreeResponse(&responses[i]);
+        }
+    }
+    return result;
+}
+
+teep_error_code_t HttpParseUri(
+    _In_z_ const char* uri,
+    _Out_writes_z_(authoritySize) char* authority,
+    size_t authoritySize,
+    _Out_writes_z_(pathSize) char* path,
+    size_t pathSize)
+{
+    const char* scheme = "http://";
+    size_t schemeLength = strlen(scheme);
+    if (strlen(uri) < schemeLength || !HeaderNameIs(uri, schemeLength, scheme)) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    const char* start = uri + schemeLength;
+    size_t authorityLength = strcspn(start, "/?#");
+    if (authorityLength == 0) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+
+    std::string hostPort(start, authorityLength);
+    size_t colon = hostPort.rfind(':');
+    size_t bracket = hostPort.rfind(']');
+    if (colon == std::string::npos || (bracket != std::string::npos && colon < bracket)) {
+        hostPort += ":" HTTP_DEFAULT_PORT;
+    }
+
+    std::string target = start + authorityLength;
+    size_t fragment = target.find('#');
+    if (fragment != std::string::npos) {
+        target.resize(fragment);
+    }
+    if (target.empty() || target[0] != '/') {
+        target.insert(0, "/");
+    }
+
+    if (hostPort.size() >= authoritySize || target.size() >= pathSize) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    memcpy(authority, hostPort.c_str(), hostPort.size() + 1);
+    memcpy(path, target.c_str(), target.size() + 1);
+    return TEEP_ERR_SUCCESS;
+}
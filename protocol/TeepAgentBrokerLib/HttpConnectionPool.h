@@ -0,0 +1,106 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+// A portable HTTP/1.1 client that keeps connections to each TAM authority
+// open between calls, so a TEEP exchange pays for one TCP handshake
+// instead of one per message.
+
+#define HTTP_POOL_USER_AGENT "TEEP Test"
+#define HTTP_POOL_MAX_IDLE_CONNECTIONS 4    // Per authority.
+#define HTTP_POOL_RECEIVE_TIMEOUT_SECONDS 30
+#define HTTP_POOL_HEADER_BUFFER_SIZE 4096   // Largest response header accepted.
+#define HTTP_POOL_MAX_BODY_SIZE (64 * 1024 * 1024) // Largest response body accepted.
+
+// Backoff between tries of a request the TAM turned away, or could not be
+// sent, which doubles with each try up to the maximum.
+#define HTTP_POOL_MAX_TRIES 5
+#define HTTP_POOL_BACKOFF_BASE_MILLISECONDS 100
+#define HTTP_POOL_BACKOFF_MAX_MILLISECONDS (30 * 1000)
+
+typedef struct {
+    const char* MediaType; // Content-Type, or nullptr for an empty POST.
+    const char* Body;
+    size_t BodyLength;
+} HttpPoolRequest;
+
+typedef struct {
+    int StatusCode;
+    char* MediaType; // Empty if the response had no Content-Type.
+    char* Body;      // NUL-terminated, and never null on success.
+    size_t BodyLength;
+    uint32_t RetryAfterSeconds; // From a Retry-After in seconds, or 0.
+} HttpPoolResponse;
+
+// POST each request to a path at an authority ("host:port"), writing them
+// all to one pooled connection before reading any response.  On success
+// the caller owns each response's buffers, which were allocated with
+// malloc and can be freed with HttpPoolFreeResponse or handed on as is.
+// The body is received straight into its own buffer.
+//
+// A pooled connection the server closed while idle is replaced without
+// the caller noticing, and requests that could not be written because the
+// server closed the connection after an earlier response are sent on a
+// new one.  A request that was written but not answered is not sent
+// again, since the server may have acted on it: the call fails, with
+// TEEP_ERR_PERMANENT_ERROR once any request has been written, so that it
+// is not tried again as a whole either.
+teep_error_code_t HttpPoolPost(
+    _In_z_ const char* authority,
+    _In_z_ const char* path,
+    _In_z_ const char* acceptMediaType,
+    _In_reads_(count) const HttpPoolRequest* requests,
+    size_t count,
+    _Out_writes_(count) HttpPoolResponse* responses);
+
+void HttpPoolFreeResponse(_Inout_ HttpPoolResponse* response);
+
+// GET up to length bytes of the resource at a path, starting at offset,
+// on a pooled connection, which is sent again if the connection closes
+// before it is answered.  A server that honors the Range answers 206
+// with just those bytes, or 416 if offset is past the end; one that does
+// not answers 200 with the whole resource.
+teep_error_code_t HttpPoolGetRange(
+    _In_z_ const char* authority,
+    _In_z_ const char* path,
+    uint64_t offset,
+    size_t length,
+    _Out_ HttpPoolResponse* response);
+
+// POST as HttpPoolPost does, but when the TAM is overloaded, try again
+// instead of failing: requests answered with 503, or all of them if none
+// could be sent, are sent again after a backoff.  A request still turned
+// away after HTTP_POOL_MAX_TRIES is returned with its 503.
+teep_error_code_t HttpPoolPostWithBackoff(
+    _In_z_ const char* authority,
+    _In_z_ const char* path,
+    _In_z_ const char* acceptMediaType,
+    _In_reads_(count) const HttpPoolRequest* requests,
+    size_t count,
+    _Out_writes_(count) HttpPoolResponse* responses);
+
+// Get how long to wait before trying again after a given number of tries
+// failed, the last with a given Retry-After.  The wait is no shorter than
+// the Retry-After, and random beyond that, so that a fleet of agents
+// turned away together do not all come back together.
+uint32_t HttpPoolGetBackoffMilliseconds(unsigned int failedTries, uint32_t retryAfterSeconds);
+
+// Close every idle connection.
+void HttpPoolCloseIdleConnections(void);
+
+// Get the number of connections opened so far, and of requests sent again
+// after a backoff.
+uint64_t HttpPoolGetConnectionsOpened(void);
+uint64_t HttpPoolGetRetries(void);
+
+// Split an "http://" URI into its authority, with the default port added
+// if it has none, and its path.
+teep_error_code_t HttpParseUri(
+    _In_z_ const char* uri,
+    _Out_writes_z_(authoritySize) char* authority,
+    size_t authoritySize,
+    _Out_writes_z_(pathSize) char* path,
+    size_t pathSize);
@@ -0,0 +1,61 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <stdlib.h>
+#include <string.h>
+#include "HttpConnectionPool.h"
+#include "TeepAgentLib.h"
+
+// Payloads are fetched with ranged GETs on the same pooled connections
+// used to reach the TAM.  The agent checks what arrives against the image
+// digest in the manifest, so nothing here needs to be trusted.
+teep_error_code_t TeepAgentFetchPayload(
+    _In_z_ const char* uri,
+    uint64_t offset,
+    _Out_writes_bytes_to_(bufferSize, *bytesRead) uint8_t* buffer,
+    size_t bufferSize,
+    _Out_ size_t* bytesRead)
+{
+    *bytesRead = 0;
+    char authority[266];
+    char path[256];
+    teep_error_code_t result = HttpParseUri(uri, authority, sizeof(authority), path, sizeof(path));
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    HttpPoolResponse response;
+    result = HttpPoolGetRange(authority, path, offset, bufferSize, &response);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    const char* body = response.Body;
+    size_t length = response.BodyLength;
+    switch (response.StatusCode) {
+    case 206:
+        break;
+    case 200:
+        // The server sent the whole payload, so take the part asked for.
+        if (offset >= length) {
+            length = 0;
+        } else {
+            body += offset;
+            length -= (size_t)offset;
+        }
+        break;
+    case 416:
+        length = 0;
+        break;
+    default:
+        result = (response.StatusCode >= 500) ? TEEP_ERR_TEMPORARY_ERROR : TEEP_ERR_PERMANENT_ERROR;
+        break;
+    }
+    if (result == TEEP_ERR_SUCCESS) {
+        if (length > bufferSize) {
+            length = bufferSize;
+        }
+        memcpy(buffer, body, length);
+        *bytesRead = length;
+    }
+    HttpPoolFreeResponse(&response);
+    return result;
+}
@@ -0,0 +1,57 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include "HttpConnectionPool.h"
+#include "PushClient.h"
+#include "../TeepAgentLib/TeepAgentLib.h"
+#include "../TeepTransport.h"
+
+teep_error_code_t PushWaitForWake(_In_z_ const char* tamUri, _Out_ int* woken)
+{
+    *woken = 0;
+    char authority[266];
+    char path[256];
+    teep_error_code_t result = HttpParseUri(tamUri, authority, sizeof(authority), path, sizeof(path));
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    char pushPath[sizeof(path) + sizeof(TEEP_PUSH_PATH)];
+    snprintf(pushPath, sizeof(pushPath), "%s%s", path, TEEP_PUSH_PATH);
+
+    // A TAM holding too many waits says when to come back.  Each try gets
+    // a new request, since the TAM refuses one it has seen before.
+    HttpPoolResponse response;
+    for (unsigned int tries = 1;; tries++) {
+        char pushRequest[TEEP_PUSH_MAX_REQUEST_SIZE];
+        size_t pushRequestLength;
+        result = TeepAgentComposePushRequest(pushRequest, sizeof(pushRequest), &pushRequestLength);
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+        HttpPoolRequest request = { TEEP_PUSH_MEDIA_TYPE, pushRequest, pushRequestLength };
+        result = HttpPoolPost(authority, pushPath, TEEP_PUSH_MEDIA_TYPE, &request, 1, &response);
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+        if (response.StatusCode != 503 || tries == HTTP_POOL_MAX_TRIES) {
+            break;
+        }
+        uint32_t retryAfterSeconds = response.RetryAfterSeconds;
+        HttpPoolFreeResponse(&response);
+        std::this_thread::sleep_for(std::chrono::milliseconds(HttpPoolGetBackoffMilliseconds(tries, retryAfterSeconds)));
+    }
+    int statusCode = response.StatusCode;
+    HttpPoolFreeResponse(&response);
+    switch (statusCode) {
+    case 200:
+        *woken = 1;
+        return TEEP_ERR_SUCCESS;
+    case 204:
+        return TEEP_ERR_SUCCESS;
+    default:
+        return (statusCode >= 500) ? TEEP_ERR_TEMPORARY_ERROR : TEEP_ERR_PERMANENT_ERROR;
+    }
+}
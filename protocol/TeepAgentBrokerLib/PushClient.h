@@ -0,0 +1,19 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // Wait on a TAM's push channel, described in TeepTransport.h, until
+    // the TAM wakes this device or ends the wait with nothing to report.
+    // The agent signs the request, and the TAM knows the device by the
+    // agent's key.  The wait uses a pooled HTTP connection, whatever
+    // transport carries TEEP messages.
+    teep_error_code_t PushWaitForWake(_In_z_ const char* tamUri, _Out_ int* woken);
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,311 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef USE_TCP
+#include <assert.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <deque>
+#include <map>
+#include <string>
+extern "C" {
+#include "TeepSession.h"
+#include "HttpClient.h"
+#include "TcpClient.h"
+};
+#include "TeepAgentBrokerLib.h"
+#include "buffer_pool.h"
+#include "tcp_frame.h"
+
+#define TCP_URI_SCHEME "tcp://"
+
+TeepAgentSession g_Session = { 0 };
+
+typedef struct {
+    teep_buffer_t Buffer;
+    size_t Length;
+} TcpInboundMessage;
+
+static struct {
+    std::string Authority; // What Socket is connected to.
+    int Socket = -1;
+    teep_frame_reader_t Reader;
+    uint32_t LastSessionId;
+
+    // Messages received for each session but not yet asked for.
+    std::map<uint32_t, std::deque<TcpInboundMessage>> Inbound;
+} g_TcpClient;
+
+static uint32_t g_SessionId;      // Of g_Session.
+static teep_buffer_t g_Outbound; // Holds g_Session.Basic.OutboundMessage.
+
+void DisconnectFromTcpServer(void)
+{
+    if (g_TcpClient.Socket >= 0) {
+        close(g_TcpClient.Socket);
+        g_TcpClient.Socket = -1;
+    }
+    g_TcpClient.Authority.clear();
+    teep_frame_reader_free(&g_TcpClient.Reader);
+    for (auto& [sessionId, messages] : g_TcpClient.Inbound) {
+        for (TcpInboundMessage& message : messages) {
+            teep_buffer_release(&message.Buffer);
+        }
+    }
+    g_TcpClient.Inbound.clear();
+}
+
+// Connect to the TAM named by a URI, unless already connected to it.
+static teep_error_code_t ConnectToTcpServer(_In_z_ const char* tamUri)
+{
+    size_t schemeLength = strlen(TCP_URI_SCHEME);
+    if (strncmp(tamUri, TCP_URI_SCHEME, schemeLength) != 0) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    std::string authority(tamUri + schemeLength, strcspn(tamUri + schemeLength, "/"));
+    if (authority.empty()) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    if (g_TcpClient.Socket >= 0 && authority == g_TcpClient.Authority) {
+        return TEEP_ERR_SUCCESS;
+    }
+    DisconnectFromTcpServer();
+
+    std::string host = authority;
+    std::string port = TEEP_TCP_PORT;
+    size_t colon = host.rfind(':');
+    if (colon != std::string::npos && host.find(']', colon) == std::string::npos) {
+        port = host.substr(colon + 1);
+        host.resize(colon);
+    }
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    int s = -1;
+    for (struct addrinfo* ai = addresses; ai != nullptr; ai = ai->ai_next) {
+        s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s < 0) {
+            continue;
+        }
+        if (connect(s, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(s);
+        s = -1;
+    }
+    freeaddrinfo(addresses);
+    if (s < 0) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    int noDelay = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    g_TcpClient.Socket = s;
+    g_TcpClient.Authority = authority;
+    teep_frame_reader_init(&g_TcpClient.Reader);
+    return TEEP_ERR_SUCCESS;
+}
+
+// Send a framed message, with the body written straight from its buffer.
+static teep_error_code_t SendTcpMessage(uint32_t sessionId, _In_reads_(messageLength) const char* message, size_t messageLength)
+{
+    uint8_t header[TEEP_TCP_FRAME_HEADER_SIZE];
+    teep_frame_encode_header(header, sessionId, messageLength);
+    struct iovec vectors[2] = { { header, sizeof(header) }, { (void*)message, messageLength } };
+    struct iovec* next = vectors;
+    int count = (messageLength > 0) ? 2 : 1;
+    while (count > 0) {
+        ssize_t sent = writev(g_TcpClient.Socket, next, count);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            DisconnectFromTcpServer();
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+        while (count > 0 && (size_t)sent >= next->iov_len) {
+            sent -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0) {
+            next->iov_base = (char*)next->iov_base + sent;
+            next->iov_len -= sent;
+        }
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+static teep_error_code_t QueueInboundMessage(void* context, uint32_t sessionId, _Inout_ teep_buffer_t* message, size_t messageLength)
+{
+    TEEP_UNUSED(context);
+    g_TcpClient.Inbound[sessionId].push_back({ *message, messageLength });
+    return TEEP_ERR_SUCCESS;
+}
+
+// Wait for the next message on a session.  Messages for other sessions
+// that arrive first are kept until they are asked for.
+static teep_error_code_t ReceiveTcpMessage(uint32_t sessionId, _Out_ TcpInboundMessage* message)
+{
+    for (;;) {
+        auto it = g_TcpClient.Inbound.find(sessionId);
+        if (it != g_TcpClient.Inbound.end() && !it->second.empty()) {
+            *message = it->second.front();
+            it->second.pop_front();
+            if (it->second.empty()) {
+                g_TcpClient.Inbound.erase(it);
+            }
+            return TEEP_ERR_SUCCESS;
+        }
+        if (g_TcpClient.Socket < 0) {
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+
+        teep_io_vector_t vectors[2];
+        size_t count = teep_frame_reader_get_vectors(&g_TcpClient.Reader, vectors);
+        struct iovec iov[2];
+        for (size_t i = 0; i < count; i++) {
+            iov[i].iov_base = vectors[i].data;
+            iov[i].iov_len = vectors[i].length;
+        }
+        ssize_t received = readv(g_TcpClient.Socket, iov, (int)count);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0 ||
+            teep_frame_reader_consume(&g_TcpClient.Reader, received, QueueInboundMessage, nullptr) != TEEP_ERR_SUCCESS) {
+            DisconnectFromTcpServer();
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+    }
+}
+
+// Start a new session with an empty message.
+teep_error_code_t TeepAgentConnect(_In_z_ const char* tamUri, _In_z_ const char* acceptMediaType)
+{
+    TEEP_UNUSED(acceptMediaType);
+    teep_error_code_t result = ConnectToTcpServer(tamUri);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    // Create session state.
+    TeepAgentSession* session = &g_Session;
+    snprintf(session->TamUri, sizeof(session->TamUri), "%s", tamUri);
+    g_SessionId = ++g_TcpClient.LastSessionId;
+
+    result = SendTcpMessage(g_SessionId, nullptr, 0);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    TcpInboundMessage message;
+    result = ReceiveTcpMessage(g_SessionId, &message);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    if (message.Length == 0) {
+        teep_buffer_release(&message.Buffer);
+        return TEEP_ERR_SUCCESS; // Nothing to do.
+    }
+
+    // Hand the buffer over as is, to be freed once it has been processed.
+    assert(session->InboundMessage == nullptr);
+    session->InboundMessage = message.Buffer.data;
+    session->InboundMessageLength = message.Length;
+    snprintf(session->InboundMediaType, sizeof(session->InboundMediaType), "%s", TEEP_CBOR_MEDIA_TYPE);
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t TeepAgentQueueOutboundTeepMessage(
+    _In_ void* sessionHandle,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    TeepBasicSession* session = (TeepBasicSession*)sessionHandle;
+
+    assert(session->OutboundMessage == nullptr);
+    if (strcmp(mediaType, TEEP_CBOR_MEDIA_TYPE) != 0) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+
+    // Save message for later transmission after the ECALL returns.
+    teep_error_code_t result = teep_buffer_acquire(messageLength, &g_Outbound);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    memcpy(g_Outbound.data, message, messageLength);
+    snprintf(session->OutboundMediaType, sizeof(session->OutboundMediaType), "%s", mediaType);
+    session->OutboundMessage = g_Outbound.data;
+    session->OutboundMessageLength = messageLength;
+    printf("Sending %zd bytes...\n", messageLength);
+    return TEEP_ERR_SUCCESS;
+}
+
+// Start a new session whose first message is sent once the ECALL returns.
+teep_error_code_t TeepAgentConnectWithMessage(
+    _In_z_ const char* tamUri,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    teep_error_code_t result = ConnectToTcpServer(tamUri);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    // Create session state.
+    TeepAgentSession* session = &g_Session;
+    snprintf(session->TamUri, sizeof(session->TamUri), "%s", tamUri);
+    g_SessionId = ++g_TcpClient.LastSessionId;
+
+    return TeepAgentQueueOutboundTeepMessage(&session->Basic, mediaType, message, messageLength);
+}
+
+// The caller is responsible for freeing the returned buffer and media type
+// if non-null.
+const char* TeepAgentSendMessage(TeepAgentSession* session, char** pResponseMediaType, int* pResponseLength)
+{
+    *pResponseMediaType = nullptr;
+    *pResponseLength = 0;
+
+    teep_error_code_t result = SendTcpMessage(g_SessionId, session->Basic.OutboundMessage, session->Basic.OutboundMessageLength);
+    teep_buffer_release(&g_Outbound);
+    session->Basic.OutboundMessage = nullptr;
+    session->Basic.OutboundMessageLength = 0;
+    if (result != TEEP_ERR_SUCCESS) {
+        return nullptr;
+    }
+    session->Basic.OutboundMessagesSent++;
+
+    TcpInboundMessage message;
+    if (ReceiveTcpMessage(g_SessionId, &message) != TEEP_ERR_SUCCESS) {
+        return nullptr;
+    }
+    *pResponseMediaType = (char*)malloc(sizeof(TEEP_CBOR_MEDIA_TYPE));
+    if (*pResponseMediaType == nullptr) {
+        teep_buffer_release(&message.Buffer);
+        return nullptr;
+    }
+    memcpy(*pResponseMediaType, TEEP_CBOR_MEDIA_TYPE, sizeof(TEEP_CBOR_MEDIA_TYPE));
+
+    // An empty message means the TAM is done.
+    *pResponseLength = (int)message.Length;
+    return message.Buffer.data;
+}
+#endif
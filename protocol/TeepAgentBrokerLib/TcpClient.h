@@ -2,6 +2,16 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 
-int ConnectToTcpServer(const char* serverName);
-int HandleTcpMessage(void);
-void DisconnectFromTcpServer(void);
+// TEEP over TCP, framed as described in TeepTransport.h.  TeepAgentConnect
+// takes a "tcp://host[:port]" URI, and sessions with the same TAM share
+// one connection.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void DisconnectFromTcpServer(void);
+
+#ifdef __cplusplus
+};
+#endif
@@ -1,15 +1,55 @@
 // Copyright (c) TEEP contributors
 // SPDX-License-Identifier: MIT
-#include <direct.h>
 #include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <direct.h>
 #include <windows.h> // for Sleep()
+#else
+#include <sys/stat.h>
+#define _mkdir(path) mkdir(path, 0700)
+#define sprintf_s snprintf
+#define strcpy_s(dest, dest_sz, src) snprintf(dest, dest_sz, "%s", src)
+#endif
 #include "TeepAgentBrokerLib.h"
 #include "TeepSession.h"
+#include "HttpClient.h"
+#include "PushClient.h"
 #ifdef USE_TCP
 #include "TcpClient.h"
-#else
-#include "HttpClient.h"
 #endif
+#ifdef USE_COAP
+#include "CoapClient.h"
+#endif
+
+// Installed components are re-checked a piece at a time between waits for
+// the TAM, hashing at most this much each time.
+#define VERIFY_BYTES_PER_WAIT (4 * 1024 * 1024)
+
+// Inbound messages are passed to the agent in pieces of at most this
+// size, so the agent never needs to hold a whole Update at once.
+#define INBOUND_MESSAGE_CHUNK_SIZE (16 * 1024)
+
+static int ProcessInboundMessage(void)
+{
+    const char* message = g_Session.InboundMessage;
+    size_t remaining = g_Session.InboundMessageLength;
+    for (;;) {
+        size_t chunkLength = (remaining < INBOUND_MESSAGE_CHUNK_SIZE) ? remaining : INBOUND_MESSAGE_CHUNK_SIZE;
+        int isFinalChunk = (chunkLength == remaining);
+        int err = TeepAgentProcessTeepMessageChunk(
+            &g_Session,
+            g_Session.InboundMediaType,
+            message,
+            chunkLength,
+            isFinalChunk);
+        if (err != 0 || isFinalChunk) {
+            return err;
+        }
+        message += chunkLength;
+        remaining -= chunkLength;
+    }
+}
 
 static int HandleMessages(void)
 {
@@ -35,11 +75,7 @@ static int HandleMessages(void)
         }
 
         if (g_Session.InboundMessage != NULL) {
-            int err = TeepAgentProcessTeepMessage(
-                &g_Session,
-                g_Session.InboundMediaType,
-                g_Session.InboundMessage,
-                g_Session.InboundMessageLength);
+            int err = ProcessInboundMessage();
 
             free((void*)g_Session.InboundMessage);
             g_Session.InboundMessage = NULL;
@@ -84,6 +120,29 @@ int AgentBrokerUnrequestTA(
     return HandleMessages();
 }
 
+int AgentBrokerWaitForPolicyCheck(_In_z_ const char* tamUri)
+{
+    int complete;
+    teep_error_code_t verifyResult = TeepAgentVerifyInstalledComponents(VERIFY_BYTES_PER_WAIT, &complete);
+    if (verifyResult != TEEP_ERR_SUCCESS) {
+        printf("Error %d verifying installed components\n", verifyResult);
+    }
+
+    int woken;
+    int err = PushWaitForWake(tamUri, &woken);
+    if (err != 0 || !woken) {
+        return err;
+    }
+
+    // The TAM has new policy for this device.
+    err = TeepAgentRequestPolicyCheck(tamUri);
+    if (err != 0) {
+        return err;
+    }
+
+    return HandleMessages();
+}
+
 int StartAgentBroker(_In_z_ const char* dataDirectory, int simulatedTee, teep_signature_kind_t signatureKind, _Out_writes_opt_z_(256) char* publicKeyFilename)
 {
     // Create data directory if it doesn't already exist.
@@ -102,6 +161,10 @@ int StartAgentBroker(_In_z_ const char* dataDirectory, int simulatedTee, teep_si
     sprintf_s(directory, sizeof(directory), "%s/manifests", dataDirectory);
     _mkdir(directory);
 
+    // Make "objects" directory if it doesn't already exist.
+    sprintf_s(directory, sizeof(directory), "%s/objects", dataDirectory);
+    _mkdir(directory);
+
 #ifdef TEEP_USE_TEE
     int result = StartAgentTABroker(simulatedTee);
     return result;
@@ -118,6 +181,12 @@ int StartAgentBroker(_In_z_ const char* dataDirectory, int simulatedTee, teep_si
 void StopAgentBroker(void)
 {
     TeepAgentShutdown();
+#ifdef USE_TCP
+    DisconnectFromTcpServer();
+#endif
+#ifdef USE_COAP
+    CoapCloseSockets();
+#endif
 #ifdef TEEP_USE_TEE
     StopAgentTABroker();
 #endif
@@ -15,6 +15,13 @@ int AgentBrokerUnrequestTA(
 extern "C" {
 #endif
 
+// Wait on the TAM's push channel until it wakes this device, and then run
+// a policy check.  Returns 0 without a check if the wait ends with nothing
+// to report, in which case the caller simply waits again.  Before each
+// wait, a bounded part of the installed components is re-checked against
+// their digests.
+int AgentBrokerWaitForPolicyCheck(_In_z_ const char* tamUri);
+
 int StartAgentBroker(_In_z_ const char* data_directory, int simulated_tee, teep_signature_kind_t signatureKind, _Out_writes_opt_z_(256) char* public_key_filename);
 void StopAgentBroker(void);
 
@@ -23,4 +30,4 @@ void StopAgentBroker(void);
 #endif
 
 // Other prototypes are the same as in the TEE.
-#include "..\TeepAgentLib\TeepAgentLib.h"
+#include "../TeepAgentLib/TeepAgentLib.h"
@@ -0,0 +1,73 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef TEEP_USE_TEE
+#include <openenclave/enclave.h>
+#endif
+#include <string.h>
+#include "ChunkTree.h"
+
+#define CHUNK_TREE_LEAF_PREFIX 0x00
+#define CHUNK_TREE_NODE_PREFIX 0x01
+
+uint64_t ChunkTreeGetChunkCount(uint64_t imageSize, uint64_t chunkSize)
+{
+    return (imageSize + chunkSize - 1) / chunkSize;
+}
+
+teep_error_code_t ChunkTreeHashLeaf(
+    _In_ UsefulBufC chunk,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* leaf)
+{
+    const uint8_t prefix = CHUNK_TREE_LEAF_PREFIX;
+    teep_sha256_ctx_t ctx;
+    teep_error_code_t result = teep_sha256_init(&ctx);
+    if (result == TEEP_ERR_SUCCESS) {
+        result = teep_sha256_update(&ctx, UsefulBufC{ &prefix, 1 });
+    }
+    if (result == TEEP_ERR_SUCCESS) {
+        result = teep_sha256_update(&ctx, chunk);
+    }
+    if (result == TEEP_ERR_SUCCESS) {
+        result = teep_sha256_final(&ctx, leaf);
+    }
+    teep_sha256_free(&ctx);
+    return result;
+}
+
+static teep_error_code_t ChunkTreeHashNode(
+    _In_reads_(leafCount * TEEP_SHA256_SIZE) const uint8_t* leaves,
+    size_t leafCount,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* node)
+{
+    if (leafCount == 1) {
+        memcpy(node, leaves, TEEP_SHA256_SIZE);
+        return TEEP_ERR_SUCCESS;
+    }
+
+    // The left subtree covers the largest power of two below leafCount.
+    size_t split = 1;
+    while (split * 2 < leafCount) {
+        split *= 2;
+    }
+    uint8_t children[1 + 2 * TEEP_SHA256_SIZE];
+    children[0] = CHUNK_TREE_NODE_PREFIX;
+    teep_error_code_t result = ChunkTreeHashNode(leaves, split, children + 1);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    result = ChunkTreeHashNode(leaves + split * TEEP_SHA256_SIZE, leafCount - split, children + 1 + TEEP_SHA256_SIZE);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    return teep_compute_sha256(UsefulBufC{ children, sizeof(children) }, node);
+}
+
+teep_error_code_t ChunkTreeComputeRoot(
+    _In_ UsefulBufC leaves,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* root)
+{
+    if (leaves.len == 0 || (leaves.len % TEEP_SHA256_SIZE) != 0) {
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    return ChunkTreeHashNode((const uint8_t*)leaves.ptr, leaves.len / TEEP_SHA256_SIZE, root);
+}
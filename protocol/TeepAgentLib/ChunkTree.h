@@ -0,0 +1,27 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "common.h"
+
+// A chunk tree is a Merkle tree over the fixed-size chunks of an image,
+// built as in RFC 6962: each leaf is SHA-256(0x00 || chunk) and each
+// interior node is SHA-256(0x01 || left || right), with the left subtree
+// covering the largest power of two of leaves.  A manifest carries only
+// the chunk size and the root, and the leaves are fetched separately, so
+// each chunk can be checked as it arrives and a transfer resumed after
+// the last good one.
+
+#define CHUNK_TREE_MIN_CHUNK_SIZE 1024
+#define CHUNK_TREE_MAX_CHUNK_SIZE (16 * 1024 * 1024)
+
+// Number of chunks in an image of the given size.
+uint64_t ChunkTreeGetChunkCount(uint64_t imageSize, uint64_t chunkSize);
+
+teep_error_code_t ChunkTreeHashLeaf(
+    _In_ UsefulBufC chunk,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* leaf);
+
+// Compute the root over leaves, which holds the leaf hashes back to back.
+teep_error_code_t ChunkTreeComputeRoot(
+    _In_ UsefulBufC leaves,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* root);
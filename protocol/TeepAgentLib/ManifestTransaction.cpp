@@ -0,0 +1,494 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef TEEP_USE_TEE
+#include <openenclave/enclave.h>
+#endif
+#include <algorithm>
+#include <string.h>
+#ifndef TEEP_USE_TEE
+#include <atomic>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "ManifestTransaction.h"
+#include "ObjectStore.h"
+
+#define TEMP_FILE_SUFFIX ".tmp"
+#define PARTIAL_FILE_SUFFIX ".partial"
+
+// Flush a file's data to stable storage.  Returns 0 on success.
+static int SyncFile(_In_ FILE* fp)
+{
+    if (fflush(fp) != 0) {
+        return -1;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(fp));
+#else
+    return fsync(fileno(fp));
+#endif
+}
+
+// Make renames and deletions within a directory durable.  NTFS journals
+// directory updates itself, so this only matters on POSIX filesystems.
+static void SyncDirectory(_In_ const filesystem::path& directory)
+{
+#ifdef _WIN32
+    TEEP_UNUSED(directory);
+#else
+    int fd = open(directory.string().c_str(), O_RDONLY);
+    if (fd >= 0) {
+        (void)fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+#ifdef TEEP_USE_TEE
+static uint64_t g_TransactionCount = 0;
+#else
+static std::atomic<uint64_t> g_TransactionCount(0);
+#endif
+
+ManifestTransaction::ManifestTransaction()
+{
+    _tempSuffix = "." + std::to_string(g_TransactionCount++) + TEMP_FILE_SUFFIX;
+    ObjectStoreOpenTransaction();
+}
+
+ManifestTransaction::~ManifestTransaction()
+{
+    Discard();
+    ObjectStoreCloseTransaction();
+}
+
+// Close a staged write's file, removing it unless keepFile, and give up
+// any claim on it.  No other write uses the same file.
+void ManifestTransaction::ReleaseWrite(_Inout_ PendingWrite& write, bool keepFile)
+{
+    if (write.File != nullptr) {
+        fclose(write.File);
+        write.File = nullptr;
+    }
+    if (!keepFile) {
+        std::error_code ec;
+        filesystem::remove(write.TempPath, ec);
+    }
+    if (write.Claimed) {
+        ObjectStoreReleasePartial(write.TempPath);
+        write.Claimed = false;
+    }
+}
+
+void ManifestTransaction::Discard()
+{
+    AbortStream();
+    for (PendingWrite& write : _writes) {
+        ReleaseWrite(write, false);
+    }
+    _writes.clear();
+    _links.clear();
+    _deletes.clear();
+}
+
+bool ManifestTransaction::HasPendingWrite(_In_ const filesystem::path& objectPath) const
+{
+    for (const PendingWrite& write : _writes) {
+        if (write.FinalPath == objectPath) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drop any earlier staged write to the same entry, so that the last
+// operation staged on an entry is the one that takes effect.  An object
+// written only for the dropped entry is collected after the commit.
+void ManifestTransaction::CancelLink(_In_ const filesystem::path& filename)
+{
+    _links.erase(
+        std::remove_if(_links.begin(), _links.end(), [&](const PendingLink& link) { return link.EntryPath == filename; }),
+        _links.end());
+}
+
+teep_error_code_t ManifestTransaction::StageWrite(
+    _In_ const filesystem::path& filename,
+    _In_ UsefulBufC contents,
+    _Inout_ std::ostream& errorMessage)
+{
+    CancelLink(filename);
+    _deletes.erase(std::remove(_deletes.begin(), _deletes.end(), filename), _deletes.end());
+
+    PendingLink link;
+    link.EntryPath = filename;
+    teep_error_code_t result = ObjectStoreGetObjectPath(contents, link.ObjectPath);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    // Contents already in the store, or already staged by this
+    // transaction, only need a new entry.
+    std::error_code ec;
+    if (!filesystem::exists(link.ObjectPath, ec) && !HasPendingWrite(link.ObjectPath)) {
+        PendingWrite write;
+        write.FinalPath = link.ObjectPath;
+        write.TempPath = link.ObjectPath;
+        write.TempPath += _tempSuffix;
+        filesystem::create_directories(write.FinalPath.parent_path(), ec);
+        write.File = fopen(write.TempPath.string().c_str(), "wb");
+        if (write.File == nullptr) {
+            errorMessage << "Could not create " << write.TempPath.string();
+            return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+        }
+        if (fwrite(contents.ptr, 1, contents.len, write.File) != contents.len) {
+            fclose(write.File);
+            filesystem::remove(write.TempPath, ec);
+            errorMessage << "Could not write " << write.TempPath.string();
+            return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+        }
+        _writes.push_back(write);
+    }
+
+    _links.push_back(link);
+    return TEEP_ERR_SUCCESS;
+}
+
+void ManifestTransaction::StageDelete(_In_ const filesystem::path& filename)
+{
+    CancelLink(filename);
+    _deletes.push_back(filename);
+}
+
+// Start staging an entry for the object with the given digest.  Returns
+// true if the object is already stored or staged, in which case only the
+// entry is staged and nothing needs to be streamed.
+bool ManifestTransaction::PrepareStream(
+    _In_ const filesystem::path& filename,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    _Out_ PendingLink& link)
+{
+    AbortStream();
+    CancelLink(filename);
+    _deletes.erase(std::remove(_deletes.begin(), _deletes.end(), filename), _deletes.end());
+
+    link.EntryPath = filename;
+    TeepAgentMakeObjectFilename(link.ObjectPath, digest, TEEP_SHA256_SIZE);
+
+    std::error_code ec;
+    if (filesystem::exists(link.ObjectPath, ec) || HasPendingWrite(link.ObjectPath)) {
+        _links.push_back(link);
+        return true;
+    }
+    filesystem::create_directories(link.ObjectPath.parent_path(), ec);
+    memcpy(_streamDigest, digest, TEEP_SHA256_SIZE);
+    return false;
+}
+
+teep_error_code_t ManifestTransaction::BeginStream(
+    _In_ const filesystem::path& filename,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    _Out_ bool* needed,
+    _Inout_ std::ostream& errorMessage)
+{
+    PendingLink link;
+    *needed = !PrepareStream(filename, digest, link);
+    if (!*needed) {
+        return TEEP_ERR_SUCCESS;
+    }
+    return OpenStream(link, errorMessage);
+}
+
+// Start a stream into a temporary file of this transaction's own.
+teep_error_code_t ManifestTransaction::OpenStream(_In_ const PendingLink& link, _Inout_ std::ostream& errorMessage)
+{
+    std::error_code ec;
+    _stream.FinalPath = link.ObjectPath;
+    _stream.TempPath = link.ObjectPath;
+    _stream.TempPath += _tempSuffix;
+    _stream.Claimed = false;
+    _stream.File = fopen(_stream.TempPath.string().c_str(), "wb");
+    if (_stream.File == nullptr) {
+        errorMessage << "Could not create " << _stream.TempPath.string();
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    teep_error_code_t result = teep_sha256_init(&_streamHash);
+    if (result != TEEP_ERR_SUCCESS) {
+        fclose(_stream.File);
+        filesystem::remove(_stream.TempPath, ec);
+        return result;
+    }
+    _streamLink = link;
+    _streaming = true;
+    _streamResumable = false;
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t ManifestTransaction::BeginResumableStream(
+    _In_ const filesystem::path& filename,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    _Out_ bool* needed,
+    _Inout_ std::ostream& errorMessage)
+{
+    PendingLink link;
+    *needed = !PrepareStream(filename, digest, link);
+    if (!*needed) {
+        return TEEP_ERR_SUCCESS;
+    }
+
+    filesystem::path partialPath;
+    ObjectStoreGetPartialPath(digest, PARTIAL_FILE_SUFFIX, partialPath);
+    if (!ObjectStoreClaimPartial(partialPath)) {
+        // Another stream is writing the same contents into the partial
+        // file, so this one writes its own, which cannot be resumed.
+        return OpenStream(link, errorMessage);
+    }
+
+    // The file is opened by ResumeStream().
+    _stream.FinalPath = link.ObjectPath;
+    _stream.TempPath = partialPath;
+    _stream.Claimed = true;
+    _stream.File = nullptr;
+    _streamLink = link;
+    _streaming = true;
+    _streamResumable = true;
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t ManifestTransaction::ResumeStream(
+    size_t chunkSize,
+    _In_ const ChunkVerifier& verifyChunk,
+    _Out_ uint64_t* offset,
+    _Inout_ std::ostream& errorMessage)
+{
+    *offset = 0;
+    if (!_streaming) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    if (!_streamResumable) {
+        // An ordinary stream, with nothing to resume.
+        return (_stream.File != nullptr) ? TEEP_ERR_SUCCESS : TEEP_ERR_PERMANENT_ERROR;
+    }
+    if (_stream.File != nullptr) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    teep_error_code_t result = teep_sha256_init(&_streamHash);
+    if (result != TEEP_ERR_SUCCESS) {
+        AbortStream();
+        return result;
+    }
+
+    // Keep the chunks that still verify, and drop anything after the
+    // first one that does not, such as a chunk cut short by a crash.
+    uint64_t keptLength = 0;
+    FILE* fp = fopen(_stream.TempPath.string().c_str(), "rb");
+    if (fp != nullptr) {
+        std::vector<uint8_t> chunk(chunkSize);
+        for (uint64_t chunkIndex = 0;; chunkIndex++) {
+            size_t length = fread(chunk.data(), 1, chunk.size(), fp);
+            if (length == 0 || !verifyChunk(chunkIndex, UsefulBufC{ chunk.data(), length })) {
+                break;
+            }
+            teep_sha256_update(&_streamHash, UsefulBufC{ chunk.data(), length });
+            keptLength += length;
+            if (length < chunk.size()) {
+                break;
+            }
+        }
+        fclose(fp);
+
+        std::error_code ec;
+        filesystem::resize_file(_stream.TempPath, keptLength, ec);
+        if (ec) {
+            filesystem::remove(_stream.TempPath, ec);
+            teep_sha256_init(&_streamHash);
+            keptLength = 0;
+        }
+    }
+
+    std::error_code ec;
+    filesystem::create_directories(_stream.TempPath.parent_path(), ec);
+    _stream.File = fopen(_stream.TempPath.string().c_str(), "ab");
+    if (_stream.File == nullptr) {
+        errorMessage << "Could not open " << _stream.TempPath.string();
+        AbortStream();
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    *offset = keptLength;
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t ManifestTransaction::WriteStream(_In_ UsefulBufC contents, _Inout_ std::ostream& errorMessage)
+{
+    if (!_streaming) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    if (_stream.File == nullptr) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    // A resumable stream hands each piece to the OS right away, so that
+    // an interrupted transfer keeps everything written so far.
+    if (fwrite(contents.ptr, 1, contents.len, _stream.File) != contents.len ||
+        (_streamResumable && fflush(_stream.File) != 0)) {
+        errorMessage << "Could not write " << _stream.TempPath.string();
+        AbortStream();
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    teep_error_code_t result = teep_sha256_update(&_streamHash, contents);
+    if (result != TEEP_ERR_SUCCESS) {
+        AbortStream();
+    }
+    return result;
+}
+
+teep_error_code_t ManifestTransaction::FinishStream(_Inout_ std::ostream& errorMessage)
+{
+    if (!_streaming || _stream.File == nullptr) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    uint8_t digest[TEEP_SHA256_SIZE];
+    teep_error_code_t result = teep_sha256_final(&_streamHash, digest);
+    if (result != TEEP_ERR_SUCCESS) {
+        AbortStream();
+        return result;
+    }
+    if (memcmp(digest, _streamDigest, TEEP_SHA256_SIZE) != 0) {
+        errorMessage << "Digest of " << _streamLink.EntryPath.filename().string() << " does not match";
+
+        // Nothing written is worth resuming.
+        _streamResumable = false;
+        AbortStream();
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+
+    teep_sha256_free(&_streamHash);
+    _writes.push_back(_stream);
+    _links.push_back(_streamLink);
+    _streaming = false;
+    _streamResumable = false;
+    return TEEP_ERR_SUCCESS;
+}
+
+void ManifestTransaction::AbortStream()
+{
+    if (!_streaming) {
+        return;
+    }
+    ReleaseWrite(_stream, _streamResumable);
+    teep_sha256_free(&_streamHash);
+    _streaming = false;
+    _streamResumable = false;
+}
+
+bool ManifestTransaction::WillExist(_In_ const filesystem::path& filename) const
+{
+    for (const PendingLink& link : _links) {
+        if (link.EntryPath == filename) {
+            return true;
+        }
+    }
+    if (std::find(_deletes.begin(), _deletes.end(), filename) != _deletes.end()) {
+        return false;
+    }
+    std::error_code ec;
+    return filesystem::exists(filename, ec);
+}
+
+void ManifestTransaction::Adopt(_Inout_ ManifestTransaction& other)
+{
+    other.AbortStream();
+    for (PendingWrite& write : other._writes) {
+        if (HasPendingWrite(write.FinalPath)) {
+            // Both staged the same contents, so keep only one copy.  The
+            // copy dropped is in a file of its own, since only one stream
+            // at a time may claim an object's partial file.
+            ReleaseWrite(write, false);
+        } else {
+            _writes.push_back(write);
+        }
+    }
+    for (const PendingLink& link : other._links) {
+        CancelLink(link.EntryPath);
+        _deletes.erase(std::remove(_deletes.begin(), _deletes.end(), link.EntryPath), _deletes.end());
+        _links.push_back(link);
+    }
+    for (const filesystem::path& filename : other._deletes) {
+        StageDelete(filename);
+    }
+    other._writes.clear();
+    other._links.clear();
+    other._deletes.clear();
+}
+
+teep_error_code_t ManifestTransaction::Commit(_Inout_ std::ostream& errorMessage)
+{
+    // A stream that was never finished is not part of the commit.
+    AbortStream();
+
+    if (_links.empty() && _deletes.empty()) {
+        Discard();
+        return TEEP_ERR_SUCCESS;
+    }
+
+    // Make all new objects durable before publishing any of them.
+    bool synced = true;
+    for (PendingWrite& write : _writes) {
+        synced = synced && (SyncFile(write.File) == 0);
+    }
+    if (!synced) {
+        errorMessage << "Could not sync manifests to storage";
+        Discard();
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+
+    // Publish each object with an atomic rename, so that an object name
+    // never refers to a partial write.
+    teep_error_code_t result = TEEP_ERR_SUCCESS;
+    for (PendingWrite& write : _writes) {
+        fclose(write.File);
+        write.File = nullptr;
+        std::error_code ec;
+        filesystem::rename(write.TempPath, write.FinalPath, ec);
+        if (ec) {
+            errorMessage << "Could not rename " << write.TempPath.string() << ": " << ec.message();
+            result = TEEP_ERR_TEMPORARY_ERROR;
+        }
+        ReleaseWrite(write, !ec);
+    }
+    _writes.clear();
+
+    // Point each entry at its object.  An entry that already refers to
+    // the same object is left alone.
+    filesystem::path entryDirectory;
+    for (const PendingLink& link : _links) {
+        bool replaced;
+        teep_error_code_t linkResult = ObjectStoreLinkEntry(link.ObjectPath, link.EntryPath, &replaced, errorMessage);
+        if (linkResult != TEEP_ERR_SUCCESS) {
+            result = linkResult;
+        }
+        entryDirectory = link.EntryPath.parent_path();
+    }
+    _links.clear();
+
+    for (const filesystem::path& filename : _deletes) {
+        std::error_code ec;
+        filesystem::remove(filename, ec);
+        entryDirectory = filename.parent_path();
+    }
+    _deletes.clear();
+
+    // Drop objects whose last entry was just replaced or deleted, once no
+    // other transaction may be between publishing an object and linking it.
+    ObjectStoreCollectGarbage();
+
+    // All entries live in one directory and all objects in another, so
+    // one sync of each covers every rename and deletion above.
+    filesystem::path objectDirectory;
+    TeepAgentGetObjectDirectory(objectDirectory);
+    SyncDirectory(objectDirectory);
+    SyncDirectory(entryDirectory);
+    return result;
+}
@@ -0,0 +1,116 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <filesystem>
+#include <functional>
+#include <ostream>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "common.h"
+using namespace std;
+#ifdef TEEP_USE_TEE
+using namespace std::__fs;
+#endif
+
+// A set of manifest writes and deletions that are made durable together.
+// Contents not already in the object store are written to temporary files
+// as they are staged; Commit() syncs each of them, publishes each object
+// with an atomic rename, points the component-ID entries at their objects,
+// applies the staged deletions, and then syncs the directories once.  Anything still staged when the transaction is destroyed is
+// discarded.
+class ManifestTransaction
+{
+public:
+    ManifestTransaction();
+    ~ManifestTransaction();
+
+    teep_error_code_t StageWrite(
+        _In_ const filesystem::path& filename,
+        _In_ UsefulBufC contents,
+        _Inout_ std::ostream& errorMessage);
+    void StageDelete(_In_ const filesystem::path& filename);
+
+    // Stage contents that arrive in pieces and whose SHA-256 digest is
+    // known in advance, such as a fetched payload.  Returns false in
+    // *needed if the contents are already stored, in which case only the
+    // entry is staged.  Otherwise pass each piece to WriteStream() and
+    // then call FinishStream(), which checks the digest of what was
+    // written.  AbortStream() drops a stream that cannot be finished.
+    teep_error_code_t BeginStream(
+        _In_ const filesystem::path& filename,
+        _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+        _Out_ bool* needed,
+        _Inout_ std::ostream& errorMessage);
+
+    // Like BeginStream(), but what has been written is kept under
+    // "partial/" if the stream is aborted, so that a later transaction can
+    // resume it.  Only one stream at a time writes an object's partial
+    // file; while another holds it, this is an ordinary stream.  ResumeStream() must be called next: it reads back what
+    // an earlier attempt kept in pieces of chunkSize, keeps the prefix
+    // that verifyChunk accepts, and returns in *offset where to continue.
+    typedef std::function<bool(uint64_t chunkIndex, UsefulBufC chunk)> ChunkVerifier;
+    teep_error_code_t BeginResumableStream(
+        _In_ const filesystem::path& filename,
+        _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+        _Out_ bool* needed,
+        _Inout_ std::ostream& errorMessage);
+    teep_error_code_t ResumeStream(
+        size_t chunkSize,
+        _In_ const ChunkVerifier& verifyChunk,
+        _Out_ uint64_t* offset,
+        _Inout_ std::ostream& errorMessage);
+
+    teep_error_code_t WriteStream(_In_ UsefulBufC contents, _Inout_ std::ostream& errorMessage);
+    teep_error_code_t FinishStream(_Inout_ std::ostream& errorMessage);
+    void AbortStream();
+
+    // Whether an entry will exist once this transaction is committed.
+    bool WillExist(_In_ const filesystem::path& filename) const;
+
+    // Move everything staged in another transaction into this one, as if
+    // it had been staged here after what this one already holds.  This
+    // lets independent work be staged on several threads at once.
+    void Adopt(_Inout_ ManifestTransaction& other);
+
+    teep_error_code_t Commit(_Inout_ std::ostream& errorMessage);
+
+private:
+    struct PendingWrite {
+        filesystem::path FinalPath;
+        filesystem::path TempPath;
+        FILE* File;
+        bool Claimed = false; // TempPath is a claimed partial file.
+    };
+    struct PendingLink {
+        filesystem::path EntryPath;
+        filesystem::path ObjectPath;
+    };
+
+    bool HasPendingWrite(_In_ const filesystem::path& objectPath) const;
+    bool PrepareStream(
+        _In_ const filesystem::path& filename,
+        _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+        _Out_ PendingLink& link);
+    teep_error_code_t OpenStream(_In_ const PendingLink& link, _Inout_ std::ostream& errorMessage);
+    static void ReleaseWrite(_Inout_ PendingWrite& write, bool keepFile);
+    void CancelLink(_In_ const filesystem::path& filename);
+    void Discard();
+
+    std::vector<PendingWrite> _writes;
+    std::vector<PendingLink> _links;
+    std::vector<filesystem::path> _deletes;
+
+    // Appended to an object's name to name its temporary file, and unique
+    // to this transaction so that transactions staging the same object
+    // at once do not write to the same file.
+    std::string _tempSuffix;
+
+    // The stream in progress, if any.
+    bool _streaming = false;
+    bool _streamResumable = false;
+    PendingWrite _stream;
+    PendingLink _streamLink;
+    teep_sha256_ctx_t _streamHash;
+    uint8_t _streamDigest[TEEP_SHA256_SIZE];
+};
@@ -0,0 +1,293 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef TEEP_USE_TEE
+#include <openenclave/enclave.h>
+#endif
+#include <algorithm>
+#include <set>
+#include <stdio.h>
+#include <string>
+#ifndef TEEP_USE_TEE
+#include <mutex>
+#endif
+#include "ObjectStore.h"
+
+#define TOXDIGIT(x) ("0123456789abcdef"[x])
+
+void TeepAgentMakeObjectFilename(_Out_ filesystem::path& objectPath, _In_reads_(digest_len) const uint8_t* digest, size_t digest_len)
+{
+    std::string filename;
+    for (size_t i = 0; i < digest_len; i++) {
+        filename += TOXDIGIT(digest[i] >> 4);
+        filename += TOXDIGIT(digest[i] & 0xf);
+    }
+    TeepAgentGetObjectDirectory(objectPath);
+    objectPath /= filename;
+}
+
+void ObjectStoreGetPartialPath(
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    _In_z_ const char* suffix,
+    _Out_ filesystem::path& partialPath)
+{
+    // Partial transfers are kept out of "objects/" so that garbage
+    // collection leaves them alone.
+    filesystem::path objectPath;
+    TeepAgentMakeObjectFilename(objectPath, digest, TEEP_SHA256_SIZE);
+    partialPath = objectPath.parent_path().parent_path() / "partial" / objectPath.filename();
+    partialPath += suffix;
+}
+
+teep_error_code_t ObjectStoreGetObjectPath(_In_ UsefulBufC contents, _Out_ filesystem::path& objectPath)
+{
+    uint8_t digest[TEEP_SHA256_SIZE];
+    teep_error_code_t result = teep_compute_sha256(contents, digest);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    TeepAgentMakeObjectFilename(objectPath, digest, sizeof(digest));
+    return TEEP_ERR_SUCCESS;
+}
+
+uintmax_t ObjectStoreGetReferenceCount(_In_ const filesystem::path& objectPath)
+{
+    std::error_code ec;
+    uintmax_t links = filesystem::hard_link_count(objectPath, ec);
+    if (ec || links == 0) {
+        return 0;
+    }
+
+    // One link is the object's own name.
+    return links - 1;
+}
+
+teep_error_code_t ObjectStoreLinkEntry(
+    _In_ const filesystem::path& objectPath,
+    _In_ const filesystem::path& entryPath,
+    _Out_ bool* replaced,
+    _Inout_ std::ostream& errorMessage)
+{
+    std::error_code ec;
+    *replaced = false;
+    if (filesystem::exists(entryPath, ec)) {
+        if (filesystem::equivalent(entryPath, objectPath, ec)) {
+            // Already installed, nothing to do.
+            return TEEP_ERR_SUCCESS;
+        }
+        *replaced = true;
+    }
+
+    // Link under a temporary name and rename over the entry, so that the
+    // entry atomically switches from the old object to the new one.
+    filesystem::path tempPath = entryPath;
+    tempPath += ".tmp";
+    filesystem::remove(tempPath, ec);
+    filesystem::create_hard_link(objectPath, tempPath, ec);
+    if (ec) {
+        errorMessage << "Could not link " << entryPath.string() << ": " << ec.message();
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    filesystem::rename(tempPath, entryPath, ec);
+    if (ec) {
+        errorMessage << "Could not rename " << tempPath.string() << ": " << ec.message();
+        filesystem::remove(tempPath, ec);
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+static struct {
+    size_t OpenTransactions;
+    bool CollectionDue;
+    std::set<std::string> ClaimedPartials;
+#ifndef TEEP_USE_TEE
+    std::mutex Lock;
+#endif
+} g_ObjectStore;
+
+#ifdef TEEP_USE_TEE
+#define LOCK_OBJECT_STORE()
+#else
+#define LOCK_OBJECT_STORE() std::lock_guard<std::mutex> lock(g_ObjectStore.Lock)
+#endif
+
+// The caller holds the lock, so no transaction opens meanwhile.
+static void CollectGarbageNow(void)
+{
+    g_ObjectStore.CollectionDue = false;
+    filesystem::path objectDirectory;
+    TeepAgentGetObjectDirectory(objectDirectory);
+    std::error_code ec;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(objectDirectory, ec)) {
+        // Skip temporary files, whose names are not digests.
+        if (!entry.path().has_extension() && ObjectStoreGetReferenceCount(entry.path()) == 0) {
+            filesystem::remove(entry.path(), ec);
+        }
+    }
+}
+
+void ObjectStoreCollectGarbage(void)
+{
+    LOCK_OBJECT_STORE();
+    if (g_ObjectStore.OpenTransactions > 0) {
+        g_ObjectStore.CollectionDue = true;
+        return;
+    }
+    CollectGarbageNow();
+}
+
+bool ObjectStoreClaimPartial(_In_ const filesystem::path& partialPath)
+{
+    LOCK_OBJECT_STORE();
+    return g_ObjectStore.ClaimedPartials.insert(partialPath.string()).second;
+}
+
+void ObjectStoreReleasePartial(_In_ const filesystem::path& partialPath)
+{
+    LOCK_OBJECT_STORE();
+    g_ObjectStore.ClaimedPartials.erase(partialPath.string());
+}
+
+void ObjectStoreOpenTransaction(void)
+{
+    LOCK_OBJECT_STORE();
+    g_ObjectStore.OpenTransactions++;
+}
+
+void ObjectStoreCloseTransaction(void)
+{
+    LOCK_OBJECT_STORE();
+    g_ObjectStore.OpenTransactions--;
+    if (g_ObjectStore.OpenTransactions == 0 && g_ObjectStore.CollectionDue) {
+        CollectGarbageNow();
+    }
+}
+
+// Progress of the background check of installed objects.
+static struct {
+    bool Active = false;
+    std::vector<filesystem::path> Objects;
+    size_t Index;
+    uint64_t Offset;
+    teep_sha256_ctx_t Hash;
+} g_ObjectVerification;
+
+// Remove an object whose contents no longer match its name, along with
+// every entry of each component that uses it, so that the component is
+// no longer reported as installed.  While a transaction is open, it may
+// be about to link an entry to the object, so the object is left for the
+// next pass.
+static void ObjectStoreRemoveCorruptObject(
+    _In_ const filesystem::path& objectPath,
+    _Inout_ std::vector<filesystem::path>& removedEntries)
+{
+    LOCK_OBJECT_STORE();
+    if (g_ObjectStore.OpenTransactions > 0) {
+        return;
+    }
+    filesystem::path entryDirectory = objectPath.parent_path().parent_path() / "manifests";
+
+    // Entries are named "<component ID>.cbor" or "<component ID>.<n>.payload".
+    std::vector<std::string> components;
+    std::error_code ec;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(entryDirectory, ec)) {
+        std::error_code equivalentError;
+        if (filesystem::equivalent(entry.path(), objectPath, equivalentError)) {
+            std::string filename = entry.path().filename().string();
+            components.push_back(filename.substr(0, filename.find('.')) + ".");
+        }
+    }
+    std::vector<filesystem::path> entries;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(entryDirectory, ec)) {
+        std::string filename = entry.path().filename().string();
+        for (const std::string& component : components) {
+            if (filename.compare(0, component.size(), component) == 0) {
+                entries.push_back(entry.path());
+                break;
+            }
+        }
+    }
+    for (const filesystem::path& entryPath : entries) {
+        filesystem::remove(entryPath, ec);
+        removedEntries.push_back(entryPath);
+    }
+    filesystem::remove(objectPath, ec);
+    TeepLogMessage("Removed corrupt object %s\n", objectPath.filename().string().c_str());
+}
+
+teep_error_code_t ObjectStoreVerifyObjects(
+    size_t maxBytes,
+    _Out_ bool* complete,
+    _Inout_ std::vector<filesystem::path>& removedEntries)
+{
+    *complete = false;
+    if (!g_ObjectVerification.Active) {
+        filesystem::path objectDirectory;
+        TeepAgentGetObjectDirectory(objectDirectory);
+        g_ObjectVerification.Objects.clear();
+        std::error_code ec;
+        for (const filesystem::directory_entry& entry : filesystem::directory_iterator(objectDirectory, ec)) {
+            // Skip temporary files, whose names are not digests.
+            if (!entry.path().has_extension()) {
+                g_ObjectVerification.Objects.push_back(entry.path());
+            }
+        }
+        g_ObjectVerification.Index = 0;
+        g_ObjectVerification.Offset = 0;
+        teep_sha256_init(&g_ObjectVerification.Hash);
+        g_ObjectVerification.Active = true;
+    }
+
+    std::vector<uint8_t> buffer(std::min<size_t>(maxBytes, 64 * 1024));
+    size_t budget = maxBytes;
+    while (budget > 0 && g_ObjectVerification.Index < g_ObjectVerification.Objects.size()) {
+        const filesystem::path& objectPath = g_ObjectVerification.Objects[g_ObjectVerification.Index];
+        bool finished = true;
+        FILE* fp = fopen(objectPath.string().c_str(), "rb");
+        if (fp != nullptr) {
+            // Pick up where the last call left off.  An object that cannot
+            // be read is not judged, but checked again on the next pass.
+            bool readError = (fseek64(fp, g_ObjectVerification.Offset, SEEK_SET) != 0);
+            finished = readError;
+            while (!finished && budget > 0) {
+                size_t length = fread(buffer.data(), 1, std::min(buffer.size(), budget), fp);
+                if (length == 0) {
+                    readError = (ferror(fp) != 0);
+                    finished = true;
+                    break;
+                }
+                teep_sha256_update(&g_ObjectVerification.Hash, UsefulBufC{ buffer.data(), length });
+                g_ObjectVerification.Offset += length;
+                budget -= length;
+            }
+            fclose(fp);
+
+            if (finished && !readError) {
+                uint8_t digest[TEEP_SHA256_SIZE];
+                filesystem::path expectedPath;
+                teep_sha256_final(&g_ObjectVerification.Hash, digest);
+                TeepAgentMakeObjectFilename(expectedPath, digest, sizeof(digest));
+                if (expectedPath.filename() != objectPath.filename()) {
+                    ObjectStoreRemoveCorruptObject(objectPath, removedEntries);
+                }
+            }
+        }
+        // An object that has since been collected is simply skipped.
+        if (finished) {
+            g_ObjectVerification.Index++;
+            g_ObjectVerification.Offset = 0;
+            teep_sha256_init(&g_ObjectVerification.Hash);
+        }
+    }
+
+    if (g_ObjectVerification.Index == g_ObjectVerification.Objects.size()) {
+        // Drop other objects used only by the components just removed.
+        if (!removedEntries.empty()) {
+            ObjectStoreCollectGarbage();
+        }
+        teep_sha256_free(&g_ObjectVerification.Hash);
+        g_ObjectVerification.Active = false;
+        *complete = true;
+    }
+    return TEEP_ERR_SUCCESS;
+}
@@ -0,0 +1,76 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <filesystem>
+#include <ostream>
+#include <vector>
+#include "common.h"
+using namespace std;
+#ifdef TEEP_USE_TEE
+using namespace std::__fs;
+#endif
+
+// Seek within objects larger than 2 GB.
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+// Trusted component contents are stored once under "objects/", named by
+// the hex SHA-256 digest of their contents.  Each component-ID entry under
+// "manifests/" is a hard link to its object, so the filesystem's link
+// count serves as the object's reference count and readers of an entry
+// see the object's contents directly.
+
+void TeepAgentGetObjectDirectory(_Out_ filesystem::path& objectDirectory);
+void TeepAgentMakeObjectFilename(_Out_ filesystem::path& objectPath, _In_reads_(digest_len) const uint8_t* digest, size_t digest_len);
+
+// Get the path under "partial/" where a resumable transfer of the object
+// with the given digest keeps its state, ending in the given suffix.
+void ObjectStoreGetPartialPath(
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    _In_z_ const char* suffix,
+    _Out_ filesystem::path& partialPath);
+
+// Claim a partial file for one stream to write, until it is released.
+// Returns false if another stream holds it.
+bool ObjectStoreClaimPartial(_In_ const filesystem::path& partialPath);
+void ObjectStoreReleasePartial(_In_ const filesystem::path& partialPath);
+
+// Get the path of the object that holds the given contents.
+teep_error_code_t ObjectStoreGetObjectPath(_In_ UsefulBufC contents, _Out_ filesystem::path& objectPath);
+
+// Get the number of component-ID entries that refer to an object.
+uintmax_t ObjectStoreGetReferenceCount(_In_ const filesystem::path& objectPath);
+
+// Point a component-ID entry at an existing object, replacing whatever
+// the entry referred to before.  Returns true in *replaced if an older
+// entry was dropped.
+teep_error_code_t ObjectStoreLinkEntry(
+    _In_ const filesystem::path& objectPath,
+    _In_ const filesystem::path& entryPath,
+    _Out_ bool* replaced,
+    _Inout_ std::ostream& errorMessage);
+
+// Remove objects that no component-ID entry refers to any more.  An
+// object a transaction has published may not have its entry yet, so while
+// any transaction is open this only notes that collection is due, and the
+// last transaction to close does it.
+void ObjectStoreCollectGarbage(void);
+
+// Called as each ManifestTransaction opens and closes.
+void ObjectStoreOpenTransaction(void);
+void ObjectStoreCloseTransaction(void);
+
+// Re-check that installed objects still match their digests, hashing at
+// most maxBytes per call so that the work can be spread out in the
+// background.  A pass that finishes sets *complete, and the next call
+// starts a new one.  An object that no longer matches is removed along
+// with every entry of each component that uses it, and those entries are
+// added to removedEntries.  An object that cannot be read, or that is
+// found corrupt while a transaction is open, is left for the next pass.
+teep_error_code_t ObjectStoreVerifyObjects(
+    size_t maxBytes,
+    _Out_ bool* complete,
+    _Inout_ std::vector<filesystem::path>& removedEntries);
@@ -0,0 +1,688 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <limits.h>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#ifndef TEEP_USE_TEE
+#include <atomic>
+#endif
+#include "teep_protocol.h"
+#include "TeepAgentLib.h"
+#include "qcbor/qcbor_decode.h"
+#include "t_cose/t_cose_common.h"
+#include "AgentKeys.h"
+#include "compress.h"
+#include "StreamingMessage.h"
+#include "SuitParser.h"
+
+#define CBOR_MAJOR_UINT  0
+#define CBOR_MAJOR_NINT  1
+#define CBOR_MAJOR_BSTR  2
+#define CBOR_MAJOR_TSTR  3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP   5
+#define CBOR_MAJOR_TAG   6
+
+#define COSE_SIGN1_TAG 18
+#define COSE_HEADER_PARAM_ALG 1
+#define COSE_ALGORITHM_ES256 (-7)
+
+// Deepest nesting of arrays and maps followed while streaming.
+#define STREAM_MAX_NESTING 16
+
+// Longest prefix buffered while deciding whether a message can be streamed.
+#define STREAM_MAX_PREFIX 64
+
+// Upper bounds on the COSE_Sign1 members that are buffered.
+#define STREAM_MAX_PROTECTED_SIZE 64
+#define STREAM_MAX_SIGNATURE_SIZE 132
+
+// Receives the pieces of a CBOR item as CborStreamWalker finds them.
+// depth is the nesting level of an item and index its position within
+// its parent, with map keys and values counted separately.  A tag is
+// reported at the depth and index of the item it tags.
+class CborStreamHandler
+{
+public:
+    virtual ~CborStreamHandler() {}
+    virtual teep_error_code_t OnHead(size_t depth, size_t index, uint8_t majorType, uint64_t argument, UsefulBufC head) = 0;
+    virtual teep_error_code_t OnStringBytes(size_t depth, size_t index, UsefulBufC bytes, bool last) = 0;
+};
+
+// Walks a single definite-length CBOR item whose bytes arrive in pieces.
+class CborStreamWalker
+{
+public:
+    CborStreamWalker(CborStreamHandler& handler) : _handler(handler) {}
+    teep_error_code_t Consume(UsefulBufC data);
+    bool IsComplete() const { return _complete; }
+
+private:
+    void FinishItem();
+
+    struct Frame {
+        uint64_t Remaining;
+        size_t NextIndex;
+    };
+    CborStreamHandler& _handler;
+    std::vector<Frame> _stack;
+    uint8_t _head[9];
+    size_t _headLength = 0;
+    size_t _headNeeded = 0;
+    bool _inString = false;
+    uint64_t _stringRemaining = 0;
+    size_t _stringDepth = 0;
+    size_t _stringIndex = 0;
+    bool _complete = false;
+};
+
+// Account for a completed item, closing any containers it completes.
+void CborStreamWalker::FinishItem()
+{
+    while (!_stack.empty()) {
+        Frame& top = _stack.back();
+        top.NextIndex++;
+        if (--top.Remaining > 0) {
+            return;
+        }
+        _stack.pop_back();
+    }
+    _complete = true;
+}
+
+teep_error_code_t CborStreamWalker::Consume(UsefulBufC data)
+{
+    const uint8_t* next = (const uint8_t*)data.ptr;
+    size_t left = data.len;
+    while (left > 0) {
+        if (_complete) {
+            // Trailing bytes after the item.
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+
+        if (_inString) {
+            size_t count = (_stringRemaining < left) ? (size_t)_stringRemaining : left;
+            _stringRemaining -= count;
+            teep_error_code_t err = _handler.OnStringBytes(_stringDepth, _stringIndex, { next, count }, _stringRemaining == 0);
+            if (err != TEEP_ERR_SUCCESS) {
+                return err;
+            }
+            next += count;
+            left -= count;
+            if (_stringRemaining == 0) {
+                _inString = false;
+                FinishItem();
+            }
+            continue;
+        }
+
+        _head[_headLength++] = *next++;
+        left--;
+        if (_headLength == 1) {
+            uint8_t additional = _head[0] & 0x1f;
+            if (additional < 24) {
+                _headNeeded = 1;
+            } else if (additional <= 27) {
+                _headNeeded = 1 + ((size_t)1 << (additional - 24));
+            } else {
+                // Indefinite lengths and reserved values are not supported.
+                return TEEP_ERR_PERMANENT_ERROR;
+            }
+        }
+        if (_headLength < _headNeeded) {
+            continue;
+        }
+
+        uint8_t majorType = _head[0] >> 5;
+        uint64_t argument = (_headNeeded == 1) ? (_head[0] & 0x1f) : 0;
+        for (size_t i = 1; i < _headNeeded; i++) {
+            argument = (argument << 8) | _head[i];
+        }
+        size_t depth = _stack.size();
+        size_t index = (depth > 0) ? _stack.back().NextIndex : 0;
+        UsefulBufC head = { _head, _headLength };
+        _headLength = 0;
+        teep_error_code_t err = _handler.OnHead(depth, index, majorType, argument, head);
+        if (err != TEEP_ERR_SUCCESS) {
+            return err;
+        }
+
+        switch (majorType) {
+        case CBOR_MAJOR_BSTR:
+        case CBOR_MAJOR_TSTR:
+            if (argument == 0) {
+                err = _handler.OnStringBytes(depth, index, NULLUsefulBufC, true);
+                if (err != TEEP_ERR_SUCCESS) {
+                    return err;
+                }
+                FinishItem();
+            } else {
+                _inString = true;
+                _stringRemaining = argument;
+                _stringDepth = depth;
+                _stringIndex = index;
+            }
+            break;
+        case CBOR_MAJOR_ARRAY:
+        case CBOR_MAJOR_MAP:
+            if (majorType == CBOR_MAJOR_MAP) {
+                if (argument > UINT64_MAX / 2) {
+                    return TEEP_ERR_PERMANENT_ERROR;
+                }
+                argument *= 2;
+            }
+            if (argument == 0) {
+                FinishItem();
+            } else {
+                if (_stack.size() >= STREAM_MAX_NESTING) {
+                    return TEEP_ERR_PERMANENT_ERROR;
+                }
+                _stack.push_back({ argument, 0 });
+            }
+            break;
+        case CBOR_MAJOR_TAG:
+            // The tagged item follows.
+            break;
+        default:
+            FinishItem();
+            break;
+        }
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+// Rebuilds a TEEP message without its manifest-list envelopes, validating
+// and staging each envelope as soon as it is complete.  Entries of a
+// compressed-manifest-list are expanded as they arrive.
+class TeepPayloadHandler : public CborStreamHandler
+{
+public:
+    ~TeepPayloadHandler();
+
+    teep_error_code_t OnHead(size_t depth, size_t index, uint8_t majorType, uint64_t argument, UsefulBufC head) override;
+    teep_error_code_t OnStringBytes(size_t depth, size_t index, UsefulBufC bytes, bool last) override;
+
+    // Stage the envelopes held back while the message streamed in, once
+    // its signature has been verified, in the same way as those of an
+    // Update that arrived whole.
+    void StageEnvelopes();
+
+    std::vector<uint8_t> Skeleton;
+    StagedManifestList Staged;
+
+private:
+    // An envelope that has been checked but not yet staged.  It is kept
+    // in a file in the agent's data directory if one can be made, and in
+    // memory otherwise.
+    struct HeldEnvelope {
+        long Offset;
+        size_t Length;
+        uint8_t Digest[TEEP_SHA256_SIZE]; // Checked again when read back.
+        std::vector<uint8_t> Bytes;
+    };
+
+    void Append(UsefulBufC bytes);
+    teep_error_code_t Hold(UsefulBufC envelope);
+
+    int64_t _messageType = -1;
+    bool _manifestListKey = false;
+    bool _compressedListKey = false;
+    bool _inManifestList = false;
+    bool _compressed = false;
+    bool _inEnvelope = false;
+    std::vector<uint8_t> _envelope;
+    std::unique_ptr<teep_decompressor_t> _decompressor;
+    std::vector<HeldEnvelope> _held;
+    FILE* _spill = nullptr;
+    filesystem::path _spillPath;
+    bool _spillFailed = false;
+    long _spillSize = 0;
+};
+
+#ifdef TEEP_USE_TEE
+static uint64_t g_SpillCount = 0;
+#else
+static std::atomic<uint64_t> g_SpillCount(0);
+#endif
+
+TeepPayloadHandler::~TeepPayloadHandler()
+{
+    if (_spill != nullptr) {
+        fclose(_spill);
+        std::error_code ec;
+        filesystem::remove(_spillPath, ec);
+    }
+}
+
+static teep_error_code_t AppendEnvelopeBytes(void* context, UsefulBufC data)
+{
+    std::vector<uint8_t>* envelope = (std::vector<uint8_t>*)context;
+    const uint8_t* ptr = (const uint8_t*)data.ptr;
+    envelope->insert(envelope->end(), ptr, ptr + data.len);
+    return TEEP_ERR_SUCCESS;
+}
+
+void TeepPayloadHandler::Append(UsefulBufC bytes)
+{
+    const uint8_t* ptr = (const uint8_t*)bytes.ptr;
+    Skeleton.insert(Skeleton.end(), ptr, ptr + bytes.len);
+}
+
+teep_error_code_t TeepPayloadHandler::OnHead(size_t depth, size_t index, uint8_t majorType, uint64_t argument, UsefulBufC head)
+{
+    if (depth <= 2) {
+        _inManifestList = false;
+    }
+    if (depth == 1 && index == 0 && majorType == CBOR_MAJOR_UINT) {
+        _messageType = (int64_t)argument;
+    } else if (depth == 2 && (index % 2) == 0) {
+        // An options map key.
+        _manifestListKey = (_messageType == TEEP_MESSAGE_UPDATE) &&
+                           (majorType == CBOR_MAJOR_UINT) &&
+                           (argument == TEEP_LABEL_MANIFEST_LIST);
+        _compressedListKey = (_messageType == TEEP_MESSAGE_UPDATE) &&
+                             (majorType == CBOR_MAJOR_NINT) &&
+                             (argument == (uint64_t)(-1 - TEEP_LABEL_COMPRESSED_MANIFEST_LIST));
+    } else if (depth == 2) {
+        // An options map value.
+        _inManifestList = (_manifestListKey || _compressedListKey) && (majorType == CBOR_MAJOR_ARRAY);
+        _compressed = _compressedListKey;
+        _manifestListKey = false;
+        _compressedListKey = false;
+    } else if (depth == 3 && _inManifestList && majorType == CBOR_MAJOR_BSTR) {
+        // Leave an empty bstr in place of the envelope.
+        static const uint8_t emptyBstr = 0x40;
+        Append({ &emptyBstr, 1 });
+        Staged.EntryCount++;
+        _inEnvelope = true;
+        if (_compressed) {
+            if (!_decompressor) {
+                _decompressor = std::make_unique<teep_decompressor_t>();
+            }
+            teep_decompressor_init(_decompressor.get(), TEEP_MAX_DECOMPRESSED_ENVELOPE_SIZE, AppendEnvelopeBytes, &_envelope);
+        }
+        return TEEP_ERR_SUCCESS;
+    }
+    Append(head);
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t TeepPayloadHandler::OnStringBytes(size_t depth, size_t index, UsefulBufC bytes, bool last)
+{
+    TEEP_UNUSED(depth);
+    TEEP_UNUSED(index);
+    if (!_inEnvelope) {
+        Append(bytes);
+        return TEEP_ERR_SUCCESS;
+    }
+
+    // Envelopes after the first failure are not installed, so don't keep them.
+    if (Staged.ErrorCode == TEEP_ERR_SUCCESS && _compressed) {
+        teep_error_code_t result = teep_decompress(_decompressor.get(), bytes);
+        if (result == TEEP_ERR_SUCCESS && last) {
+            result = teep_decompressor_finish(_decompressor.get());
+        }
+        if (result != TEEP_ERR_SUCCESS) {
+            Staged.ErrorCode = result;
+            Staged.ErrorMessage = "Malformed compressed SUIT_Envelope\n";
+        }
+    } else if (Staged.ErrorCode == TEEP_ERR_SUCCESS) {
+        AppendEnvelopeBytes(&_envelope, bytes);
+    }
+    if (!last) {
+        return TEEP_ERR_SUCCESS;
+    }
+    if (Staged.ErrorCode == TEEP_ERR_SUCCESS) {
+        // Nothing is fetched or staged until the signature is verified.
+        std::ostringstream errorMessage;
+        UsefulBufC envelope = { _envelope.data(), _envelope.size() };
+        Staged.ErrorCode = SuitCheckEnvelope(envelope, errorMessage);
+        if (Staged.ErrorCode == TEEP_ERR_SUCCESS) {
+            Staged.ErrorCode = Hold(envelope);
+        }
+        Staged.ErrorMessage = errorMessage.str();
+    }
+    _envelope.clear();
+    _envelope.shrink_to_fit();
+    _inEnvelope = false;
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t TeepPayloadHandler::Hold(UsefulBufC envelope)
+{
+    HeldEnvelope held;
+    held.Offset = _spillSize;
+    held.Length = envelope.len;
+    teep_error_code_t result = teep_compute_sha256(envelope, held.Digest);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    if (_spill == nullptr && !_spillFailed) {
+        // tmpfile() is not available in an enclave, so use a file of the
+        // agent's own, named uniquely since several messages may stream
+        // in at once.
+        TeepAgentGetHeldEnvelopesFilename(_spillPath);
+        _spillPath += "." + std::to_string(g_SpillCount++);
+        _spill = fopen(_spillPath.string().c_str(), "w+b");
+        _spillFailed = (_spill == nullptr);
+    }
+    if (!_spillFailed && (long)envelope.len <= LONG_MAX - _spillSize &&
+        fseek(_spill, _spillSize, SEEK_SET) == 0 &&
+        fwrite(envelope.ptr, 1, envelope.len, _spill) == envelope.len) {
+        _spillSize += (long)envelope.len;
+    } else {
+        // Keep this envelope, and any after it, in memory instead.
+        _spillFailed = true;
+        const uint8_t* ptr = (const uint8_t*)envelope.ptr;
+        held.Bytes.assign(ptr, ptr + envelope.len);
+    }
+    _held.push_back(std::move(held));
+    return TEEP_ERR_SUCCESS;
+}
+
+void TeepPayloadHandler::StageEnvelopes()
+{
+    std::vector<std::vector<uint8_t>> envelopes(_held.size());
+    std::vector<UsefulBufC> list;
+    for (size_t i = 0; i < _held.size(); i++) {
+        if (Staged.ErrorCode != TEEP_ERR_SUCCESS) {
+            break;
+        }
+        HeldEnvelope& held = _held[i];
+        std::vector<uint8_t>& envelope = envelopes[i];
+        if (held.Bytes.empty()) {
+            envelope.resize(held.Length);
+            if (fflush(_spill) != 0 || fseek(_spill, held.Offset, SEEK_SET) != 0 ||
+                fread(envelope.data(), 1, held.Length, _spill) != held.Length) {
+                Staged.ErrorCode = TEEP_ERR_TEMPORARY_ERROR;
+                Staged.ErrorMessage = "Could not read back a SUIT_Envelope\n";
+                break;
+            }
+        } else {
+            envelope.swap(held.Bytes);
+        }
+
+        // The file is outside the agent's control, so make sure it still
+        // holds what was checked.
+        uint8_t digest[TEEP_SHA256_SIZE];
+        if (teep_compute_sha256({ envelope.data(), envelope.size() }, digest) != TEEP_ERR_SUCCESS ||
+            memcmp(digest, held.Digest, sizeof(digest)) != 0) {
+            Staged.ErrorCode = TEEP_ERR_TEMPORARY_ERROR;
+            Staged.ErrorMessage = "SUIT_Envelope changed while held\n";
+            break;
+        }
+        list.push_back({ envelope.data(), envelope.size() });
+    }
+    _held.clear();
+
+    // Install on several workers, each manifest after those it depends on.
+    if (Staged.ErrorCode == TEEP_ERR_SUCCESS && !list.empty()) {
+        std::ostringstream errorMessage;
+        Staged.ErrorCode = SuitProcessEnvelopes(list, 0, Staged.Transaction, errorMessage);
+        Staged.ErrorMessage = errorMessage.str();
+    }
+}
+
+// Processes an ES256 COSE_Sign1 message as it arrives.
+class StreamingMessage : public CborStreamHandler
+{
+public:
+    StreamingMessage() : _walker(*this), _payloadWalker(_payload) { teep_sha256_init(&_hash); }
+    ~StreamingMessage() { teep_sha256_free(&_hash); }
+
+    teep_error_code_t Consume(UsefulBufC chunk) { return _walker.Consume(chunk); }
+    teep_error_code_t Finish(_In_ void* sessionHandle);
+
+    teep_error_code_t OnHead(size_t depth, size_t index, uint8_t majorType, uint64_t argument, UsefulBufC head) override;
+    teep_error_code_t OnStringBytes(size_t depth, size_t index, UsefulBufC bytes, bool last) override;
+
+private:
+    CborStreamWalker _walker;
+    TeepPayloadHandler _payload;
+    CborStreamWalker _payloadWalker;
+    teep_sha256_ctx_t _hash;
+    std::vector<uint8_t> _protectedHead;
+    std::vector<uint8_t> _protected;
+    std::vector<uint8_t> _signature;
+};
+
+// Check whether an encoded protected header bucket selects ES256.
+static bool IsEs256ProtectedHeader(UsefulBufC encoded)
+{
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_MAP) {
+        return false;
+    }
+    bool es256 = false;
+    uint16_t entryCount = item.val.uCount;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        QCBORDecode_GetNext(&context, &item);
+        if (item.uLabelType == QCBOR_TYPE_INT64 && item.label.int64 == COSE_HEADER_PARAM_ALG) {
+            es256 = (item.uDataType == QCBOR_TYPE_INT64 && item.val.int64 == COSE_ALGORITHM_ES256);
+        }
+    }
+    return (QCBORDecode_Finish(&context) == QCBOR_SUCCESS) && es256;
+}
+
+teep_error_code_t StreamingMessage::OnHead(size_t depth, size_t index, uint8_t majorType, uint64_t argument, UsefulBufC head)
+{
+    if (depth == 0) {
+        if (majorType == CBOR_MAJOR_TAG) {
+            return (argument == COSE_SIGN1_TAG) ? TEEP_ERR_SUCCESS : TEEP_ERR_PERMANENT_ERROR;
+        }
+        return (majorType == CBOR_MAJOR_ARRAY && argument == 4) ? TEEP_ERR_SUCCESS : TEEP_ERR_PERMANENT_ERROR;
+    }
+    if (depth > 1) {
+        // Contents of the unprotected header map.
+        return TEEP_ERR_SUCCESS;
+    }
+
+    switch (index) {
+    case 0: // protected
+        if (majorType != CBOR_MAJOR_BSTR || argument > STREAM_MAX_PROTECTED_SIZE) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        _protectedHead.assign((const uint8_t*)head.ptr, (const uint8_t*)head.ptr + head.len);
+        return TEEP_ERR_SUCCESS;
+    case 1: // unprotected
+        return (majorType == CBOR_MAJOR_MAP) ? TEEP_ERR_SUCCESS : TEEP_ERR_PERMANENT_ERROR;
+    case 2: // payload
+    {
+        if (majorType != CBOR_MAJOR_BSTR || !IsEs256ProtectedHeader({ _protected.data(), _protected.size() })) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+
+        // Sig_structure = [ "Signature1", protected, external_aad, payload ]
+        static const uint8_t context[] = { 0x84, 0x6a, 'S', 'i', 'g', 'n', 'a', 't', 'u', 'r', 'e', '1' };
+        static const uint8_t emptyExternalAad = 0x40;
+        teep_error_code_t err = teep_sha256_init(&_hash);
+        if (err == TEEP_ERR_SUCCESS) {
+            err = teep_sha256_update(&_hash, { context, sizeof(context) });
+        }
+        if (err == TEEP_ERR_SUCCESS) {
+            err = teep_sha256_update(&_hash, { _protectedHead.data(), _protectedHead.size() });
+        }
+        if (err == TEEP_ERR_SUCCESS) {
+            err = teep_sha256_update(&_hash, { _protected.data(), _protected.size() });
+        }
+        if (err == TEEP_ERR_SUCCESS) {
+            err = teep_sha256_update(&_hash, { &emptyExternalAad, 1 });
+        }
+        if (err == TEEP_ERR_SUCCESS) {
+            err = teep_sha256_update(&_hash, head);
+        }
+        return err;
+    }
+    case 3: // signature
+        return (majorType == CBOR_MAJOR_BSTR && argument <= STREAM_MAX_SIGNATURE_SIZE) ? TEEP_ERR_SUCCESS : TEEP_ERR_PERMANENT_ERROR;
+    default:
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+}
+
+teep_error_code_t StreamingMessage::OnStringBytes(size_t depth, size_t index, UsefulBufC bytes, bool last)
+{
+    TEEP_UNUSED(last);
+    if (depth != 1) {
+        return TEEP_ERR_SUCCESS;
+    }
+    const uint8_t* ptr = (const uint8_t*)bytes.ptr;
+    switch (index) {
+    case 0:
+        _protected.insert(_protected.end(), ptr, ptr + bytes.len);
+        return TEEP_ERR_SUCCESS;
+    case 2:
+    {
+        teep_error_code_t err = teep_sha256_update(&_hash, bytes);
+        if (err != TEEP_ERR_SUCCESS) {
+            return err;
+        }
+        return _payloadWalker.Consume(bytes);
+    }
+    case 3:
+        _signature.insert(_signature.end(), ptr, ptr + bytes.len);
+        return TEEP_ERR_SUCCESS;
+    default:
+        return TEEP_ERR_SUCCESS;
+    }
+}
+
+teep_error_code_t StreamingMessage::Finish(_In_ void* sessionHandle)
+{
+    if (!_walker.IsComplete() || !_payloadWalker.IsComplete()) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+
+    uint8_t digest[TEEP_SHA256_SIZE];
+    teep_error_code_t err = teep_sha256_final(&_hash, digest);
+    if (err != TEEP_ERR_SUCCESS) {
+        return err;
+    }
+    bool verified = false;
+    for (auto [kind, key_pair] : TeepAgentGetTamKeys()) {
+        if (kind == TEEP_SIGNATURE_ES256 &&
+            teep_verify_es256_digest(&key_pair, digest, { _signature.data(), _signature.size() }) == TEEP_ERR_SUCCESS) {
+            // TODO(#114): save key_pair in session
+            verified = true;
+            break;
+        }
+    }
+    if (!verified) {
+        // Anything held is discarded along with _payload.
+        TeepLogMessage("TEEP agent failed verification of TAM key\n");
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+
+    _payload.StageEnvelopes();
+    UsefulBufC skeleton = { _payload.Skeleton.data(), _payload.Skeleton.size() };
+    return TeepAgentHandleVerifiedMessage(sessionHandle, skeleton, &_payload.Staged);
+}
+
+// State of a message being delivered in chunks.
+struct InboundStream {
+    // Bytes held until the message can be streamed, or the whole message
+    // if it cannot.
+    std::vector<uint8_t> Buffer;
+    std::unique_ptr<StreamingMessage> Streaming;
+    bool Buffered = false;
+};
+
+static std::map<void*, InboundStream> g_InboundStreams;
+
+// Decide from the first bytes of a message whether it is an ES256
+// COSE_Sign1 that can be streamed.  Returns false in *decided if more
+// bytes are needed.
+static bool CanStreamMessage(_In_ const std::vector<uint8_t>& prefix, _Out_ bool* decided)
+{
+    // Keep waiting for bytes unless the prefix is already too long.
+    *decided = (prefix.size() >= STREAM_MAX_PREFIX);
+
+    size_t offset = 0;
+    if (prefix.size() > offset && prefix[offset] == 0xc0 + COSE_SIGN1_TAG) {
+        offset++;
+    }
+    if (prefix.size() <= offset) {
+        return false;
+    }
+    if (prefix[offset++] != 0x84) {
+        *decided = true;
+        return false;
+    }
+    if (prefix.size() <= offset) {
+        return false;
+    }
+    uint8_t initialByte = prefix[offset++];
+    size_t protectedLength;
+    if (initialByte >= 0x40 && initialByte < 0x58) {
+        protectedLength = initialByte - 0x40;
+    } else if (initialByte == 0x58) {
+        if (prefix.size() <= offset) {
+            return false;
+        }
+        protectedLength = prefix[offset++];
+    } else {
+        *decided = true;
+        return false;
+    }
+    if (prefix.size() < offset + protectedLength) {
+        return false;
+    }
+    *decided = true;
+    return IsEs256ProtectedHeader({ prefix.data() + offset, protectedLength });
+}
+
+teep_error_code_t TeepAgentProcessTeepMessageChunk(
+    _In_ void* sessionHandle,
+    _In_z_ const char* mediaType,
+    _In_reads_(chunkLength) const char* chunk,
+    size_t chunkLength,
+    int isFinalChunk)
+{
+    if (strncmp(mediaType, TEEP_CBOR_MEDIA_TYPE, strlen(TEEP_CBOR_MEDIA_TYPE)) != 0) {
+        g_InboundStreams.erase(sessionHandle);
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+
+    InboundStream& stream = g_InboundStreams[sessionHandle];
+    teep_error_code_t err = TEEP_ERR_SUCCESS;
+    UsefulBufC bytes = { chunk, chunkLength };
+    if (!stream.Streaming) {
+        stream.Buffer.insert(stream.Buffer.end(), (const uint8_t*)chunk, (const uint8_t*)chunk + chunkLength);
+        if (!stream.Buffered) {
+            bool decided;
+            if (CanStreamMessage(stream.Buffer, &decided)) {
+                stream.Streaming = std::make_unique<StreamingMessage>();
+                bytes = { stream.Buffer.data(), stream.Buffer.size() };
+            } else {
+                stream.Buffered = decided;
+            }
+        }
+    }
+
+    if (stream.Streaming) {
+        err = stream.Streaming->Consume(bytes);
+        stream.Buffer.clear();
+        stream.Buffer.shrink_to_fit();
+        if (err == TEEP_ERR_SUCCESS && isFinalChunk) {
+            err = stream.Streaming->Finish(sessionHandle);
+        }
+    } else if (isFinalChunk) {
+        std::vector<uint8_t> message = std::move(stream.Buffer);
+        g_InboundStreams.erase(sessionHandle);
+        return TeepAgentProcessTeepMessage(sessionHandle, mediaType, (const char*)message.data(), message.size());
+    }
+
+    if (err != TEEP_ERR_SUCCESS || isFinalChunk) {
+        g_InboundStreams.erase(sessionHandle);
+    }
+    return err;
+}
@@ -0,0 +1,45 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <string>
+#include "common.h"
+#include "ManifestTransaction.h"
+
+// Inbound TEEP messages can be delivered in chunks through
+// TeepAgentProcessTeepMessageChunk().  An ES256 COSE_Sign1 message is
+// processed as it arrives: the Sig_structure is hashed incrementally, and
+// each manifest-list envelope of an Update is checked as soon as its last
+// byte arrives, and then written to a file in the agent's data directory.
+// Only the rest of the message (the "skeleton", in which every envelope is
+// replaced by an empty bstr) is kept while it streams in, so memory is
+// bounded by the largest single envelope rather than by the whole Update.
+// Only once the signature verifies are the envelopes read back, and then
+// installed by SuitProcessEnvelopes() as for an Update that arrived whole.  Other message forms are buffered and handed to
+// TeepAgentProcessTeepMessage() once complete.
+//
+// Entries of a compressed-manifest-list are decompressed as their bytes
+// arrive, so only the expanded envelope is ever held.
+
+// Largest envelope that a compressed-manifest-list entry may expand to.
+#define TEEP_MAX_DECOMPRESSED_ENVELOPE_SIZE (16 * 1024 * 1024)
+
+// Manifest-list entries of an Update that streamed in, staged once its
+// signature verified.
+struct StagedManifestList {
+    ManifestTransaction Transaction;
+    size_t EntryCount = 0;
+    teep_error_code_t ErrorCode = TEEP_ERR_SUCCESS;
+    std::string ErrorMessage;
+};
+
+// Get the name that files holding envelopes of a streamed Update start
+// with.
+void TeepAgentGetHeldEnvelopesFilename(_Out_ filesystem::path& filename);
+
+// Handle a TEEP message whose signature has already been verified.  If
+// staged is non-null, the manifest-list of an Update holds placeholders
+// and the envelopes themselves are already in staged->Transaction.
+teep_error_code_t TeepAgentHandleVerifiedMessage(
+    _In_ void* sessionHandle,
+    _In_ UsefulBufC encoded,
+    _Inout_opt_ StagedManifestList* staged);
@@ -0,0 +1,340 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef TEEP_USE_TEE
+#include <openenclave/enclave.h>
+#endif
+#include <deque>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#ifndef TEEP_USE_TEE
+#include <mutex>
+#endif
+#include "common.h"
+#include "qcbor/qcbor_decode.h"
+#include "t_cose/t_cose_common.h"
+#include "AgentKeys.h"
+#include "SuitAuthentication.h"
+
+// Most (suit-digest, signer) pairs remembered.  Once full, the oldest
+// are forgotten.
+#define SUIT_MAX_VERIFIED_SIGNATURES 1024
+
+#define TOXDIGIT(x) ("0123456789abcdef"[x])
+
+#define SUIT_VERIFICATION_CACHE_KEY_SIZE 32
+
+// Each pair is the hex suit-digest, a space, and the hex digest of the
+// signer's public key.  Outside a TEE, pairs are also written to a cache
+// file, one per line, each followed by a space and the hex HMAC-SHA256 of
+// the pair under a key kept beside the agent's signing key, so that a
+// line the agent did not write is dropped when the file is loaded.  In a
+// TEE, where the host can read and write the agent's files, the cache is
+// only kept in enclave memory.
+static struct {
+    filesystem::path Filename; // File the pairs were loaded from.
+    std::set<std::string> Pairs;
+    std::deque<std::string> Order; // Oldest first.
+#ifndef TEEP_USE_TEE
+    uint8_t Key[SUIT_VERIFICATION_CACHE_KEY_SIZE];
+    bool HaveKey;
+    std::mutex Lock; // Envelopes are validated on several threads.
+#endif
+} g_VerificationCache;
+
+#ifndef TEEP_USE_TEE
+static bool g_UnsignedEnvelopesAllowed = false;
+
+void SuitSetUnsignedEnvelopesAllowed(bool allowed)
+{
+    g_UnsignedEnvelopesAllowed = allowed;
+}
+#endif
+
+#ifdef TEEP_USE_TEE
+#define LOCK_VERIFICATION_CACHE()
+#else
+#define LOCK_VERIFICATION_CACHE() std::lock_guard<std::mutex> lock(g_VerificationCache.Lock)
+#endif
+
+static std::string MakeHexString(_In_reads_(length) const uint8_t* bytes, size_t length)
+{
+    std::string hex;
+    for (size_t i = 0; i < length; i++) {
+        hex += TOXDIGIT(bytes[i] >> 4);
+        hex += TOXDIGIT(bytes[i] & 0xf);
+    }
+    return hex;
+}
+
+static void AddVerifiedPair(_In_ const std::string& pair)
+{
+    if (g_VerificationCache.Pairs.insert(pair).second) {
+        g_VerificationCache.Order.push_back(pair);
+    }
+}
+
+static void ForgetOldestPairs(void)
+{
+    while (g_VerificationCache.Order.size() > SUIT_MAX_VERIFIED_SIGNATURES) {
+        g_VerificationCache.Pairs.erase(g_VerificationCache.Order.front());
+        g_VerificationCache.Order.pop_front();
+    }
+}
+
+#ifndef TEEP_USE_TEE
+static void GetKeyFilename(_Out_ filesystem::path& keyFilename)
+{
+    keyFilename = g_VerificationCache.Filename;
+    keyFilename += ".key";
+}
+
+// Load the key that authenticates the cache file, or make one.  A new key
+// invalidates any lines already in the file.  The caller must hold the
+// lock.
+static bool LoadVerificationCacheKey(void)
+{
+    filesystem::path keyFilename;
+    GetKeyFilename(keyFilename);
+    FILE* fp = fopen(keyFilename.string().c_str(), "rb");
+    if (fp != nullptr) {
+        size_t length = fread(g_VerificationCache.Key, 1, sizeof(g_VerificationCache.Key), fp);
+        fclose(fp);
+        if (length == sizeof(g_VerificationCache.Key)) {
+            return true;
+        }
+    }
+
+    if (teep_random(g_VerificationCache.Key, sizeof(g_VerificationCache.Key)) != TEEP_ERR_SUCCESS) {
+        return false;
+    }
+    fp = fopen(keyFilename.string().c_str(), "wb");
+    if (fp == nullptr) {
+        return false;
+    }
+    size_t length = fwrite(g_VerificationCache.Key, 1, sizeof(g_VerificationCache.Key), fp);
+    if (fclose(fp) != 0 || length != sizeof(g_VerificationCache.Key)) {
+        return false;
+    }
+    std::error_code ec;
+    filesystem::remove(g_VerificationCache.Filename, ec);
+    return true;
+}
+
+// Compute the hex HMAC-SHA256 (RFC 2104) of a pair under the cache key.
+static std::string ComputePairMac(_In_ const std::string& pair)
+{
+    uint8_t mac[TEEP_SHA256_SIZE];
+    UsefulBufC key = { g_VerificationCache.Key, sizeof(g_VerificationCache.Key) };
+    if (teep_hmac_sha256(key, { pair.data(), pair.size() }, mac) != TEEP_ERR_SUCCESS) {
+        return std::string();
+    }
+    return MakeHexString(mac, sizeof(mac));
+}
+
+// Compare two MACs in time that does not depend on where they differ.
+static bool IsSameMac(_In_ const std::string& expected, _In_z_ const char* actual)
+{
+    if (expected.empty() || strlen(actual) != expected.size()) {
+        return false;
+    }
+    uint8_t difference = 0;
+    for (size_t i = 0; i < expected.size(); i++) {
+        difference |= (uint8_t)(expected[i] ^ actual[i]);
+    }
+    return difference == 0;
+}
+
+static void WriteVerifiedPair(_In_ FILE* fp, _In_ const std::string& pair)
+{
+    std::string mac = ComputePairMac(pair);
+    if (!mac.empty()) {
+        fprintf(fp, "%s %s\n", pair.c_str(), mac.c_str());
+    }
+}
+#endif
+
+// Load the cache file of the current data directory, unless it is the one
+// already loaded.  The caller must hold the lock.
+static void LoadVerificationCache(void)
+{
+    filesystem::path filename;
+    TeepAgentGetVerificationCacheFilename(filename);
+    if (filename == g_VerificationCache.Filename) {
+        return;
+    }
+    g_VerificationCache.Filename = filename;
+    g_VerificationCache.Pairs.clear();
+    g_VerificationCache.Order.clear();
+
+#ifndef TEEP_USE_TEE
+    g_VerificationCache.HaveKey = LoadVerificationCacheKey();
+    if (!g_VerificationCache.HaveKey) {
+        return;
+    }
+    FILE* fp = fopen(filename.string().c_str(), "r");
+    if (fp == nullptr) {
+        return;
+    }
+
+    // A line cut short by a crash, or one that fails its MAC, is dropped.
+    char digest[2 * TEEP_SHA256_SIZE + 1];
+    char signer[2 * TEEP_SHA256_SIZE + 1];
+    char mac[2 * TEEP_SHA256_SIZE + 1];
+    char line[6 * TEEP_SHA256_SIZE + 4];
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+        if (sscanf(line, "%64s %64s %64s", digest, signer, mac) != 3 ||
+            strlen(digest) != 2 * TEEP_SHA256_SIZE || strlen(signer) != 2 * TEEP_SHA256_SIZE) {
+            continue;
+        }
+        std::string pair = std::string(digest) + " " + signer;
+        if (IsSameMac(ComputePairMac(pair), mac)) {
+            AddVerifiedPair(pair);
+        }
+    }
+    fclose(fp);
+    ForgetOldestPairs();
+#endif
+}
+
+// Remember a pair that has just been verified.  The caller must hold the
+// lock.
+static void RememberVerifiedPair(_In_ const std::string& pair)
+{
+    LoadVerificationCache();
+    if (g_VerificationCache.Pairs.count(pair) > 0) {
+        return;
+    }
+    AddVerifiedPair(pair);
+#ifdef TEEP_USE_TEE
+    ForgetOldestPairs();
+#else
+    bool rewrite = (g_VerificationCache.Order.size() > SUIT_MAX_VERIFIED_SIGNATURES);
+    ForgetOldestPairs();
+    if (!g_VerificationCache.HaveKey) {
+        return;
+    }
+
+    // Append the new pair, or rewrite the file once the oldest must go.
+    FILE* fp = fopen(g_VerificationCache.Filename.string().c_str(), rewrite ? "w" : "a");
+    if (fp == nullptr) {
+        // Only the time saved on a later delivery is lost.
+        return;
+    }
+    if (rewrite) {
+        for (const std::string& entry : g_VerificationCache.Order) {
+            WriteVerifiedPair(fp, entry);
+        }
+    } else {
+        WriteVerifiedPair(fp, pair);
+    }
+    fclose(fp);
+#endif
+}
+
+void SuitClearVerificationCache(void)
+{
+    LOCK_VERIFICATION_CACHE();
+    filesystem::path filename;
+    TeepAgentGetVerificationCacheFilename(filename);
+    std::error_code ec;
+    filesystem::remove(filename, ec);
+
+    // Load whatever is in the file again when next needed.
+    g_VerificationCache.Filename.clear();
+    g_VerificationCache.Pairs.clear();
+    g_VerificationCache.Order.clear();
+}
+
+// Get the COSE authentication blocks that follow the digest in a
+// SUIT_Authentication.
+static bool GetAuthenticationBlocks(UsefulBufC authenticationWrapper, _Out_ std::vector<UsefulBufC>& blocks)
+{
+    blocks.clear();
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, authenticationWrapper, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount < 1) {
+        return false;
+    }
+    uint16_t entryCount = item.val.uCount;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS || item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+            return false;
+        }
+        if (i > 0) {
+            blocks.push_back(item.val.string);
+        }
+    }
+    return QCBORDecode_Finish(&context) == QCBOR_SUCCESS;
+}
+
+teep_error_code_t SuitVerifyAuthentication(_In_ const SuitEnvelopeOffsets& offsets, std::ostream& errorMessage)
+{
+    if (offsets.DigestBytes.len != TEEP_SHA256_SIZE) {
+        errorMessage << "SUIT_Envelope has no SHA-256 suit-digest";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    uint8_t digest[TEEP_SHA256_SIZE];
+    teep_error_code_t errorCode = SuitComputeManifestDigest(offsets, digest);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+    if (memcmp(digest, offsets.DigestBytes.ptr, TEEP_SHA256_SIZE) != 0) {
+        errorMessage << "suit-digest does not match suit-manifest";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+
+    std::vector<UsefulBufC> blocks;
+    if (!GetAuthenticationBlocks(offsets.AuthenticationWrapper, blocks)) {
+        errorMessage << "Malformed suit-authentication-wrapper";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    if (blocks.empty()) {
+#ifndef TEEP_USE_TEE
+        if (g_UnsignedEnvelopesAllowed) {
+            return TEEP_ERR_SUCCESS;
+        }
+#endif
+        errorMessage << "SUIT_Envelope is not signed";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+
+    // Any trusted key that has signed this digest before vouches for it.
+    std::string digestHex = MakeHexString(digest, sizeof(digest));
+    std::vector<struct t_cose_key> keys;
+    std::vector<std::string> pairs;
+    for (auto [kind, key_pair] : TeepAgentGetTamKeys()) {
+        uint8_t signer[TEEP_SHA256_SIZE];
+        if (teep_compute_public_key_digest(&key_pair, signer) == TEEP_ERR_SUCCESS) {
+            keys.push_back(key_pair);
+            pairs.push_back(digestHex + " " + MakeHexString(signer, sizeof(signer)));
+        }
+    }
+    {
+        LOCK_VERIFICATION_CACHE();
+        LoadVerificationCache();
+        for (const std::string& pair : pairs) {
+            if (g_VerificationCache.Pairs.count(pair) > 0) {
+                return TEEP_ERR_SUCCESS;
+            }
+        }
+    }
+
+    // The payload of each COSE_Sign1 is the detached SUIT_Digest.
+    for (UsefulBufC block : blocks) {
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (teep_verify_sign1_detached(&keys[i], block, offsets.Digest) == TEEP_ERR_SUCCESS) {
+                LOCK_VERIFICATION_CACHE();
+                RememberVerifiedPair(pairs[i]);
+                return TEEP_ERR_SUCCESS;
+            }
+        }
+    }
+    errorMessage << "SUIT_Envelope is not signed by a trusted key";
+    return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+}
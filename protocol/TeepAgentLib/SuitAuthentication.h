@@ -0,0 +1,33 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <filesystem>
+#include <ostream>
+#include "common.h"
+#include "SuitParser.h"
+
+// Check the suit-authentication-wrapper of a parsed SUIT_Envelope.  Its
+// digest must match suit-manifest, and one of its authentication blocks
+// must be a COSE_Sign1 by a trusted key.  An envelope with no blocks is
+// refused.
+//
+// Each (suit-digest, signer) pair that verifies is remembered, with the
+// signer identified by the SHA-256 of its public key, so a manifest that
+// is delivered again, whether installed already or resent after a failed
+// Update, is not verified a second time.  Outside a TEE the pairs are
+// also kept in a file, each with a MAC under an agent-held key; in a TEE
+// they are only kept in memory.
+teep_error_code_t SuitVerifyAuthentication(_In_ const SuitEnvelopeOffsets& offsets, std::ostream& errorMessage);
+
+#ifndef TEEP_USE_TEE
+// For tests only: accept envelopes that carry no authentication blocks,
+// such as the unsigned sample manifests.  Off by default.
+void SuitSetUnsignedEnvelopesAllowed(bool allowed);
+#endif
+
+// Forget every signature verified so far.
+void SuitClearVerificationCache(void);
+
+// Get the file in which verified signatures are remembered.  The key that
+// authenticates its lines is kept in the same name with ".key" added.
+void TeepAgentGetVerificationCacheFilename(_Out_ filesystem::path& filename);
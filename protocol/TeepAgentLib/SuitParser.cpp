@@ -3,56 +3,112 @@
 #ifdef TEEP_USE_TEE
 #include <openenclave/enclave.h>
 #endif
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <stdlib.h>
+#include <string.h>
+#ifndef TEEP_USE_TEE
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
 #include "common.h"
 extern "C" {
 #include "suit_manifest.h"
 };
 #include "qcbor/qcbor_decode.h"
+#include "ChunkTree.h"
+#include "delta.h"
+#include "ManifestTransaction.h"
+#include "ObjectStore.h"
+#include "SuitAuthentication.h"
 #include "SuitParser.h"
+#include "TeepAgentLib.h"
+
+// Consume the children of a container item so that the next call to
+// QCBORDecode_GetNext returns the item's next sibling.
+static void SkipNestedItems(_Inout_ QCBORDecodeContext* context, _Inout_ QCBORItem* item)
+{
+    uint8_t level = item->uNestingLevel;
+    while (item->uNextNestLevel > level) {
+        if (QCBORDecode_GetNext(context, item) != QCBOR_SUCCESS) {
+            break;
+        }
+    }
+}
 
-// Construct a filename from a SUIT_Digest.
-static teep_error_code_t GetFilenameFromSuitDigest(_Out_ filesystem::path& filename, UsefulBufC encoded)
+// Record the range of a SUIT_Digest and its digest bytes.
+static teep_error_code_t ParseSuitDigest(UsefulBufC encoded, _Inout_ SuitEnvelopeOffsets& offsets, std::ostream& errorMessage)
 {
-    teep_error_code_t errorCode = TEEP_ERR_PERMANENT_ERROR;
     QCBORDecodeContext context;
     QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
 
     QCBORItem item;
     QCBORDecode_GetNext(&context, &item);
-    if (item.uDataType != QCBOR_TYPE_ARRAY && item.val.uCount > 0) {
+    if (item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount < 2) {
+        REPORT_TYPE_ERROR(errorMessage, "SUIT_Digest", QCBOR_TYPE_ARRAY, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    uint16_t entryCount = item.val.uCount;
+
+    // Skip suit-digest-algorithm-id.
+    QCBORDecode_GetNext(&context, &item);
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        REPORT_TYPE_ERROR(errorMessage, "suit-digest-bytes", QCBOR_TYPE_BYTE_STRING, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    offsets.Digest = encoded;
+    offsets.DigestBytes = item.val.string;
+
+    // Skip any suit-digest-parameters.
+    for (uint16_t i = 2; i < entryCount; i++) {
         QCBORDecode_GetNext(&context, &item);
-        if (item.uDataType == QCBOR_TYPE_BYTE_STRING) {
-            // Base16 encode item.val.string.
-            TeepAgentMakeManifestFilename(filename, (const char*)item.val.string.ptr, item.val.string.len);
-            errorCode = TEEP_ERR_SUCCESS;
-        }
+        SkipNestedItems(&context, &item);
     }
-    QCBORDecode_Finish(&context);
-    return errorCode;
+    return (QCBORDecode_Finish(&context) == QCBOR_SUCCESS) ? TEEP_ERR_SUCCESS : TEEP_ERR_MANIFEST_PROCESSING_FAILED;
 }
 
-// Construct a filename from a SUIT_Authentication.
-static teep_error_code_t GetFilenameFromSuitAuthentication(_Out_ filesystem::path& filename, UsefulBufC encoded)
+// Record the range of a SUIT_Authentication and the digest inside it.
+static teep_error_code_t ParseSuitAuthentication(UsefulBufC encoded, _Inout_ SuitEnvelopeOffsets& offsets, std::ostream& errorMessage)
 {
-    teep_error_code_t errorCode = TEEP_ERR_PERMANENT_ERROR;
     QCBORDecodeContext context;
     QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
 
     QCBORItem item;
     QCBORDecode_GetNext(&context, &item);
-    if (item.uDataType == QCBOR_TYPE_ARRAY && item.val.uCount > 0) {
+    if (item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount < 1) {
+        REPORT_TYPE_ERROR(errorMessage, "SUIT_Authentication", QCBOR_TYPE_ARRAY, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    uint16_t entryCount = item.val.uCount;
+    offsets.AuthenticationWrapper = encoded;
+
+    // The first entry is the bstr-wrapped SUIT_Digest, and the rest are
+    // bstr-wrapped COSE authentication blocks.
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        REPORT_TYPE_ERROR(errorMessage, "suit-digest", QCBOR_TYPE_BYTE_STRING, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    teep_error_code_t errorCode = ParseSuitDigest(item.val.string, offsets, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+    for (uint16_t i = 1; i < entryCount; i++) {
         QCBORDecode_GetNext(&context, &item);
-        if (item.uDataType == QCBOR_TYPE_BYTE_STRING) {
-            errorCode = GetFilenameFromSuitDigest(filename, item.val.string);
-        }
+        SkipNestedItems(&context, &item);
     }
-    QCBORDecode_Finish(&context);
-    return errorCode;
+    return (QCBORDecode_Finish(&context) == QCBOR_SUCCESS) ? TEEP_ERR_SUCCESS : TEEP_ERR_MANIFEST_PROCESSING_FAILED;
 }
 
-// Construct a filename from a SUIT_Component_Identifier.
-static teep_error_code_t GetFilenameFromSuitComponentIdentifier(_Out_ filesystem::path& filename, QCBORDecodeContext* context, QCBORItem* item, ostream& errorMessage)
+// Record the last bstr of a SUIT_Component_Identifier, which is used
+// to name the manifest.
+static teep_error_code_t ParseSuitComponentIdentifier(QCBORDecodeContext* context, QCBORItem* item, _Out_ UsefulBufC& componentId, ostream& errorMessage)
 {
     if (item->uDataType != QCBOR_TYPE_ARRAY) {
         REPORT_TYPE_ERROR(errorMessage, "suit-manifest-component-id", QCBOR_TYPE_ARRAY, *item);
@@ -75,121 +131,36 @@ static teep_error_code_t GetFilenameFromSuitComponentIdentifier(_Out_ filesystem
     }
 
     // Return the last bstr as the suffix.
-    TeepAgentMakeManifestFilename(filename, (const char*)item->val.string.ptr, item->val.string.len);
+    componentId = item->val.string;
     return TEEP_ERR_SUCCESS;
 }
 
-// Construct a filename from a SUIT_Common.
-static teep_error_code_t GetFilenameFromSuitCommon(_Out_ filesystem::path& filename, UsefulBufC encoded, std::ostream& errorMessage)
+// Get the component indices that key suit-dependencies.
+static teep_error_code_t ParseSuitDependencies(QCBORDecodeContext* context, QCBORItem* item, _Out_ std::vector<uint64_t>& indices, ostream& errorMessage)
 {
-    teep_error_code_t errorCode = TEEP_ERR_PERMANENT_ERROR;
-    QCBORDecodeContext context;
-    QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
-
-    QCBORItem item;
-    QCBORDecode_GetNext(&context, &item);
-    if (item.uDataType == QCBOR_TYPE_MAP) {
-        size_t entryCount = item.val.uCount;
-        for (size_t entryIndex = 0; entryIndex < entryCount; entryIndex++) {
-            QCBORDecode_GetNext(&context, &item);
-            suit_common_label_t label = (suit_common_label_t)item.label.int64;
-            if (label != SUIT_COMMON_LABEL_COMPONENTS) {
-                continue;
-            }
-            if (item.uDataType != QCBOR_TYPE_ARRAY) {
-                break;
-            }
-            if (item.val.uCount < 1) {
-                break;
-            }
-
-            // Get first array entry.
-            QCBORDecode_GetNext(&context, &item);
-            errorCode = GetFilenameFromSuitComponentIdentifier(filename, &context, &item, errorMessage);
-            break;
-        }
+    indices.clear();
+    if (item->uDataType != QCBOR_TYPE_MAP) {
+        REPORT_TYPE_ERROR(errorMessage, "suit-dependencies", QCBOR_TYPE_MAP, *item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
     }
-    QCBORDecode_Finish(&context);
-    return errorCode;
-}
-
-// Construct a filename from a SUIT_Manifest.
-static teep_error_code_t GetFilenameFromSuitManifest(_Out_ filesystem::path& filename, UsefulBufC encoded, std::ostream& errorMessage)
-{
-    teep_error_code_t errorCode = TEEP_ERR_PERMANENT_ERROR;
-    QCBORDecodeContext context;
-    QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
-
-    QCBORItem item;
-    QCBORDecode_GetNext(&context, &item);
-    if (item.uDataType == QCBOR_TYPE_MAP) {
-        size_t entryCount = item.val.uCount;
-        for (size_t entryIndex = 0; entryIndex < entryCount; entryIndex++) {
-            QCBORDecode_GetNext(&context, &item);
-            suit_envelope_label_t label = (suit_envelope_label_t)item.label.int64;
-            if (label == SUIT_MANIFEST_LABEL_COMMON) {
-                if (item.uDataType != QCBOR_TYPE_BYTE_STRING) {
-                    break;
-                }
-                errorCode = GetFilenameFromSuitCommon(filename, item.val.string, errorMessage);
-
-                // Keep going in case we actually find a manifest component ID.
-                continue;
-            }
-            if (label == SUIT_MANIFEST_LABEL_COMPONENT_ID) {
-                errorCode = GetFilenameFromSuitComponentIdentifier(filename, &context, &item, errorMessage);
-                break;
-            }
+    uint16_t dependencyCount = item->val.uCount;
+    for (uint16_t i = 0; i < dependencyCount; i++) {
+        QCBORDecode_GetNext(context, item);
+        if (item->uLabelType != QCBOR_TYPE_INT64 || item->label.int64 < 0) {
+            errorMessage << "suit-dependencies must be keyed by component index";
+            return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
         }
-    }
-    QCBORDecode_Finish(&context);
-    return errorCode;
-}
-
-// Construct a filename from a SUIT_Envelope.
-static teep_error_code_t GetFilenameFromSuitEnvelope(_Out_ filesystem::path& filename, UsefulBufC encoded, std::ostream& errorMessage)
-{
-    teep_error_code_t errorCode = TEEP_ERR_PERMANENT_ERROR;
-    QCBORDecodeContext context;
-    QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
+        indices.push_back((uint64_t)item->label.int64);
 
-    QCBORItem item;
-    QCBORDecode_GetNext(&context, &item);
-    if (item.uDataType == QCBOR_TYPE_MAP) {
-        size_t entryCount = item.val.uCount;
-        for (size_t entryIndex = 0; entryIndex < entryCount; entryIndex++) {
-            QCBORDecode_GetNext(&context, &item);
-            suit_envelope_label_t label = (suit_envelope_label_t)item.label.int64;
-            if (label == SUIT_ENVELOPE_LABEL_AUTHENTICATION_WRAPPER) {
-                if (item.uDataType != QCBOR_TYPE_BYTE_STRING) {
-                    break;
-                }
-                errorCode = GetFilenameFromSuitAuthentication(filename, item.val.string);
-                if (errorCode == TEEP_ERR_SUCCESS) {
-                    break;
-                }
-                continue;
-            }
-            if (label == SUIT_ENVELOPE_LABEL_MANIFEST) {
-                if (item.uDataType != QCBOR_TYPE_BYTE_STRING) {
-                    break;
-                }
-                errorCode = GetFilenameFromSuitManifest(filename, item.val.string, errorMessage);
-                if (errorCode == TEEP_ERR_SUCCESS) {
-                    break;
-                }
-                continue;
-            }
-        }
+        // SUIT_Dependency_Metadata is of no use here.
+        SkipNestedItems(context, item);
     }
-    QCBORDecode_Finish(&context);
-    return errorCode;
+    return TEEP_ERR_SUCCESS;
 }
 
-#if 0
-// TODO(issue #7): implement SUIT processing.
-// Parse a SUIT_Common out of a decode context and try to install it.
-static teep_error_code_t TryProcessSuitCommon(UsefulBufC encoded, std::ostream& errorMessage)
+// Record the range of a SUIT_Common, of its first component identifier,
+// and of the identifier of each component that is a dependency.
+static teep_error_code_t ParseSuitCommon(UsefulBufC encoded, _Inout_ SuitEnvelopeOffsets& offsets, std::ostream& errorMessage)
 {
     QCBORDecodeContext context;
     QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
@@ -198,144 +169,222 @@ static teep_error_code_t TryProcessSuitCommon(UsefulBufC encoded, std::ostream&
     QCBORDecode_GetNext(&context, &item);
     if (item.uDataType != QCBOR_TYPE_MAP) {
         REPORT_TYPE_ERROR(errorMessage, "SUIT_Common", QCBOR_TYPE_MAP, item);
-        return TEEP_ERR_PERMANENT_ERROR;
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
     }
-    uint16_t mapEntryCount = item.val.uCount;
+    offsets.Common = encoded;
 
-    for (int mapEntryIndex = 0; mapEntryIndex < mapEntryCount; mapEntryIndex++) {
+    // suit-dependencies may come before suit-components, so indices are
+    // only resolved once both have been read.
+    std::vector<UsefulBufC> componentIds;
+    std::vector<uint64_t> dependencyIndices;
+    size_t entryCount = item.val.uCount;
+    for (size_t entryIndex = 0; entryIndex < entryCount; entryIndex++) {
         QCBORDecode_GetNext(&context, &item);
         suit_common_label_t label = (suit_common_label_t)item.label.int64;
-        switch (label) {
-        case SUIT_COMMON_LABEL_DEPENDENCIES:
-        case SUIT_COMMON_LABEL_COMPONENTS:
-        case SUIT_COMMON_LABEL_SEQUENCE:
-            // Not yet implemented.
-            return TEEP_ERR_TEMPORARY_ERROR;
-            break;
-        default:
-            return TEEP_ERR_PERMANENT_ERROR;
+        if (label == SUIT_COMMON_LABEL_SEQUENCE && item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+            offsets.CommonSequence = item.val.string;
+            continue;
+        }
+        if (label == SUIT_COMMON_LABEL_DEPENDENCIES) {
+            teep_error_code_t errorCode = ParseSuitDependencies(&context, &item, dependencyIndices, errorMessage);
+            if (errorCode != TEEP_ERR_SUCCESS) {
+                return errorCode;
+            }
+            continue;
+        }
+        if (label != SUIT_COMMON_LABEL_COMPONENTS) {
+            SkipNestedItems(&context, &item);
+            continue;
+        }
+        if (item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount < 1) {
+            REPORT_TYPE_ERROR(errorMessage, "suit-components", QCBOR_TYPE_ARRAY, item);
+            return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+        }
+        uint16_t componentCount = item.val.uCount;
+        offsets.ComponentCount = componentCount;
+        for (uint16_t componentIndex = 0; componentIndex < componentCount; componentIndex++) {
+            QCBORDecode_GetNext(&context, &item);
+            UsefulBufC componentId;
+            teep_error_code_t errorCode = ParseSuitComponentIdentifier(&context, &item, componentId, errorMessage);
+            if (errorCode != TEEP_ERR_SUCCESS) {
+                return errorCode;
+            }
+            componentIds.push_back(componentId);
+        }
+        if (UsefulBuf_IsNULLC(offsets.ComponentId)) {
+            offsets.ComponentId = componentIds[0];
         }
     }
 
-    QCBORError err = QCBORDecode_Finish(&context);
-    return (err == QCBOR_SUCCESS) ? TEEP_ERR_SUCCESS : TEEP_ERR_TEMPORARY_ERROR;
+    // Component 0 is the one this manifest installs, so it cannot also
+    // be a dependency.
+    offsets.Dependencies.clear();
+    for (uint64_t index : dependencyIndices) {
+        if (index == 0 || index >= componentIds.size()) {
+            errorMessage << "suit-dependencies refers to component " << index << ", which is not a dependency";
+            return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+        }
+        offsets.Dependencies.push_back(componentIds[(size_t)index]);
+    }
+    return (QCBORDecode_Finish(&context) == QCBOR_SUCCESS) ? TEEP_ERR_SUCCESS : TEEP_ERR_MANIFEST_PROCESSING_FAILED;
 }
-#endif
 
-static teep_error_code_t SuitSaveManifest(
-    _In_ filesystem::path& filename,
-    _In_ UsefulBufC encoded,
-    _Inout_ std::ostream& errorMessage)
+// Record the SHA-256 digest that stands in a manifest for a severed
+// member.  Digests of other algorithms are skipped, so the member cannot
+// be used.
+static void ParseSeveredMemberDigest(_Inout_ QCBORDecodeContext* context, _Inout_ QCBORItem* item, _Out_ UsefulBufC& digestBytes)
 {
-    std::string path_str = filename.string();
-    FILE* fp = fopen(path_str.c_str(), "wb");
-    if (fp == nullptr) {
-        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    digestBytes = NULLUsefulBufC;
+    if (item->uDataType != QCBOR_TYPE_ARRAY) {
+        SkipNestedItems(context, item);
+        return;
+    }
+    bool sha256 = false;
+    uint16_t entryCount = item->val.uCount;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        QCBORDecode_GetNext(context, item);
+        if (i == 0) {
+            sha256 = (item->uDataType == QCBOR_TYPE_INT64 && item->val.int64 == SUIT_DIGEST_ALGORITHM_SHA256);
+        } else if (i == 1 && sha256 && item->uDataType == QCBOR_TYPE_BYTE_STRING && item->val.string.len == TEEP_SHA256_SIZE) {
+            digestBytes = item->val.string;
+        }
+        SkipNestedItems(context, item);
     }
-    fwrite(encoded.ptr, 1, encoded.len, fp);
-    fclose(fp);
-    return TEEP_ERR_SUCCESS;
 }
 
-// Parse a SUIT_Manifest out of a decode context and try to install it.
-static teep_error_code_t TryProcessSuitManifest(_Inout_ filesystem::path& filename, UsefulBufC encoded, std::ostream& errorMessage)
+// Record the range of a SUIT_Manifest and of the members nested inside it.
+static teep_error_code_t ParseSuitManifest(UsefulBufC encoded, _Inout_ SuitEnvelopeOffsets& offsets, std::ostream& errorMessage)
 {
-#if 1
-    TEEP_UNUSED(filename);
-    TEEP_UNUSED(encoded);
-    TEEP_UNUSED(errorMessage);
-    return TEEP_ERR_SUCCESS;
-#else
     QCBORDecodeContext context;
     QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
+
     QCBORItem item;
     QCBORDecode_GetNext(&context, &item);
     if (item.uDataType != QCBOR_TYPE_MAP) {
         REPORT_TYPE_ERROR(errorMessage, "SUIT_Manifest", QCBOR_TYPE_MAP, item);
-        return TEEP_ERR_PERMANENT_ERROR;
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
     }
-    int mapEntryCount = item.val.uCount;
+    offsets.Manifest = encoded;
 
+    // A manifest component ID takes precedence over the first component
+    // listed in the common block.
+    UsefulBufC manifestComponentId = NULLUsefulBufC;
     teep_error_code_t errorCode = TEEP_ERR_SUCCESS;
-    for (int mapEntryIndex = 0; mapEntryIndex < mapEntryCount; mapEntryIndex++) {
+    size_t entryCount = item.val.uCount;
+    for (size_t entryIndex = 0; entryIndex < entryCount; entryIndex++) {
         QCBORDecode_GetNext(&context, &item);
-        if (errorCode != TEEP_ERR_SUCCESS) {
-            continue;
-        }
         suit_manifest_label_t label = (suit_manifest_label_t)item.label.int64;
         switch (label) {
-        case SUIT_MANIFEST_LABEL_VERSION:
-            if (item.uDataType != QCBOR_TYPE_INT64 || item.val.int64 != SUIT_MANIFEST_VERSION_VALUE) {
-                REPORT_TYPE_ERROR(errorMessage, "suit-manifest-version", QCBOR_TYPE_INT64, item);
-                return TEEP_ERR_PERMANENT_ERROR;
-            }
-            break;
         case SUIT_MANIFEST_LABEL_SEQUENCE_NUMBER:
             if (item.uDataType != QCBOR_TYPE_INT64 && item.uDataType != QCBOR_TYPE_UINT64) {
                 REPORT_TYPE_ERROR(errorMessage, "suit-manifest-sequence-number", QCBOR_TYPE_UINT64, item);
-                return TEEP_ERR_PERMANENT_ERROR;
+                return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
             }
+            offsets.SequenceNumber = item.val.uint64;
             break;
         case SUIT_MANIFEST_LABEL_COMMON:
             if (item.uDataType != QCBOR_TYPE_BYTE_STRING) {
                 REPORT_TYPE_ERROR(errorMessage, "suit-common", QCBOR_TYPE_BYTE_STRING, item);
-                return TEEP_ERR_PERMANENT_ERROR;
+                return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+            }
+            errorCode = ParseSuitCommon(item.val.string, offsets, errorMessage);
+            if (errorCode != TEEP_ERR_SUCCESS) {
+                return errorCode;
             }
-#if 0
-            // TODO(issue #7): implement SUIT processing.
-            errorCode = TryProcessSuitCommon(item.val.string, errorMessage);
-#endif
             break;
-        case SUIT_MANIFEST_LABEL_REFERENCE_URI:
-        case SUIT_MANIFEST_LABEL_VALIDATE:
-        case SUIT_MANIFEST_LABEL_LOAD:
-        case SUIT_MANIFEST_LABEL_INVOKE:
-        case 10: // obsolete
-        case 11: // obsolete
-        case 12: // obsolete
-#if 0
-            // TODO(issue #7): implement SUIT processing.
-            errorCode = TEEP_ERR_TEMPORARY_ERROR;
-#endif
+        case SUIT_MANIFEST_LABEL_PAYLOAD_FETCH:
+        case SUIT_MANIFEST_LABEL_INSTALL:
+            if (item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+                // A severed member is replaced by its digest, and the
+                // member itself may be carried in the envelope.
+                ParseSeveredMemberDigest(&context, &item,
+                    (label == SUIT_MANIFEST_LABEL_PAYLOAD_FETCH) ? offsets.PayloadFetchDigest : offsets.InstallDigest);
+                break;
+            }
+            if (label == SUIT_MANIFEST_LABEL_PAYLOAD_FETCH) {
+                offsets.PayloadFetch = item.val.string;
+            } else {
+                offsets.Install = item.val.string;
+            }
             break;
         case SUIT_MANIFEST_LABEL_COMPONENT_ID:
-            errorCode = GetFilenameFromSuitComponentIdentifier(filename, &context, &item, errorMessage);
+            errorCode = ParseSuitComponentIdentifier(&context, &item, manifestComponentId, errorMessage);
+            if (errorCode != TEEP_ERR_SUCCESS) {
+                return errorCode;
+            }
             break;
         default:
-            errorCode = TEEP_ERR_PERMANENT_ERROR;
+            SkipNestedItems(&context, &item);
+            break;
         }
     }
+    if (!UsefulBuf_IsNULLC(manifestComponentId)) {
+        offsets.ComponentId = manifestComponentId;
+    }
+    return (QCBORDecode_Finish(&context) == QCBOR_SUCCESS) ? TEEP_ERR_SUCCESS : TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+}
 
-    return errorCode;
-#endif
+// Size of the CBOR head that precedes a definite-length bstr.
+static size_t GetByteStringHeadSize(size_t length)
+{
+    return (length < 24) ? 1 : (length <= 0xff) ? 2 : (length <= 0xffff) ? 3 : (length <= 0xffffffff) ? 5 : 9;
 }
 
-// Parse a SUIT_Envelope out of a decode context and try to install it.
-teep_error_code_t TryProcessSuitEnvelope(UsefulBufC encoded, std::ostream& errorMessage)
+teep_error_code_t SuitComputeManifestDigest(_In_ const SuitEnvelopeOffsets& offsets, _Out_writes_(TEEP_SHA256_SIZE) uint8_t* digest)
 {
-    // Try to extract a filename out of the SUIT envelope.
-    filesystem::path filename;
-    teep_error_code_t errorCode = GetFilenameFromSuitEnvelope(filename, encoded, errorMessage);
+    size_t headSize = GetByteStringHeadSize(offsets.Manifest.len);
+    return teep_compute_sha256({ (const uint8_t*)offsets.Manifest.ptr - headSize, offsets.Manifest.len + headSize }, digest);
+}
+
+// Use a severed member from the envelope in place of the digest that the
+// manifest holds for it, once its bstr-wrapped form matches the digest.
+static teep_error_code_t UseSeveredMember(UsefulBufC member, UsefulBufC expectedDigest, _Inout_ UsefulBufC& contents, std::ostream& errorMessage)
+{
+    if (UsefulBuf_IsNULLC(member)) {
+        return TEEP_ERR_SUCCESS;
+    }
+    if (!UsefulBuf_IsNULLC(contents) || UsefulBuf_IsNULLC(expectedDigest)) {
+        errorMessage << "Severed SUIT member has no SHA-256 digest in the manifest";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    size_t headSize = GetByteStringHeadSize(member.len);
+    uint8_t digest[TEEP_SHA256_SIZE];
+    teep_error_code_t errorCode = teep_compute_sha256({ (const uint8_t*)member.ptr - headSize, member.len + headSize }, digest);
     if (errorCode != TEEP_ERR_SUCCESS) {
         return errorCode;
     }
+    if (memcmp(digest, expectedDigest.ptr, TEEP_SHA256_SIZE) != 0) {
+        errorMessage << "Severed SUIT member does not match its digest";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    contents = member;
+    return TEEP_ERR_SUCCESS;
+}
 
-    QCBORDecodeContext context;
+// Walk a SUIT_Envelope once, recording the byte range of each member
+// that later processing needs.  Every range points into the encoded
+// envelope, so nothing is copied and nothing is decoded twice.
+teep_error_code_t SuitParseEnvelope(UsefulBufC encoded, _Out_ SuitEnvelopeOffsets& offsets, std::ostream& errorMessage)
+{
+    offsets = SuitEnvelopeOffsets{};
+    offsets.Envelope = encoded;
 
+    QCBORDecodeContext context;
     QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
+
     QCBORItem item;
     QCBORDecode_GetNext(&context, &item);
     if (item.uDataType != QCBOR_TYPE_MAP) {
         REPORT_TYPE_ERROR(errorMessage, "SUIT_Envelope", QCBOR_TYPE_MAP, item);
         return TEEP_ERR_PERMANENT_ERROR;
     }
-    size_t mapEntryCount = item.val.uCount;
 
+    teep_error_code_t errorCode = TEEP_ERR_SUCCESS;
+    UsefulBufC severedPayloadFetch = NULLUsefulBufC;
+    UsefulBufC severedInstall = NULLUsefulBufC;
+    size_t mapEntryCount = item.val.uCount;
     for (size_t mapEntryIndex = 0; mapEntryIndex < mapEntryCount; mapEntryIndex++) {
         QCBORDecode_GetNext(&context, &item);
-        if (errorCode != TEEP_ERR_SUCCESS) {
-            continue;
-        }
         suit_envelope_label_t label = (suit_envelope_label_t)item.label.int64;
         switch (label) {
         case SUIT_ENVELOPE_LABEL_AUTHENTICATION_WRAPPER:
@@ -343,32 +392,1043 @@ teep_error_code_t TryProcessSuitEnvelope(UsefulBufC encoded, std::ostream& error
                 REPORT_TYPE_ERROR(errorMessage, "suit-authentication-wrapper", QCBOR_TYPE_BYTE_STRING, item);
                 return TEEP_ERR_PERMANENT_ERROR;
             }
-            // TODO: process authentication wrapper
+            errorCode = ParseSuitAuthentication(item.val.string, offsets, errorMessage);
             break;
         case SUIT_ENVELOPE_LABEL_MANIFEST:
             if (item.uDataType != QCBOR_TYPE_BYTE_STRING) {
                 REPORT_TYPE_ERROR(errorMessage, "suit-manifest", QCBOR_TYPE_BYTE_STRING, item);
                 return TEEP_ERR_PERMANENT_ERROR;
             }
-            errorCode = TryProcessSuitManifest(filename, item.val.string, errorMessage);
+            errorCode = ParseSuitManifest(item.val.string, offsets, errorMessage);
             break;
-        default:
-            errorCode = TEEP_ERR_PERMANENT_ERROR;
+        case SUIT_ENVELOPE_LABEL_PAYLOAD_FETCH:
+        case SUIT_ENVELOPE_LABEL_INSTALL:
+            if (item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+                REPORT_TYPE_ERROR(errorMessage, "severed SUIT member", QCBOR_TYPE_BYTE_STRING, item);
+                return TEEP_ERR_PERMANENT_ERROR;
+            }
+            if (label == SUIT_ENVELOPE_LABEL_PAYLOAD_FETCH) {
+                severedPayloadFetch = item.val.string;
+            } else {
+                severedInstall = item.val.string;
+            }
+            break;
+        case SUIT_ENVELOPE_LABEL_TEXT:
+            // Descriptions are of no use here.
+            SkipNestedItems(&context, &item);
             break;
+        default:
+            errorMessage << "Unrecognized SUIT_Envelope label " << item.label.int64;
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        if (errorCode != TEEP_ERR_SUCCESS) {
+            return errorCode;
         }
     }
 
-    if (errorCode == TEEP_ERR_SUCCESS) {
-        errorCode = SuitSaveManifest(filename, encoded, errorMessage);
+    if (QCBORDecode_Finish(&context) != QCBOR_SUCCESS) {
+        return TEEP_ERR_PERMANENT_ERROR;
     }
-    return errorCode;
+    if (UsefulBuf_IsNULLC(offsets.Manifest)) {
+        errorMessage << "SUIT_Envelope has no suit-manifest";
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    errorCode = UseSeveredMember(severedPayloadFetch, offsets.PayloadFetchDigest, offsets.PayloadFetch, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+    return UseSeveredMember(severedInstall, offsets.InstallDigest, offsets.Install, errorMessage);
 }
 
-teep_error_code_t SuitUninstallComponent(UsefulBufC componentId)
+// Construct a filename from the offsets of a parsed SUIT_Envelope.
+static teep_error_code_t GetFilenameFromSuitEnvelope(_Out_ filesystem::path& filename, _In_ const SuitEnvelopeOffsets& offsets)
 {
-    // TODO(issue #7): SUIT manifest support
-    filesystem::path filename;
-    TeepAgentMakeManifestFilename(filename, (const char*)componentId.ptr, componentId.len);
-    _unlink(filename.string().c_str());
+    if (UsefulBuf_IsNULLC(offsets.ComponentId)) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    TeepAgentMakeManifestFilename(filename, (const char*)offsets.ComponentId.ptr, offsets.ComponentId.len);
+    return TEEP_ERR_SUCCESS;
+}
+
+static teep_error_code_t SuitSaveManifest(
+    _In_ filesystem::path& filename,
+    _In_ UsefulBufC encoded,
+    _Inout_ ManifestTransaction& transaction,
+    _Inout_ std::ostream& errorMessage)
+{
+    return transaction.StageWrite(filename, encoded, errorMessage);
+}
+
+// Parse a SUIT_Envelope and check that it can be installed, without
+// touching any persistent state.
+static teep_error_code_t SuitValidateEnvelope(UsefulBufC encoded, _Out_ SuitEnvelopeOffsets& offsets, std::ostream& errorMessage)
+{
+    teep_error_code_t errorCode = SuitParseEnvelope(encoded, offsets, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+    if (UsefulBuf_IsNULLC(offsets.ComponentId)) {
+        errorMessage << "SUIT_Envelope has no component identifier";
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    return SuitVerifyAuthentication(offsets, errorMessage);
+}
+
+teep_error_code_t SuitCheckEnvelope(UsefulBufC encoded, std::ostream& errorMessage)
+{
+    SuitEnvelopeOffsets offsets;
+    return SuitValidateEnvelope(encoded, offsets, errorMessage);
+}
+
+// Payloads are fetched in pieces of this size, so memory use does not
+// grow with the size of the payload.
+#define SUIT_FETCH_CHUNK_SIZE (64 * 1024)
+
+// The leaves of a chunk tree are fetched from the image URI plus this.
+#define SUIT_CHUNK_LEAVES_SUFFIX ".chunks"
+
+static SuitPayloadFetcher g_PayloadFetcher = TeepAgentFetchPayload;
+
+void SuitSetPayloadFetcher(_In_opt_ SuitPayloadFetcher fetcher)
+{
+    g_PayloadFetcher = fetcher;
+}
+
+// Parameters that the command sequences have set for one component.
+typedef struct {
+    UsefulBufC Uri;
+    UsefulBufC ImageDigest; // SHA-256 suit-digest-bytes.
+    uint64_t ImageSize;
+    uint64_t ChunkSize;     // Zero unless the image has a chunk tree.
+    UsefulBufC ChunkTreeRoot;
+    UsefulBufC DeltaBaseDigest; // SHA-256 suit-digest-bytes of the base image.
+    UsefulBufC DeltaUri;
+    uint64_t SourceComponent;
+    bool HasSourceComponent;
+    bool FetchDeferred;         // Fetched with no image digest, to be copied.
+} SuitComponentParameters;
+
+// State shared by the command sequences of one manifest.
+typedef struct {
+    filesystem::path ManifestFilename;
+    ManifestTransaction* Transaction;
+    std::vector<SuitComponentParameters> Components;
+    std::vector<bool> Selected;
+} SuitCommandState;
+
+// Each fetched payload is stored next to its manifest, named by the
+// manifest and the index of the component.
+static void SuitMakePayloadFilename(_Out_ filesystem::path& payloadPath, _In_ const filesystem::path& manifestPath, size_t componentIndex)
+{
+    payloadPath = manifestPath;
+    payloadPath.replace_extension("." + std::to_string(componentIndex) + ".payload");
+}
+
+// Get the digest bytes out of a bstr-wrapped SHA-256 SUIT_Digest.
+static teep_error_code_t ParseSuitImageDigest(UsefulBufC encoded, _Out_ UsefulBufC& digestBytes, std::ostream& errorMessage)
+{
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount < 2) {
+        REPORT_TYPE_ERROR(errorMessage, "suit-parameter-image-digest", QCBOR_TYPE_ARRAY, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    uint16_t entryCount = item.val.uCount;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_INT64 || item.val.int64 != SUIT_DIGEST_ALGORITHM_SHA256) {
+        errorMessage << "Unsupported suit-digest-algorithm-id";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_BYTE_STRING || item.val.string.len != TEEP_SHA256_SIZE) {
+        REPORT_TYPE_ERROR(errorMessage, "suit-digest-bytes", QCBOR_TYPE_BYTE_STRING, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    digestBytes = item.val.string;
+    for (uint16_t i = 2; i < entryCount; i++) {
+        QCBORDecode_GetNext(&context, &item);
+        SkipNestedItems(&context, &item);
+    }
+    return (QCBORDecode_Finish(&context) == QCBOR_SUCCESS) ? TEEP_ERR_SUCCESS : TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+}
+
+// Get the chunk size and root out of a bstr-wrapped chunk tree parameter.
+static teep_error_code_t ParseSuitChunkTree(UsefulBufC encoded, _Inout_ SuitComponentParameters& component, std::ostream& errorMessage)
+{
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount != 2) {
+        REPORT_TYPE_ERROR(errorMessage, "chunk tree", QCBOR_TYPE_ARRAY, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_INT64 ||
+        item.val.int64 < CHUNK_TREE_MIN_CHUNK_SIZE || item.val.int64 > CHUNK_TREE_MAX_CHUNK_SIZE) {
+        errorMessage << "Unsupported chunk size";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    uint64_t chunkSize = item.val.uint64;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_BYTE_STRING || item.val.string.len != TEEP_SHA256_SIZE) {
+        REPORT_TYPE_ERROR(errorMessage, "chunk tree root", QCBOR_TYPE_BYTE_STRING, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    if (QCBORDecode_Finish(&context) != QCBOR_SUCCESS) {
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    component.ChunkSize = chunkSize;
+    component.ChunkTreeRoot = item.val.string;
     return TEEP_ERR_SUCCESS;
-}
\ No newline at end of file
+}
+
+// Get the base digest and URI out of a bstr-wrapped delta parameter.
+static teep_error_code_t ParseSuitDelta(UsefulBufC encoded, _Inout_ SuitComponentParameters& component, std::ostream& errorMessage)
+{
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount != 2) {
+        REPORT_TYPE_ERROR(errorMessage, "delta", QCBOR_TYPE_ARRAY, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        REPORT_TYPE_ERROR(errorMessage, "delta base digest", QCBOR_TYPE_BYTE_STRING, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    UsefulBufC baseDigest;
+    teep_error_code_t errorCode = ParseSuitImageDigest(item.val.string, baseDigest, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_TEXT_STRING) {
+        REPORT_TYPE_ERROR(errorMessage, "delta URI", QCBOR_TYPE_TEXT_STRING, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    if (QCBORDecode_Finish(&context) != QCBOR_SUCCESS) {
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    component.DeltaBaseDigest = baseDigest;
+    component.DeltaUri = item.val.string;
+    return TEEP_ERR_SUCCESS;
+}
+
+// Apply suit-directive-set-parameters or suit-directive-override-parameters
+// to the selected components.
+static teep_error_code_t SuitSetParameters(
+    _Inout_ QCBORDecodeContext* context,
+    _Inout_ QCBORItem* item,
+    bool overrideExisting,
+    _Inout_ SuitCommandState& state,
+    std::ostream& errorMessage)
+{
+    if (item->uDataType != QCBOR_TYPE_MAP) {
+        REPORT_TYPE_ERROR(errorMessage, "SUIT_Parameters", QCBOR_TYPE_MAP, *item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    uint16_t entryCount = item->val.uCount;
+    for (uint16_t entryIndex = 0; entryIndex < entryCount; entryIndex++) {
+        QCBORDecode_GetNext(context, item);
+        suit_parameter_t label = (suit_parameter_t)item->label.int64;
+        for (size_t i = 0; i < state.Components.size(); i++) {
+            if (!state.Selected[i]) {
+                continue;
+            }
+            SuitComponentParameters& component = state.Components[i];
+            if (label == SUIT_PARAMETER_URI && item->uDataType == QCBOR_TYPE_TEXT_STRING) {
+                if (overrideExisting || UsefulBuf_IsNULLC(component.Uri)) {
+                    component.Uri = item->val.string;
+                }
+            } else if (label == SUIT_PARAMETER_IMAGE_DIGEST && item->uDataType == QCBOR_TYPE_BYTE_STRING) {
+                if (overrideExisting || UsefulBuf_IsNULLC(component.ImageDigest)) {
+                    teep_error_code_t errorCode = ParseSuitImageDigest(item->val.string, component.ImageDigest, errorMessage);
+                    if (errorCode != TEEP_ERR_SUCCESS) {
+                        return errorCode;
+                    }
+                }
+            } else if (label == SUIT_PARAMETER_IMAGE_SIZE && item->uDataType == QCBOR_TYPE_INT64) {
+                if (overrideExisting || component.ImageSize == 0) {
+                    component.ImageSize = item->val.uint64;
+                }
+            } else if (label == SUIT_PARAMETER_CHUNK_TREE && item->uDataType == QCBOR_TYPE_BYTE_STRING) {
+                if (overrideExisting || component.ChunkSize == 0) {
+                    teep_error_code_t errorCode = ParseSuitChunkTree(item->val.string, component, errorMessage);
+                    if (errorCode != TEEP_ERR_SUCCESS) {
+                        return errorCode;
+                    }
+                }
+            } else if (label == SUIT_PARAMETER_SOURCE_COMPONENT && item->uDataType == QCBOR_TYPE_INT64) {
+                if (overrideExisting || !component.HasSourceComponent) {
+                    component.SourceComponent = item->val.uint64;
+                    component.HasSourceComponent = true;
+                }
+            } else if (label == SUIT_PARAMETER_DELTA && item->uDataType == QCBOR_TYPE_BYTE_STRING) {
+                if (overrideExisting || UsefulBuf_IsNULLC(component.DeltaUri)) {
+                    teep_error_code_t errorCode = ParseSuitDelta(item->val.string, component, errorMessage);
+                    if (errorCode != TEEP_ERR_SUCCESS) {
+                        return errorCode;
+                    }
+                }
+            }
+        }
+        SkipNestedItems(context, item);
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+// Check a chunk against its leaf of the chunk tree.
+static bool SuitCheckChunk(_In_ const std::vector<uint8_t>& leaves, uint64_t chunkIndex, UsefulBufC chunk)
+{
+    uint8_t leaf[TEEP_SHA256_SIZE];
+    if (chunkIndex >= leaves.size() / TEEP_SHA256_SIZE ||
+        ChunkTreeHashLeaf(chunk, leaf) != TEEP_ERR_SUCCESS) {
+        return false;
+    }
+    return memcmp(leaf, leaves.data() + chunkIndex * TEEP_SHA256_SIZE, TEEP_SHA256_SIZE) == 0;
+}
+
+// Get the leaves of a component's chunk tree, either from the copy kept
+// by an earlier attempt or else from "<uri>.chunks", and check them
+// against the root in the manifest.
+static teep_error_code_t SuitGetChunkLeaves(
+    _In_ const SuitComponentParameters& component,
+    _In_ const std::string& uri,
+    _In_ const filesystem::path& leavesPath,
+    _Out_ std::vector<uint8_t>& leaves,
+    std::ostream& errorMessage)
+{
+    uint64_t chunkCount = ChunkTreeGetChunkCount(component.ImageSize, component.ChunkSize);
+    leaves.resize((size_t)chunkCount * TEEP_SHA256_SIZE);
+    uint8_t root[TEEP_SHA256_SIZE];
+
+    FILE* fp = fopen(leavesPath.string().c_str(), "rb");
+    if (fp != nullptr) {
+        size_t length = fread(leaves.data(), 1, leaves.size(), fp);
+        fclose(fp);
+        if (length == leaves.size() &&
+            ChunkTreeComputeRoot(UsefulBufC{ leaves.data(), leaves.size() }, root) == TEEP_ERR_SUCCESS &&
+            memcmp(root, component.ChunkTreeRoot.ptr, TEEP_SHA256_SIZE) == 0) {
+            return TEEP_ERR_SUCCESS;
+        }
+    }
+
+    std::string leavesUri = uri + SUIT_CHUNK_LEAVES_SUFFIX;
+    size_t received = 0;
+    while (received < leaves.size()) {
+        size_t bytesRead = 0;
+        size_t requestSize = std::min<size_t>(SUIT_FETCH_CHUNK_SIZE, leaves.size() - received);
+        teep_error_code_t errorCode = g_PayloadFetcher(leavesUri.c_str(), received, leaves.data() + received, requestSize, &bytesRead);
+        if (errorCode != TEEP_ERR_SUCCESS) {
+            errorMessage << "Could not fetch " << leavesUri;
+            return errorCode;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        received += bytesRead;
+    }
+    if (received != leaves.size() ||
+        ChunkTreeComputeRoot(UsefulBufC{ leaves.data(), leaves.size() }, root) != TEEP_ERR_SUCCESS ||
+        memcmp(root, component.ChunkTreeRoot.ptr, TEEP_SHA256_SIZE) != 0) {
+        errorMessage << leavesUri << " does not match its chunk tree root";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+
+    // Keep a copy so that a resumed transfer need not fetch them again.
+    std::error_code ec;
+    filesystem::create_directories(leavesPath.parent_path(), ec);
+    fp = fopen(leavesPath.string().c_str(), "wb");
+    if (fp != nullptr) {
+        fwrite(leaves.data(), 1, leaves.size(), fp);
+        fclose(fp);
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+// Execute suit-directive-fetch for a component with a chunk tree.  Each
+// chunk is checked before it is written, so what is kept after a failure
+// can be trusted, and the next attempt resumes after the last good chunk.
+static teep_error_code_t SuitFetchChunkedComponent(_Inout_ SuitCommandState& state, size_t componentIndex, std::ostream& errorMessage)
+{
+    const SuitComponentParameters& component = state.Components[componentIndex];
+    if (component.ImageSize == 0) {
+        errorMessage << "A chunk tree needs suit-parameter-image-size";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+
+    filesystem::path filename;
+    SuitMakePayloadFilename(filename, state.ManifestFilename, componentIndex);
+    ManifestTransaction* transaction = state.Transaction;
+    const uint8_t* imageDigest = (const uint8_t*)component.ImageDigest.ptr;
+    bool needed;
+    teep_error_code_t errorCode = transaction->BeginResumableStream(filename, imageDigest, &needed, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS || !needed) {
+        return errorCode;
+    }
+
+    std::string uri((const char*)component.Uri.ptr, component.Uri.len);
+    filesystem::path leavesPath;
+    ObjectStoreGetPartialPath(imageDigest, SUIT_CHUNK_LEAVES_SUFFIX, leavesPath);
+    std::vector<uint8_t> leaves;
+    errorCode = SuitGetChunkLeaves(component, uri, leavesPath, leaves, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        transaction->AbortStream();
+        return errorCode;
+    }
+
+    uint64_t offset;
+    errorCode = transaction->ResumeStream(
+        (size_t)component.ChunkSize,
+        [&](uint64_t chunkIndex, UsefulBufC chunk) { return SuitCheckChunk(leaves, chunkIndex, chunk); },
+        &offset,
+        errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+
+    std::vector<uint8_t> chunk((size_t)component.ChunkSize);
+    uint64_t chunkCount = ChunkTreeGetChunkCount(component.ImageSize, component.ChunkSize);
+    for (uint64_t chunkIndex = ChunkTreeGetChunkCount(offset, component.ChunkSize); chunkIndex < chunkCount; chunkIndex++) {
+        uint64_t chunkOffset = chunkIndex * component.ChunkSize;
+        size_t chunkLength = (size_t)std::min<uint64_t>(component.ChunkSize, component.ImageSize - chunkOffset);
+        size_t received = 0;
+        while (received < chunkLength) {
+            size_t bytesRead = 0;
+            size_t requestSize = std::min<size_t>(SUIT_FETCH_CHUNK_SIZE, chunkLength - received);
+            errorCode = g_PayloadFetcher(uri.c_str(), chunkOffset + received, chunk.data() + received, requestSize, &bytesRead);
+            if (errorCode != TEEP_ERR_SUCCESS || bytesRead == 0) {
+                errorMessage << "Could not fetch " << uri;
+                transaction->AbortStream();
+                return (errorCode != TEEP_ERR_SUCCESS) ? errorCode : TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+            }
+            received += bytesRead;
+        }
+        if (!SuitCheckChunk(leaves, chunkIndex, UsefulBufC{ chunk.data(), chunkLength })) {
+            errorMessage << "Chunk " << chunkIndex << " of " << uri << " does not match its chunk tree";
+            transaction->AbortStream();
+            return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+        }
+        errorCode = transaction->WriteStream(UsefulBufC{ chunk.data(), chunkLength }, errorMessage);
+        if (errorCode != TEEP_ERR_SUCCESS) {
+            return errorCode;
+        }
+    }
+
+    // Whether or not the image digest matches, the leaves are done with.
+    errorCode = transaction->FinishStream(errorMessage);
+    std::error_code ec;
+    filesystem::remove(leavesPath, ec);
+    return errorCode;
+}
+
+// Where a delta's output goes, and the base image that it copies from.
+typedef struct {
+    FILE* Base;
+    ManifestTransaction* Transaction;
+    uint64_t ImageSize;
+    uint64_t Written;
+    std::ostream* ErrorMessage;
+} SuitDeltaTarget;
+
+static teep_error_code_t SuitReadDeltaBase(void* context, uint64_t offset, UsefulBuf buffer)
+{
+    SuitDeltaTarget* target = (SuitDeltaTarget*)context;
+    if (fseek64(target->Base, offset, SEEK_SET) != 0 ||
+        fread(buffer.ptr, 1, buffer.len, target->Base) != buffer.len) {
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+static teep_error_code_t SuitWriteDeltaTarget(void* context, UsefulBufC data)
+{
+    SuitDeltaTarget* target = (SuitDeltaTarget*)context;
+    target->Written += data.len;
+    if (target->ImageSize != 0 && target->Written > target->ImageSize) {
+        *target->ErrorMessage << "Delta output is larger than its suit-parameter-image-size";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    return target->Transaction->WriteStream(data, *target->ErrorMessage);
+}
+
+// Try to rebuild a component's image from an installed base image and a
+// delta, which is usually far smaller than the image.  Returns false in
+// *applied if the image should be fetched in full instead, because the
+// base is not installed or the delta does not produce the image digest.
+static teep_error_code_t SuitFetchDeltaComponent(_Inout_ SuitCommandState& state, size_t componentIndex, _Out_ bool* applied, std::ostream& errorMessage)
+{
+    *applied = false;
+    const SuitComponentParameters& component = state.Components[componentIndex];
+    filesystem::path basePath;
+    TeepAgentMakeObjectFilename(basePath, (const uint8_t*)component.DeltaBaseDigest.ptr, TEEP_SHA256_SIZE);
+    std::error_code ec;
+    uint64_t baseSize = filesystem::file_size(basePath, ec);
+    if (ec) {
+        return TEEP_ERR_SUCCESS;
+    }
+    FILE* base = fopen(basePath.string().c_str(), "rb");
+    if (base == nullptr) {
+        return TEEP_ERR_SUCCESS;
+    }
+
+    filesystem::path filename;
+    SuitMakePayloadFilename(filename, state.ManifestFilename, componentIndex);
+    bool needed;
+    teep_error_code_t errorCode = state.Transaction->BeginStream(filename, (const uint8_t*)component.ImageDigest.ptr, &needed, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS || !needed) {
+        fclose(base);
+        *applied = (errorCode == TEEP_ERR_SUCCESS);
+        return errorCode;
+    }
+
+    // Problems with the delta itself are only logged, since the full
+    // image is fetched next.
+    std::ostringstream deltaError;
+    SuitDeltaTarget target = { base, state.Transaction, component.ImageSize, 0, &deltaError };
+    std::unique_ptr<teep_delta_decoder_t> decoder(new teep_delta_decoder_t);
+    teep_delta_decoder_init(decoder.get(), baseSize, SuitReadDeltaBase, SuitWriteDeltaTarget, &target);
+    std::string uri((const char*)component.DeltaUri.ptr, component.DeltaUri.len);
+    std::vector<uint8_t> buffer(SUIT_FETCH_CHUNK_SIZE);
+    uint64_t offset = 0;
+    for (;;) {
+        size_t bytesRead = 0;
+        teep_error_code_t fetchError = g_PayloadFetcher(uri.c_str(), offset, buffer.data(), buffer.size(), &bytesRead);
+        if (fetchError != TEEP_ERR_SUCCESS) {
+            TeepLogMessage("Could not fetch %s (error %d), fetching the full image\n", uri.c_str(), fetchError);
+            state.Transaction->AbortStream();
+            fclose(base);
+            return TEEP_ERR_SUCCESS;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        offset += bytesRead;
+        errorCode = teep_delta_decode(decoder.get(), UsefulBufC{ buffer.data(), bytesRead });
+        if (errorCode != TEEP_ERR_SUCCESS) {
+            break;
+        }
+    }
+    if (errorCode == TEEP_ERR_SUCCESS) {
+        errorCode = teep_delta_decoder_finish(decoder.get());
+    }
+    fclose(base);
+    if (errorCode == TEEP_ERR_SUCCESS) {
+        errorCode = state.Transaction->FinishStream(deltaError);
+    } else {
+        state.Transaction->AbortStream();
+    }
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        TeepLogMessage("Could not apply %s (%s), fetching the full image\n", uri.c_str(), deltaError.str().c_str());
+        return TEEP_ERR_SUCCESS;
+    }
+    *applied = true;
+    return TEEP_ERR_SUCCESS;
+}
+
+// Execute suit-directive-fetch for one component, streaming the payload
+// into the transaction and checking it against the image digest.
+static teep_error_code_t SuitFetchComponent(_Inout_ SuitCommandState& state, size_t componentIndex, std::ostream& errorMessage)
+{
+    const SuitComponentParameters& component = state.Components[componentIndex];
+    if (UsefulBuf_IsNULLC(component.Uri)) {
+        errorMessage << "suit-directive-fetch needs a URI";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    if (UsefulBuf_IsNULLC(component.ImageDigest)) {
+        // Nothing can be stored that has not been checked, so a download
+        // component is only fetched once copied into one with a digest.
+        state.Components[componentIndex].FetchDeferred = true;
+        return TEEP_ERR_SUCCESS;
+    }
+    std::string uri((const char*)component.Uri.ptr, component.Uri.len);
+    if (g_PayloadFetcher == nullptr) {
+        errorMessage << "No payload fetcher to fetch " << uri;
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    if (!UsefulBuf_IsNULLC(component.DeltaUri)) {
+        bool applied;
+        teep_error_code_t errorCode = SuitFetchDeltaComponent(state, componentIndex, &applied, errorMessage);
+        if (errorCode != TEEP_ERR_SUCCESS || applied) {
+            return errorCode;
+        }
+    }
+    if (component.ChunkSize != 0) {
+        return SuitFetchChunkedComponent(state, componentIndex, errorMessage);
+    }
+
+    filesystem::path filename;
+    SuitMakePayloadFilename(filename, state.ManifestFilename, componentIndex);
+    bool needed;
+    teep_error_code_t errorCode = state.Transaction->BeginStream(filename, (const uint8_t*)component.ImageDigest.ptr, &needed, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS || !needed) {
+        return errorCode;
+    }
+
+    std::vector<uint8_t> buffer(SUIT_FETCH_CHUNK_SIZE);
+    uint64_t offset = 0;
+    for (;;) {
+        size_t bytesRead = 0;
+        errorCode = g_PayloadFetcher(uri.c_str(), offset, buffer.data(), buffer.size(), &bytesRead);
+        if (errorCode != TEEP_ERR_SUCCESS) {
+            errorMessage << "Could not fetch " << uri;
+            state.Transaction->AbortStream();
+            return errorCode;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        offset += bytesRead;
+        if (component.ImageSize != 0 && offset > component.ImageSize) {
+            errorMessage << uri << " is larger than its suit-parameter-image-size";
+            state.Transaction->AbortStream();
+            return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+        }
+        errorCode = state.Transaction->WriteStream(UsefulBufC{ buffer.data(), bytesRead }, errorMessage);
+        if (errorCode != TEEP_ERR_SUCCESS) {
+            return errorCode;
+        }
+    }
+    return state.Transaction->FinishStream(errorMessage);
+}
+
+// Execute suit-directive-copy for one component by fetching the source
+// component's payload into it, checked against its own image digest.
+static teep_error_code_t SuitCopyComponent(_Inout_ SuitCommandState& state, size_t componentIndex, std::ostream& errorMessage)
+{
+    SuitComponentParameters& component = state.Components[componentIndex];
+    if (!component.HasSourceComponent || component.SourceComponent >= state.Components.size() ||
+        !state.Components[(size_t)component.SourceComponent].FetchDeferred) {
+        errorMessage << "suit-directive-copy needs a fetched source component";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    if (UsefulBuf_IsNULLC(component.ImageDigest)) {
+        errorMessage << "suit-directive-copy needs an image digest";
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    component.Uri = state.Components[(size_t)component.SourceComponent].Uri;
+    return SuitFetchComponent(state, componentIndex, errorMessage);
+}
+
+// Run a SUIT_Command_Sequence.  Only the commands needed to locate,
+// fetch, and copy payloads are acted on; conditions on the device
+// identity are treated as met, and suit-condition-image-match is
+// satisfied by the digest check of the fetch itself.
+static teep_error_code_t SuitRunCommandSequence(UsefulBufC encoded, _Inout_ SuitCommandState& state, std::ostream& errorMessage)
+{
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_ARRAY || (item.val.uCount % 2) != 0) {
+        REPORT_TYPE_ERROR(errorMessage, "SUIT_Command_Sequence", QCBOR_TYPE_ARRAY, item);
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    uint16_t commandCount = item.val.uCount / 2;
+    for (uint16_t commandIndex = 0; commandIndex < commandCount; commandIndex++) {
+        QCBORDecode_GetNext(&context, &item);
+        if (item.uDataType != QCBOR_TYPE_INT64) {
+            REPORT_TYPE_ERROR(errorMessage, "SUIT_Command", QCBOR_TYPE_INT64, item);
+            return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+        }
+        suit_command_t command = (suit_command_t)item.val.int64;
+        QCBORDecode_GetNext(&context, &item);
+
+        teep_error_code_t errorCode = TEEP_ERR_SUCCESS;
+        switch (command) {
+        case SUIT_DIRECTIVE_SET_COMPONENT_INDEX:
+            if (item.uDataType == QCBOR_TYPE_TRUE) {
+                std::fill(state.Selected.begin(), state.Selected.end(), true);
+            } else if (item.uDataType == QCBOR_TYPE_INT64 && item.val.uint64 < state.Components.size()) {
+                std::fill(state.Selected.begin(), state.Selected.end(), false);
+                state.Selected[(size_t)item.val.uint64] = true;
+            } else {
+                errorMessage << "Unsupported suit-directive-set-component-index";
+                return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+            }
+            break;
+        case SUIT_DIRECTIVE_SET_PARAMETERS:
+        case SUIT_DIRECTIVE_OVERRIDE_PARAMETERS:
+            errorCode = SuitSetParameters(&context, &item, command == SUIT_DIRECTIVE_OVERRIDE_PARAMETERS, state, errorMessage);
+            break;
+        case SUIT_DIRECTIVE_FETCH:
+            for (size_t i = 0; i < state.Components.size() && errorCode == TEEP_ERR_SUCCESS; i++) {
+                if (state.Selected[i]) {
+                    errorCode = SuitFetchComponent(state, i, errorMessage);
+                }
+            }
+            break;
+        case SUIT_DIRECTIVE_COPY:
+            for (size_t i = 0; i < state.Components.size() && errorCode == TEEP_ERR_SUCCESS; i++) {
+                if (state.Selected[i]) {
+                    errorCode = SuitCopyComponent(state, i, errorMessage);
+                }
+            }
+            break;
+        default:
+            SkipNestedItems(&context, &item);
+            break;
+        }
+        if (errorCode != TEEP_ERR_SUCCESS) {
+            return errorCode;
+        }
+    }
+    return (QCBORDecode_Finish(&context) == QCBOR_SUCCESS) ? TEEP_ERR_SUCCESS : TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+}
+
+// Run the shared, payload-fetch, and install sequences of a manifest.
+static teep_error_code_t SuitProcessPayloads(
+    _In_ const SuitEnvelopeOffsets& offsets,
+    _In_ const filesystem::path& manifestFilename,
+    _Inout_ ManifestTransaction& transaction,
+    std::ostream& errorMessage)
+{
+    SuitCommandState state;
+    state.ManifestFilename = manifestFilename;
+    state.Transaction = &transaction;
+    state.Components.resize(offsets.ComponentCount, SuitComponentParameters{});
+    state.Selected.assign(offsets.ComponentCount, false);
+    if (!state.Selected.empty()) {
+        state.Selected[0] = true;
+    }
+
+    for (UsefulBufC sequence : { offsets.CommonSequence, offsets.PayloadFetch, offsets.Install }) {
+        if (UsefulBuf_IsNULLC(sequence)) {
+            continue;
+        }
+        teep_error_code_t errorCode = SuitRunCommandSequence(sequence, state, errorMessage);
+        if (errorCode != TEEP_ERR_SUCCESS) {
+            return errorCode;
+        }
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+// Stage a SUIT_Envelope that passed SuitValidateEnvelope for persistence,
+// along with any payloads it fetches.
+static teep_error_code_t SuitCommitEnvelope(_In_ const SuitEnvelopeOffsets& offsets, _Inout_ ManifestTransaction& transaction, std::ostream& errorMessage)
+{
+    // Try to extract a filename out of the SUIT envelope.
+    filesystem::path filename;
+    teep_error_code_t errorCode = GetFilenameFromSuitEnvelope(filename, offsets);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+    errorCode = SuitProcessPayloads(offsets, filename, transaction, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+    return SuitSaveManifest(filename, offsets.Envelope, transaction, errorMessage);
+}
+
+// Parse a SUIT_Envelope and try to install it.
+teep_error_code_t TryProcessSuitEnvelope(UsefulBufC encoded, std::ostream& errorMessage)
+{
+    SuitEnvelopeOffsets offsets;
+    teep_error_code_t errorCode = SuitValidateEnvelope(encoded, offsets, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+    ManifestTransaction transaction;
+    errorCode = SuitCommitEnvelope(offsets, transaction, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+    return transaction.Commit(errorMessage);
+}
+
+// Check whether a component that a manifest depends on is installed, or
+// will be once the transaction is committed.
+static bool SuitIsDependencyAvailable(UsefulBufC componentId, _In_ const ManifestTransaction& transaction)
+{
+    filesystem::path filename;
+    TeepAgentMakeManifestFilename(filename, (const char*)componentId.ptr, componentId.len);
+    return transaction.WillExist(filename);
+}
+
+// Validate a single SUIT_Envelope and stage it into a transaction.  Its
+// dependencies must already be installed or staged, which they are when
+// the TAM lists them ahead of the manifests that need them.
+teep_error_code_t SuitStageEnvelope(UsefulBufC encoded, _Inout_ ManifestTransaction& transaction, std::ostream& errorMessage)
+{
+    SuitEnvelopeOffsets offsets;
+    teep_error_code_t errorCode = SuitValidateEnvelope(encoded, offsets, errorMessage);
+    if (errorCode != TEEP_ERR_SUCCESS) {
+        return errorCode;
+    }
+    for (UsefulBufC dependency : offsets.Dependencies) {
+        if (!SuitIsDependencyAvailable(dependency, transaction)) {
+            errorMessage << "SUIT_Envelope depends on a component that is not installed";
+            return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+        }
+    }
+    return SuitCommitEnvelope(offsets, transaction, errorMessage);
+}
+
+// Outcome of validating and staging one manifest-list entry.
+typedef struct {
+    SuitEnvelopeOffsets Offsets;
+    teep_error_code_t ErrorCode;
+    std::string ErrorMessage;
+    ManifestTransaction Transaction;  // What the entry staged.
+    std::vector<size_t> Dependents;   // Entries waiting for this one.
+    size_t PendingCount;              // Prerequisites not yet staged.
+    bool PrerequisiteFailed;
+    bool Staged;
+} SuitEnvelopeResult;
+
+static void SuitValidateEnvelopeResult(UsefulBufC encoded, _Out_ SuitEnvelopeResult& result)
+{
+    std::ostringstream errorMessage;
+    result.ErrorCode = SuitValidateEnvelope(encoded, result.Offsets, errorMessage);
+    result.ErrorMessage = errorMessage.str();
+}
+
+static std::string SuitComponentKey(UsefulBufC componentId)
+{
+    return std::string((const char*)componentId.ptr, componentId.len);
+}
+
+// Link each of the first count entries to the entries that install the
+// components it depends on, and return the entries that depend on none.
+// A dependency that is not in the list must already be installed or
+// staged in the transaction.
+static std::deque<size_t> SuitLinkDependencies(
+    _Inout_ std::vector<SuitEnvelopeResult>& results,
+    size_t count,
+    _In_ const ManifestTransaction& transaction)
+{
+    std::map<std::string, std::vector<size_t>> entriesByComponent;
+    for (size_t i = 0; i < count; i++) {
+        results[i].PendingCount = 0;
+        results[i].PrerequisiteFailed = false;
+        results[i].Staged = false;
+        if (results[i].ErrorCode == TEEP_ERR_SUCCESS) {
+            entriesByComponent[SuitComponentKey(results[i].Offsets.ComponentId)].push_back(i);
+        }
+    }
+
+    std::deque<size_t> ready;
+    for (size_t i = 0; i < count; i++) {
+        SuitEnvelopeResult& result = results[i];
+        for (size_t d = 0; d < result.Offsets.Dependencies.size() && result.ErrorCode == TEEP_ERR_SUCCESS; d++) {
+            UsefulBufC dependency = result.Offsets.Dependencies[d];
+            auto entries = entriesByComponent.find(SuitComponentKey(dependency));
+            if (entries != entriesByComponent.end()) {
+                for (size_t j : entries->second) {
+                    results[j].Dependents.push_back(i);
+                    result.PendingCount++;
+                }
+                continue;
+            }
+            if (!SuitIsDependencyAvailable(dependency, transaction)) {
+                result.ErrorCode = TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+                result.ErrorMessage = "SUIT_Envelope depends on a component that is not installed";
+            }
+        }
+        if (result.PendingCount == 0) {
+            ready.push_back(i);
+        }
+    }
+    return ready;
+}
+
+// Stage an entry whose prerequisites have all been staged.  Entries after
+// the first failure are never committed, so they are not staged either.
+static void SuitStageEnvelopeResult(_Inout_ SuitEnvelopeResult& result, bool skip)
+{
+    result.Staged = true;
+    if (result.ErrorCode != TEEP_ERR_SUCCESS) {
+        return;
+    }
+    if (skip || result.PrerequisiteFailed) {
+        result.ErrorCode = TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+        result.ErrorMessage = "A dependency of the SUIT_Envelope could not be installed";
+        return;
+    }
+    std::ostringstream errorMessage;
+    result.ErrorCode = SuitCommitEnvelope(result.Offsets, result.Transaction, errorMessage);
+    result.ErrorMessage = errorMessage.str();
+}
+
+// Release the entries that were waiting for one that has just been
+// staged or has failed.
+static void SuitReleaseDependents(
+    _Inout_ std::vector<SuitEnvelopeResult>& results,
+    size_t index,
+    _Inout_ std::deque<size_t>& ready,
+    _Inout_ size_t& firstFailedIndex)
+{
+    bool failed = (results[index].ErrorCode != TEEP_ERR_SUCCESS);
+    if (failed) {
+        firstFailedIndex = std::min(firstFailedIndex, index);
+    }
+    for (size_t dependent : results[index].Dependents) {
+        if (failed) {
+            results[dependent].PrerequisiteFailed = true;
+        }
+        if (--results[dependent].PendingCount == 0) {
+            ready.push_back(dependent);
+        }
+    }
+}
+
+// Install the envelopes of a manifest-list.  Envelopes are parsed and
+// validated concurrently by up to maxWorkers threads (0 means one per
+// hardware thread).  Each is then staged, along with any payloads it
+// fetches, as soon as every entry that installs one of its
+// suit-dependencies has been staged, so independent manifests are
+// installed concurrently whatever order the TAM lists them in.
+// As with serial processing, entries before the first failing one are
+// installed, the rest are not, and the failing entry's error is
+// returned.  An entry fails if any of its dependencies does.
+teep_error_code_t SuitProcessEnvelopes(_In_ const std::vector<UsefulBufC>& envelopes, size_t maxWorkers, _Inout_ ManifestTransaction& transaction, std::ostream& errorMessage)
+{
+    size_t count = envelopes.size();
+    std::vector<SuitEnvelopeResult> results(count);
+
+#ifdef TEEP_USE_TEE
+    // Enclaves have no thread support, so validate serially.
+    TEEP_UNUSED(maxWorkers);
+    for (size_t i = 0; i < count; i++) {
+        SuitValidateEnvelopeResult(envelopes[i], results[i]);
+        if (results[i].ErrorCode != TEEP_ERR_SUCCESS) {
+            count = i + 1;
+            break;
+        }
+    }
+#else
+    if (maxWorkers == 0) {
+        maxWorkers = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    size_t workerCount = std::min(maxWorkers, count);
+
+    // Workers claim entries in list order, and stop claiming once an
+    // earlier entry has failed since nothing after it will be committed.
+    std::atomic<size_t> nextIndex(0);
+    std::atomic<size_t> firstInvalidIndex(count);
+    auto worker = [&]() {
+        for (;;) {
+            size_t i = nextIndex++;
+            if (i >= count || i > firstInvalidIndex) {
+                break;
+            }
+            SuitValidateEnvelopeResult(envelopes[i], results[i]);
+            if (results[i].ErrorCode != TEEP_ERR_SUCCESS) {
+                size_t previous = firstInvalidIndex;
+                while (i < previous && !firstInvalidIndex.compare_exchange_weak(previous, i)) {
+                }
+            }
+        }
+    };
+
+    if (workerCount <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> workers;
+        for (size_t w = 1; w < workerCount; w++) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+    count = std::min<size_t>(count, firstInvalidIndex + 1);
+#endif
+
+    // Stage entries in dependency order, each into its own transaction.
+    std::deque<size_t> ready = SuitLinkDependencies(results, count, transaction);
+    size_t firstFailedIndex = count;
+#ifdef TEEP_USE_TEE
+    while (!ready.empty()) {
+        size_t i = ready.front();
+        ready.pop_front();
+        SuitStageEnvelopeResult(results[i], i > firstFailedIndex);
+        SuitReleaseDependents(results, i, ready, firstFailedIndex);
+    }
+#else
+    // A worker waits while entries are being staged that may release
+    // more, and stops once nothing is ready and nothing is running.
+    std::mutex lock;
+    std::condition_variable wake;
+    size_t running = 0;
+    auto installer = [&]() {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            wake.wait(guard, [&]() { return !ready.empty() || running == 0; });
+            if (ready.empty()) {
+                break;
+            }
+            size_t i = ready.front();
+            ready.pop_front();
+            bool skip = (i > firstFailedIndex);
+            running++;
+            guard.unlock();
+            SuitStageEnvelopeResult(results[i], skip);
+            guard.lock();
+            running--;
+            SuitReleaseDependents(results, i, ready, firstFailedIndex);
+            wake.notify_all();
+        }
+    };
+
+    workerCount = std::min(workerCount, count);
+    if (workerCount <= 1) {
+        installer();
+    } else {
+        std::vector<std::thread> installers;
+        for (size_t w = 1; w < workerCount; w++) {
+            installers.emplace_back(installer);
+        }
+        installer();
+        for (std::thread& t : installers) {
+            t.join();
+        }
+    }
+#endif
+
+    // Commit in list order until the first error.  Entries never staged
+    // depend on each other in a cycle.
+    for (size_t i = 0; i < count; i++) {
+        SuitEnvelopeResult& result = results[i];
+        if (result.ErrorCode == TEEP_ERR_SUCCESS && !result.Staged) {
+            errorMessage << "SUIT_Envelope dependencies form a cycle";
+            return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+        }
+        if (result.ErrorCode != TEEP_ERR_SUCCESS) {
+            errorMessage << result.ErrorMessage;
+            return result.ErrorCode;
+        }
+        transaction.Adopt(result.Transaction);
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t SuitUninstallComponent(UsefulBufC componentId, _Inout_ ManifestTransaction& transaction)
+{
+    // TODO(issue #7): SUIT manifest support
+    filesystem::path filename;
+    TeepAgentMakeManifestFilename(filename, (const char*)componentId.ptr, componentId.len);
+    transaction.StageDelete(filename);
+
+    // Also remove any payloads fetched for the component.
+    std::string prefix = filename.stem().string() + ".";
+    std::error_code ec;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(filename.parent_path(), ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) == 0 && entry.path().extension() == ".payload") {
+            transaction.StageDelete(entry.path());
+        }
+    }
+    return TEEP_ERR_SUCCESS;
+}
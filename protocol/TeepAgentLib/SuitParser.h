@@ -3,11 +3,57 @@
 #pragma once
 #include <filesystem>
 #include <ostream>
+#include <vector>
 using namespace std;
 #ifdef TEEP_USE_TEE
 using namespace std::__fs;
 #endif
 
+class ManifestTransaction;
+
+// Byte ranges within an encoded SUIT_Envelope, filled in by a single
+// pass of SuitParseEnvelope.  Members that are absent are NULLUsefulBufC.
+typedef struct {
+    UsefulBufC Envelope;              // The whole SUIT_Envelope.
+    UsefulBufC AuthenticationWrapper; // Contents of suit-authentication-wrapper.
+    UsefulBufC Digest;                // Encoded SUIT_Digest of the manifest.
+    UsefulBufC DigestBytes;           // suit-digest-bytes within Digest.
+    UsefulBufC Manifest;              // Contents of suit-manifest.
+    UsefulBufC Common;                // Contents of suit-common.
+    UsefulBufC ComponentId;           // Last bstr of the component identifier.
+    UsefulBufC CommonSequence;        // Contents of suit-shared-sequence.
+    UsefulBufC PayloadFetch;          // Contents of suit-payload-fetch.
+    UsefulBufC Install;               // Contents of suit-install.
+    UsefulBufC PayloadFetchDigest;    // SHA-256 of a severed suit-payload-fetch.
+    UsefulBufC InstallDigest;         // SHA-256 of a severed suit-install.
+    uint16_t ComponentCount;          // Number of entries in suit-components.
+    uint64_t SequenceNumber;          // suit-manifest-sequence-number.
+    std::vector<UsefulBufC> Dependencies; // Last bstr of each component in suit-dependencies.
+} SuitEnvelopeOffsets;
+
+teep_error_code_t SuitParseEnvelope(UsefulBufC encoded, _Out_ SuitEnvelopeOffsets& offsets, std::ostream& errorMessage);
+// Compute the SHA-256 digest that suit-digest should hold, which covers
+// the bstr-wrapped suit-manifest.
+teep_error_code_t SuitComputeManifestDigest(_In_ const SuitEnvelopeOffsets& offsets, _Out_writes_(TEEP_SHA256_SIZE) uint8_t* digest);
 teep_error_code_t TryProcessSuitEnvelope(UsefulBufC encoded, std::ostream& errorMessage);
+// Check that a SUIT_Envelope is well formed and authentic, without
+// fetching its payloads or staging anything.
+teep_error_code_t SuitCheckEnvelope(UsefulBufC encoded, std::ostream& errorMessage);
+teep_error_code_t SuitStageEnvelope(UsefulBufC encoded, _Inout_ ManifestTransaction& transaction, std::ostream& errorMessage);
+teep_error_code_t SuitProcessEnvelopes(_In_ const std::vector<UsefulBufC>& envelopes, size_t maxWorkers, _Inout_ ManifestTransaction& transaction, std::ostream& errorMessage);
 void TeepAgentMakeManifestFilename(_Out_ filesystem::path& filename, _In_reads_(buffer_len) const char* buffer, size_t buffer_len);
-teep_error_code_t SuitUninstallComponent(UsefulBufC componentId);
\ No newline at end of file
+// Reads up to bufferSize bytes of the payload at uri, starting at offset.
+// *bytesRead is 0 once the end of the payload has been reached.
+typedef teep_error_code_t (*SuitPayloadFetcher)(
+    _In_z_ const char* uri,
+    uint64_t offset,
+    _Out_writes_bytes_to_(bufferSize, *bytesRead) uint8_t* buffer,
+    size_t bufferSize,
+    _Out_ size_t* bytesRead);
+
+// Set the function that suit-directive-fetch uses to get payloads, which
+// is TeepAgentFetchPayload unless set otherwise.  With none, fetch
+// directives fail.
+void SuitSetPayloadFetcher(_In_opt_ SuitPayloadFetcher fetcher);
+
+teep_error_code_t SuitUninstallComponent(UsefulBufC componentId, _Inout_ ManifestTransaction& transaction);
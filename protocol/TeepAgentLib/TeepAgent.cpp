@@ -1,6 +1,7 @@
 // Copyright (c) TEEP contributors
 // SPDX-License-Identifier: MIT
 
+#include <chrono>
 #include <dirent.h>
 #include <sstream>
 #include <stdio.h>
@@ -9,6 +10,7 @@
 #include <string.h>
 #include <string.h>
 #include <string>
+#include <vector>
 #include "TrustedComponent.h"
 #include "teep_protocol.h"
 #include "TeepAgentLib.h"
@@ -20,8 +22,13 @@
 #include "t_cose/t_cose_common.h"
 #include "t_cose/t_cose_sign1_verify.h"
 #include "TeepDeviceEcallHandler.h"
+#include "ManifestTransaction.h"
+#include "ObjectStore.h"
+#include "StreamingMessage.h"
+#include "SuitAuthentication.h"
 #include "SuitParser.h"
 #include "AgentKeys.h"
+#include "compress.h"
 
 static teep_error_code_t TeepAgentComposeError(UsefulBufC token, teep_error_code_t errorCode, const std::string& errorMessage, UsefulBufC* encoded);
 
@@ -34,6 +41,19 @@ TrustedComponent* g_InstalledComponentList = nullptr;
 // List of unneeded Trusted Components.
 TrustedComponent* g_UnneededComponentList = nullptr;
 
+// TAM that the session most recently started is with.
+static std::string g_SessionTamUri;
+
+// What the last QueryRequest asked for, so that a later policy check can
+// answer it in its first message rather than wait for the TAM to ask
+// again.  The TAM decides whether the token it sent is still fresh.
+static struct {
+    bool Valid;
+    std::string TamUri;
+    std::string Token;
+    int64_t DataItemRequested;
+} g_CachedQueryRequest;
+
 teep_error_code_t
 TeepAgentSignMessage(
     _In_ const UsefulBufC* unsignedMessage,
@@ -55,30 +75,53 @@ teep_error_code_t TeepAgentProcessError(_In_ void* sessionHandle)
     return TEEP_ERR_TEMPORARY_ERROR;
 }
 
+static teep_error_code_t TeepAgentSendCachedQueryResponse(_In_z_ const char* tamUri);
+
 teep_error_code_t TeepAgentRequestPolicyCheck(_In_z_ const char* tamUri)
 {
-    teep_error_code_t err = TEEP_ERR_SUCCESS;
-
     // TODO: we may want to modify the TAM URI here.
 
-    // TODO: see whether we already have a TAM cert we trust.
-    // For now we skip this step and say we don't.
-    bool haveTrustedTamCert = false;
+    if (g_CachedQueryRequest.Valid && g_CachedQueryRequest.TamUri == tamUri) {
+        // Answer the TAM's last QueryRequest straight away.  If it is no
+        // longer fresh, the TAM replies with a new one.
+        return TeepAgentSendCachedQueryResponse(tamUri);
+    }
 
-    if (!haveTrustedTamCert) {
-        // Pass back a TAM URI with no buffer.
-        TeepLogMessage("Sending an empty message...\n");
-        const char* acceptMediaType = TEEP_CBOR_MEDIA_TYPE;
-        teep_error_code_t error = TeepAgentConnect(tamUri, acceptMediaType);
-        if (error != TEEP_ERR_SUCCESS) {
-            return error;
-        }
-    } else {
-        // TODO: implement going on to the next message.
-        TEEP_ASSERT(false);
+    // Pass back a TAM URI with no buffer.
+    TeepLogMessage("Sending an empty message...\n");
+    g_SessionTamUri = tamUri;
+    return TeepAgentConnect(tamUri, TEEP_CBOR_MEDIA_TYPE);
+}
+
+// Sequence number of the last push request, which only ever grows.  It
+// starts from the time, so that it keeps growing across restarts.
+static uint64_t g_PushSequence;
+
+teep_error_code_t TeepAgentComposePushRequest(
+    _Out_writes_bytes_to_(bufferSize, *requestLength) char* buffer,
+    size_t bufferSize,
+    _Out_ size_t* requestLength)
+{
+    *requestLength = 0;
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    g_PushSequence = (now > g_PushSequence) ? now : g_PushSequence + 1;
+
+    UsefulBuf_MAKE_STACK_UB(payloadBuffer, 16);
+    QCBOREncodeContext context;
+    QCBOREncode_Init(&context, payloadBuffer);
+    QCBOREncode_AddUInt64(&context, g_PushSequence);
+    UsefulBufC payload;
+    if (QCBOREncode_Finish(&context, &payload) != QCBOR_SUCCESS) {
+        return TEEP_ERR_PERMANENT_ERROR;
     }
 
-    return err;
+    UsefulBufC signedRequest;
+    teep_error_code_t result = TeepAgentSignMessage(&payload, { buffer, bufferSize }, &signedRequest);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    *requestLength = signedRequest.len;
+    return TEEP_ERR_SUCCESS;
 }
 
 static void AddComponentIdToMap(_Inout_ QCBOREncodeContext* context, _In_ TrustedComponent* tc)
@@ -91,12 +134,100 @@ static void AddComponentIdToMap(_Inout_ QCBOREncodeContext* context, _In_ Truste
     QCBOREncode_CloseArray(context);
 }
 
+static void AddSelectedCipherSuite(_Inout_ QCBOREncodeContext* context)
+{
+    QCBOREncode_OpenArrayInMapN(context, TEEP_LABEL_SELECTED_CIPHER_SUITE);
+    {
+        // Add teep-operation-sign1-es256.
+        QCBOREncode_OpenArray(context);
+        {
+            QCBOREncode_AddInt64(context, CBOR_TAG_COSE_SIGN1);
+            QCBOREncode_AddInt64(context, T_COSE_ALGORITHM_ES256);
+        }
+        QCBOREncode_CloseArray(context);
+    }
+    QCBOREncode_CloseArray(context);
+}
+
+// Add the data items requested, and the components the agent wants
+// installed or removed.
+static void AddQueryResponseItems(_Inout_ QCBOREncodeContext* context, int64_t dataItemRequested)
+{
+    if (dataItemRequested & TEEP_ATTESTATION) {
+        // Add evidence.
+        // TODO(issue #9): get actual evidence via ctoken library or OE.
+        QCBOREncode_AddSZStringToMapN(context, TEEP_LABEL_ATTESTATION_PAYLOAD_FORMAT, "text/plain");
+        UsefulBufC evidence = UsefulBuf_FROM_SZ_LITERAL("dummy value");
+        QCBOREncode_AddBytesToMapN(context, TEEP_LABEL_ATTESTATION_PAYLOAD, evidence);
+    }
+    if (dataItemRequested & TEEP_TRUSTED_COMPONENTS) {
+        // Add tc-list.
+        QCBOREncode_OpenArrayInMapN(context, TEEP_LABEL_TC_LIST);
+        {
+            for (TrustedComponent* ta = g_InstalledComponentList; ta != nullptr; ta = ta->Next) {
+                QCBOREncode_OpenMap(context);
+                {
+                    AddComponentIdToMap(context, ta);
+
+                    // Lets the TAM pick a delta from this version.
+                    QCBOREncode_AddUInt64ToMapN(context, TEEP_LABEL_TC_MANIFEST_SEQUENCE_NUMBER, ta->ManifestSequenceNumber);
+                }
+                QCBOREncode_CloseMap(context);
+            }
+        }
+        QCBOREncode_CloseArray(context);
+    }
+    if (dataItemRequested & TEEP_EXTENSIONS) {
+        // Add ext-list to QueryResponse
+        QCBOREncode_OpenArrayInMapN(context, TEEP_LABEL_EXT_LIST);
+        {
+            // Manifests can be sent to us compressed.
+            QCBOREncode_AddUInt64(context, TEEP_EXTENSION_COMPRESSED_MANIFESTS);
+        }
+        QCBOREncode_CloseArray(context);
+    }
+
+    if (g_RequestedComponentList != nullptr)
+    {
+        // Add requested-tc-list.
+        QCBOREncode_OpenArrayInMapN(context, TEEP_LABEL_REQUESTED_TC_LIST);
+        {
+            for (TrustedComponent* ta = g_RequestedComponentList; ta != nullptr; ta = ta->Next) {
+                QCBOREncode_OpenMap(context);
+                {
+                    AddComponentIdToMap(context, ta);
+                }
+                QCBOREncode_CloseMap(context);
+            }
+        }
+        QCBOREncode_CloseArray(context);
+    }
+
+    if (g_UnneededComponentList != nullptr)
+    {
+        // Add unneeded-manifest-list.
+        QCBOREncode_OpenArrayInMapN(context, TEEP_LABEL_UNNEEDED_MANIFEST_LIST);
+        {
+            for (TrustedComponent* tc = g_UnneededComponentList; tc != nullptr; tc = tc->Next) {
+                QCBOREncode_OpenArray(context);
+                {
+                    UsefulBuf tc_id = UsefulBuf_FROM_BYTE_ARRAY(tc->ID.b);
+                    QCBOREncode_AddBytes(context, UsefulBuf_Const(tc_id));
+                }
+                QCBOREncode_CloseArray(context);
+            }
+        }
+        QCBOREncode_CloseArray(context);
+    }
+}
+
 // Parse QueryRequest and compose QueryResponse.
 static teep_error_code_t TeepAgentComposeQueryResponse(_Inout_ QCBORDecodeContext* decodeContext, _Out_ UsefulBufC* encodedResponse, _Out_ UsefulBufC* errorResponse)
 {
     UsefulBufC challenge = NULLUsefulBufC;
     *encodedResponse = NULLUsefulBufC;
     UsefulBufC errorToken = NULLUsefulBufC;
+    int64_t dataItemRequested = 0;
     std::ostringstream errorMessage;
 
     size_t maxBufferLength = 4096;
@@ -246,17 +377,7 @@ static teep_error_code_t TeepAgentComposeQueryResponse(_Inout_ QCBORDecodeContex
                     return TEEP_ERR_UNSUPPORTED_CIPHER_SUITES;
                 }
                 // Add selected-cipher-suite to the QueryResponse.
-                QCBOREncode_OpenArrayInMapN(&context, TEEP_LABEL_SELECTED_CIPHER_SUITE);
-                {
-                    // Add teep-operation-sign1-es256.
-                    QCBOREncode_OpenArray(&context);
-                    {
-                        QCBOREncode_AddInt64(&context, CBOR_TAG_COSE_SIGN1);
-                        QCBOREncode_AddInt64(&context, T_COSE_ALGORITHM_ES256);
-                    }
-                    QCBOREncode_CloseArray(&context);
-                }
-                QCBOREncode_CloseArray(&context);
+                AddSelectedCipherSuite(&context);
             }
 
             // Parse the supported-eat-suit-cipher-suites.
@@ -306,68 +427,58 @@ static teep_error_code_t TeepAgentComposeQueryResponse(_Inout_ QCBORDecodeContex
                 REPORT_TYPE_ERROR(errorMessage, "data-item-requested", QCBOR_TYPE_INT64, item);
                 return TeepAgentComposeError(errorToken, TEEP_ERR_PERMANENT_ERROR, errorMessage.str(), errorResponse);
             }
-            if (item.val.int64 & TEEP_ATTESTATION) {
-                // Add evidence.
-                // TODO(issue #9): get actual evidence via ctoken library or OE.
-                QCBOREncode_AddSZStringToMapN(&context, TEEP_LABEL_ATTESTATION_PAYLOAD_FORMAT, "text/plain");
-                UsefulBufC evidence = UsefulBuf_FROM_SZ_LITERAL("dummy value");
-                QCBOREncode_AddBytesToMapN(&context, TEEP_LABEL_ATTESTATION_PAYLOAD, evidence);
-            }
-            if (item.val.int64 & TEEP_TRUSTED_COMPONENTS) {
-                // Add tc-list.
-                QCBOREncode_OpenArrayInMapN(&context, TEEP_LABEL_TC_LIST);
-                {
-                    for (TrustedComponent* ta = g_InstalledComponentList; ta != nullptr; ta = ta->Next) {
-                        QCBOREncode_OpenMap(&context);
-                        {
-                            AddComponentIdToMap(&context, ta);
-                        }
-                        QCBOREncode_CloseMap(&context);
-                    }
-                }
-                QCBOREncode_CloseArray(&context);
-            }
-            if (item.val.int64 & TEEP_EXTENSIONS) {
-                // Add ext-list to QueryResponse
-                QCBOREncode_OpenArrayInMapN(&context, TEEP_LABEL_EXT_LIST);
-                {
-                    // We don't support any extensions currently.
-                }
-                QCBOREncode_CloseArray(&context);
-            }
+            dataItemRequested = item.val.int64;
+            AddQueryResponseItems(&context, dataItemRequested);
+        }
+        QCBOREncode_CloseMap(&context);
+    }
+    QCBOREncode_CloseArray(&context);
 
-            if (g_RequestedComponentList != nullptr)
-            {
-                // Add requested-tc-list.
-                QCBOREncode_OpenArrayInMapN(&context, TEEP_LABEL_REQUESTED_TC_LIST);
-                {
-                    for (TrustedComponent* ta = g_RequestedComponentList; ta != nullptr; ta = ta->Next) {
-                        QCBOREncode_OpenMap(&context);
-                        {
-                            AddComponentIdToMap(&context, ta);
-                        }
-                        QCBOREncode_CloseMap(&context);
-                    }
-                }
-                QCBOREncode_CloseArray(&context);
-            }
+    UsefulBufC const_buffer = UsefulBuf_Const(buffer);
+    QCBORError err = QCBOREncode_Finish(&context, &const_buffer);
+    if (err != QCBOR_SUCCESS) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
 
-            if (g_UnneededComponentList != nullptr)
-            {
-                // Add unneeded-manifest-list.
-                QCBOREncode_OpenArrayInMapN(&context, TEEP_LABEL_UNNEEDED_MANIFEST_LIST);
-                {
-                    for (TrustedComponent* tc = g_UnneededComponentList; tc != nullptr; tc = tc->Next) {
-                        QCBOREncode_OpenArray(&context);
-                        {
-                            UsefulBuf tc_id = UsefulBuf_FROM_BYTE_ARRAY(tc->ID.b);
-                            QCBOREncode_AddBytes(&context, UsefulBuf_Const(tc_id));
-                        }
-                        QCBOREncode_CloseArray(&context);
-                    }
-                }
-                QCBOREncode_CloseArray(&context);
+    // Keep what was asked for, to answer it again later.
+    g_CachedQueryRequest.Valid = true;
+    g_CachedQueryRequest.TamUri = g_SessionTamUri;
+    g_CachedQueryRequest.Token = (errorToken.len > 0) ? std::string((const char*)errorToken.ptr, errorToken.len) : std::string();
+    g_CachedQueryRequest.DataItemRequested = dataItemRequested;
+
+    *encodedResponse = const_buffer;
+    return TEEP_ERR_SUCCESS;
+}
+
+// Compose a QueryResponse to the last QueryRequest received.
+static teep_error_code_t TeepAgentComposeCachedQueryResponse(_Out_ UsefulBufC* encodedResponse)
+{
+    *encodedResponse = NULLUsefulBufC;
+
+    size_t maxBufferLength = 4096;
+    char* rawBuffer = (char*)malloc(maxBufferLength);
+    if (rawBuffer == nullptr) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+
+    QCBOREncodeContext context;
+    UsefulBuf buffer{ rawBuffer, maxBufferLength };
+    QCBOREncode_Init(&context, buffer);
+
+    QCBOREncode_OpenArray(&context);
+    {
+        // Add TYPE.
+        QCBOREncode_AddInt64(&context, TEEP_MESSAGE_QUERY_RESPONSE);
+
+        QCBOREncode_OpenMap(&context);
+        {
+            // The token tells the TAM which QueryRequest this answers.
+            const std::string& token = g_CachedQueryRequest.Token;
+            if (!token.empty()) {
+                QCBOREncode_AddBytesToMapN(&context, TEEP_LABEL_TOKEN, { token.data(), token.size() });
             }
+            AddSelectedCipherSuite(&context);
+            AddQueryResponseItems(&context, g_CachedQueryRequest.DataItemRequested);
         }
         QCBOREncode_CloseMap(&context);
     }
@@ -376,6 +487,7 @@ static teep_error_code_t TeepAgentComposeQueryResponse(_Inout_ QCBORDecodeContex
     UsefulBufC const_buffer = UsefulBuf_Const(buffer);
     QCBORError err = QCBOREncode_Finish(&context, &const_buffer);
     if (err != QCBOR_SUCCESS) {
+        free(rawBuffer);
         return TEEP_ERR_TEMPORARY_ERROR;
     }
 
@@ -383,6 +495,35 @@ static teep_error_code_t TeepAgentComposeQueryResponse(_Inout_ QCBORDecodeContex
     return TEEP_ERR_SUCCESS;
 }
 
+// Start a new session by sending a QueryResponse to the last QueryRequest,
+// saving the round trip in which the TAM would ask for it.
+static teep_error_code_t TeepAgentSendCachedQueryResponse(_In_z_ const char* tamUri)
+{
+    UsefulBufC queryResponse;
+    teep_error_code_t error = TeepAgentComposeCachedQueryResponse(&queryResponse);
+    if (error != TEEP_ERR_SUCCESS) {
+        return error;
+    }
+
+    HexPrintBuffer("Sending CBOR message: ", queryResponse.ptr, queryResponse.len);
+
+    TeepLogMessage("Sending QueryResponse without waiting for a QueryRequest...\n");
+
+#ifdef TEEP_USE_COSE
+    UsefulBufC message;
+    Q_USEFUL_BUF_MAKE_STACK_UB(signed_cose_buffer, 1000);
+    error = TeepAgentSignMessage(&queryResponse, signed_cose_buffer, &message);
+#else
+    UsefulBufC message = queryResponse;
+#endif
+    if (error == TEEP_ERR_SUCCESS) {
+        g_SessionTamUri = tamUri;
+        error = TeepAgentConnectWithMessage(tamUri, TEEP_CBOR_MEDIA_TYPE, (const char*)message.ptr, message.len);
+    }
+    free((void*)queryResponse.ptr);
+    return error;
+}
+
 static teep_error_code_t TeepAgentSendMessage(
     _In_ void* sessionHandle,
     _In_z_ const char* mediaType,
@@ -581,7 +722,7 @@ static teep_error_code_t TeepAgentParseComponentId(
     return TEEP_ERR_SUCCESS;
 }
 
-static teep_error_code_t TeepAgentHandleUpdate(void* sessionHandle, QCBORDecodeContext* context)
+static teep_error_code_t TeepAgentHandleUpdate(void* sessionHandle, QCBORDecodeContext* context, _Inout_opt_ StagedManifestList* staged)
 {
     TeepLogMessage("TeepAgentHandleUpdate\n");
 
@@ -599,6 +740,11 @@ static teep_error_code_t TeepAgentHandleUpdate(void* sessionHandle, QCBORDecodeC
         TeepAgentSendError(errorResponse, sessionHandle);
         return teep_error;
     }
+    // Installs and deletions are staged here and only become visible
+    // once the whole Update has been processed.  A streamed Update has
+    // already staged its manifest-list entries.
+    ManifestTransaction localTransaction;
+    ManifestTransaction& transaction = (staged != nullptr) ? staged->Transaction : localTransaction;
     teep_error_code_t errorCode = TEEP_ERR_SUCCESS;
     uint16_t mapEntryCount = item.val.uCount;
     for (int mapEntryIndex = 0; mapEntryIndex < mapEntryCount; mapEntryIndex++) {
@@ -638,7 +784,7 @@ static teep_error_code_t TeepAgentHandleUpdate(void* sessionHandle, QCBORDecodeC
                     TeepAgentSendError(errorResponse, sessionHandle);
                     return teep_error;
                 }
-                errorCode = SuitUninstallComponent(componentId);
+                errorCode = SuitUninstallComponent(componentId, transaction);
                 if (errorCode != TEEP_ERR_SUCCESS) {
                     break;
                 }
@@ -646,9 +792,11 @@ static teep_error_code_t TeepAgentHandleUpdate(void* sessionHandle, QCBORDecodeC
             break;
         }
         case TEEP_LABEL_MANIFEST_LIST:
+        case TEEP_LABEL_COMPRESSED_MANIFEST_LIST:
         {
+            bool compressed = (label == TEEP_LABEL_COMPRESSED_MANIFEST_LIST);
             if (item.uDataType != QCBOR_TYPE_ARRAY) {
-                REPORT_TYPE_ERROR(errorMessage, "manifest-list", QCBOR_TYPE_ARRAY, item);
+                REPORT_TYPE_ERROR(errorMessage, compressed ? "compressed-manifest-list" : "manifest-list", QCBOR_TYPE_ARRAY, item);
                 teep_error = TeepAgentComposeError(token, TEEP_ERR_PERMANENT_ERROR, errorMessage.str(), &errorResponse);
                 TeepAgentSendError(errorResponse, sessionHandle);
                 return teep_error;
@@ -657,20 +805,40 @@ static teep_error_code_t TeepAgentHandleUpdate(void* sessionHandle, QCBORDecodeC
 #ifdef _DEBUG
             TeepLogMessage("Parsing %d manifest-list entries...\n", item.val.uCount);
 #endif
+            std::vector<UsefulBufC> envelopes;
+            envelopes.reserve(arrayEntryCount);
             for (int arrayEntryIndex = 0; arrayEntryIndex < arrayEntryCount; arrayEntryIndex++) {
                 QCBORDecode_GetNext(context, &item);
                 if (item.uDataType != QCBOR_TYPE_BYTE_STRING) {
-                    REPORT_TYPE_ERROR(errorMessage, "SUIT_Envelope", QCBOR_TYPE_BYTE_STRING, item);
+                    REPORT_TYPE_ERROR(errorMessage, compressed ? "compressed SUIT_Envelope" : "SUIT_Envelope", QCBOR_TYPE_BYTE_STRING, item);
                     teep_error = TeepAgentComposeError(token, TEEP_ERR_PERMANENT_ERROR, errorMessage.str(), &errorResponse);
                     TeepAgentSendError(errorResponse, sessionHandle);
                     return teep_error;
                 }
-                if (errorCode == TEEP_ERR_SUCCESS) {
-                    // Try until we hit the first error.
-                    errorCode = TryProcessSuitEnvelope(item.val.string, errorMessage);
+                envelopes.push_back(item.val.string);
+            }
+            if (errorCode != TEEP_ERR_SUCCESS) {
+                break;
+            }
+            if (staged != nullptr) {
+                // The envelopes were replaced by placeholders as they arrived.
+                errorCode = staged->ErrorCode;
+                errorMessage << staged->ErrorMessage;
+            } else {
+                // Expand every compressed entry before installing any.
+                std::vector<std::vector<uint8_t>> decompressed(compressed ? envelopes.size() : 0);
+                for (size_t i = 0; i < decompressed.size(); i++) {
+                    errorCode = teep_decompress_buffer(envelopes[i], TEEP_MAX_DECOMPRESSED_ENVELOPE_SIZE, decompressed[i]);
                     if (errorCode != TEEP_ERR_SUCCESS) {
+                        errorMessage << "Malformed compressed SUIT_Envelope" << std::endl;
                         break;
                     }
+                    envelopes[i] = { decompressed[i].data(), decompressed[i].size() };
+                }
+
+                // Install until we hit the first error.
+                if (errorCode == TEEP_ERR_SUCCESS) {
+                    errorCode = SuitProcessEnvelopes(envelopes, 0, transaction, errorMessage);
                 }
             }
             break;
@@ -727,6 +895,12 @@ static teep_error_code_t TeepAgentHandleUpdate(void* sessionHandle, QCBORDecodeC
         }
     }
 
+    // Make everything staged above durable with a single sync.
+    teep_error_code_t commitError = transaction.Commit(errorMessage);
+    if (errorCode == TEEP_ERR_SUCCESS) {
+        errorCode = commitError;
+    }
+
     /* Compose a Success reply. */
     UsefulBufC reply;
     teep_error = TeepAgentComposeSuccess(token, &reply);
@@ -793,25 +967,16 @@ static teep_error_code_t TeepAgentVerifyMessageSignature(
 #endif
 }
 
-/* Handle an incoming message from a TAM. */
-static teep_error_code_t TeepAgentHandleMessage(
+/* Handle an incoming message from a TAM once its signature is verified. */
+teep_error_code_t TeepAgentHandleVerifiedMessage(
     _In_ void* sessionHandle,
-    _In_reads_(messageLength) const char* message,
-    size_t messageLength)
+    _In_ UsefulBufC encoded,
+    _Inout_opt_ StagedManifestList* staged)
 {
     QCBORDecodeContext context;
     QCBORItem item;
     std::ostringstream errorMessage;
-
-    HexPrintBuffer("TeepAgentHandleCborMessage got COSE message:\n", message, messageLength);
-    TeepLogMessage("\n");
-
-    // Verify signature and save which signing key was used.
-    UsefulBufC encoded;
-    teep_error_code_t teeperr = TeepAgentVerifyMessageSignature(sessionHandle, message, messageLength, &encoded);
-    if (teeperr != TEEP_ERR_SUCCESS) {
-        return teeperr;
-    }
+    teep_error_code_t teeperr;
 
     HexPrintBuffer("Received CBOR message: ", encoded.ptr, encoded.len);
 
@@ -836,7 +1001,7 @@ static teep_error_code_t TeepAgentHandleMessage(
         teeperr = TeepAgentHandleQueryRequest(sessionHandle, &context);
         break;
     case TEEP_MESSAGE_UPDATE:
-        teeperr = TeepAgentHandleUpdate(sessionHandle, &context);
+        teeperr = TeepAgentHandleUpdate(sessionHandle, &context, staged);
         break;
     default:
         teeperr = TeepAgentHandleInvalidMessage(sessionHandle, &context);
@@ -850,6 +1015,25 @@ static teep_error_code_t TeepAgentHandleMessage(
     return (err == QCBOR_SUCCESS) ? TEEP_ERR_SUCCESS : TEEP_ERR_TEMPORARY_ERROR;
 }
 
+/* Handle an incoming message from a TAM. */
+static teep_error_code_t TeepAgentHandleMessage(
+    _In_ void* sessionHandle,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    HexPrintBuffer("TeepAgentHandleCborMessage got COSE message:\n", message, messageLength);
+    TeepLogMessage("\n");
+
+    // Verify signature and save which signing key was used.
+    UsefulBufC encoded;
+    teep_error_code_t teeperr = TeepAgentVerifyMessageSignature(sessionHandle, message, messageLength, &encoded);
+    if (teeperr != TEEP_ERR_SUCCESS) {
+        return teeperr;
+    }
+
+    return TeepAgentHandleVerifiedMessage(sessionHandle, encoded, nullptr);
+}
+
 teep_error_code_t TeepAgentProcessTeepMessage(
     _In_ void* sessionHandle,
     _In_z_ const char* mediaType,
@@ -922,6 +1106,7 @@ teep_error_code_t TeepAgentRequestTA(
         // Pass back a TAM URI with no buffer.
         TeepLogMessage("Sending an empty message...\n");
         const char* acceptMediaType = TEEP_CBOR_MEDIA_TYPE;
+        g_SessionTamUri = tamUri;
         err = TeepAgentConnect(tamUri, acceptMediaType);
         if (err != TEEP_ERR_SUCCESS) {
             return err;
@@ -970,6 +1155,7 @@ teep_error_code_t TeepAgentUnrequestTA(
     if (!haveTrustedTamCert) {
         // Pass back a TAM URI with no buffer.
         TeepLogMessage("Sending an empty message...\n");
+        g_SessionTamUri = tamUri;
         teep_error = TeepAgentConnect(tamUri, TEEP_CBOR_MEDIA_TYPE);
         if (teep_error != TEEP_ERR_SUCCESS) {
             return teep_error;
@@ -982,6 +1168,30 @@ teep_error_code_t TeepAgentUnrequestTA(
     return teep_error;
 }
 
+// Get the sequence number of an installed manifest, or 0 if it cannot be
+// read.
+static uint64_t TeepAgentGetManifestSequenceNumber(_In_ const filesystem::path& manifestPath)
+{
+    FILE* fp = fopen(manifestPath.string().c_str(), "rb");
+    if (fp == nullptr) {
+        return 0;
+    }
+    std::vector<uint8_t> envelope;
+    uint8_t buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        envelope.insert(envelope.end(), buffer, buffer + length);
+    }
+    fclose(fp);
+
+    SuitEnvelopeOffsets offsets;
+    std::ostringstream errorMessage;
+    if (SuitParseEnvelope(UsefulBufC{ envelope.data(), envelope.size() }, offsets, errorMessage) != TEEP_ERR_SUCCESS) {
+        return 0;
+    }
+    return offsets.SequenceNumber;
+}
+
 /* TODO: This is just a placeholder for a real implementation.
  * Currently we provide untrusted manifests into the TEEP Agent.
  * In a real implementation, the TEEP Agent would instead either load
@@ -1003,6 +1213,13 @@ teep_error_code_t TeepAgentConfigureManifests(
         }
         char* filename = dirent->d_name;
         size_t filename_length = strlen(filename);
+        if (filename_length > 4 &&
+            strcmp(filename + filename_length - 4, ".tmp") == 0) {
+            // Remove a temporary file left by an interrupted install.
+            std::error_code ec;
+            filesystem::remove(filesystem::path(directory_name) / filename, ec);
+            continue;
+        }
         if (filename_length < 6 ||
             strcmp(filename + filename_length - 5, ".cbor") != 0) {
             continue;
@@ -1020,6 +1237,7 @@ teep_error_code_t TeepAgentConfigureManifests(
             result = TEEP_ERR_TEMPORARY_ERROR;
             break;
         }
+        tc->ManifestSequenceNumber = TeepAgentGetManifestSequenceNumber(filesystem::path(directory_name) / filename);
         tc->Next = g_InstalledComponentList;
         g_InstalledComponentList = tc;
     }
@@ -1035,7 +1253,11 @@ teep_error_code_t TeepAgentLoadConfiguration(_In_z_ const char* dataDirectory)
     g_agent_data_directory /= dataDirectory;
 
     std::filesystem::path manifest_path = g_agent_data_directory / "manifests";
-    return TeepAgentConfigureManifests(manifest_path.string().c_str());
+    teep_error_code_t result = TeepAgentConfigureManifests(manifest_path.string().c_str());
+
+    // Drop any objects orphaned by an interrupted Update.
+    ObjectStoreCollectGarbage();
+    return result;
 }
 
 static void ClearComponentList(_Inout_ TrustedComponent** componentList)
@@ -1053,6 +1275,40 @@ void TeepAgentShutdown()
     ClearComponentList(&g_InstalledComponentList);
     ClearComponentList(&g_UnneededComponentList);
     ClearComponentList(&g_RequestedComponentList);
+    g_CachedQueryRequest.Valid = false;
+}
+
+teep_error_code_t TeepAgentVerifyInstalledComponents(size_t maxBytes, _Out_ int* complete)
+{
+    bool done;
+    std::vector<filesystem::path> removedEntries;
+    teep_error_code_t result = ObjectStoreVerifyObjects(maxBytes, &done, removedEntries);
+    *complete = done;
+    if (!removedEntries.empty()) {
+        // Rebuild the installed list from the entries that remain.
+        ClearComponentList(&g_InstalledComponentList);
+        std::filesystem::path manifest_path = g_agent_data_directory / "manifests";
+        TeepAgentConfigureManifests(manifest_path.string().c_str());
+    }
+    return result;
+}
+
+void TeepAgentGetObjectDirectory(_Out_ filesystem::path& objectDirectory)
+{
+    objectDirectory = g_agent_data_directory;
+    objectDirectory /= "objects";
+}
+
+void TeepAgentGetHeldEnvelopesFilename(_Out_ filesystem::path& filename)
+{
+    filename = g_agent_data_directory;
+    filename /= "held-envelopes";
+}
+
+void TeepAgentGetVerificationCacheFilename(_Out_ filesystem::path& filename)
+{
+    filename = g_agent_data_directory;
+    filename /= "verified-signatures";
 }
 
 #define TOXDIGIT(x) ("0123456789abcdef"[x])
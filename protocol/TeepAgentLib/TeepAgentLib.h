@@ -17,6 +17,24 @@ extern "C" {
         _In_reads_(messageLength) const char* message,
         size_t messageLength);
 
+    // Start a new session whose first message is the one given, rather
+    // than an empty one.
+    teep_error_code_t TeepAgentConnectWithMessage(
+        _In_z_ const char* tamUri,
+        _In_z_ const char* mediaType,
+        _In_reads_(messageLength) const char* message,
+        size_t messageLength);
+
+    // Read up to bufferSize bytes of the payload at uri, starting at
+    // offset, for suit-directive-fetch.  *bytesRead is 0 once the end of
+    // the payload has been reached.
+    teep_error_code_t TeepAgentFetchPayload(
+        _In_z_ const char* uri,
+        uint64_t offset,
+        _Out_writes_bytes_to_(bufferSize, *bytesRead) uint8_t* buffer,
+        size_t bufferSize,
+        _Out_ size_t* bytesRead);
+
     // Calls up from broker.
     teep_error_code_t TeepAgentLoadConfiguration(_In_z_ const char* dataDirectory);
     teep_error_code_t TeepAgentInitializeKeys(
@@ -30,6 +48,15 @@ extern "C" {
         _In_reads_(messageLength) const char* message,
         size_t messageLength);
 
+    // Deliver an inbound message in pieces.  The message is complete once
+    // a chunk is passed with isFinalChunk set.
+    teep_error_code_t TeepAgentProcessTeepMessageChunk(
+        _In_ void* sessionHandle,
+        _In_z_ const char* mediaType,
+        _In_reads_(chunkLength) const char* chunk,
+        size_t chunkLength,
+        int isFinalChunk);
+
     teep_error_code_t TeepAgentRequestTA(
         teep_uuid_t requestedTaid,
         _In_z_ const char* tamUri);
@@ -38,6 +65,20 @@ extern "C" {
         teep_uuid_t unneededTaid,
         _In_z_ const char* tamUri);
 
+    // Re-check installed components against their digests in the
+    // background, hashing at most maxBytes per call.  *complete is set
+    // once a full pass has finished.  Components found to be corrupt are
+    // removed, so they are no longer reported to the TAM and get
+    // installed again by the next Update.
+    teep_error_code_t TeepAgentVerifyInstalledComponents(size_t maxBytes, _Out_ int* complete);
+
+    // Compose a push request, described in TeepTransport.h, to hold a
+    // push channel open to a TAM with.
+    teep_error_code_t TeepAgentComposePushRequest(
+        _Out_writes_bytes_to_(bufferSize, *requestLength) char* buffer,
+        size_t bufferSize,
+        _Out_ size_t* requestLength);
+
     teep_error_code_t TeepAgentProcessError(_In_ void* sessionHandle);
     teep_error_code_t TeepAgentRequestPolicyCheck(_In_z_ const char* tamUri);
     void TeepAgentShutdown();
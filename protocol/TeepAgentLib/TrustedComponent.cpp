@@ -8,6 +8,7 @@ TrustedComponent::TrustedComponent(teep_uuid_t id)
 {
     this->ID = id;
     ConvertUUIDToString(this->Name, sizeof(this->Name), id);
+    this->ManifestSequenceNumber = 0;
     this->Next = nullptr;
 }
 
@@ -12,6 +12,7 @@ public:
 
     char Name[256];
     teep_uuid_t ID;
+    uint64_t ManifestSequenceNumber; // Of the installed manifest, if any.
 
     TrustedComponent* Next;
 };
@@ -0,0 +1,171 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#ifndef TEEP_USE_TEE
+#include <mutex>
+#endif
+#include "buffer_pool.h"
+
+static const size_t g_ClassSizes[TEEP_BUFFER_POOL_CLASS_COUNT] = { 4 * 1024, 16 * 1024, 64 * 1024, 1024 * 1024 };
+
+static struct {
+    std::vector<char*> Free[TEEP_BUFFER_POOL_CLASS_COUNT];
+    uint64_t Allocations;
+#ifndef TEEP_USE_TEE
+    std::mutex Lock;
+#endif
+} g_BufferPool;
+
+#ifdef TEEP_USE_TEE
+#define LOCK_BUFFER_POOL()
+#else
+#define LOCK_BUFFER_POOL() std::lock_guard<std::mutex> lock(g_BufferPool.Lock)
+#endif
+
+// Get the smallest class a size fits in, or TEEP_BUFFER_POOL_CLASS_COUNT
+// if it fits in none.
+static int GetSizeClass(size_t size)
+{
+    int sizeClass = 0;
+    while (sizeClass < TEEP_BUFFER_POOL_CLASS_COUNT && size > g_ClassSizes[sizeClass]) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+teep_error_code_t teep_buffer_acquire(size_t size, _Out_ teep_buffer_t* buffer)
+{
+    int sizeClass = GetSizeClass(size);
+    size_t capacity = (sizeClass < TEEP_BUFFER_POOL_CLASS_COUNT) ? g_ClassSizes[sizeClass] : size;
+    {
+        LOCK_BUFFER_POOL();
+        if (sizeClass < TEEP_BUFFER_POOL_CLASS_COUNT && !g_BufferPool.Free[sizeClass].empty()) {
+            buffer->data = g_BufferPool.Free[sizeClass].back();
+            buffer->capacity = capacity;
+            g_BufferPool.Free[sizeClass].pop_back();
+            return TEEP_ERR_SUCCESS;
+        }
+        g_BufferPool.Allocations++;
+    }
+
+    buffer->data = (char*)malloc((capacity > 0) ? capacity : 1);
+    buffer->capacity = (buffer->data != nullptr) ? capacity : 0;
+    return (buffer->data != nullptr) ? TEEP_ERR_SUCCESS : TEEP_ERR_TEMPORARY_ERROR;
+}
+
+void teep_buffer_release(_Inout_ teep_buffer_t* buffer)
+{
+    if (buffer->data == nullptr) {
+        return;
+    }
+    int sizeClass = GetSizeClass(buffer->capacity);
+    if (sizeClass < TEEP_BUFFER_POOL_CLASS_COUNT && buffer->capacity == g_ClassSizes[sizeClass]) {
+        LOCK_BUFFER_POOL();
+        if (g_BufferPool.Free[sizeClass].size() < TEEP_BUFFER_POOL_MAX_FREE) {
+            g_BufferPool.Free[sizeClass].push_back(buffer->data);
+            buffer->data = nullptr;
+            buffer->capacity = 0;
+            return;
+        }
+    }
+    free(buffer->data);
+    buffer->data = nullptr;
+    buffer->capacity = 0;
+}
+
+void teep_buffer_pool_trim(void)
+{
+    LOCK_BUFFER_POOL();
+    for (std::vector<char*>& list : g_BufferPool.Free) {
+        for (char* data : list) {
+            free(data);
+        }
+        list.clear();
+    }
+}
+
+uint64_t teep_buffer_pool_get_allocations(void)
+{
+    LOCK_BUFFER_POOL();
+    return g_BufferPool.Allocations;
+}
+
+void teep_buffer_chain_init(_Out_ teep_buffer_chain_t* chain)
+{
+    chain->link_count = 0;
+    chain->last_length = 0;
+    chain->length = 0;
+}
+
+teep_error_code_t teep_buffer_chain_reserve(
+    _Inout_ teep_buffer_chain_t* chain,
+    size_t sizeHint,
+    _Outptr_ char** space,
+    _Out_ size_t* spaceLength)
+{
+    *space = nullptr;
+    *spaceLength = 0;
+    if (chain->link_count == 0 || chain->last_length == chain->links[chain->link_count - 1].capacity) {
+        if (chain->link_count == TEEP_BUFFER_CHAIN_MAX_LINKS) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+
+        // Each link is the next size class up from the one before.
+        size_t size = g_ClassSizes[0];
+        if (chain->link_count > 0) {
+            int sizeClass = GetSizeClass(chain->links[chain->link_count - 1].capacity);
+            size = g_ClassSizes[(sizeClass + 1 < TEEP_BUFFER_POOL_CLASS_COUNT) ? sizeClass + 1 : TEEP_BUFFER_POOL_CLASS_COUNT - 1];
+        }
+        teep_error_code_t result = teep_buffer_acquire((sizeHint > size) ? sizeHint : size, &chain->links[chain->link_count]);
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+        chain->link_count++;
+        chain->last_length = 0;
+    }
+
+    teep_buffer_t* last = &chain->links[chain->link_count - 1];
+    *space = last->data + chain->last_length;
+    *spaceLength = last->capacity - chain->last_length;
+    return TEEP_ERR_SUCCESS;
+}
+
+void teep_buffer_chain_commit(_Inout_ teep_buffer_chain_t* chain, size_t length)
+{
+    chain->last_length += length;
+    chain->length += length;
+}
+
+teep_error_code_t teep_buffer_chain_flatten(_Inout_ teep_buffer_chain_t* chain, _Out_ teep_buffer_t* buffer)
+{
+    if (chain->link_count == 1 && chain->last_length < chain->links[0].capacity) {
+        *buffer = chain->links[0];
+    } else {
+        teep_error_code_t result = teep_buffer_acquire(chain->length + 1, buffer);
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < chain->link_count; i++) {
+            size_t length = (i + 1 < chain->link_count) ? chain->links[i].capacity : chain->last_length;
+            if (length > 0) {
+                memcpy(buffer->data + offset, chain->links[i].data, length);
+            }
+            offset += length;
+            teep_buffer_release(&chain->links[i]);
+        }
+    }
+    buffer->data[chain->length] = 0;
+    teep_buffer_chain_init(chain);
+    return TEEP_ERR_SUCCESS;
+}
+
+void teep_buffer_chain_release(_Inout_ teep_buffer_chain_t* chain)
+{
+    for (size_t i = 0; i < chain->link_count; i++) {
+        teep_buffer_release(&chain->links[i]);
+    }
+    teep_buffer_chain_init(chain);
+}
@@ -0,0 +1,68 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "common.h"
+
+// Buffers that transports receive messages into are recycled by size
+// class (4K, 16K, 64K, and 1M), so once warm, receiving a message needs
+// no heap allocation.  Larger sizes get a buffer of their own.  Every
+// buffer is a separate malloc, so a caller may also keep the memory and
+// later free() it instead of releasing the buffer.
+#define TEEP_BUFFER_POOL_CLASS_COUNT 4
+#define TEEP_BUFFER_POOL_MAX_FREE 16 // Free buffers kept per class.
+
+typedef struct {
+    char* data;
+    size_t capacity;
+} teep_buffer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Get a buffer of at least the given size.
+teep_error_code_t teep_buffer_acquire(size_t size, _Out_ teep_buffer_t* buffer);
+
+// Return a buffer to the pool.  Releasing an empty buffer does nothing.
+void teep_buffer_release(_Inout_ teep_buffer_t* buffer);
+
+// Free every buffer the pool is keeping.
+void teep_buffer_pool_trim(void);
+
+// Get the number of buffers allocated from the heap so far.
+uint64_t teep_buffer_pool_get_allocations(void);
+
+// A message of unknown size, received into a chain of pooled buffers that
+// grow by size class, so that a large message is never reallocated.
+#define TEEP_BUFFER_CHAIN_MAX_LINKS 32
+
+typedef struct {
+    teep_buffer_t links[TEEP_BUFFER_CHAIN_MAX_LINKS];
+    size_t link_count;
+    size_t last_length; // Bytes used in the last link.
+    size_t length;      // Bytes used in the whole chain.
+} teep_buffer_chain_t;
+
+void teep_buffer_chain_init(_Out_ teep_buffer_chain_t* chain);
+
+// Get free space at the end of a chain, first adding a link of at least
+// the given size if the last link is full.
+teep_error_code_t teep_buffer_chain_reserve(
+    _Inout_ teep_buffer_chain_t* chain,
+    size_t sizeHint,
+    _Outptr_ char** space,
+    _Out_ size_t* spaceLength);
+
+// Count bytes written into the space last reserved.
+void teep_buffer_chain_commit(_Inout_ teep_buffer_chain_t* chain, size_t length);
+
+// Take the contents of a chain as one NUL-terminated buffer, leaving the
+// chain empty.  A single link with room to spare is handed over as is.
+teep_error_code_t teep_buffer_chain_flatten(_Inout_ teep_buffer_chain_t* chain, _Out_ teep_buffer_t* buffer);
+
+// Release every link of a chain, leaving it empty.
+void teep_buffer_chain_release(_Inout_ teep_buffer_chain_t* chain);
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,302 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "bundle.h"
+
+#define TEEP_BUNDLE_BOUNDARY_PREFIX "teep-"
+#define TEEP_BUNDLE_MAX_BOUNDARY_LENGTH 70 // RFC 2046 section 5.1.1.
+#define TEEP_BUNDLE_BOUNDARY_SIZE (sizeof(TEEP_BUNDLE_BOUNDARY_PREFIX) + 16) // One we choose.
+
+// Find a byte string in another, as memmem() does where it exists.
+static const char* FindBytes(_In_reads_(length) const char* data, size_t length, _In_reads_(patternLength) const char* pattern, size_t patternLength)
+{
+    while (length >= patternLength) {
+        const char* first = (const char*)memchr(data, pattern[0], length - patternLength + 1);
+        if (first == nullptr) {
+            return nullptr;
+        }
+        if (memcmp(first, pattern, patternLength) == 0) {
+            return first;
+        }
+        length -= (first + 1) - data;
+        data = first + 1;
+    }
+    return nullptr;
+}
+
+static bool StartsWithIgnoringCase(_In_reads_(length) const char* text, size_t length, _In_z_ const char* prefix)
+{
+    size_t prefixLength = strlen(prefix);
+    if (length < prefixLength) {
+        return false;
+    }
+    for (size_t i = 0; i < prefixLength; i++) {
+        if (tolower((unsigned char)text[i]) != tolower((unsigned char)prefix[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int teep_bundle_is_media_type(_In_opt_z_ const char* media_type)
+{
+    if (media_type == nullptr) {
+        return 0;
+    }
+    size_t length = strlen(media_type);
+    size_t prefixLength = strlen(TEEP_BUNDLE_MEDIA_TYPE);
+    if (!StartsWithIgnoringCase(media_type, length, TEEP_BUNDLE_MEDIA_TYPE)) {
+        return 0;
+    }
+    char next = media_type[prefixLength];
+    return (next == '\0' || next == ';' || next == ' ');
+}
+
+// A header value may not break the header it is in.
+static bool IsHeaderSafe(_In_z_ const char* value)
+{
+    for (; *value != '\0'; value++) {
+        if (*value == '\r' || *value == '\n') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Pick a boundary that no part contains.  The first guess, a hash of the
+// lengths of the parts, is almost always good.
+static teep_error_code_t ChooseBoundary(
+    _In_reads_(count) const teep_bundle_part_t* parts,
+    size_t count,
+    _Out_writes_z_(TEEP_BUNDLE_BOUNDARY_SIZE) char* boundary)
+{
+    uint64_t guess = 14695981039346656037ULL;
+    for (size_t i = 0; i < count; i++) {
+        guess = (guess ^ parts[i].body_length) * 1099511628211ULL;
+    }
+    for (int attempt = 0; attempt < 16; attempt++, guess = guess * 6364136223846793005ULL + 1442695040888963407ULL) {
+        snprintf(boundary, TEEP_BUNDLE_BOUNDARY_SIZE, TEEP_BUNDLE_BOUNDARY_PREFIX "%08x%08x", (unsigned int)(guess >> 32), (unsigned int)guess);
+        size_t boundaryLength = strlen(boundary);
+        size_t i = 0;
+        while (i < count && FindBytes(parts[i].body, parts[i].body_length, boundary, boundaryLength) == nullptr) {
+            i++;
+        }
+        if (i == count) {
+            return TEEP_ERR_SUCCESS;
+        }
+    }
+    return TEEP_ERR_PERMANENT_ERROR;
+}
+
+teep_error_code_t teep_bundle_encode(
+    _In_reads_(count) const teep_bundle_part_t* parts,
+    size_t count,
+    _Out_ teep_buffer_t* bundle,
+    _Out_ size_t* bundle_length,
+    _Out_writes_z_(TEEP_BUNDLE_MAX_MEDIA_TYPE_SIZE) char* media_type)
+{
+    bundle->data = nullptr;
+    bundle->capacity = 0;
+    *bundle_length = 0;
+    if (count == 0 || count > TEEP_BUNDLE_MAX_PARTS) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    char boundary[TEEP_BUNDLE_BOUNDARY_SIZE];
+    teep_error_code_t result = ChooseBoundary(parts, count, boundary);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    // Size the bundle first, so it is written into one buffer.
+    size_t boundaryLength = strlen(boundary);
+    size_t size = 2 + boundaryLength + 4; // The closing delimiter.
+    for (size_t i = 0; i < count; i++) {
+        if (!IsHeaderSafe(parts[i].media_type) || !IsHeaderSafe(parts[i].device_id)) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        size += 2 + boundaryLength + 2;
+        size += sizeof("Content-Type: \r\n") + strlen(parts[i].media_type);
+        size += sizeof("Content-ID: <>\r\n") + strlen(parts[i].device_id);
+        size += 2 + parts[i].body_length + 2;
+    }
+    result = teep_buffer_acquire(size + 1, bundle);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    char* next = bundle->data;
+    char* end = bundle->data + bundle->capacity;
+    for (size_t i = 0; i < count; i++) {
+        const teep_bundle_part_t* part = &parts[i];
+        next += snprintf(next, end - next, "--%s\r\n", boundary);
+        if (part->media_type[0] != '\0') {
+            next += snprintf(next, end - next, "Content-Type: %s\r\n", part->media_type);
+        }
+        if (part->device_id[0] != '\0') {
+            next += snprintf(next, end - next, "Content-ID: <%s>\r\n", part->device_id);
+        }
+        next += snprintf(next, end - next, "\r\n");
+        if (part->body_length > 0) {
+            memcpy(next, part->body, part->body_length);
+            next += part->body_length;
+        }
+        next += snprintf(next, end - next, "\r\n");
+    }
+    next += snprintf(next, end - next, "--%s--\r\n", boundary);
+    *bundle_length = next - bundle->data;
+    snprintf(media_type, TEEP_BUNDLE_MAX_MEDIA_TYPE_SIZE, TEEP_BUNDLE_MEDIA_TYPE "; boundary=%s", boundary);
+    return TEEP_ERR_SUCCESS;
+}
+
+// Get the boundary parameter of a bundle's Content-Type.
+static teep_error_code_t GetBoundary(_In_z_ const char* media_type, _Out_writes_z_(TEEP_BUNDLE_MAX_BOUNDARY_LENGTH + 1) char* boundary)
+{
+    const char* parameter = media_type;
+    while ((parameter = strchr(parameter, ';')) != nullptr) {
+        parameter++;
+        while (*parameter == ' ' || *parameter == '\t') {
+            parameter++;
+        }
+        if (!StartsWithIgnoringCase(parameter, strlen(parameter), "boundary=")) {
+            continue;
+        }
+        const char* value = parameter + strlen("boundary=");
+        size_t length;
+        if (*value == '"') {
+            value++;
+            const char* quote = strchr(value, '"');
+            length = (quote != nullptr) ? (size_t)(quote - value) : 0;
+        } else {
+            length = strcspn(value, "; \t");
+        }
+        if (length == 0 || length > TEEP_BUNDLE_MAX_BOUNDARY_LENGTH) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        memcpy(boundary, value, length);
+        boundary[length] = '\0';
+        return TEEP_ERR_SUCCESS;
+    }
+    return TEEP_ERR_PERMANENT_ERROR;
+}
+
+// Copy a header value, trimmed, if it fits.
+static bool CopyHeaderValue(_In_reads_(length) const char* value, size_t length, _Out_writes_z_(size) char* copy, size_t size)
+{
+    while (length > 0 && (*value == ' ' || *value == '\t')) {
+        value++;
+        length--;
+    }
+    while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t')) {
+        length--;
+    }
+    if (length >= size) {
+        return false;
+    }
+    memcpy(copy, value, length);
+    copy[length] = '\0';
+    return true;
+}
+
+// Parse the headers of one part, up to and including the empty line.
+static teep_error_code_t ParsePartHeaders(_In_reads_(length) const char* headers, size_t length, _Inout_ teep_bundle_part_t* part, _Out_ size_t* consumed)
+{
+    const char* start = headers;
+    for (;;) {
+        const char* lineEnd = FindBytes(headers, length, "\r\n", 2);
+        if (lineEnd == nullptr) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        size_t lineLength = lineEnd - headers;
+        if (lineLength == 0) {
+            *consumed = (lineEnd + 2) - start;
+            return TEEP_ERR_SUCCESS;
+        }
+        if (StartsWithIgnoringCase(headers, lineLength, "Content-Type:")) {
+            size_t nameLength = strlen("Content-Type:");
+            if (!CopyHeaderValue(headers + nameLength, lineLength - nameLength, part->media_type, sizeof(part->media_type))) {
+                return TEEP_ERR_PERMANENT_ERROR;
+            }
+        } else if (StartsWithIgnoringCase(headers, lineLength, "Content-ID:")) {
+            size_t nameLength = strlen("Content-ID:");
+            if (!CopyHeaderValue(headers + nameLength, lineLength - nameLength, part->device_id, sizeof(part->device_id))) {
+                return TEEP_ERR_PERMANENT_ERROR;
+            }
+
+            // The ID is in angle brackets, as a msg-id is.
+            size_t idLength = strlen(part->device_id);
+            if (idLength >= 2 && part->device_id[0] == '<' && part->device_id[idLength - 1] == '>') {
+                memmove(part->device_id, part->device_id + 1, idLength - 2);
+                part->device_id[idLength - 2] = '\0';
+            }
+        }
+        length -= lineLength + 2;
+        headers = lineEnd + 2;
+    }
+}
+
+teep_error_code_t teep_bundle_parse(
+    _In_z_ const char* media_type,
+    _In_reads_(bundle_length) const char* bundle,
+    size_t bundle_length,
+    _Out_writes_(max_count) teep_bundle_part_t* parts,
+    size_t max_count,
+    _Out_ size_t* count)
+{
+    *count = 0;
+    char boundary[TEEP_BUNDLE_MAX_BOUNDARY_LENGTH + 1];
+    if (!teep_bundle_is_media_type(media_type) || GetBoundary(media_type, boundary) != TEEP_ERR_SUCCESS) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+
+    // Every delimiter but a first one with no preamble starts a line.
+    char delimiter[2 + 2 + TEEP_BUNDLE_MAX_BOUNDARY_LENGTH + 1];
+    snprintf(delimiter, sizeof(delimiter), "\r\n--%s", boundary);
+    size_t delimiterLength = strlen(delimiter);
+    const char* end = bundle + bundle_length;
+    const char* next;
+    if (bundle_length >= delimiterLength - 2 && memcmp(bundle, delimiter + 2, delimiterLength - 2) == 0) {
+        next = bundle + delimiterLength - 2;
+    } else {
+        next = FindBytes(bundle, bundle_length, delimiter, delimiterLength);
+        if (next == nullptr) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        next += delimiterLength;
+    }
+
+    for (;;) {
+        // The closing delimiter ends the bundle.
+        if (end - next >= 2 && next[0] == '-' && next[1] == '-') {
+            return (*count > 0) ? TEEP_ERR_SUCCESS : TEEP_ERR_PERMANENT_ERROR;
+        }
+        while (next < end && (*next == ' ' || *next == '\t')) {
+            next++;
+        }
+        if (end - next < 2 || next[0] != '\r' || next[1] != '\n') {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        next += 2;
+        if (*count == max_count) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+
+        teep_bundle_part_t* part = &parts[*count];
+        memset(part, 0, sizeof(*part));
+        size_t consumed;
+        teep_error_code_t result = ParsePartHeaders(next, end - next, part, &consumed);
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+        next += consumed;
+        const char* bodyEnd = FindBytes(next, end - next, delimiter, delimiterLength);
+        if (bodyEnd == nullptr) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        part->body = next;
+        part->body_length = bodyEnd - next;
+        (*count)++;
+        next = bodyEnd + delimiterLength;
+    }
+}
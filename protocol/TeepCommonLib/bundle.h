@@ -0,0 +1,48 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "common.h"
+#include "buffer_pool.h"
+#include "../TeepTransport.h"
+
+// Bundles of TEEP messages for many devices, as described in
+// TeepTransport.h.
+
+// The largest Content-Type a bundle can have, with its boundary.
+#define TEEP_BUNDLE_MAX_MEDIA_TYPE_SIZE 80
+
+typedef struct {
+    char media_type[80]; // Empty if the part is empty.
+    char device_id[TEEP_BUNDLE_MAX_DEVICE_ID_LENGTH + 1];
+    const char* body; // Points into the bundle when parsed.
+    size_t body_length;
+} teep_bundle_part_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Check whether a Content-Type is that of a bundle.
+int teep_bundle_is_media_type(_In_opt_z_ const char* media_type);
+
+// Encode parts into a pooled buffer, with a boundary found in none of
+// them, and get the Content-Type to send the bundle with.
+teep_error_code_t teep_bundle_encode(
+    _In_reads_(count) const teep_bundle_part_t* parts,
+    size_t count,
+    _Out_ teep_buffer_t* bundle,
+    _Out_ size_t* bundle_length,
+    _Out_writes_z_(TEEP_BUNDLE_MAX_MEDIA_TYPE_SIZE) char* media_type);
+
+// Split a bundle into its parts, whose bodies point into the bundle.
+teep_error_code_t teep_bundle_parse(
+    _In_z_ const char* media_type,
+    _In_reads_(bundle_length) const char* bundle,
+    size_t bundle_length,
+    _Out_writes_(max_count) teep_bundle_part_t* parts,
+    size_t max_count,
+    _Out_ size_t* count);
+
+#ifdef __cplusplus
+};
+#endif
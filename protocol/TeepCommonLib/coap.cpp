@@ -0,0 +1,276 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <string.h>
+#include "coap.h"
+
+#define COAP_HEADER_SIZE 4
+#define COAP_PAYLOAD_MARKER 0xFF
+
+#define COAP_OPTION_URI_PATH 11
+#define COAP_OPTION_CONTENT_FORMAT 12
+#define COAP_OPTION_ACCEPT 17
+#define COAP_OPTION_BLOCK2 23
+#define COAP_OPTION_BLOCK1 27
+#define COAP_OPTION_SIZE2 28
+#define COAP_OPTION_SIZE1 60
+
+void teep_coap_message_init(_Out_ teep_coap_message_t* message)
+{
+    memset(message, 0, sizeof(*message));
+    message->content_format = TEEP_COAP_OPTION_ABSENT;
+    message->accept = TEEP_COAP_OPTION_ABSENT;
+    message->block1 = TEEP_COAP_OPTION_ABSENT;
+    message->block2 = TEEP_COAP_OPTION_ABSENT;
+    message->size1 = TEEP_COAP_OPTION_ABSENT;
+    message->size2 = TEEP_COAP_OPTION_ABSENT;
+}
+
+// Read the extended form of an option delta or length nibble.
+static teep_error_code_t ReadOptionNibble(uint32_t nibble, _Inout_ const uint8_t** p, _In_ const uint8_t* end, _Out_ uint32_t* value)
+{
+    if (nibble < 13) {
+        *value = nibble;
+    } else if (nibble == 13) {
+        if (end - *p < 1) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        *value = 13 + (*p)[0];
+        *p += 1;
+    } else if (nibble == 14) {
+        if (end - *p < 2) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        *value = 269 + (((uint32_t)(*p)[0] << 8) | (*p)[1]);
+        *p += 2;
+    } else {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+static teep_error_code_t DecodeUintOption(_In_reads_(length) const uint8_t* value, uint32_t length, _Out_ uint32_t* result)
+{
+    if (length > 4) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    *result = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        *result = (*result << 8) | value[i];
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t teep_coap_parse(
+    _In_reads_(length) const uint8_t* datagram,
+    size_t length,
+    _Out_ teep_coap_message_t* message)
+{
+    teep_coap_message_init(message);
+    if (length < COAP_HEADER_SIZE || (datagram[0] >> 6) != TEEP_COAP_VERSION) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    message->type = (teep_coap_type_t)((datagram[0] >> 4) & 0x3);
+    message->token_length = datagram[0] & 0xF;
+    message->code = datagram[1];
+    message->message_id = (uint16_t)((datagram[2] << 8) | datagram[3]);
+    if (message->token_length > TEEP_COAP_MAX_TOKEN_LENGTH || length < COAP_HEADER_SIZE + message->token_length) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    memcpy(message->token, datagram + COAP_HEADER_SIZE, message->token_length);
+
+    const uint8_t* p = datagram + COAP_HEADER_SIZE + message->token_length;
+    const uint8_t* end = datagram + length;
+    uint32_t number = 0;
+    size_t pathLength = 0;
+    while (p < end) {
+        if (*p == COAP_PAYLOAD_MARKER) {
+            p++;
+            if (p == end) {
+                return TEEP_ERR_PERMANENT_ERROR; // A marker must have a payload after it.
+            }
+            message->payload = p;
+            message->payload_length = end - p;
+            break;
+        }
+        uint32_t delta;
+        uint32_t optionLength;
+        uint8_t nibbles = *p++;
+        if (ReadOptionNibble(nibbles >> 4, &p, end, &delta) != TEEP_ERR_SUCCESS ||
+            ReadOptionNibble(nibbles & 0xF, &p, end, &optionLength) != TEEP_ERR_SUCCESS ||
+            (size_t)(end - p) < optionLength) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        number += delta;
+        const uint8_t* value = p;
+        p += optionLength;
+
+        teep_error_code_t result = TEEP_ERR_SUCCESS;
+        switch (number) {
+        case COAP_OPTION_URI_PATH:
+            if (pathLength + (pathLength > 0) + optionLength >= sizeof(message->uri_path)) {
+                return TEEP_ERR_PERMANENT_ERROR;
+            }
+            if (pathLength > 0) {
+                message->uri_path[pathLength++] = '/';
+            }
+            memcpy(message->uri_path + pathLength, value, optionLength);
+            pathLength += optionLength;
+            message->uri_path[pathLength] = '\0';
+            break;
+        case COAP_OPTION_CONTENT_FORMAT:
+            result = DecodeUintOption(value, optionLength, &message->content_format);
+            break;
+        case COAP_OPTION_ACCEPT:
+            result = DecodeUintOption(value, optionLength, &message->accept);
+            break;
+        case COAP_OPTION_BLOCK2:
+            result = DecodeUintOption(value, optionLength, &message->block2);
+            break;
+        case COAP_OPTION_BLOCK1:
+            result = DecodeUintOption(value, optionLength, &message->block1);
+            break;
+        case COAP_OPTION_SIZE2:
+            result = DecodeUintOption(value, optionLength, &message->size2);
+            break;
+        case COAP_OPTION_SIZE1:
+            result = DecodeUintOption(value, optionLength, &message->size1);
+            break;
+        default:
+            // Odd option numbers are critical, and must not be ignored.
+            if (number & 1) {
+                message->unrecognized_critical_option = 1;
+            }
+            break;
+        }
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+// Write one option, or return false if it does not fit.
+static bool WriteOption(
+    uint32_t number,
+    _Inout_ uint32_t* lastNumber,
+    _In_reads_(length) const uint8_t* value,
+    size_t length,
+    _Inout_ uint8_t** p,
+    _In_ const uint8_t* end)
+{
+    uint32_t delta = number - *lastNumber;
+    uint8_t extended[4];
+    size_t extendedLength = 0;
+    uint8_t nibbles[2];
+    uint32_t fields[2] = { delta, (uint32_t)length };
+    for (int i = 0; i < 2; i++) {
+        if (fields[i] < 13) {
+            nibbles[i] = (uint8_t)fields[i];
+        } else if (fields[i] < 269) {
+            nibbles[i] = 13;
+            extended[extendedLength++] = (uint8_t)(fields[i] - 13);
+        } else {
+            nibbles[i] = 14;
+            extended[extendedLength++] = (uint8_t)((fields[i] - 269) >> 8);
+            extended[extendedLength++] = (uint8_t)(fields[i] - 269);
+        }
+    }
+    if ((size_t)(end - *p) < 1 + extendedLength + length) {
+        return false;
+    }
+    *(*p)++ = (uint8_t)((nibbles[0] << 4) | nibbles[1]);
+    memcpy(*p, extended, extendedLength);
+    *p += extendedLength;
+    memcpy(*p, value, length);
+    *p += length;
+    *lastNumber = number;
+    return true;
+}
+
+// Write a uint option in as few bytes as its value needs.
+static bool WriteUintOption(uint32_t number, _Inout_ uint32_t* lastNumber, uint32_t value, _Inout_ uint8_t** p, _In_ const uint8_t* end)
+{
+    if (value == TEEP_COAP_OPTION_ABSENT) {
+        return true;
+    }
+    uint8_t bytes[4];
+    size_t length = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (length > 0 || (value >> shift) != 0) {
+            bytes[length++] = (uint8_t)(value >> shift);
+        }
+    }
+    return WriteOption(number, lastNumber, bytes, length, p, end);
+}
+
+size_t teep_coap_serialize(
+    _In_ const teep_coap_message_t* message,
+    _Out_writes_(size) uint8_t* buffer,
+    size_t size)
+{
+    if (message->token_length > TEEP_COAP_MAX_TOKEN_LENGTH || size < COAP_HEADER_SIZE + message->token_length) {
+        return 0;
+    }
+    buffer[0] = (uint8_t)((TEEP_COAP_VERSION << 6) | (message->type << 4) | message->token_length);
+    buffer[1] = message->code;
+    buffer[2] = (uint8_t)(message->message_id >> 8);
+    buffer[3] = (uint8_t)message->message_id;
+    memcpy(buffer + COAP_HEADER_SIZE, message->token, message->token_length);
+
+    uint8_t* p = buffer + COAP_HEADER_SIZE + message->token_length;
+    const uint8_t* end = buffer + size;
+    uint32_t lastNumber = 0;
+
+    // Options must be in order of option number.
+    const char* segment = message->uri_path;
+    while (*segment != '\0') {
+        size_t length = strcspn(segment, "/");
+        if (!WriteOption(COAP_OPTION_URI_PATH, &lastNumber, (const uint8_t*)segment, length, &p, end)) {
+            return 0;
+        }
+        segment += length;
+        if (*segment == '/') {
+            segment++;
+        }
+    }
+    if (!WriteUintOption(COAP_OPTION_CONTENT_FORMAT, &lastNumber, message->content_format, &p, end) ||
+        !WriteUintOption(COAP_OPTION_ACCEPT, &lastNumber, message->accept, &p, end) ||
+        !WriteUintOption(COAP_OPTION_BLOCK2, &lastNumber, message->block2, &p, end) ||
+        !WriteUintOption(COAP_OPTION_BLOCK1, &lastNumber, message->block1, &p, end) ||
+        !WriteUintOption(COAP_OPTION_SIZE2, &lastNumber, message->size2, &p, end) ||
+        !WriteUintOption(COAP_OPTION_SIZE1, &lastNumber, message->size1, &p, end)) {
+        return 0;
+    }
+
+    if (message->payload_length > 0) {
+        if ((size_t)(end - p) < 1 + message->payload_length) {
+            return 0;
+        }
+        *p++ = COAP_PAYLOAD_MARKER;
+        memcpy(p, message->payload, message->payload_length);
+        p += message->payload_length;
+    }
+    return p - buffer;
+}
+
+uint32_t teep_coap_block_encode(uint32_t number, int more, size_t size)
+{
+    uint32_t szx = 0;
+    while (((size_t)16 << szx) < size && szx < 6) {
+        szx++;
+    }
+    return (number << 4) | (more ? 0x8 : 0) | szx;
+}
+
+void teep_coap_block_decode(
+    uint32_t value,
+    _Out_ uint32_t* number,
+    _Out_ int* more,
+    _Out_ size_t* size)
+{
+    // SZX 7 is reserved, so treat it as the largest size.
+    uint32_t szx = value & 0x7;
+    *number = value >> 4;
+    *more = (value & 0x8) != 0;
+    *size = (size_t)16 << ((szx < 7) ? szx : 6);
+}
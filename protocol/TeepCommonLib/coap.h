@@ -0,0 +1,90 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "common.h"
+#include "../TeepTransport.h"
+
+// Encoding and decoding of CoAP (RFC 7252) messages, with the options
+// TEEP needs, including those for block-wise transfer (RFC 7959).
+
+#define TEEP_COAP_VERSION 1
+#define TEEP_COAP_MAX_TOKEN_LENGTH 8
+#define TEEP_COAP_MAX_URI_PATH_LENGTH 64
+#define TEEP_COAP_BLOCK_SIZE 1024 // The largest block size allowed.
+#define TEEP_COAP_MAX_DATAGRAM_SIZE (TEEP_COAP_BLOCK_SIZE + 128)
+
+// Transmission parameters, from RFC 7252 section 4.8.
+#define TEEP_COAP_ACK_TIMEOUT_MS 2000
+#define TEEP_COAP_ACK_RANDOM_FACTOR_PERCENT 150
+#define TEEP_COAP_MAX_RETRANSMIT 4
+#define TEEP_COAP_EXCHANGE_LIFETIME_SECONDS 247
+
+typedef enum {
+    TEEP_COAP_TYPE_CONFIRMABLE = 0,
+    TEEP_COAP_TYPE_NON_CONFIRMABLE = 1,
+    TEEP_COAP_TYPE_ACKNOWLEDGEMENT = 2,
+    TEEP_COAP_TYPE_RESET = 3,
+} teep_coap_type_t;
+
+#define TEEP_COAP_CODE(codeClass, detail) ((uint8_t)(((codeClass) << 5) | (detail)))
+#define TEEP_COAP_CODE_EMPTY TEEP_COAP_CODE(0, 0)
+#define TEEP_COAP_CODE_POST TEEP_COAP_CODE(0, 2)
+#define TEEP_COAP_CODE_CHANGED TEEP_COAP_CODE(2, 4)
+#define TEEP_COAP_CODE_CONTINUE TEEP_COAP_CODE(2, 31)
+#define TEEP_COAP_CODE_BAD_REQUEST TEEP_COAP_CODE(4, 0)
+#define TEEP_COAP_CODE_BAD_OPTION TEEP_COAP_CODE(4, 2)
+#define TEEP_COAP_CODE_NOT_FOUND TEEP_COAP_CODE(4, 4)
+#define TEEP_COAP_CODE_METHOD_NOT_ALLOWED TEEP_COAP_CODE(4, 5)
+#define TEEP_COAP_CODE_REQUEST_ENTITY_INCOMPLETE TEEP_COAP_CODE(4, 8)
+#define TEEP_COAP_CODE_REQUEST_ENTITY_TOO_LARGE TEEP_COAP_CODE(4, 13)
+#define TEEP_COAP_CODE_UNSUPPORTED_CONTENT_FORMAT TEEP_COAP_CODE(4, 15)
+#define TEEP_COAP_CODE_INTERNAL_SERVER_ERROR TEEP_COAP_CODE(5, 0)
+#define TEEP_COAP_CODE_SERVICE_UNAVAILABLE TEEP_COAP_CODE(5, 3)
+#define TEEP_COAP_CODE_CLASS(code) ((code) >> 5)
+
+// Value of an option the message does not have.
+#define TEEP_COAP_OPTION_ABSENT UINT32_MAX
+
+typedef struct {
+    teep_coap_type_t type;
+    uint8_t code;
+    uint16_t message_id;
+    size_t token_length;
+    uint8_t token[TEEP_COAP_MAX_TOKEN_LENGTH];
+
+    char uri_path[TEEP_COAP_MAX_URI_PATH_LENGTH]; // Segments joined by '/'.
+    uint32_t content_format;
+    uint32_t accept;
+    uint32_t block1; // As made by teep_coap_block_encode.
+    uint32_t block2;
+    uint32_t size1;  // Size of the whole request body.
+    uint32_t size2;  // Size of the whole response body.
+    int unrecognized_critical_option;
+
+    const uint8_t* payload;
+    size_t payload_length;
+} teep_coap_message_t;
+
+// Initialize a message with no options and no payload.
+void teep_coap_message_init(_Out_ teep_coap_message_t* message);
+
+// Decode a datagram.  The payload points into the datagram.
+teep_error_code_t teep_coap_parse(
+    _In_reads_(length) const uint8_t* datagram,
+    size_t length,
+    _Out_ teep_coap_message_t* message);
+
+// Encode a message, returning its length, or 0 if it does not fit.
+size_t teep_coap_serialize(
+    _In_ const teep_coap_message_t* message,
+    _Out_writes_(size) uint8_t* buffer,
+    size_t size);
+
+// Block options carry a block number, whether more blocks follow, and a
+// block size, which must be a power of two from 16 to 1024.
+uint32_t teep_coap_block_encode(uint32_t number, int more, size_t size);
+void teep_coap_block_decode(
+    uint32_t value,
+    _Out_ uint32_t* number,
+    _Out_ int* more,
+    _Out_ size_t* size);
@@ -14,6 +14,8 @@ extern "C" {
 #define sprintf_s(dest, len, ...) sprintf(dest, __VA_ARGS__)
 #endif
 #include "teep_protocol.h"
+#include "openssl/bn.h"
+#include "openssl/ecdsa.h"
 #include "openssl/rsa.h"
 #include "openssl/evp.h"
 #include "openssl/pem.h"
@@ -543,6 +545,93 @@ teep_verify_cbor_message(
     return teep_verify_cbor_message_sign(signature_kind, key_pair, signed_cose, encoded);
 }
 
+teep_error_code_t
+teep_verify_sign1_detached(
+    _In_ const struct t_cose_key* key_pair,
+    _In_ UsefulBufC signed_cose,
+    _In_ UsefulBufC detached_payload)
+{
+    struct t_cose_sign1_verify_ctx verify_ctx;
+
+    // Decode only, to learn the size of auxiliary buffer needed.
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_DECODE_ONLY);
+    t_cose_err_t return_value = t_cose_sign1_verify_detached(&verify_ctx, signed_cose, NULL_Q_USEFUL_BUF_C, detached_payload, nullptr);
+    if (return_value != T_COSE_SUCCESS) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    struct q_useful_buf auxiliary_buffer = {};
+    auxiliary_buffer.len = t_cose_sign1_verify_auxiliary_buffer_size(&verify_ctx);
+    if (auxiliary_buffer.len > 0) {
+        auxiliary_buffer.ptr = malloc(auxiliary_buffer.len);
+        if (auxiliary_buffer.ptr == NULL) {
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+    }
+
+    t_cose_sign1_verify_init(&verify_ctx, 0);
+    t_cose_sign1_set_verification_key(&verify_ctx, *key_pair);
+    t_cose_sign1_verify_set_auxiliary_buffer(&verify_ctx, auxiliary_buffer);
+    return_value = t_cose_sign1_verify_detached(&verify_ctx, signed_cose, NULL_Q_USEFUL_BUF_C, detached_payload, nullptr);
+    free(auxiliary_buffer.ptr);
+    return (return_value == T_COSE_SUCCESS) ? TEEP_ERR_SUCCESS : TEEP_ERR_PERMANENT_ERROR;
+}
+
+teep_error_code_t
+teep_compute_public_key_digest(
+    _In_ const struct t_cose_key* key_pair,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* digest)
+{
+    unsigned char* der = nullptr;
+    int der_length = i2d_PUBKEY((EVP_PKEY*)key_pair->key.ptr, &der);
+    if (der_length <= 0) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    teep_error_code_t result = teep_compute_sha256({ der, (size_t)der_length }, digest);
+    OPENSSL_free(der);
+    return result;
+}
+
+teep_error_code_t
+teep_verify_es256_digest(
+    _In_ const struct t_cose_key* key_pair,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    _In_ UsefulBufC signature)
+{
+    // COSE carries the ECDSA signature as r || s, but OpenSSL wants DER.
+    const size_t coordinate_size = 32;
+    if (signature.len != 2 * coordinate_size) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    const unsigned char* raw = (const unsigned char*)signature.ptr;
+    ECDSA_SIG* sig = ECDSA_SIG_new();
+    BIGNUM* r = BN_bin2bn(raw, coordinate_size, NULL);
+    BIGNUM* s = BN_bin2bn(raw + coordinate_size, coordinate_size, NULL);
+    if (sig == nullptr || r == nullptr || s == nullptr || !ECDSA_SIG_set0(sig, r, s)) {
+        BN_free(r);
+        BN_free(s);
+        ECDSA_SIG_free(sig);
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    unsigned char* der = nullptr;
+    int der_length = i2d_ECDSA_SIG(sig, &der);
+    ECDSA_SIG_free(sig);
+    if (der_length <= 0) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+
+    teep_error_code_t result = TEEP_ERR_PERMANENT_ERROR;
+    EVP_PKEY_CTX* pkey_ctx = EVP_PKEY_CTX_new((EVP_PKEY*)key_pair->key.ptr, NULL);
+    if (pkey_ctx != nullptr &&
+        EVP_PKEY_verify_init(pkey_ctx) > 0 &&
+        EVP_PKEY_CTX_set_signature_md(pkey_ctx, EVP_sha256()) > 0 &&
+        EVP_PKEY_verify(pkey_ctx, der, der_length, digest, TEEP_SHA256_SIZE) == 1) {
+        result = TEEP_ERR_SUCCESS;
+    }
+    EVP_PKEY_CTX_free(pkey_ctx);
+    OPENSSL_free(der);
+    return result;
+}
+
 #ifdef TEEP_USE_CERTIFICATES // Currently unused.
 _Ret_writes_bytes_maybenull_(*pCertificateSize)
 const unsigned char* GetDerCertificate(
@@ -19,8 +19,10 @@ typedef oe_uuid_t teep_uuid_t;
 #define _In_reads_(x)
 #define _In_z_
 #define _Inout_
+#define _Inout_opt_
 #define _Out_
 #define _Out_writes_(x)
+#define _Out_writes_bytes_to_(x, y)
 #define _Out_writes_opt_z_(x)
 #define _Ret_writes_bytes_(x)
 #define _Ret_writes_bytes_maybenull_(x)
@@ -90,6 +92,82 @@ teep_verify_cbor_message(
     _In_ const UsefulBufC* signed_cose,
     _Out_ UsefulBufC* encoded);
 
+#define TEEP_SHA256_SIZE 32 // Size in bytes of a SHA-256 digest.
+
+// Compute the SHA-256 digest of a buffer.
+teep_error_code_t
+teep_compute_sha256(
+    _In_ UsefulBufC data,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* digest);
+
+// State of a SHA-256 digest computed over data that arrives in pieces.
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;       // Total number of bytes hashed.
+    uint8_t block[64];     // Bytes not yet compressed.
+    size_t block_length;
+} teep_sha256_ctx_t;
+
+teep_error_code_t teep_sha256_init(_Out_ teep_sha256_ctx_t* ctx);
+teep_error_code_t teep_sha256_update(_Inout_ teep_sha256_ctx_t* ctx, _In_ UsefulBufC data);
+teep_error_code_t teep_sha256_final(_Inout_ teep_sha256_ctx_t* ctx, _Out_writes_(TEEP_SHA256_SIZE) uint8_t* digest);
+void teep_sha256_free(_Inout_ teep_sha256_ctx_t* ctx);
+
+typedef uint8_t teep_sha256_digest_t[TEEP_SHA256_SIZE];
+
+// Compute the HMAC-SHA256 (RFC 2104) of a buffer under a key of at most
+// 64 bytes.
+teep_error_code_t
+teep_hmac_sha256(
+    _In_ UsefulBufC key,
+    _In_ UsefulBufC data,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* mac);
+
+// Compute the SHA-256 digests of many independent buffers, which some
+// engines can do faster than one at a time.
+teep_error_code_t
+teep_compute_sha256_many(
+    _In_reads_(count) const UsefulBufC* data,
+    size_t count,
+    _Out_writes_(count) teep_sha256_digest_t* digests);
+
+// SHA-256 implementations.  By default the fastest one the CPU supports
+// is used.
+typedef enum {
+    TEEP_SHA256_ENGINE_AUTO,
+    TEEP_SHA256_ENGINE_PORTABLE, // Plain C.
+    TEEP_SHA256_ENGINE_SHA_NI,   // x86 SHA extensions.
+    TEEP_SHA256_ENGINE_AVX2,     // Eight buffers at a time; batches only.
+} teep_sha256_engine_t;
+
+int teep_sha256_engine_available(teep_sha256_engine_t engine);
+
+// Force a particular engine, for tests and benchmarks.  Not thread-safe.
+teep_error_code_t teep_sha256_use_engine(teep_sha256_engine_t engine);
+
+// Verify a COSE_Sign1 whose payload is detached, as in a SUIT
+// authentication block.
+teep_error_code_t
+teep_verify_sign1_detached(
+    _In_ const struct t_cose_key* key_pair,
+    _In_ UsefulBufC signed_cose,
+    _In_ UsefulBufC detached_payload);
+
+// Compute the SHA-256 digest of the DER-encoded public key of a key pair,
+// which identifies the key no matter how it was loaded.
+teep_error_code_t
+teep_compute_public_key_digest(
+    _In_ const struct t_cose_key* key_pair,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* digest);
+
+// Verify a raw (r || s) ES256 signature over a SHA-256 digest that the
+// caller has already computed over the COSE Sig_structure.
+teep_error_code_t
+teep_verify_es256_digest(
+    _In_ const struct t_cose_key* key_pair,
+    _In_reads_(TEEP_SHA256_SIZE) const uint8_t* digest,
+    _In_ UsefulBufC signature);
+
 #ifdef __cplusplus
 #include <iostream>
 #include <ostream>
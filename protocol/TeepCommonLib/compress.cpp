@@ -0,0 +1,285 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <memory>
+#include <string.h>
+#include "compress.h"
+
+#define TEEP_COMPRESS_EXTENDED 15
+#define TEEP_COMPRESS_MAX_OFFSET (TEEP_COMPRESS_WINDOW_SIZE - 1)
+#define TEEP_COMPRESS_HASH_BITS 14
+
+typedef enum {
+    TEEP_DECOMPRESS_SIZE,
+    TEEP_DECOMPRESS_TOKEN,
+    TEEP_DECOMPRESS_LITERAL_LENGTH,
+    TEEP_DECOMPRESS_LITERALS,
+    TEEP_DECOMPRESS_OFFSET,
+    TEEP_DECOMPRESS_MATCH_LENGTH,
+} teep_decompress_state_t;
+
+void teep_decompressor_init(
+    _Out_ teep_decompressor_t* decompressor,
+    uint64_t max_size,
+    _In_ teep_decompress_write_t write,
+    _In_opt_ void* context)
+{
+    decompressor->write = write;
+    decompressor->context = context;
+    decompressor->max_size = max_size;
+    decompressor->state = TEEP_DECOMPRESS_SIZE;
+    decompressor->token = 0;
+    decompressor->head_length = 0;
+    decompressor->expected_size = 0;
+    decompressor->output_size = 0;
+    decompressor->literal_length = 0;
+    decompressor->match_length = 0;
+    decompressor->offset = 0;
+}
+
+// Write literals out and keep them in the window.
+static teep_error_code_t teep_decompress_literals(_Inout_ teep_decompressor_t* decompressor, _In_reads_(length) const uint8_t* data, size_t length)
+{
+    teep_error_code_t result = decompressor->write(decompressor->context, UsefulBufC{ data, length });
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    while (length > 0) {
+        size_t start = (size_t)(decompressor->output_size % TEEP_COMPRESS_WINDOW_SIZE);
+        size_t piece = std::min(length, TEEP_COMPRESS_WINDOW_SIZE - start);
+        memcpy(decompressor->window + start, data, piece);
+        decompressor->output_size += piece;
+        data += piece;
+        length -= piece;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+// Copy a match from earlier output.  The source may overlap the bytes
+// being produced, so it is copied a byte at a time.
+static teep_error_code_t teep_decompress_match(_Inout_ teep_decompressor_t* decompressor)
+{
+    uint64_t length = decompressor->match_length;
+    if (length > decompressor->expected_size - decompressor->output_size) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    while (length > 0) {
+        size_t start = (size_t)(decompressor->output_size % TEEP_COMPRESS_WINDOW_SIZE);
+        size_t piece = (size_t)std::min<uint64_t>(length, TEEP_COMPRESS_WINDOW_SIZE - start);
+        for (size_t i = 0; i < piece; i++) {
+            decompressor->window[start + i] = decompressor->window[(start + i - decompressor->offset) % TEEP_COMPRESS_WINDOW_SIZE];
+        }
+        teep_error_code_t result = decompressor->write(decompressor->context, UsefulBufC{ decompressor->window + start, piece });
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+        decompressor->output_size += piece;
+        length -= piece;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t teep_decompress(_Inout_ teep_decompressor_t* decompressor, _In_ UsefulBufC compressed)
+{
+    const uint8_t* data = (const uint8_t*)compressed.ptr;
+    size_t length = compressed.len;
+    while (length > 0) {
+        if (decompressor->state == TEEP_DECOMPRESS_LITERALS) {
+            size_t piece = (size_t)std::min<uint64_t>(length, decompressor->literal_length);
+            teep_error_code_t result = teep_decompress_literals(decompressor, data, piece);
+            if (result != TEEP_ERR_SUCCESS) {
+                return result;
+            }
+            data += piece;
+            length -= piece;
+            decompressor->literal_length -= piece;
+            if (decompressor->literal_length == 0) {
+                decompressor->state = TEEP_DECOMPRESS_OFFSET;
+            }
+            continue;
+        }
+
+        uint8_t byte = *data++;
+        length--;
+        switch (decompressor->state) {
+        case TEEP_DECOMPRESS_SIZE:
+            decompressor->head[decompressor->head_length++] = byte;
+            if (decompressor->head_length < TEEP_COMPRESS_SIZE_PREFIX) {
+                break;
+            }
+            decompressor->head_length = 0;
+            decompressor->expected_size = (uint64_t)decompressor->head[0] | ((uint64_t)decompressor->head[1] << 8) |
+                                          ((uint64_t)decompressor->head[2] << 16) | ((uint64_t)decompressor->head[3] << 24);
+            if (decompressor->expected_size > decompressor->max_size) {
+                return TEEP_ERR_PERMANENT_ERROR;
+            }
+            decompressor->state = TEEP_DECOMPRESS_TOKEN;
+            break;
+        case TEEP_DECOMPRESS_TOKEN:
+            decompressor->token = byte;
+            decompressor->literal_length = byte >> 4;
+            if (decompressor->literal_length == TEEP_COMPRESS_EXTENDED) {
+                decompressor->state = TEEP_DECOMPRESS_LITERAL_LENGTH;
+            } else {
+                decompressor->state = (decompressor->literal_length > 0) ? TEEP_DECOMPRESS_LITERALS : TEEP_DECOMPRESS_OFFSET;
+            }
+            break;
+        case TEEP_DECOMPRESS_LITERAL_LENGTH:
+            decompressor->literal_length += byte;
+            if (byte < 255) {
+                decompressor->state = TEEP_DECOMPRESS_LITERALS;
+            }
+            break;
+        case TEEP_DECOMPRESS_OFFSET:
+            decompressor->head[decompressor->head_length++] = byte;
+            if (decompressor->head_length < 2) {
+                break;
+            }
+            decompressor->head_length = 0;
+            decompressor->offset = (uint16_t)(decompressor->head[0] | (decompressor->head[1] << 8));
+            if (decompressor->offset == 0 || decompressor->offset > decompressor->output_size) {
+                return TEEP_ERR_PERMANENT_ERROR;
+            }
+            decompressor->match_length = (decompressor->token & 0xf) + TEEP_COMPRESS_MIN_MATCH;
+            if ((decompressor->token & 0xf) == TEEP_COMPRESS_EXTENDED) {
+                decompressor->state = TEEP_DECOMPRESS_MATCH_LENGTH;
+                break;
+            }
+            decompressor->state = TEEP_DECOMPRESS_TOKEN;
+            {
+                teep_error_code_t result = teep_decompress_match(decompressor);
+                if (result != TEEP_ERR_SUCCESS) {
+                    return result;
+                }
+            }
+            break;
+        case TEEP_DECOMPRESS_MATCH_LENGTH:
+            decompressor->match_length += byte;
+            if (byte < 255) {
+                decompressor->state = TEEP_DECOMPRESS_TOKEN;
+                teep_error_code_t result = teep_decompress_match(decompressor);
+                if (result != TEEP_ERR_SUCCESS) {
+                    return result;
+                }
+            }
+            break;
+        default:
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+
+        // Literals must fit within the promised size.
+        if (decompressor->state == TEEP_DECOMPRESS_LITERALS &&
+            decompressor->literal_length > decompressor->expected_size - decompressor->output_size) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t teep_decompressor_finish(_In_ const teep_decompressor_t* decompressor)
+{
+    if (decompressor->state != TEEP_DECOMPRESS_OFFSET || decompressor->head_length > 0 ||
+        decompressor->output_size != decompressor->expected_size) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+static teep_error_code_t AppendToVector(void* context, UsefulBufC data)
+{
+    std::vector<uint8_t>* output = (std::vector<uint8_t>*)context;
+    const uint8_t* bytes = (const uint8_t*)data.ptr;
+    output->insert(output->end(), bytes, bytes + data.len);
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t teep_decompress_buffer(_In_ UsefulBufC compressed, uint64_t max_size, _Out_ std::vector<uint8_t>& output)
+{
+    output.clear();
+    std::unique_ptr<teep_decompressor_t> decompressor = std::make_unique<teep_decompressor_t>();
+    teep_decompressor_init(decompressor.get(), max_size, AppendToVector, &output);
+    teep_error_code_t result = teep_decompress(decompressor.get(), compressed);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    return teep_decompressor_finish(decompressor.get());
+}
+
+// Append a length that did not fit in its nibble.
+static void AppendExtendedLength(_Inout_ std::vector<uint8_t>& compressed, uint64_t length)
+{
+    while (length >= 255) {
+        compressed.push_back(255);
+        length -= 255;
+    }
+    compressed.push_back((uint8_t)length);
+}
+
+// Append a sequence; matchLength is 0 for the last one.
+static void AppendSequence(
+    _Inout_ std::vector<uint8_t>& compressed,
+    _In_reads_(literalLength) const uint8_t* literals,
+    uint64_t literalLength,
+    uint16_t offset,
+    uint64_t matchLength)
+{
+    uint64_t matchNibble = (matchLength > 0) ? matchLength - TEEP_COMPRESS_MIN_MATCH : 0;
+    uint8_t token = (uint8_t)(std::min<uint64_t>(literalLength, TEEP_COMPRESS_EXTENDED) << 4) |
+                    (uint8_t)std::min<uint64_t>(matchNibble, TEEP_COMPRESS_EXTENDED);
+    compressed.push_back(token);
+    if (literalLength >= TEEP_COMPRESS_EXTENDED) {
+        AppendExtendedLength(compressed, literalLength - TEEP_COMPRESS_EXTENDED);
+    }
+    compressed.insert(compressed.end(), literals, literals + literalLength);
+    if (matchLength == 0) {
+        return;
+    }
+    compressed.push_back((uint8_t)offset);
+    compressed.push_back((uint8_t)(offset >> 8));
+    if (matchNibble >= TEEP_COMPRESS_EXTENDED) {
+        AppendExtendedLength(compressed, matchNibble - TEEP_COMPRESS_EXTENDED);
+    }
+}
+
+teep_error_code_t teep_compress(_In_ UsefulBufC input, _Out_ std::vector<uint8_t>& compressed)
+{
+    if (input.len > UINT32_MAX) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    const uint8_t* in = (const uint8_t*)input.ptr;
+    compressed.clear();
+    compressed.reserve(TEEP_COMPRESS_SIZE_PREFIX + input.len / 2);
+    for (int i = 0; i < TEEP_COMPRESS_SIZE_PREFIX; i++) {
+        compressed.push_back((uint8_t)(input.len >> (8 * i)));
+    }
+
+    // Remember the last position (plus one) at which each hash of
+    // TEEP_COMPRESS_MIN_MATCH bytes was seen.
+    std::vector<uint32_t> positions((size_t)1 << TEEP_COMPRESS_HASH_BITS, 0);
+
+    size_t literal = 0; // Start of the input not yet emitted.
+    size_t position = 0;
+    while (position + TEEP_COMPRESS_MIN_MATCH <= input.len) {
+        uint32_t sequence;
+        memcpy(&sequence, in + position, sizeof(sequence));
+        uint32_t hash = (sequence * 2654435761u) >> (32 - TEEP_COMPRESS_HASH_BITS);
+        size_t candidate = positions[hash];
+        positions[hash] = (uint32_t)(position + 1);
+        if (candidate == 0 || position - (candidate - 1) > TEEP_COMPRESS_MAX_OFFSET ||
+            memcmp(in + candidate - 1, in + position, TEEP_COMPRESS_MIN_MATCH) != 0) {
+            position++;
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t length = TEEP_COMPRESS_MIN_MATCH;
+        while (position + length < input.len && in[match + length] == in[position + length]) {
+            length++;
+        }
+        AppendSequence(compressed, in + literal, position - literal, (uint16_t)(position - match), length);
+        position += length;
+        literal = position;
+    }
+    AppendSequence(compressed, in + literal, input.len - literal, 0, 0);
+    return TEEP_ERR_SUCCESS;
+}
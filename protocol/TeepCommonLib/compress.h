@@ -0,0 +1,59 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "common.h"
+
+// A compressed buffer is the 32-bit little-endian size of the original
+// followed by LZ4-style sequences.  Each sequence is a token byte whose
+// high nibble is a literal count and low nibble a match length less
+// TEEP_COMPRESS_MIN_MATCH, then the literals, a 16-bit little-endian
+// offset back into the output, and the match.  A nibble of 15 is extended
+// by bytes that follow it (after the token for literals, after the offset
+// for matches), each added on until one is less than 255.  The last
+// sequence stops after its literals.
+#define TEEP_COMPRESS_SIZE_PREFIX 4
+#define TEEP_COMPRESS_MIN_MATCH 4
+#define TEEP_COMPRESS_WINDOW_SIZE 65536
+
+typedef teep_error_code_t (*teep_decompress_write_t)(void* context, UsefulBufC data);
+
+// Decompresses a buffer that arrives in pieces of any size, handing the
+// output to a callback.  The last TEEP_COMPRESS_WINDOW_SIZE bytes of
+// output are kept for matches to copy from.
+typedef struct {
+    teep_decompress_write_t write;
+    void* context;
+    uint64_t max_size;
+    int state;
+    uint8_t token;
+    uint8_t head[TEEP_COMPRESS_SIZE_PREFIX]; // Size prefix or offset so far.
+    size_t head_length;
+    uint64_t expected_size;
+    uint64_t output_size;
+    uint64_t literal_length;
+    uint64_t match_length;
+    uint16_t offset;
+    uint8_t window[TEEP_COMPRESS_WINDOW_SIZE];
+} teep_decompressor_t;
+
+// Output larger than max_size is rejected before any of it is written.
+void teep_decompressor_init(
+    _Out_ teep_decompressor_t* decompressor,
+    uint64_t max_size,
+    _In_ teep_decompress_write_t write,
+    _In_opt_ void* context);
+teep_error_code_t teep_decompress(_Inout_ teep_decompressor_t* decompressor, _In_ UsefulBufC compressed);
+
+// Check that the input ended after the last sequence and produced
+// exactly the size it promised.
+teep_error_code_t teep_decompressor_finish(_In_ const teep_decompressor_t* decompressor);
+
+#ifdef __cplusplus
+#include <vector>
+
+// Compress a buffer of at most UINT32_MAX bytes.
+teep_error_code_t teep_compress(_In_ UsefulBufC input, _Out_ std::vector<uint8_t>& compressed);
+
+// Decompress a buffer that is held in memory all at once.
+teep_error_code_t teep_decompress_buffer(_In_ UsefulBufC compressed, uint64_t max_size, _Out_ std::vector<uint8_t>& output);
+#endif
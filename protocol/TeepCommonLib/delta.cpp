@@ -0,0 +1,229 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <string.h>
+#include <unordered_map>
+#include "delta.h"
+
+static uint32_t GetLittleEndian32(_In_reads_(4) const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t GetLittleEndian64(_In_reads_(8) const uint8_t* p)
+{
+    return (uint64_t)GetLittleEndian32(p) | ((uint64_t)GetLittleEndian32(p + 4) << 32);
+}
+
+void teep_delta_decoder_init(
+    _Out_ teep_delta_decoder_t* decoder,
+    uint64_t base_size,
+    _In_ teep_delta_read_base_t read_base,
+    _In_ teep_delta_write_t write,
+    _In_opt_ void* context)
+{
+    decoder->base_size = base_size;
+    decoder->read_base = read_base;
+    decoder->write = write;
+    decoder->context = context;
+    decoder->head_length = 0;
+    decoder->have_magic = 0;
+    decoder->insert_remaining = 0;
+}
+
+// Carry out a copy instruction whose head has been collected.
+static teep_error_code_t teep_delta_copy(_Inout_ teep_delta_decoder_t* decoder, uint64_t offset, uint32_t length)
+{
+    if (offset > decoder->base_size || length > decoder->base_size - offset) {
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    while (length > 0) {
+        size_t piece = std::min<size_t>(length, sizeof(decoder->copy_buffer));
+        teep_error_code_t result = decoder->read_base(decoder->context, offset, UsefulBuf{ decoder->copy_buffer, piece });
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+        result = decoder->write(decoder->context, UsefulBufC{ decoder->copy_buffer, piece });
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+        offset += piece;
+        length -= (uint32_t)piece;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t teep_delta_decode(_Inout_ teep_delta_decoder_t* decoder, _In_ UsefulBufC delta)
+{
+    const uint8_t* data = (const uint8_t*)delta.ptr;
+    size_t length = delta.len;
+    while (length > 0) {
+        if (!decoder->have_magic) {
+            size_t piece = std::min(length, TEEP_DELTA_MAGIC_SIZE - decoder->head_length);
+            memcpy(decoder->head + decoder->head_length, data, piece);
+            decoder->head_length += piece;
+            data += piece;
+            length -= piece;
+            if (decoder->head_length == TEEP_DELTA_MAGIC_SIZE) {
+                if (memcmp(decoder->head, TEEP_DELTA_MAGIC, TEEP_DELTA_MAGIC_SIZE) != 0) {
+                    return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+                }
+                decoder->have_magic = 1;
+                decoder->head_length = 0;
+            }
+            continue;
+        }
+
+        if (decoder->insert_remaining > 0) {
+            size_t piece = (size_t)std::min<uint64_t>(length, decoder->insert_remaining);
+            teep_error_code_t result = decoder->write(decoder->context, UsefulBufC{ data, piece });
+            if (result != TEEP_ERR_SUCCESS) {
+                return result;
+            }
+            decoder->insert_remaining -= piece;
+            data += piece;
+            length -= piece;
+            continue;
+        }
+
+        // Collect the next instruction head a byte at a time.
+        uint8_t opcode = (decoder->head_length > 0) ? decoder->head[0] : *data;
+        size_t headSize;
+        if (opcode == TEEP_DELTA_COPY) {
+            headSize = 13;
+        } else if (opcode == TEEP_DELTA_INSERT) {
+            headSize = 5;
+        } else {
+            return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+        }
+        decoder->head[decoder->head_length++] = *data++;
+        length--;
+        if (decoder->head_length < headSize) {
+            continue;
+        }
+        decoder->head_length = 0;
+
+        uint32_t instructionLength = GetLittleEndian32(decoder->head + 1);
+        if (opcode == TEEP_DELTA_INSERT) {
+            decoder->insert_remaining = instructionLength;
+        } else {
+            teep_error_code_t result = teep_delta_copy(decoder, GetLittleEndian64(decoder->head + 5), instructionLength);
+            if (result != TEEP_ERR_SUCCESS) {
+                return result;
+            }
+        }
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t teep_delta_decoder_finish(_In_ const teep_delta_decoder_t* decoder)
+{
+    if (!decoder->have_magic || decoder->head_length > 0 || decoder->insert_remaining > 0) {
+        return TEEP_ERR_MANIFEST_PROCESSING_FAILED;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+static void AppendInstruction(_Inout_ std::vector<uint8_t>& delta, teep_delta_opcode_t opcode, uint32_t length)
+{
+    delta.push_back((uint8_t)opcode);
+    for (int i = 0; i < 4; i++) {
+        delta.push_back((uint8_t)(length >> (8 * i)));
+    }
+}
+
+static void AppendInsert(_Inout_ std::vector<uint8_t>& delta, _In_reads_(length) const uint8_t* data, uint64_t length)
+{
+    while (length > 0) {
+        uint32_t piece = (uint32_t)std::min<uint64_t>(length, UINT32_MAX);
+        AppendInstruction(delta, TEEP_DELTA_INSERT, piece);
+        delta.insert(delta.end(), data, data + piece);
+        data += piece;
+        length -= piece;
+    }
+}
+
+static void AppendCopy(_Inout_ std::vector<uint8_t>& delta, uint64_t offset, uint64_t length)
+{
+    while (length > 0) {
+        uint32_t piece = (uint32_t)std::min<uint64_t>(length, UINT32_MAX);
+        AppendInstruction(delta, TEEP_DELTA_COPY, piece);
+        for (int i = 0; i < 8; i++) {
+            delta.push_back((uint8_t)(offset >> (8 * i)));
+        }
+        offset += piece;
+        length -= piece;
+    }
+}
+
+// Polynomial hash of a block, which can be rolled forward a byte at a time.
+#define TEEP_DELTA_HASH_MULTIPLIER 0x100000001b3ull
+
+static uint64_t HashBlock(_In_reads_(TEEP_DELTA_BLOCK_SIZE) const uint8_t* block)
+{
+    uint64_t hash = 0;
+    for (size_t i = 0; i < TEEP_DELTA_BLOCK_SIZE; i++) {
+        hash = hash * TEEP_DELTA_HASH_MULTIPLIER + block[i];
+    }
+    return hash;
+}
+
+teep_error_code_t teep_delta_encode(_In_ UsefulBufC base, _In_ UsefulBufC target, _Out_ std::vector<uint8_t>& delta)
+{
+    const uint8_t* b = (const uint8_t*)base.ptr;
+    const uint8_t* t = (const uint8_t*)target.ptr;
+    delta.assign(TEEP_DELTA_MAGIC, TEEP_DELTA_MAGIC + TEEP_DELTA_MAGIC_SIZE);
+
+    // Index the base by the hash of each aligned block, keeping the first
+    // offset for blocks that repeat.
+    std::unordered_map<uint64_t, uint64_t> blocks;
+    blocks.reserve(base.len / TEEP_DELTA_BLOCK_SIZE);
+    for (uint64_t offset = 0; offset + TEEP_DELTA_BLOCK_SIZE <= base.len; offset += TEEP_DELTA_BLOCK_SIZE) {
+        blocks.emplace(HashBlock(b + offset), offset);
+    }
+
+    // Weight of the byte that leaves the window when the hash is rolled.
+    uint64_t outgoingWeight = 1;
+    for (size_t i = 1; i < TEEP_DELTA_BLOCK_SIZE; i++) {
+        outgoingWeight *= TEEP_DELTA_HASH_MULTIPLIER;
+    }
+
+    // Look for a base block at every offset of the target.
+    uint64_t literal = 0; // Start of the target bytes not yet emitted.
+    uint64_t position = 0;
+    uint64_t hash = 0;
+    bool haveHash = false;
+    while (position + TEEP_DELTA_BLOCK_SIZE <= target.len) {
+        if (!haveHash) {
+            hash = HashBlock(t + position);
+            haveHash = true;
+        }
+        auto found = blocks.find(hash);
+        if (found != blocks.end() && memcmp(b + found->second, t + position, TEEP_DELTA_BLOCK_SIZE) == 0) {
+            // Grow the match in both directions.
+            uint64_t baseStart = found->second;
+            uint64_t targetStart = position;
+            while (targetStart > literal && baseStart > 0 && b[baseStart - 1] == t[targetStart - 1]) {
+                baseStart--;
+                targetStart--;
+            }
+            uint64_t baseEnd = found->second + TEEP_DELTA_BLOCK_SIZE;
+            uint64_t targetEnd = position + TEEP_DELTA_BLOCK_SIZE;
+            while (targetEnd < target.len && baseEnd < base.len && b[baseEnd] == t[targetEnd]) {
+                baseEnd++;
+                targetEnd++;
+            }
+            AppendInsert(delta, t + literal, targetStart - literal);
+            AppendCopy(delta, baseStart, targetEnd - targetStart);
+            literal = position = targetEnd;
+            haveHash = false;
+            continue;
+        }
+        if (position + TEEP_DELTA_BLOCK_SIZE < target.len) {
+            hash = (hash - t[position] * outgoingWeight) * TEEP_DELTA_HASH_MULTIPLIER + t[position + TEEP_DELTA_BLOCK_SIZE];
+        }
+        position++;
+    }
+    AppendInsert(delta, t + literal, target.len - literal);
+    return TEEP_ERR_SUCCESS;
+}
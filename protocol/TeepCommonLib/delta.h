@@ -0,0 +1,56 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "common.h"
+
+// A binary delta rebuilds a target image from a base image that the
+// device already has.  It is the magic "TDL1" followed by instructions,
+// each a one-byte opcode and a 32-bit little-endian length:
+//   TEEP_DELTA_COPY:   then a 64-bit little-endian offset into the base;
+//                      copies length bytes of the base from there.
+//   TEEP_DELTA_INSERT: then length bytes that are output as they are.
+#define TEEP_DELTA_MAGIC "TDL1"
+#define TEEP_DELTA_MAGIC_SIZE 4
+#define TEEP_DELTA_MAX_HEAD_SIZE 13
+
+typedef enum {
+    TEEP_DELTA_COPY = 1,
+    TEEP_DELTA_INSERT = 2,
+} teep_delta_opcode_t;
+
+typedef teep_error_code_t (*teep_delta_read_base_t)(void* context, uint64_t offset, UsefulBuf buffer);
+typedef teep_error_code_t (*teep_delta_write_t)(void* context, UsefulBufC data);
+
+// Applies a delta that arrives in pieces of any size, reading the base
+// and writing the target through the given callbacks.
+typedef struct {
+    uint64_t base_size;
+    teep_delta_read_base_t read_base;
+    teep_delta_write_t write;
+    void* context;
+    uint8_t head[TEEP_DELTA_MAX_HEAD_SIZE]; // Magic or instruction head so far.
+    size_t head_length;
+    int have_magic;
+    uint64_t insert_remaining; // Literal bytes still to come.
+    uint8_t copy_buffer[8192];
+} teep_delta_decoder_t;
+
+void teep_delta_decoder_init(
+    _Out_ teep_delta_decoder_t* decoder,
+    uint64_t base_size,
+    _In_ teep_delta_read_base_t read_base,
+    _In_ teep_delta_write_t write,
+    _In_opt_ void* context);
+teep_error_code_t teep_delta_decode(_Inout_ teep_delta_decoder_t* decoder, _In_ UsefulBufC delta);
+
+// Check that the delta did not end in the middle of an instruction.
+teep_error_code_t teep_delta_decoder_finish(_In_ const teep_delta_decoder_t* decoder);
+
+#ifdef __cplusplus
+#include <vector>
+
+// Compute a delta that rebuilds target from base.  Runs of at least
+// TEEP_DELTA_BLOCK_SIZE bytes that also appear in base are copied.
+#define TEEP_DELTA_BLOCK_SIZE 32
+teep_error_code_t teep_delta_encode(_In_ UsefulBufC base, _In_ UsefulBufC target, _Out_ std::vector<uint8_t>& delta);
+#endif
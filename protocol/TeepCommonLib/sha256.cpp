@@ -0,0 +1,601 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+//
+// SHA-256 used for SUIT digests and content addressing.  The block function
+// is picked once at run time from what the CPU supports: the x86 SHA
+// extensions when present, otherwise portable C.  Batches of independent
+// buffers can instead be hashed eight at a time with AVX2.
+#include <string.h>
+#include "common.h"
+
+#if (defined(_M_X64) || defined(__x86_64__)) && !defined(OE_BUILD_ENCLAVE)
+// CPUID is not usable inside an SGX enclave, so enclaves only get the
+// portable code.
+#define TEEP_SHA256_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TEEP_TARGET(x)
+#else
+#include <cpuid.h>
+#define TEEP_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_LANES 8 // Buffers hashed together by the AVX2 engine.
+
+typedef void (*sha256_blocks_function_t)(uint32_t state[8], const uint8_t* data, size_t blocks);
+
+static const uint32_t sha256_initial_state[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t load_be32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void store_be32(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+static inline uint32_t rotr32(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_blocks_portable(uint32_t state[8], const uint8_t* data, size_t blocks)
+{
+    uint32_t w[64];
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+        for (int t = 0; t < 16; t++) {
+            w[t] = load_be32(data + 4 * t);
+        }
+        for (int t = 16; t < 64; t++) {
+            uint32_t s0 = rotr32(w[t - 15], 7) ^ rotr32(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = rotr32(w[t - 2], 17) ^ rotr32(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int t = 0; t < 64; t++) {
+            uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[t] + w[t];
+            uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef TEEP_SHA256_X86
+static void cpuid(int leaf, int subleaf, int registers[4])
+{
+#ifdef _MSC_VER
+    __cpuidex(registers, leaf, subleaf);
+#else
+    unsigned int eax, ebx, ecx, edx;
+    __cpuid_count(leaf, subleaf, eax, ebx, ecx, edx);
+    registers[0] = (int)eax;
+    registers[1] = (int)ebx;
+    registers[2] = (int)ecx;
+    registers[3] = (int)edx;
+#endif
+}
+
+// Returns the XCR0 register, which says which register state the OS saves.
+static uint64_t read_xcr0(void)
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static bool cpu_has_sha_ni(void)
+{
+    int registers[4];
+    cpuid(0, 0, registers);
+    if (registers[0] < 7) {
+        return false;
+    }
+    cpuid(1, 0, registers);
+    bool ssse3 = (registers[2] & (1 << 9)) != 0;
+    bool sse41 = (registers[2] & (1 << 19)) != 0;
+    cpuid(7, 0, registers);
+    bool sha = (registers[1] & (1 << 29)) != 0;
+    return ssse3 && sse41 && sha;
+}
+
+static bool cpu_has_avx2(void)
+{
+    int registers[4];
+    cpuid(0, 0, registers);
+    if (registers[0] < 7) {
+        return false;
+    }
+    cpuid(1, 0, registers);
+    bool osxsave = (registers[2] & (1 << 27)) != 0;
+    bool avx = (registers[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (read_xcr0() & 0x6) != 0x6) {
+        return false;
+    }
+    cpuid(7, 0, registers);
+    return (registers[1] & (1 << 5)) != 0;
+}
+
+// Four rounds using the SHA extensions.  x0 holds the next four message
+// words; for rounds 16 and up it is first derived from the previous 16.
+#define SHA_NI_SCHEDULE(x0, x1, x2, x3) \
+    x0 = _mm_sha256msg1_epu32(x0, x1); \
+    x0 = _mm_add_epi32(x0, _mm_alignr_epi8(x3, x2, 4)); \
+    x0 = _mm_sha256msg2_epu32(x0, x3)
+
+#define SHA_NI_ROUNDS(x0, t) \
+    msg = _mm_add_epi32(x0, _mm_loadu_si128((const __m128i*)&sha256_k[t])); \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+    msg = _mm_shuffle_epi32(msg, 0x0e); \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg)
+
+TEEP_TARGET("sha,ssse3,sse4.1")
+static void sha256_blocks_sha_ni(uint32_t state[8], const uint8_t* data, size_t blocks)
+{
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // The SHA instructions keep the state as ABEF and CDGH.
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xb1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1b);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+        __m128i saved0 = state0;
+        __m128i saved1 = state1;
+        __m128i msg;
+        __m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), byte_swap);
+        __m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), byte_swap);
+        __m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), byte_swap);
+        __m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), byte_swap);
+
+        SHA_NI_ROUNDS(x0, 0);
+        SHA_NI_ROUNDS(x1, 4);
+        SHA_NI_ROUNDS(x2, 8);
+        SHA_NI_ROUNDS(x3, 12);
+        for (int t = 16; t < 64; t += 16) {
+            SHA_NI_SCHEDULE(x0, x1, x2, x3);
+            SHA_NI_ROUNDS(x0, t);
+            SHA_NI_SCHEDULE(x1, x2, x3, x0);
+            SHA_NI_ROUNDS(x1, t + 4);
+            SHA_NI_SCHEDULE(x2, x3, x0, x1);
+            SHA_NI_ROUNDS(x2, t + 8);
+            SHA_NI_SCHEDULE(x3, x0, x1, x2);
+            SHA_NI_ROUNDS(x3, t + 12);
+        }
+
+        state0 = _mm_add_epi32(state0, saved0);
+        state1 = _mm_add_epi32(state1, saved1);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+// Padded message fed to one lane of the AVX2 engine: the whole blocks
+// straight from the caller's buffer, then one or two blocks holding the
+// remaining bytes and the padding.
+typedef struct {
+    const uint8_t* data;
+    size_t full_blocks;
+    size_t tail_blocks;
+    size_t next_block;
+    uint8_t tail[2 * SHA256_BLOCK_SIZE];
+} sha256_padded_message_t;
+
+static void sha256_pad_message(_In_ UsefulBufC data, _Out_ sha256_padded_message_t* message)
+{
+    size_t remainder = data.len % SHA256_BLOCK_SIZE;
+    message->data = (const uint8_t*)data.ptr;
+    message->full_blocks = data.len / SHA256_BLOCK_SIZE;
+    message->tail_blocks = (remainder + 9 <= SHA256_BLOCK_SIZE) ? 1 : 2;
+    message->next_block = 0;
+
+    size_t tail_length = message->tail_blocks * SHA256_BLOCK_SIZE;
+    memset(message->tail, 0, tail_length);
+    if (remainder > 0) {
+        memcpy(message->tail, message->data + message->full_blocks * SHA256_BLOCK_SIZE, remainder);
+    }
+    message->tail[remainder] = 0x80;
+    uint64_t bits = (uint64_t)data.len * 8;
+    store_be32(message->tail + tail_length - 8, (uint32_t)(bits >> 32));
+    store_be32(message->tail + tail_length - 4, (uint32_t)bits);
+}
+
+static const uint8_t* sha256_next_block(_Inout_ sha256_padded_message_t* message)
+{
+    size_t block = message->next_block++;
+    if (block < message->full_blocks) {
+        return message->data + block * SHA256_BLOCK_SIZE;
+    }
+    return message->tail + (block - message->full_blocks) * SHA256_BLOCK_SIZE;
+}
+
+static bool sha256_is_done(_In_ const sha256_padded_message_t* message)
+{
+    return message->next_block == message->full_blocks + message->tail_blocks;
+}
+
+#define AVX2_ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+// Compress one block in each of eight lanes.  state[i] holds word i of
+// every lane's state.
+TEEP_TARGET("avx2")
+static void sha256_block_avx2(__m256i state[8], const uint8_t* blocks[SHA256_LANES])
+{
+    const __m256i byte_swap = _mm256_set_epi8(
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i w[16];
+
+    // Transpose each half of the eight blocks so that w[t] holds message
+    // word t of every lane.
+    for (int half = 0; half < 2; half++) {
+        __m256i r[SHA256_LANES];
+        for (int lane = 0; lane < SHA256_LANES; lane++) {
+            r[lane] = _mm256_loadu_si256((const __m256i*)(blocks[lane] + 32 * half));
+        }
+        __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+        __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+        __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+        __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+        __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+        __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+        __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+        __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+        __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+        __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+        __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+        __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+        __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+        __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+        __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+        __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+        __m256i* out = &w[8 * half];
+        out[0] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x20), byte_swap);
+        out[1] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x20), byte_swap);
+        out[2] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x20), byte_swap);
+        out[3] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x20), byte_swap);
+        out[4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x31), byte_swap);
+        out[5] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x31), byte_swap);
+        out[6] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x31), byte_swap);
+        out[7] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x31), byte_swap);
+    }
+
+    __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+    __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int t = 0; t < 64; t++) {
+        __m256i wt;
+        if (t < 16) {
+            wt = w[t];
+        } else {
+            __m256i w15 = w[(t - 15) & 15];
+            __m256i w2 = w[(t - 2) & 15];
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(w15, 7), AVX2_ROTR(w15, 18)), _mm256_srli_epi32(w15, 3));
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(w2, 17), AVX2_ROTR(w2, 19)), _mm256_srli_epi32(w2, 10));
+            wt = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+            w[t & 15] = wt;
+        }
+        __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(e, 6), AVX2_ROTR(e, 11)), AVX2_ROTR(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, s1), _mm256_add_epi32(ch, _mm256_add_epi32(wt, _mm256_set1_epi32((int)sha256_k[t]))));
+        __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(a, 2), AVX2_ROTR(a, 13)), AVX2_ROTR(a, 22));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        __m256i t2 = _mm256_add_epi32(s0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, t2);
+    }
+    state[0] = _mm256_add_epi32(state[0], a);
+    state[1] = _mm256_add_epi32(state[1], b);
+    state[2] = _mm256_add_epi32(state[2], c);
+    state[3] = _mm256_add_epi32(state[3], d);
+    state[4] = _mm256_add_epi32(state[4], e);
+    state[5] = _mm256_add_epi32(state[5], f);
+    state[6] = _mm256_add_epi32(state[6], g);
+    state[7] = _mm256_add_epi32(state[7], h);
+}
+
+// Hash each buffer in eight lanes.  A lane that finishes its buffer picks
+// up the next one, so buffers of different sizes keep all lanes busy
+// until the queue runs dry.
+TEEP_TARGET("avx2")
+static void sha256_many_avx2(
+    _In_reads_(count) const UsefulBufC* data,
+    size_t count,
+    _Out_writes_(count) teep_sha256_digest_t* digests)
+{
+    static const uint8_t idle_block[SHA256_BLOCK_SIZE] = { 0 };
+    sha256_padded_message_t messages[SHA256_LANES];
+    size_t message_index[SHA256_LANES];
+    bool active[SHA256_LANES];
+    alignas(32) uint32_t lane_state[8][SHA256_LANES];
+    size_t next = 0;
+
+    for (int lane = 0; lane < SHA256_LANES; lane++) {
+        active[lane] = false;
+        for (int i = 0; i < 8; i++) {
+            lane_state[i][lane] = 0;
+        }
+    }
+
+    for (;;) {
+        const uint8_t* blocks[SHA256_LANES];
+        bool any_active = false;
+        for (int lane = 0; lane < SHA256_LANES; lane++) {
+            if (!active[lane] && next < count) {
+                sha256_pad_message(data[next], &messages[lane]);
+                message_index[lane] = next++;
+                for (int i = 0; i < 8; i++) {
+                    lane_state[i][lane] = sha256_initial_state[i];
+                }
+                active[lane] = true;
+            }
+            blocks[lane] = active[lane] ? sha256_next_block(&messages[lane]) : idle_block;
+            any_active = any_active || active[lane];
+        }
+        if (!any_active) {
+            break;
+        }
+
+        __m256i state[8];
+        for (int i = 0; i < 8; i++) {
+            state[i] = _mm256_load_si256((const __m256i*)lane_state[i]);
+        }
+        sha256_block_avx2(state, blocks);
+        for (int i = 0; i < 8; i++) {
+            _mm256_store_si256((__m256i*)lane_state[i], state[i]);
+        }
+
+        for (int lane = 0; lane < SHA256_LANES; lane++) {
+            if (active[lane] && sha256_is_done(&messages[lane])) {
+                for (int i = 0; i < 8; i++) {
+                    store_be32(digests[message_index[lane]] + 4 * i, lane_state[i][lane]);
+                }
+                active[lane] = false;
+            }
+        }
+    }
+}
+#endif
+
+static bool sha256_engine_is_available(teep_sha256_engine_t engine)
+{
+    switch (engine) {
+    case TEEP_SHA256_ENGINE_AUTO:
+    case TEEP_SHA256_ENGINE_PORTABLE:
+        return true;
+#ifdef TEEP_SHA256_X86
+    case TEEP_SHA256_ENGINE_SHA_NI:
+        return cpu_has_sha_ni();
+    case TEEP_SHA256_ENGINE_AVX2:
+        return cpu_has_avx2();
+#endif
+    default:
+        return false;
+    }
+}
+
+// Engines in use.  The AVX2 engine only helps batches, so single buffers
+// then use the portable code.
+static struct sha256_dispatch_t {
+    sha256_blocks_function_t blocks;
+    teep_sha256_engine_t batch_engine;
+
+    sha256_dispatch_t() { select(TEEP_SHA256_ENGINE_AUTO); }
+
+    void select(teep_sha256_engine_t engine)
+    {
+        if (engine == TEEP_SHA256_ENGINE_AUTO) {
+            // The SHA extensions beat eight AVX2 lanes on every CPU that has both.
+            engine = sha256_engine_is_available(TEEP_SHA256_ENGINE_SHA_NI) ? TEEP_SHA256_ENGINE_SHA_NI :
+                     sha256_engine_is_available(TEEP_SHA256_ENGINE_AVX2) ? TEEP_SHA256_ENGINE_AVX2 :
+                     TEEP_SHA256_ENGINE_PORTABLE;
+        }
+        batch_engine = engine;
+        blocks = sha256_blocks_portable;
+#ifdef TEEP_SHA256_X86
+        if (engine == TEEP_SHA256_ENGINE_SHA_NI) {
+            blocks = sha256_blocks_sha_ni;
+        }
+#endif
+    }
+} g_sha256_dispatch;
+
+teep_error_code_t teep_sha256_use_engine(teep_sha256_engine_t engine)
+{
+    if (!sha256_engine_is_available(engine)) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    g_sha256_dispatch.select(engine);
+    return TEEP_ERR_SUCCESS;
+}
+
+int teep_sha256_engine_available(teep_sha256_engine_t engine)
+{
+    return sha256_engine_is_available(engine);
+}
+
+teep_error_code_t teep_sha256_init(_Out_ teep_sha256_ctx_t* ctx)
+{
+    memcpy(ctx->state, sha256_initial_state, sizeof(ctx->state));
+    ctx->length = 0;
+    ctx->block_length = 0;
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t teep_sha256_update(_Inout_ teep_sha256_ctx_t* ctx, _In_ UsefulBufC data)
+{
+    const uint8_t* p = (const uint8_t*)data.ptr;
+    size_t length = data.len;
+    ctx->length += length;
+
+    if (ctx->block_length > 0) {
+        size_t needed = SHA256_BLOCK_SIZE - ctx->block_length;
+        size_t copy = (length < needed) ? length : needed;
+        memcpy(ctx->block + ctx->block_length, p, copy);
+        ctx->block_length += copy;
+        p += copy;
+        length -= copy;
+        if (ctx->block_length < SHA256_BLOCK_SIZE) {
+            return TEEP_ERR_SUCCESS;
+        }
+        g_sha256_dispatch.blocks(ctx->state, ctx->block, 1);
+        ctx->block_length = 0;
+    }
+
+    size_t blocks = length / SHA256_BLOCK_SIZE;
+    if (blocks > 0) {
+        g_sha256_dispatch.blocks(ctx->state, p, blocks);
+        p += blocks * SHA256_BLOCK_SIZE;
+        length -= blocks * SHA256_BLOCK_SIZE;
+    }
+    if (length > 0) {
+        memcpy(ctx->block, p, length);
+        ctx->block_length = length;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t teep_sha256_final(_Inout_ teep_sha256_ctx_t* ctx, _Out_writes_(TEEP_SHA256_SIZE) uint8_t* digest)
+{
+    uint64_t bits = ctx->length * 8;
+    ctx->block[ctx->block_length++] = 0x80;
+    if (ctx->block_length > SHA256_BLOCK_SIZE - 8) {
+        memset(ctx->block + ctx->block_length, 0, SHA256_BLOCK_SIZE - ctx->block_length);
+        g_sha256_dispatch.blocks(ctx->state, ctx->block, 1);
+        ctx->block_length = 0;
+    }
+    memset(ctx->block + ctx->block_length, 0, SHA256_BLOCK_SIZE - 8 - ctx->block_length);
+    store_be32(ctx->block + SHA256_BLOCK_SIZE - 8, (uint32_t)(bits >> 32));
+    store_be32(ctx->block + SHA256_BLOCK_SIZE - 4, (uint32_t)bits);
+    g_sha256_dispatch.blocks(ctx->state, ctx->block, 1);
+
+    for (int i = 0; i < 8; i++) {
+        store_be32(digest + 4 * i, ctx->state[i]);
+    }
+    ctx->block_length = 0;
+    return TEEP_ERR_SUCCESS;
+}
+
+void teep_sha256_free(_Inout_ teep_sha256_ctx_t* ctx)
+{
+    // Nothing is allocated, but don't leave intermediate state behind.
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+teep_error_code_t
+teep_compute_sha256(
+    _In_ UsefulBufC data,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* digest)
+{
+    teep_sha256_ctx_t ctx;
+    teep_sha256_init(&ctx);
+    teep_sha256_update(&ctx, data);
+    teep_sha256_final(&ctx, digest);
+    teep_sha256_free(&ctx);
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t
+teep_hmac_sha256(
+    _In_ UsefulBufC key,
+    _In_ UsefulBufC data,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* mac)
+{
+    if (key.len > SHA256_BLOCK_SIZE) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    uint8_t pad[SHA256_BLOCK_SIZE];
+    uint8_t innerDigest[TEEP_SHA256_SIZE];
+    teep_sha256_ctx_t ctx;
+
+    memset(pad, 0x36, sizeof(pad));
+    for (size_t i = 0; i < key.len; i++) {
+        pad[i] ^= ((const uint8_t*)key.ptr)[i];
+    }
+    teep_sha256_init(&ctx);
+    teep_sha256_update(&ctx, { pad, sizeof(pad) });
+    teep_sha256_update(&ctx, data);
+    teep_sha256_final(&ctx, innerDigest);
+
+    memset(pad, 0x5c, sizeof(pad));
+    for (size_t i = 0; i < key.len; i++) {
+        pad[i] ^= ((const uint8_t*)key.ptr)[i];
+    }
+    teep_sha256_init(&ctx);
+    teep_sha256_update(&ctx, { pad, sizeof(pad) });
+    teep_sha256_update(&ctx, { innerDigest, sizeof(innerDigest) });
+    teep_sha256_final(&ctx, mac);
+    teep_sha256_free(&ctx);
+    memset(pad, 0, sizeof(pad));
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t
+teep_compute_sha256_many(
+    _In_reads_(count) const UsefulBufC* data,
+    size_t count,
+    _Out_writes_(count) teep_sha256_digest_t* digests)
+{
+#ifdef TEEP_SHA256_X86
+    if (g_sha256_dispatch.batch_engine == TEEP_SHA256_ENGINE_AVX2 && count > 1) {
+        sha256_many_avx2(data, count, digests);
+        return TEEP_ERR_SUCCESS;
+    }
+#endif
+    for (size_t i = 0; i < count; i++) {
+        teep_compute_sha256(data[i], digests[i]);
+    }
+    return TEEP_ERR_SUCCESS;
+}
@@ -8,7 +8,12 @@
 typedef enum {
     SUIT_ENVELOPE_LABEL_DELEGATION = 1,
     SUIT_ENVELOPE_LABEL_AUTHENTICATION_WRAPPER = 2,
-    SUIT_ENVELOPE_LABEL_MANIFEST = 3
+    SUIT_ENVELOPE_LABEL_MANIFEST = 3,
+
+    // Severable members, whose digests stay in the manifest.
+    SUIT_ENVELOPE_LABEL_PAYLOAD_FETCH = 16,
+    SUIT_ENVELOPE_LABEL_INSTALL = 17,
+    SUIT_ENVELOPE_LABEL_TEXT = 23,
 } suit_envelope_label_t;
 
 typedef enum {
@@ -20,12 +25,50 @@ typedef enum {
     SUIT_MANIFEST_LABEL_VALIDATE = 7,
     SUIT_MANIFEST_LABEL_LOAD = 8,
     SUIT_MANIFEST_LABEL_INVOKE = 9,
+    SUIT_MANIFEST_LABEL_PAYLOAD_FETCH = 16,
+    SUIT_MANIFEST_LABEL_INSTALL = 17,
+    SUIT_MANIFEST_LABEL_TEXT = 23,
 } suit_manifest_label_t;
 
 typedef enum {
+    // {+ component index => SUIT_Dependency_Metadata}, as in
+    // draft-ietf-suit-trust-domains.  Each indexed component is
+    // installed by another manifest.
     SUIT_COMMON_LABEL_DEPENDENCIES = 1,
     SUIT_COMMON_LABEL_COMPONENTS = 2,
     SUIT_COMMON_LABEL_SEQUENCE = 4,
 } suit_common_label_t;
 
+typedef enum {
+    SUIT_CONDITION_VENDOR_IDENTIFIER = 1,
+    SUIT_CONDITION_CLASS_IDENTIFIER = 2,
+    SUIT_CONDITION_IMAGE_MATCH = 3,
+    SUIT_DIRECTIVE_SET_COMPONENT_INDEX = 12,
+    SUIT_DIRECTIVE_TRY_EACH = 15,
+    SUIT_DIRECTIVE_SET_PARAMETERS = 19,
+    SUIT_DIRECTIVE_OVERRIDE_PARAMETERS = 20,
+    SUIT_DIRECTIVE_FETCH = 21,
+    SUIT_DIRECTIVE_COPY = 22,
+} suit_command_t;
+
+typedef enum {
+    SUIT_PARAMETER_VENDOR_IDENTIFIER = 1,
+    SUIT_PARAMETER_CLASS_IDENTIFIER = 2,
+    SUIT_PARAMETER_IMAGE_DIGEST = 3,
+    SUIT_PARAMETER_IMAGE_SIZE = 14,
+    SUIT_PARAMETER_URI = 21,
+    SUIT_PARAMETER_SOURCE_COMPONENT = 22,
+
+    // Custom parameter: bstr-wrapped [chunk-size, chunk tree root], which
+    // lets a fetched image be checked a chunk at a time.
+    SUIT_PARAMETER_CHUNK_TREE = -1,
+
+    // Custom parameter: bstr-wrapped [bstr-wrapped SUIT_Digest of a base
+    // image, delta URI].  If the base is installed, the image can be
+    // rebuilt from it with the delta instead of being fetched in full.
+    SUIT_PARAMETER_DELTA = -2,
+} suit_parameter_t;
+
+#define SUIT_DIGEST_ALGORITHM_SHA256 (-16)
+
 #define SUIT_MANIFEST_VERSION_VALUE 1
@@ -0,0 +1,121 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <string.h>
+#include "tcp_frame.h"
+
+void teep_frame_reader_init(_Out_ teep_frame_reader_t* reader)
+{
+    memset(reader, 0, sizeof(*reader));
+}
+
+size_t teep_frame_reader_get_vectors(_Inout_ teep_frame_reader_t* reader, _Out_writes_(2) teep_io_vector_t* vectors)
+{
+    size_t count = 0;
+    if (reader->in_message) {
+        vectors[count].data = reader->message.data + reader->message_received;
+        vectors[count].length = reader->message_length - reader->message_received;
+        count++;
+    }
+    vectors[count].data = (char*)reader->header + reader->header_received;
+    vectors[count].length = TEEP_TCP_FRAME_HEADER_SIZE - reader->header_received;
+    count++;
+    return count;
+}
+
+static uint32_t DecodeUint32(_In_reads_(4) const uint8_t* bytes)
+{
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+static void EncodeUint32(_Out_writes_(4) uint8_t* bytes, uint32_t value)
+{
+    bytes[0] = (uint8_t)(value >> 24);
+    bytes[1] = (uint8_t)(value >> 16);
+    bytes[2] = (uint8_t)(value >> 8);
+    bytes[3] = (uint8_t)value;
+}
+
+void teep_frame_encode_header(
+    _Out_writes_(TEEP_TCP_FRAME_HEADER_SIZE) uint8_t* header,
+    uint32_t session_id,
+    size_t message_length)
+{
+    EncodeUint32(header, (uint32_t)message_length);
+    EncodeUint32(header + 4, session_id);
+}
+
+static teep_error_code_t DeliverMessage(
+    _Inout_ teep_frame_reader_t* reader,
+    _In_ teep_frame_handler_t handler,
+    _In_opt_ void* context)
+{
+    teep_buffer_t message = reader->message;
+    message.data[reader->message_length] = '\0';
+    reader->message.data = nullptr;
+    reader->message.capacity = 0;
+    reader->in_message = 0;
+    return handler(context, reader->session_id, &message, reader->message_length);
+}
+
+teep_error_code_t teep_frame_reader_consume(
+    _Inout_ teep_frame_reader_t* reader,
+    size_t received,
+    _In_ teep_frame_handler_t handler,
+    _In_opt_ void* context)
+{
+    while (received > 0) {
+        if (reader->in_message) {
+            size_t piece = reader->message_length - reader->message_received;
+            if (piece > received) {
+                piece = received;
+            }
+            reader->message_received += piece;
+            received -= piece;
+            if (reader->message_received < reader->message_length) {
+                break;
+            }
+            teep_error_code_t result = DeliverMessage(reader, handler, context);
+            if (result != TEEP_ERR_SUCCESS) {
+                return result;
+            }
+            continue;
+        }
+
+        size_t piece = TEEP_TCP_FRAME_HEADER_SIZE - reader->header_received;
+        if (piece > received) {
+            piece = received;
+        }
+        reader->header_received += piece;
+        received -= piece;
+        if (reader->header_received < TEEP_TCP_FRAME_HEADER_SIZE) {
+            break;
+        }
+        reader->header_received = 0;
+        reader->message_length = DecodeUint32(reader->header);
+        reader->session_id = DecodeUint32(reader->header + 4);
+        if (reader->message_length > TEEP_TCP_MAX_MESSAGE_SIZE) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+
+        // Leave room for the NUL byte.
+        teep_error_code_t result = teep_buffer_acquire(reader->message_length + 1, &reader->message);
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+        reader->in_message = 1;
+        reader->message_received = 0;
+        if (reader->message_length == 0) {
+            result = DeliverMessage(reader, handler, context);
+            if (result != TEEP_ERR_SUCCESS) {
+                return result;
+            }
+        }
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+void teep_frame_reader_free(_Inout_ teep_frame_reader_t* reader)
+{
+    teep_buffer_release(&reader->message);
+    teep_frame_reader_init(reader);
+}
@@ -0,0 +1,56 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "common.h"
+#include "buffer_pool.h"
+#include "../TeepTransport.h"
+
+// A place for received bytes to go, laid out like a struct iovec.
+typedef struct {
+    char* data;
+    size_t length;
+} teep_io_vector_t;
+
+// Called with each complete message.  The buffer, in which the message is
+// followed by a NUL byte, then belongs to the handler.
+typedef teep_error_code_t (*teep_frame_handler_t)(
+    void* context,
+    uint32_t session_id,
+    _Inout_ teep_buffer_t* message,
+    size_t message_length);
+
+// Splits a TCP byte stream into framed messages, each received straight
+// into a pooled buffer of its own.
+typedef struct {
+    uint8_t header[TEEP_TCP_FRAME_HEADER_SIZE];
+    size_t header_received;
+    int in_message;
+    uint32_t session_id;
+    teep_buffer_t message;
+    size_t message_length;
+    size_t message_received;
+} teep_frame_reader_t;
+
+void teep_frame_reader_init(_Out_ teep_frame_reader_t* reader);
+
+// Get where the next bytes received should go: the rest of the message
+// being received, if any, and then the header of the one after it, so
+// one readv() can finish a message and start the next.  Returns the
+// number of vectors.
+size_t teep_frame_reader_get_vectors(_Inout_ teep_frame_reader_t* reader, _Out_writes_(2) teep_io_vector_t* vectors);
+
+// Account for bytes received into the vectors, handing each message that
+// completes to the handler.
+teep_error_code_t teep_frame_reader_consume(
+    _Inout_ teep_frame_reader_t* reader,
+    size_t received,
+    _In_ teep_frame_handler_t handler,
+    _In_opt_ void* context);
+
+// Release any partly received message.
+void teep_frame_reader_free(_Inout_ teep_frame_reader_t* reader);
+
+void teep_frame_encode_header(
+    _Out_writes_(TEEP_TCP_FRAME_HEADER_SIZE) uint8_t* header,
+    uint32_t session_id,
+    size_t message_length);
@@ -57,8 +57,19 @@ typedef enum {
     TEEP_LABEL_TOKEN = 20,
     TEEP_LABEL_SUPPORTED_FRESHNESS_MECHANISMS = 21,
     TEEP_LABEL_ERR_CODE = 23,
+
+    // Not in the draft: a manifest-list whose entries are compressed
+    // (see compress.h), sent only to agents that list
+    // TEEP_EXTENSION_COMPRESSED_MANIFESTS in their ext-list.
+    TEEP_LABEL_COMPRESSED_MANIFEST_LIST = -1,
 } teep_label_t;
 
+// Extensions that can appear in an ext-list.  The draft registers none,
+// so these are private.
+typedef enum {
+    TEEP_EXTENSION_COMPRESSED_MANIFESTS = 1,
+} teep_extension_t;
+
 typedef enum {
     TEEP_FRESHNESS_MECHANISM_NONCE = 0,
     TEEP_FRESHNESS_MECHANISM_TIMESTAMP = 1,
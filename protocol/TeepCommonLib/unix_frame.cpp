@@ -0,0 +1,260 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "unix_frame.h"
+
+#define TEEP_UNIX_MIN_REGION_SIZE (1024 * 1024)
+
+// Seals that keep a region from changing size under the peer's mapping.
+#define TEEP_UNIX_REGION_SEALS (F_SEAL_SHRINK | F_SEAL_GROW)
+
+static void InitRegion(_Out_ teep_unix_region_t* region)
+{
+    region->fd = -1;
+    region->data = nullptr;
+    region->capacity = 0;
+}
+
+static void FreeRegion(_Inout_ teep_unix_region_t* region)
+{
+    if (region->data != nullptr) {
+        munmap(region->data, region->capacity + 1);
+    }
+    if (region->fd >= 0) {
+        close(region->fd);
+    }
+    InitRegion(region);
+}
+
+// Replace the outbound region with one of at least the given size.
+static teep_error_code_t CreateOutboundRegion(_Inout_ teep_unix_channel_t* channel, size_t size)
+{
+    FreeRegion(&channel->outbound);
+    channel->outbound_passed = 0;
+    size_t capacity = (size > TEEP_UNIX_MIN_REGION_SIZE) ? size : TEEP_UNIX_MIN_REGION_SIZE;
+
+    int fd = memfd_create("teep", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    if (ftruncate(fd, (off_t)(capacity + 1)) < 0 || fcntl(fd, F_ADD_SEALS, TEEP_UNIX_REGION_SEALS | F_SEAL_SEAL) < 0) {
+        close(fd);
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    void* data = mmap(nullptr, capacity + 1, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    channel->outbound.fd = fd;
+    channel->outbound.data = (char*)data;
+    channel->outbound.capacity = capacity;
+    return TEEP_ERR_SUCCESS;
+}
+
+// Map a region the peer passed, in place of any it passed before.
+static teep_error_code_t MapInboundRegion(_Inout_ teep_unix_channel_t* channel, int fd)
+{
+    FreeRegion(&channel->inbound);
+    struct stat status;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & TEEP_UNIX_REGION_SEALS) != TEEP_UNIX_REGION_SEALS ||
+        fstat(fd, &status) < 0 || status.st_size < 1 || (uint64_t)status.st_size > (uint64_t)TEEP_UNIX_MAX_MESSAGE_SIZE + 1) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    void* data = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    channel->inbound.data = (char*)data;
+    channel->inbound.capacity = (size_t)status.st_size - 1;
+    return TEEP_ERR_SUCCESS;
+}
+
+void teep_unix_channel_init(_Out_ teep_unix_channel_t* channel, int socket)
+{
+    channel->socket = socket;
+    InitRegion(&channel->outbound);
+    channel->outbound_passed = 0;
+    InitRegion(&channel->inbound);
+}
+
+void teep_unix_channel_free(_Inout_ teep_unix_channel_t* channel)
+{
+    if (channel->socket >= 0) {
+        close(channel->socket);
+    }
+    FreeRegion(&channel->outbound);
+    FreeRegion(&channel->inbound);
+    teep_unix_channel_init(channel, -1);
+}
+
+teep_error_code_t teep_unix_reserve(_Inout_ teep_unix_channel_t* channel, size_t size, _Outptr_ char** space)
+{
+    *space = nullptr;
+    if (size > TEEP_UNIX_MAX_MESSAGE_SIZE) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    if (channel->outbound.data == nullptr || size > channel->outbound.capacity) {
+        teep_error_code_t result = CreateOutboundRegion(channel, size);
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+    }
+    *space = channel->outbound.data;
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t teep_unix_send(
+    _Inout_ teep_unix_channel_t* channel,
+    uint32_t session_id,
+    _In_z_ const char* media_type,
+    _In_reads_(message_length) const char* message,
+    size_t message_length)
+{
+    teep_unix_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.session_id = session_id;
+    header.message_length = message_length;
+    strncpy(header.media_type, media_type, sizeof(header.media_type) - 1);
+    struct iovec vectors[2] = { { &header, sizeof(header) }, { (void*)message, message_length } };
+    union {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control = {};
+    struct msghdr record = {};
+    record.msg_iov = vectors;
+    record.msg_iovlen = (message_length > 0) ? 2 : 1;
+
+    if (message_length > TEEP_UNIX_MAX_INLINE_MESSAGE_SIZE) {
+        bool composedInPlace = (message != nullptr && message == channel->outbound.data && message_length <= channel->outbound.capacity);
+        if (!composedInPlace) {
+            char* space;
+            teep_error_code_t result = teep_unix_reserve(channel, message_length, &space);
+            if (result != TEEP_ERR_SUCCESS) {
+                return result;
+            }
+            memcpy(space, message, message_length);
+        }
+        channel->outbound.data[message_length] = '\0';
+        header.flags = TEEP_UNIX_FLAG_SHARED;
+        record.msg_iovlen = 1;
+
+        if (!channel->outbound_passed) {
+            record.msg_control = control.space;
+            record.msg_controllen = sizeof(control.space);
+            struct cmsghdr* passed = CMSG_FIRSTHDR(&record);
+            passed->cmsg_level = SOL_SOCKET;
+            passed->cmsg_type = SCM_RIGHTS;
+            passed->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(passed), &channel->outbound.fd, sizeof(int));
+        }
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(channel->socket, &record, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    if (record.msg_control != nullptr) {
+        // The peer has its own descriptor now.
+        channel->outbound_passed = 1;
+        close(channel->outbound.fd);
+        channel->outbound.fd = -1;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t teep_unix_receive(_Inout_ teep_unix_channel_t* channel, _Out_ teep_unix_message_t* message)
+{
+    memset(message, 0, sizeof(*message));
+
+    // Receive the record straight into a pooled buffer, leaving room for
+    // the NUL byte.
+    teep_error_code_t result = teep_buffer_acquire(TEEP_UNIX_MAX_INLINE_MESSAGE_SIZE + 1, &message->buffer);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    teep_unix_header_t header;
+    struct iovec vectors[2] = { { &header, sizeof(header) }, { message->buffer.data, TEEP_UNIX_MAX_INLINE_MESSAGE_SIZE } };
+    union {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control = {};
+    struct msghdr record = {};
+    record.msg_iov = vectors;
+    record.msg_iovlen = 2;
+    record.msg_control = control.space;
+    record.msg_controllen = sizeof(control.space);
+
+    ssize_t received;
+    do {
+        received = recvmsg(channel->socket, &record, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+
+    int fd = -1;
+    for (struct cmsghdr* passed = CMSG_FIRSTHDR(&record); passed != nullptr; passed = CMSG_NXTHDR(&record, passed)) {
+        if (passed->cmsg_level == SOL_SOCKET && passed->cmsg_type == SCM_RIGHTS && passed->cmsg_len == CMSG_LEN(sizeof(int))) {
+            memcpy(&fd, CMSG_DATA(passed), sizeof(int));
+        }
+    }
+    if (fd >= 0) {
+        result = MapInboundRegion(channel, fd);
+        close(fd);
+    }
+
+    if (received <= 0) {
+        result = TEEP_ERR_TEMPORARY_ERROR;
+    } else if (result != TEEP_ERR_SUCCESS) {
+        // The region passed could not be mapped.
+    } else if ((size_t)received < sizeof(header) || (record.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        result = TEEP_ERR_PERMANENT_ERROR;
+    } else if (header.flags & TEEP_UNIX_FLAG_SHARED) {
+        // The peer can still write to its region, so copy the message out
+        // before anything looks at it.
+        teep_buffer_release(&message->buffer);
+        if ((size_t)received != sizeof(header) || channel->inbound.data == nullptr ||
+            header.message_length > channel->inbound.capacity) {
+            result = TEEP_ERR_PERMANENT_ERROR;
+        } else {
+            result = teep_buffer_acquire((size_t)header.message_length + 1, &message->buffer);
+        }
+        if (result == TEEP_ERR_SUCCESS) {
+            memcpy(message->buffer.data, channel->inbound.data, (size_t)header.message_length);
+            message->buffer.data[header.message_length] = '\0';
+            message->message = message->buffer.data;
+        }
+    } else if ((size_t)received - sizeof(header) != header.message_length) {
+        result = TEEP_ERR_PERMANENT_ERROR;
+    } else {
+        message->buffer.data[header.message_length] = '\0';
+        message->message = message->buffer.data;
+    }
+
+    if (result != TEEP_ERR_SUCCESS) {
+        teep_unix_message_release(message);
+        return result;
+    }
+    message->session_id = header.session_id;
+    memcpy(message->media_type, header.media_type, sizeof(message->media_type));
+    message->media_type[sizeof(message->media_type) - 1] = '\0';
+    message->message_length = (size_t)header.message_length;
+    return TEEP_ERR_SUCCESS;
+}
+
+void teep_unix_message_release(_Inout_ teep_unix_message_t* message)
+{
+    teep_buffer_release(&message->buffer);
+    message->message = nullptr;
+    message->message_length = 0;
+}
+#endif
@@ -0,0 +1,84 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "common.h"
+#include "buffer_pool.h"
+#include "../TeepTransport.h"
+
+// Records on the AF_UNIX SOCK_SEQPACKET socket between a TAM front end
+// and back end, as described in TeepTransport.h.  Linux only.
+#define TEEP_UNIX_FLAG_SHARED 0x1 // The message is in the sender's shared region.
+
+typedef struct {
+    uint32_t session_id;
+    uint32_t flags;
+    uint64_t message_length;
+    char media_type[TEEP_UNIX_MEDIA_TYPE_SIZE];
+} teep_unix_header_t;
+
+// A memfd mapping with room for a message of up to capacity bytes and
+// its NUL byte.
+typedef struct {
+    int fd;
+    char* data;
+    size_t capacity;
+} teep_unix_region_t;
+
+// One end of a connection.  Each end writes any message too large for one
+// record into a region of its own, which it passes to the peer with
+// SCM_RIGHTS the first time and then reuses, so that a large message
+// costs no new mapping's worth of page faults.  A region is replaced when
+// a message outgrows it.  Since each message gets exactly one back, an
+// end reuses its region only once the peer is done with what it last
+// sent there.  The regions are sealed against resizing but not writes, so
+// the receiver copies each message out of the peer's region before using
+// it, and a peer that writes there meanwhile cannot change a message
+// after it has been checked.
+typedef struct {
+    int socket;
+    teep_unix_region_t outbound;
+    int outbound_passed; // Whether the peer has mapped the outbound region.
+    teep_unix_region_t inbound; // The peer's region, mapped read-only.
+} teep_unix_channel_t;
+
+// A received message, which is NUL-terminated and always held in a
+// buffer of its own.
+typedef struct {
+    uint32_t session_id;
+    char media_type[TEEP_UNIX_MEDIA_TYPE_SIZE];
+    const char* message;
+    size_t message_length;
+    teep_buffer_t buffer; // Holds the message.
+} teep_unix_message_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void teep_unix_channel_init(_Out_ teep_unix_channel_t* channel, int socket);
+
+// Close the socket and unmap both regions.
+void teep_unix_channel_free(_Inout_ teep_unix_channel_t* channel);
+
+// Get space in the outbound region to compose a message of up to the
+// given size in, so that sending it needs no copy at all.
+teep_error_code_t teep_unix_reserve(_Inout_ teep_unix_channel_t* channel, size_t size, _Outptr_ char** space);
+
+// Send a message in one record if it fits, or else in the outbound
+// region, copying it there unless it was composed there.
+teep_error_code_t teep_unix_send(
+    _Inout_ teep_unix_channel_t* channel,
+    uint32_t session_id,
+    _In_z_ const char* media_type,
+    _In_reads_(message_length) const char* message,
+    size_t message_length);
+
+// Receive the next message.  Returns TEEP_ERR_TEMPORARY_ERROR if the peer
+// has closed the socket.
+teep_error_code_t teep_unix_receive(_Inout_ teep_unix_channel_t* channel, _Out_ teep_unix_message_t* message);
+
+void teep_unix_message_release(_Inout_ teep_unix_message_t* message);
+
+#ifdef __cplusplus
+};
+#endif
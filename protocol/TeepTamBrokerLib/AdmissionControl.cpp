@@ -0,0 +1,113 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <chrono>
+#ifndef TEEP_USE_TEE
+#include <mutex>
+#endif
+#include "AdmissionControl.h"
+
+static struct {
+    size_t MaxQueued = TAM_ADMISSION_DEFAULT_MAX_QUEUED;
+    uint64_t MaxDelay = TAM_ADMISSION_DEFAULT_MAX_DELAY_MILLISECONDS * 1000ULL; // Microseconds.
+    size_t Queued;
+    size_t InService;
+    uint64_t ServiceTime; // Moving average, in microseconds.
+    uint64_t Rejected;
+#ifndef TEEP_USE_TEE
+    std::mutex Lock;
+#endif
+} g_Admission;
+
+#ifdef TEEP_USE_TEE
+#define LOCK_ADMISSION()
+#else
+#define LOCK_ADMISSION() std::lock_guard<std::mutex> lock(g_Admission.Lock)
+#endif
+
+static uint64_t GetMicroseconds(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// How long until a request arriving now would be taken up.  The caller
+// holds the lock.
+static uint64_t EstimateDelay(void)
+{
+    return (g_Admission.Queued + g_Admission.InService) * g_Admission.ServiceTime;
+}
+
+// Suggest coming back once the queue has drained.  The caller holds the
+// lock.
+static uint32_t GetRetryAfterSeconds(void)
+{
+    uint64_t seconds = (EstimateDelay() + g_Admission.ServiceTime + 999999) / 1000000;
+    if (seconds < 1) {
+        return 1;
+    }
+    return (seconds > TAM_ADMISSION_MAX_RETRY_AFTER_SECONDS) ? TAM_ADMISSION_MAX_RETRY_AFTER_SECONDS : (uint32_t)seconds;
+}
+
+void TamAdmissionConfigure(size_t maxQueued, uint32_t maxDelayMilliseconds)
+{
+    LOCK_ADMISSION();
+    g_Admission.MaxQueued = maxQueued;
+    g_Admission.MaxDelay = (maxDelayMilliseconds == UINT32_MAX) ? UINT64_MAX : maxDelayMilliseconds * 1000ULL;
+}
+
+teep_error_code_t TamAdmitRequest(_Out_ TamAdmissionTicket* ticket, _Out_ uint32_t* retryAfterSeconds)
+{
+    ticket->QueuedAt = GetMicroseconds();
+    ticket->StartedAt = 0;
+    *retryAfterSeconds = 0;
+
+    LOCK_ADMISSION();
+    if (g_Admission.Queued >= g_Admission.MaxQueued || EstimateDelay() > g_Admission.MaxDelay) {
+        g_Admission.Rejected++;
+        *retryAfterSeconds = GetRetryAfterSeconds();
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    g_Admission.Queued++;
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t TamStartAdmittedRequest(_Inout_ TamAdmissionTicket* ticket, _Out_ uint32_t* retryAfterSeconds)
+{
+    ticket->StartedAt = GetMicroseconds();
+    *retryAfterSeconds = 0;
+
+    LOCK_ADMISSION();
+    g_Admission.Queued--;
+    if (ticket->StartedAt - ticket->QueuedAt > g_Admission.MaxDelay) {
+        // The agent has probably given up on it already.
+        g_Admission.Rejected++;
+        *retryAfterSeconds = GetRetryAfterSeconds();
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    g_Admission.InService++;
+    return TEEP_ERR_SUCCESS;
+}
+
+void TamFinishAdmittedRequest(_In_ const TamAdmissionTicket* ticket)
+{
+    uint64_t serviceTime = GetMicroseconds() - ticket->StartedAt;
+
+    LOCK_ADMISSION();
+    g_Admission.InService--;
+    if (g_Admission.ServiceTime == 0) {
+        g_Admission.ServiceTime = serviceTime;
+    } else {
+        g_Admission.ServiceTime = (7 * g_Admission.ServiceTime + serviceTime) / 8;
+    }
+}
+
+uint64_t TamAdmissionGetRejected(void)
+{
+    LOCK_ADMISSION();
+    return g_Admission.Rejected;
+}
+
+size_t TamAdmissionGetQueued(void)
+{
+    LOCK_ADMISSION();
+    return g_Admission.Queued;
+}
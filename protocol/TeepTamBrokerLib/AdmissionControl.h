@@ -0,0 +1,49 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+// Admission control for a transport server that hands requests to the TAM
+// one at a time.  A request is turned away, with 503 and a Retry-After,
+// instead of queued if the queue is full or the requests ahead of it would
+// take too long, and again when its turn comes if it waited too long
+// anyway.  The TAM then spends its time on requests whose agents are still
+// waiting, rather than on ones they have given up on.
+
+#define TAM_ADMISSION_DEFAULT_MAX_QUEUED 64
+#define TAM_ADMISSION_DEFAULT_MAX_DELAY_MILLISECONDS 1000
+#define TAM_ADMISSION_MAX_RETRY_AFTER_SECONDS 60
+
+typedef struct {
+    uint64_t QueuedAt;  // Microseconds, on a steady clock.
+    uint64_t StartedAt;
+} TamAdmissionTicket;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // Set the longest queue, and the longest a request may wait in it.
+    // SIZE_MAX and UINT32_MAX turn each limit off.
+    void TamAdmissionConfigure(size_t maxQueued, uint32_t maxDelayMilliseconds);
+
+    // Decide whether to queue a request that just arrived.  If not, the
+    // request should be answered with 503 and the Retry-After given.
+    teep_error_code_t TamAdmitRequest(_Out_ TamAdmissionTicket* ticket, _Out_ uint32_t* retryAfterSeconds);
+
+    // Take up a queued request.  If it waited too long, it should be
+    // answered the same way, and not finished.
+    teep_error_code_t TamStartAdmittedRequest(_Inout_ TamAdmissionTicket* ticket, _Out_ uint32_t* retryAfterSeconds);
+
+    // Record that the TAM is done with a request it took up.
+    void TamFinishAdmittedRequest(_In_ const TamAdmissionTicket* ticket);
+
+    // Get the number of requests turned away, and of requests queued now.
+    uint64_t TamAdmissionGetRejected(void);
+    size_t TamAdmissionGetQueued(void);
+
+#ifdef __cplusplus
+};
+#endif
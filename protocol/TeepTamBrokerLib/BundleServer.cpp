@@ -0,0 +1,92 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+#include "BundleServer.h"
+#include "bundle.h"
+
+static struct {
+    std::atomic<uint64_t> BundlesProcessed;
+    std::atomic<uint64_t> PartsProcessed;
+} g_BundleServer;
+
+static teep_error_code_t DispatchToTam(
+    _Inout_ TamBrokerSession* session,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    if (messageLength == 0) {
+        // An empty message is a connect.
+        return TamProcessConnect(session, mediaType);
+    }
+    return TamProcessTeepMessage(session, mediaType, message, messageLength);
+}
+
+teep_error_code_t TamProcessBundle(
+    _Inout_ TamBrokerSession* session,
+    _In_z_ const char* mediaType,
+    _In_reads_(bundleLength) const char* bundle,
+    size_t bundleLength,
+    _In_opt_ TamBrokerMessageHandler handler)
+{
+    std::vector<teep_bundle_part_t> parts(TEEP_BUNDLE_MAX_PARTS);
+    size_t count;
+    teep_error_code_t result = teep_bundle_parse(mediaType, bundle, bundleLength, parts.data(), parts.size(), &count);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    parts.resize(count);
+    if (handler == nullptr) {
+        handler = DispatchToTam;
+    }
+
+    // Each device gets a session of its own, and exactly one part back,
+    // which is empty if the TAM had nothing to say or failed.
+    std::vector<TamBrokerSession> sessions(count);
+    std::vector<teep_bundle_part_t> responses(count);
+    for (size_t i = 0; i < count; i++) {
+        const teep_bundle_part_t& part = parts[i];
+        TamBrokerSession& partSession = sessions[i];
+        memset(&partSession, 0, sizeof(partSession));
+        const char* partMediaType = (part.media_type[0] != '\0') ? part.media_type : TEEP_CBOR_MEDIA_TYPE;
+        if (handler(&partSession, partMediaType, part.body, part.body_length) != TEEP_ERR_SUCCESS) {
+            printf("Error handling the part for device %s\n", part.device_id);
+            teep_buffer_release(&partSession.OutboundBuffer);
+            partSession.OutboundMessageLength = 0;
+        }
+
+        teep_bundle_part_t& response = responses[i];
+        memset(&response, 0, sizeof(response));
+        snprintf(response.device_id, sizeof(response.device_id), "%s", part.device_id);
+        if (partSession.OutboundMessageLength > 0) {
+            snprintf(response.media_type, sizeof(response.media_type), "%s", partSession.OutboundMediaType);
+            response.body = partSession.OutboundBuffer.data;
+            response.body_length = partSession.OutboundMessageLength;
+        }
+    }
+    g_BundleServer.BundlesProcessed++;
+    g_BundleServer.PartsProcessed += count;
+
+    char responseMediaType[TEEP_BUNDLE_MAX_MEDIA_TYPE_SIZE];
+    result = teep_bundle_encode(responses.data(), count, &session->OutboundBuffer, &session->OutboundMessageLength, responseMediaType);
+    if (result == TEEP_ERR_SUCCESS) {
+        snprintf(session->OutboundMediaType, sizeof(session->OutboundMediaType), "%s", responseMediaType);
+    }
+    for (TamBrokerSession& partSession : sessions) {
+        teep_buffer_release(&partSession.OutboundBuffer);
+    }
+    return result;
+}
+
+uint64_t TamGetBundlesProcessed(void)
+{
+    return g_BundleServer.BundlesProcessed;
+}
+
+uint64_t TamGetBundlePartsProcessed(void)
+{
+    return g_BundleServer.PartsProcessed;
+}
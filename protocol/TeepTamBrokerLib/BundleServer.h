@@ -0,0 +1,30 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "TeepTamBrokerLib.h"
+
+// The TAM's side of message bundles from gateways, described in
+// TeepTransport.h.  An HTTP server hands any POST whose Content-Type is a
+// bundle here instead of to the TAM.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // Hand each part of a bundle to the handler, or to the TAM if it is
+    // null, in a session of its own, and leave the bundle of responses in
+    // the session, in a pooled buffer.
+    teep_error_code_t TamProcessBundle(
+        _Inout_ TamBrokerSession* session,
+        _In_z_ const char* mediaType,
+        _In_reads_(bundleLength) const char* bundle,
+        size_t bundleLength,
+        _In_opt_ TamBrokerMessageHandler handler);
+
+    // Get the number of bundles, and of parts, processed.
+    uint64_t TamGetBundlesProcessed(void);
+    uint64_t TamGetBundlePartsProcessed(void);
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,378 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CoapServer.h"
+#include "coap.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "ws2_32.lib")
+#else
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+#define COAP_SERVER_POLL_INTERVAL_MS 100 // How often to check for a stop.
+#define COAP_SERVER_MAX_CACHED_REPLIES 16 // Per peer.
+
+typedef struct {
+    uint16_t MessageId;
+    std::vector<uint8_t> Datagram;
+} CoapCachedReply;
+
+// What is known about one client address.
+typedef struct {
+    std::chrono::steady_clock::time_point LastActivity;
+
+    // A request body being received in blocks.
+    std::vector<char> RequestBody;
+
+    // A response being sent in blocks, in the buffer the TAM composed it in.
+    teep_buffer_t Response;
+    size_t ResponseLength;
+
+    // Recent replies to confirmable requests, to send again if the
+    // request is retransmitted.
+    std::deque<CoapCachedReply> Replies;
+} CoapPeer;
+
+static struct {
+    SOCKET Socket = INVALID_SOCKET;
+    std::thread Thread;
+    std::atomic<bool> Stopping;
+    CoapMessageHandler Handler;
+    uint16_t NextMessageId;
+    std::map<std::string, CoapPeer> Peers; // By address.
+    std::atomic<uint64_t> DatagramsReceived;
+    std::atomic<uint64_t> MessagesHandled;
+} g_CoapServer;
+
+static teep_error_code_t DispatchToTam(
+    _Inout_ TamBrokerSession* session,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    if (messageLength == 0) {
+        // An empty message is a connect.
+        return TamProcessConnect(session, mediaType);
+    }
+    return TamProcessTeepMessage(session, mediaType, message, messageLength);
+}
+
+static void DiscardResponse(_Inout_ CoapPeer* peer)
+{
+    teep_buffer_release(&peer->Response);
+    peer->ResponseLength = 0;
+}
+
+// Fill in a reply with one block of the peer's response.
+static void ReplyWithResponseBlock(_Inout_ CoapPeer* peer, uint32_t number, size_t blockSize, _Inout_ teep_coap_message_t* reply)
+{
+    size_t offset = (size_t)number * blockSize;
+    if (offset > peer->ResponseLength || (offset == peer->ResponseLength && offset > 0)) {
+        reply->code = TEEP_COAP_CODE_BAD_REQUEST;
+        return;
+    }
+    size_t length = peer->ResponseLength - offset;
+    int more = (length > blockSize);
+    if (more) {
+        length = blockSize;
+    }
+    reply->code = TEEP_COAP_CODE_CHANGED;
+    if (peer->ResponseLength > 0) {
+        reply->content_format = TEEP_COAP_CONTENT_FORMAT;
+    }
+    if (more || number > 0) {
+        reply->block2 = teep_coap_block_encode(number, more, blockSize);
+        if (number == 0) {
+            reply->size2 = (uint32_t)peer->ResponseLength;
+        }
+    }
+    reply->payload = (const uint8_t*)peer->Response.data + offset;
+    reply->payload_length = length;
+}
+
+// Work out the reply to a request.  Its payload may point into the peer's
+// response, so it must be sent before the peer is touched again.
+static void HandleRequest(_Inout_ CoapPeer* peer, _In_ const teep_coap_message_t* request, _Inout_ teep_coap_message_t* reply)
+{
+    if (request->code != TEEP_COAP_CODE_POST) {
+        reply->code = TEEP_COAP_CODE_METHOD_NOT_ALLOWED;
+        return;
+    }
+    if (request->unrecognized_critical_option) {
+        reply->code = TEEP_COAP_CODE_BAD_OPTION;
+        return;
+    }
+    if (strcmp(request->uri_path, TEEP_COAP_PATH) != 0) {
+        reply->code = TEEP_COAP_CODE_NOT_FOUND;
+        return;
+    }
+
+    // The client can ask for a smaller block size than ours.
+    size_t responseBlockSize = TEEP_COAP_BLOCK_SIZE;
+    if (request->block2 != TEEP_COAP_OPTION_ABSENT) {
+        uint32_t number;
+        int more;
+        teep_coap_block_decode(request->block2, &number, &more, &responseBlockSize);
+        if (responseBlockSize > TEEP_COAP_BLOCK_SIZE) {
+            responseBlockSize = TEEP_COAP_BLOCK_SIZE;
+        }
+
+        // Asking for a later block of the response to the last message.
+        if (number > 0) {
+            ReplyWithResponseBlock(peer, number, responseBlockSize, reply);
+            return;
+        }
+    }
+
+    if (request->payload_length > 0 && request->content_format != TEEP_COAP_CONTENT_FORMAT) {
+        reply->code = TEEP_COAP_CODE_UNSUPPORTED_CONTENT_FORMAT;
+        return;
+    }
+
+    const char* message = (const char*)request->payload;
+    size_t messageLength = request->payload_length;
+    if (request->block1 != TEEP_COAP_OPTION_ABSENT) {
+        uint32_t number;
+        int more;
+        size_t blockSize;
+        teep_coap_block_decode(request->block1, &number, &more, &blockSize);
+        if (number == 0) {
+            peer->RequestBody.clear();
+        }
+        if ((request->size1 != TEEP_COAP_OPTION_ABSENT && request->size1 > TEEP_COAP_MAX_MESSAGE_SIZE) ||
+            peer->RequestBody.size() + request->payload_length > TEEP_COAP_MAX_MESSAGE_SIZE) {
+            peer->RequestBody.clear();
+            reply->code = TEEP_COAP_CODE_REQUEST_ENTITY_TOO_LARGE;
+            reply->size1 = TEEP_COAP_MAX_MESSAGE_SIZE;
+            return;
+        }
+        if ((size_t)number * blockSize != peer->RequestBody.size() || (more && request->payload_length != blockSize)) {
+            peer->RequestBody.clear();
+            reply->code = TEEP_COAP_CODE_REQUEST_ENTITY_INCOMPLETE;
+            return;
+        }
+        peer->RequestBody.insert(peer->RequestBody.end(), message, message + messageLength);
+        reply->block1 = teep_coap_block_encode(number, more, blockSize);
+        if (more) {
+            reply->code = TEEP_COAP_CODE_CONTINUE;
+            return;
+        }
+        message = peer->RequestBody.data();
+        messageLength = peer->RequestBody.size();
+    }
+
+    // Hand the whole message over.
+    TamBrokerSession session = {};
+    CoapMessageHandler handler = (g_CoapServer.Handler != nullptr) ? g_CoapServer.Handler : DispatchToTam;
+    teep_error_code_t result = handler(&session, TEEP_CBOR_MEDIA_TYPE, message, messageLength);
+    g_CoapServer.MessagesHandled++;
+    peer->RequestBody.clear();
+    DiscardResponse(peer);
+    if (result != TEEP_ERR_SUCCESS) {
+        teep_buffer_release(&session.OutboundBuffer);
+        reply->code = TEEP_COAP_CODE_BAD_REQUEST;
+        return;
+    }
+    peer->Response = session.OutboundBuffer;
+    peer->ResponseLength = session.OutboundMessageLength;
+    ReplyWithResponseBlock(peer, 0, responseBlockSize, reply);
+}
+
+static void SendDatagram(_In_reads_(length) const uint8_t* datagram, size_t length, _In_ const struct sockaddr* address, socklen_t addressLength)
+{
+    (void)sendto(g_CoapServer.Socket, (const char*)datagram, (int)length, 0, address, addressLength);
+}
+
+static void HandleDatagram(_In_reads_(length) const uint8_t* datagram, size_t length, _In_ const struct sockaddr* address, socklen_t addressLength)
+{
+    teep_coap_message_t request;
+    if (teep_coap_parse(datagram, length, &request) != TEEP_ERR_SUCCESS ||
+        request.type == TEEP_COAP_TYPE_ACKNOWLEDGEMENT ||
+        request.type == TEEP_COAP_TYPE_RESET) {
+        return;
+    }
+
+    std::string key((const char*)address, addressLength);
+    CoapPeer& peer = g_CoapServer.Peers[key];
+    peer.LastActivity = std::chrono::steady_clock::now();
+
+    // A retransmitted request gets the same reply again.
+    bool confirmable = (request.type == TEEP_COAP_TYPE_CONFIRMABLE);
+    if (confirmable) {
+        for (const CoapCachedReply& cached : peer.Replies) {
+            if (cached.MessageId == request.message_id) {
+                SendDatagram(cached.Datagram.data(), cached.Datagram.size(), address, addressLength);
+                return;
+            }
+        }
+    }
+
+    teep_coap_message_t reply;
+    teep_coap_message_init(&reply);
+    reply.token_length = request.token_length;
+    memcpy(reply.token, request.token, request.token_length);
+    if (confirmable) {
+        reply.type = TEEP_COAP_TYPE_ACKNOWLEDGEMENT;
+        reply.message_id = request.message_id;
+    } else {
+        reply.type = TEEP_COAP_TYPE_NON_CONFIRMABLE;
+        reply.message_id = g_CoapServer.NextMessageId++;
+    }
+    if (request.code == TEEP_COAP_CODE_EMPTY) {
+        // A ping.
+        reply.type = TEEP_COAP_TYPE_RESET;
+        reply.token_length = 0;
+    } else {
+        HandleRequest(&peer, &request, &reply);
+    }
+
+    uint8_t buffer[TEEP_COAP_MAX_DATAGRAM_SIZE];
+    size_t replyLength = teep_coap_serialize(&reply, buffer, sizeof(buffer));
+    if (replyLength == 0) {
+        return;
+    }
+    SendDatagram(buffer, replyLength, address, addressLength);
+
+    if (confirmable) {
+        if (peer.Replies.size() == COAP_SERVER_MAX_CACHED_REPLIES) {
+            peer.Replies.pop_front();
+        }
+        peer.Replies.push_back({ request.message_id, std::vector<uint8_t>(buffer, buffer + replyLength) });
+    }
+
+    // Keep the response only while blocks of it remain to be asked for.
+    uint32_t number;
+    int more = 0;
+    size_t blockSize;
+    if (reply.block2 != TEEP_COAP_OPTION_ABSENT) {
+        teep_coap_block_decode(reply.block2, &number, &more, &blockSize);
+    }
+    if (!more) {
+        DiscardResponse(&peer);
+    }
+}
+
+// Forget peers not heard from within the time a retransmission could
+// still arrive.
+static void ForgetIdlePeers(void)
+{
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = g_CoapServer.Peers.begin(); it != g_CoapServer.Peers.end();) {
+        if (now - it->second.LastActivity > std::chrono::seconds(TEEP_COAP_EXCHANGE_LIFETIME_SECONDS)) {
+            DiscardResponse(&it->second);
+            it = g_CoapServer.Peers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+static void RunCoapServer(void)
+{
+    while (!g_CoapServer.Stopping) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(g_CoapServer.Socket, &readable);
+        struct timeval timeout = { 0, COAP_SERVER_POLL_INTERVAL_MS * 1000 };
+        if (select((int)g_CoapServer.Socket + 1, &readable, nullptr, nullptr, &timeout) > 0) {
+            uint8_t datagram[TEEP_COAP_MAX_DATAGRAM_SIZE];
+            struct sockaddr_storage address;
+            socklen_t addressLength = sizeof(address);
+            int received = (int)recvfrom(g_CoapServer.Socket, (char*)datagram, sizeof(datagram), 0, (struct sockaddr*)&address, &addressLength);
+            if (received > 0) {
+                g_CoapServer.DatagramsReceived++;
+                HandleDatagram(datagram, received, (struct sockaddr*)&address, addressLength);
+            }
+        }
+        ForgetIdlePeers();
+    }
+}
+
+int StartCoapServer(_In_opt_z_ const char* port, _In_opt_ CoapMessageHandler handler)
+{
+#ifdef _WIN32
+    WSADATA wsaData;
+    int err = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (err != 0) {
+        return err;
+    }
+#endif
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET6;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo* ai;
+    int result = getaddrinfo(nullptr, (port != nullptr) ? port : TEEP_COAP_PORT, &hints, &ai);
+    if (result != 0) {
+        return result;
+    }
+
+    // Accept IPv4 clients as well.
+    SOCKET s = socket(ai->ai_family, SOCK_DGRAM, 0);
+    int off = 0;
+    if (s == INVALID_SOCKET ||
+        setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&off, sizeof(off)) != 0 ||
+        bind(s, ai->ai_addr, (int)ai->ai_addrlen) != 0) {
+        freeaddrinfo(ai);
+        if (s != INVALID_SOCKET) {
+            closesocket(s);
+        }
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    freeaddrinfo(ai);
+
+    g_CoapServer.Socket = s;
+    g_CoapServer.Handler = handler;
+    g_CoapServer.Stopping = false;
+    g_CoapServer.Thread = std::thread(RunCoapServer);
+    return 0;
+}
+
+void StopCoapServer(void)
+{
+    if (g_CoapServer.Socket == INVALID_SOCKET) {
+        return;
+    }
+    g_CoapServer.Stopping = true;
+    g_CoapServer.Thread.join();
+    closesocket(g_CoapServer.Socket);
+    g_CoapServer.Socket = INVALID_SOCKET;
+    for (auto& [key, peer] : g_CoapServer.Peers) {
+        DiscardResponse(&peer);
+    }
+    g_CoapServer.Peers.clear();
+}
+
+uint64_t GetCoapServerDatagramsReceived(void)
+{
+    return g_CoapServer.DatagramsReceived;
+}
+
+uint64_t GetCoapServerMessagesHandled(void)
+{
+    return g_CoapServer.MessagesHandled;
+}
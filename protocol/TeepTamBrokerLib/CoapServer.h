@@ -0,0 +1,30 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "TeepTamBrokerLib.h"
+
+// TEEP over CoAP on UDP, for agents on constrained devices.  Messages are
+// confirmable POSTs to TEEP_COAP_PATH, answered in piggybacked
+// acknowledgements, and any message larger than one datagram moves in
+// blocks (RFC 7959).  Retransmitted requests are answered again from a
+// cache rather than handled twice.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef TamBrokerMessageHandler CoapMessageHandler;
+
+    // Serve on a port, or TEEP_COAP_PORT if null, from a thread of its
+    // own.  Messages go to the handler, or to the TAM if it is null.
+    int StartCoapServer(_In_opt_z_ const char* port, _In_opt_ CoapMessageHandler handler);
+
+    void StopCoapServer(void);
+
+    // Get the number of datagrams received, and of messages handled.
+    uint64_t GetCoapServerDatagramsReceived(void);
+    uint64_t GetCoapServerMessagesHandled(void);
+
+#ifdef __cplusplus
+};
+#endif
@@ -1,9 +1,13 @@
 // Copyright (c) TEEP contributors
 // SPDX-License-Identifier: MIT
 #pragma once
+#include <stddef.h>
 
 #define TEEP_PATH L"/TEEP"
 
+// Larger request bodies are refused with 413 Payload Too Large.
+#define TAM_HTTP_DEFAULT_MAX_BODY_SIZE (16 * 1024 * 1024)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -14,6 +18,7 @@ void StopHttpServer(void);
 void AcceptHttpSession(void);
 int HandleHttpMessage(void);
 void CloseHttpSession(void);
+void SetHttpServerMaxBodySize(size_t maxBodySize);
 
 
 #ifdef __cplusplus
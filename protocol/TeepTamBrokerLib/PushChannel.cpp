@@ -0,0 +1,194 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#include <chrono>
+#include <map>
+#include <set>
+#include <string.h>
+#include <string>
+#include <vector>
+#ifndef TEEP_USE_TEE
+#include <mutex>
+#endif
+#include "PushChannel.h"
+
+typedef struct {
+    std::string DeviceId;
+    TamPushCompletion Completion;
+    void* Context;
+    std::chrono::steady_clock::time_point Started;
+} TamPushWaiter;
+
+static struct {
+    std::vector<TamPushWaiter> Waiters;
+    std::set<std::string> PendingWakes;
+    std::map<std::string, std::chrono::steady_clock::time_point> RecentlyIdle; // When each wait ended unwoken.
+    std::chrono::milliseconds Timeout{ TEEP_PUSH_WAIT_SECONDS * 1000 };
+    size_t MaxWaiters = TAM_PUSH_DEFAULT_MAX_WAITERS;
+#ifndef TEEP_USE_TEE
+    std::mutex Lock;
+#endif
+} g_PushChannel;
+
+#ifdef TEEP_USE_TEE
+#define LOCK_PUSH_CHANNEL()
+#else
+#define LOCK_PUSH_CHANNEL() std::lock_guard<std::mutex> lock(g_PushChannel.Lock)
+#endif
+
+// Completions run outside the lock, since they may answer a request.
+static void CompleteWaiters(const std::vector<TamPushWaiter>& waiters, int changed)
+{
+    for (const TamPushWaiter& waiter : waiters) {
+        waiter.Completion(waiter.Context, changed);
+    }
+}
+
+// Keep a wake for a device that is not waiting.  The caller holds the lock.
+static void KeepWake(const std::string& deviceId)
+{
+    if (g_PushChannel.PendingWakes.size() < TAM_PUSH_MAX_PENDING_WAKES) {
+        g_PushChannel.PendingWakes.insert(deviceId);
+    }
+}
+
+// Remember when waits that end with nothing to report ended, so that a
+// change made before the device waits again is not missed.  The caller
+// holds the lock.
+static void RecordIdle(const std::vector<TamPushWaiter>& waiters, std::chrono::steady_clock::time_point now)
+{
+    for (const TamPushWaiter& waiter : waiters) {
+        if (g_PushChannel.RecentlyIdle.size() < TAM_PUSH_MAX_PENDING_WAKES) {
+            g_PushChannel.RecentlyIdle[waiter.DeviceId] = now;
+        }
+    }
+}
+
+teep_error_code_t TamPushAddWaiter(_In_z_ const char* deviceId, _In_ TamPushCompletion completion, _In_opt_ void* context)
+{
+    if (deviceId[0] == 0 || strlen(deviceId) > TEEP_PUSH_MAX_DEVICE_ID_LENGTH) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    std::vector<TamPushWaiter> replaced;
+    {
+        LOCK_PUSH_CHANNEL();
+        g_PushChannel.RecentlyIdle.erase(deviceId);
+        if (g_PushChannel.PendingWakes.erase(deviceId) == 0) {
+            TamPushWaiter waiter = { deviceId, completion, context, std::chrono::steady_clock::now() };
+            auto it = g_PushChannel.Waiters.begin();
+            while (it != g_PushChannel.Waiters.end() && it->DeviceId != deviceId) {
+                it++;
+            }
+            if (it != g_PushChannel.Waiters.end()) {
+                replaced.push_back(*it);
+                *it = waiter;
+            } else if (g_PushChannel.Waiters.size() < g_PushChannel.MaxWaiters) {
+                g_PushChannel.Waiters.push_back(waiter);
+            } else {
+                return TEEP_ERR_TEMPORARY_ERROR;
+            }
+            completion = nullptr;
+        }
+    }
+    CompleteWaiters(replaced, 0);
+    if (completion != nullptr) {
+        // Woken while it had no wait outstanding.
+        completion(context, 1);
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+int TamWakeDevice(_In_z_ const char* deviceId)
+{
+    std::vector<TamPushWaiter> woken;
+    {
+        LOCK_PUSH_CHANNEL();
+        for (auto it = g_PushChannel.Waiters.begin(); it != g_PushChannel.Waiters.end();) {
+            if (it->DeviceId == deviceId) {
+                woken.push_back(*it);
+                it = g_PushChannel.Waiters.erase(it);
+            } else {
+                it++;
+            }
+        }
+        if (woken.empty()) {
+            g_PushChannel.RecentlyIdle.erase(deviceId);
+            KeepWake(deviceId);
+        }
+    }
+    CompleteWaiters(woken, 1);
+    return (int)woken.size();
+}
+
+int TamWakeAllDevices(void)
+{
+    std::vector<TamPushWaiter> woken;
+    {
+        LOCK_PUSH_CHANNEL();
+        woken.swap(g_PushChannel.Waiters);
+        auto now = std::chrono::steady_clock::now();
+        for (const auto& idle : g_PushChannel.RecentlyIdle) {
+            if (now - idle.second < std::chrono::milliseconds(TAM_PUSH_RECENT_MILLISECONDS)) {
+                KeepWake(idle.first);
+            }
+        }
+        g_PushChannel.RecentlyIdle.clear();
+    }
+    CompleteWaiters(woken, 1);
+    return (int)woken.size();
+}
+
+void TamPushExpireWaiters(void)
+{
+    std::vector<TamPushWaiter> expired;
+    {
+        LOCK_PUSH_CHANNEL();
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = g_PushChannel.Waiters.begin(); it != g_PushChannel.Waiters.end();) {
+            if (now - it->Started >= g_PushChannel.Timeout) {
+                expired.push_back(*it);
+                it = g_PushChannel.Waiters.erase(it);
+            } else {
+                it++;
+            }
+        }
+        for (auto it = g_PushChannel.RecentlyIdle.begin(); it != g_PushChannel.RecentlyIdle.end();) {
+            if (now - it->second >= std::chrono::milliseconds(TAM_PUSH_RECENT_MILLISECONDS)) {
+                it = g_PushChannel.RecentlyIdle.erase(it);
+            } else {
+                it++;
+            }
+        }
+        RecordIdle(expired, now);
+    }
+    CompleteWaiters(expired, 0);
+}
+
+void TamPushSetWaitTimeout(unsigned int milliseconds)
+{
+    LOCK_PUSH_CHANNEL();
+    g_PushChannel.Timeout = std::chrono::milliseconds(milliseconds);
+}
+
+void TamPushSetMaxWaiters(size_t maxWaiters)
+{
+    LOCK_PUSH_CHANNEL();
+    g_PushChannel.MaxWaiters = maxWaiters;
+}
+
+void TamPushCancelAll(void)
+{
+    std::vector<TamPushWaiter> cancelled;
+    {
+        LOCK_PUSH_CHANNEL();
+        cancelled.swap(g_PushChannel.Waiters);
+        g_PushChannel.PendingWakes.clear();
+        g_PushChannel.RecentlyIdle.clear();
+    }
+    CompleteWaiters(cancelled, 0);
+}
+
+size_t TamPushGetWaiterCount(void)
+{
+    LOCK_PUSH_CHANNEL();
+    return g_PushChannel.Waiters.size();
+}
@@ -0,0 +1,59 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <stddef.h>
+#include "common.h"
+#include "../TeepTransport.h"
+
+// Agents waiting on the TAM's push channel, described in TeepTransport.h.
+// A transport server adds a wait for each push request it holds open, once
+// the request is authenticated, and answers the request when the wait
+// completes.  A device has at most one wait outstanding.
+
+#define TAM_PUSH_MAX_PENDING_WAKES 4096 // Wakes kept for devices not waiting.
+#define TAM_PUSH_DEFAULT_MAX_WAITERS 4096
+#define TAM_PUSH_RECENT_MILLISECONDS 5000 // How long a device is between waits.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // Complete a wait, with changed nonzero if the device's policy changed,
+    // or zero if the wait ended with nothing to report.
+    typedef void (*TamPushCompletion)(_In_opt_ void* context, int changed);
+
+    // Start waiting for a device's policy to change.  If the device was
+    // woken while it had no wait outstanding, the wait completes at once.
+    // A wait the device already had completes with nothing to report.
+    // Returns TEEP_ERR_TEMPORARY_ERROR, without calling the completion, if
+    // there are already as many waits as allowed.
+    teep_error_code_t TamPushAddWaiter(_In_z_ const char* deviceId, _In_ TamPushCompletion completion, _In_opt_ void* context);
+
+    // Wake a device so that it runs a policy check.  If it has no wait
+    // outstanding, the wake is kept for its next one.  Returns the number
+    // of waits completed.
+    int TamWakeDevice(_In_z_ const char* deviceId);
+
+    // Wake every device, when the policy for all of them changed.  Devices
+    // whose last wait ended within TAM_PUSH_RECENT_MILLISECONDS are woken
+    // on their next one, since they may have missed the change.  Returns
+    // the number of waits completed.
+    int TamWakeAllDevices(void);
+
+    // Complete every wait that has lasted the wait timeout, which is
+    // otherwise TEEP_PUSH_WAIT_SECONDS.
+    void TamPushExpireWaiters(void);
+    void TamPushSetWaitTimeout(unsigned int milliseconds);
+
+    // Set the most waits held at once, which is otherwise
+    // TAM_PUSH_DEFAULT_MAX_WAITERS.
+    void TamPushSetMaxWaiters(size_t maxWaiters);
+
+    // Complete every wait with nothing to report, and forget kept wakes.
+    void TamPushCancelAll(void);
+
+    size_t TamPushGetWaiterCount(void);
+
+#ifdef __cplusplus
+};
+#endif
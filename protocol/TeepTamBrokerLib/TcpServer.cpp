@@ -0,0 +1,411 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef USE_TCP
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <deque>
+#include <set>
+#include "TeepTamBrokerLib.h"
+#include "TcpServer.h"
+#include "buffer_pool.h"
+#include "tcp_frame.h"
+
+#define TCP_SERVER_MAX_EVENTS 64
+#define TCP_SERVER_MAX_WRITE_VECTORS 16
+
+// Most output held for a peer that is not reading it.  Past this, nothing
+// more is read from the peer until it catches up.
+#define TCP_SERVER_MAX_PENDING_BYTES (1024 * 1024)
+
+// Output the socket could not take yet, in order.
+typedef struct {
+    teep_buffer_t Buffer;
+    size_t Length;
+    size_t Offset; // Bytes already sent.
+} TcpPendingOutput;
+
+struct TcpConnection {
+    int Socket;
+    teep_frame_reader_t Reader;
+    std::deque<TcpPendingOutput> Pending;
+    size_t PendingBytes; // Not yet sent, over all of Pending.
+    bool Failed;
+};
+
+// The session handle the TAM sees while it handles one message.
+typedef struct {
+    TcpConnection* Connection;
+    uint32_t SessionId;
+    bool Replied;
+} TcpSession;
+
+static struct {
+    int ListenSocket = -1;
+    int Epoll = -1;
+    int StopEvent = -1;
+    std::set<TcpConnection*> Connections;
+} g_TcpServer;
+
+static void CloseConnection(_In_ TcpConnection* connection)
+{
+    close(connection->Socket);
+    teep_frame_reader_free(&connection->Reader);
+    for (TcpPendingOutput& output : connection->Pending) {
+        teep_buffer_release(&output.Buffer);
+    }
+    g_TcpServer.Connections.erase(connection);
+    delete connection;
+}
+
+static bool IsBackedUp(_In_ const TcpConnection* connection)
+{
+    return connection->PendingBytes >= TCP_SERVER_MAX_PENDING_BYTES;
+}
+
+static void WatchConnection(_In_ TcpConnection* connection, int operation)
+{
+    struct epoll_event event = {};
+    event.events = IsBackedUp(connection) ? 0 : EPOLLIN;
+    if (!connection->Pending.empty()) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.ptr = connection;
+    epoll_ctl(g_TcpServer.Epoll, operation, connection->Socket, &event);
+}
+
+// Write as much pending output as the socket will take.
+static void FlushPendingOutput(_Inout_ TcpConnection* connection)
+{
+    while (!connection->Pending.empty()) {
+        struct iovec vectors[TCP_SERVER_MAX_WRITE_VECTORS];
+        int count = 0;
+        for (TcpPendingOutput& output : connection->Pending) {
+            if (count == TCP_SERVER_MAX_WRITE_VECTORS) {
+                break;
+            }
+            vectors[count].iov_base = output.Buffer.data + output.Offset;
+            vectors[count].iov_len = output.Length - output.Offset;
+            count++;
+        }
+        ssize_t sent = writev(connection->Socket, vectors, count);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                connection->Failed = true;
+            }
+            break;
+        }
+        while (sent > 0) {
+            TcpPendingOutput& output = connection->Pending.front();
+            size_t piece = output.Length - output.Offset;
+            if ((size_t)sent < piece) {
+                output.Offset += sent;
+                connection->PendingBytes -= sent;
+                break;
+            }
+            sent -= piece;
+            connection->PendingBytes -= piece;
+            teep_buffer_release(&output.Buffer);
+            connection->Pending.pop_front();
+        }
+    }
+    WatchConnection(connection, EPOLL_CTL_MOD);
+}
+
+// Keep whatever part of the vectors the socket did not take.
+static teep_error_code_t QueuePendingOutput(_Inout_ TcpConnection* connection, _In_reads_(count) const struct iovec* vectors, int count, size_t skip)
+{
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        length += vectors[i].iov_len;
+    }
+    TcpPendingOutput output = {};
+    output.Length = length - skip;
+    teep_error_code_t result = teep_buffer_acquire(output.Length, &output.Buffer);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    size_t offset = 0;
+    for (int i = 0; i < count; i++) {
+        const char* data = (const char*)vectors[i].iov_base;
+        size_t piece = vectors[i].iov_len;
+        if (skip >= piece) {
+            skip -= piece;
+            continue;
+        }
+        memcpy(output.Buffer.data + offset, data + skip, piece - skip);
+        offset += piece - skip;
+        skip = 0;
+    }
+    connection->Pending.push_back(output);
+    connection->PendingBytes += output.Length;
+    WatchConnection(connection, EPOLL_CTL_MOD);
+    return TEEP_ERR_SUCCESS;
+}
+
+// Send a framed message.  The body is written straight from the caller's
+// buffer unless the socket is backed up, in which case whatever it did not
+// take is copied to go out later.
+static teep_error_code_t SendTcpMessage(
+    _Inout_ TcpConnection* connection,
+    uint32_t sessionId,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    uint8_t header[TEEP_TCP_FRAME_HEADER_SIZE];
+    teep_frame_encode_header(header, sessionId, messageLength);
+    struct iovec vectors[2] = { { header, sizeof(header) }, { (void*)message, messageLength } };
+    int count = (messageLength > 0) ? 2 : 1;
+
+    size_t sent = 0;
+    if (connection->Pending.empty()) {
+        ssize_t result;
+        do {
+            result = writev(connection->Socket, vectors, count);
+        } while (result < 0 && errno == EINTR);
+        if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            connection->Failed = true;
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+        sent = (result > 0) ? (size_t)result : 0;
+        if (sent == sizeof(header) + messageLength) {
+            return TEEP_ERR_SUCCESS;
+        }
+    }
+    return QueuePendingOutput(connection, vectors, count, sent);
+}
+
+teep_error_code_t TamAcquireOutboundTeepBuffer(
+    _In_ void* sessionHandle,
+    size_t size,
+    _Out_ teep_buffer_t* buffer)
+{
+    return teep_buffer_acquire(size, buffer);
+}
+
+void TamReleaseOutboundTeepBuffer(_In_ void* sessionHandle, _Inout_ teep_buffer_t* buffer)
+{
+    teep_buffer_release(buffer);
+}
+
+// Write a message from the buffer the TAM composed it in, which is released
+// once written or queued.
+teep_error_code_t TamQueueOutboundTeepBuffer(
+    _In_ void* sessionHandle,
+    _In_z_ const char* mediaType,
+    _Inout_ teep_buffer_t* buffer,
+    size_t messageLength)
+{
+    TcpSession* session = (TcpSession*)sessionHandle;
+    teep_error_code_t result = TEEP_ERR_PERMANENT_ERROR;
+    if (strcmp(mediaType, TEEP_CBOR_MEDIA_TYPE) == 0) {
+        session->Replied = true;
+        result = SendTcpMessage(session->Connection, session->SessionId, buffer->data, messageLength);
+    }
+    teep_buffer_release(buffer);
+    return result;
+}
+
+// Hand a message to the TAM straight from the buffer it was received in.
+static teep_error_code_t HandleTcpMessage(void* context, uint32_t sessionId, _Inout_ teep_buffer_t* message, size_t messageLength)
+{
+    TcpConnection* connection = (TcpConnection*)context;
+    TcpSession session = { connection, sessionId, false };
+
+    teep_error_code_t result;
+    if (messageLength == 0) {
+        // An empty message is a connect.
+        result = TamProcessConnect(&session, TEEP_CBOR_MEDIA_TYPE);
+    } else {
+        result = TamProcessTeepMessage(&session, TEEP_CBOR_MEDIA_TYPE, message->data, messageLength);
+    }
+    teep_buffer_release(message);
+    if (result != TEEP_ERR_SUCCESS) {
+        printf("Error %d handling message on session %u\n", result, sessionId);
+    }
+
+    // Every message gets exactly one back.
+    if (!session.Replied) {
+        return SendTcpMessage(connection, sessionId, nullptr, 0);
+    }
+    return connection->Failed ? TEEP_ERR_TEMPORARY_ERROR : TEEP_ERR_SUCCESS;
+}
+
+// Receive whatever the socket has, straight into the buffers each message
+// will be handled from, until too much output is waiting for the peer.
+// Returns false once the connection is done.
+static bool ReceiveTcpMessages(_Inout_ TcpConnection* connection)
+{
+    while (!IsBackedUp(connection)) {
+        teep_io_vector_t vectors[2];
+        size_t count = teep_frame_reader_get_vectors(&connection->Reader, vectors);
+        struct iovec iov[2];
+        for (size_t i = 0; i < count; i++) {
+            iov[i].iov_base = vectors[i].data;
+            iov[i].iov_len = vectors[i].length;
+        }
+        ssize_t received = readv(connection->Socket, iov, (int)count);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+        if (received == 0) {
+            return false;
+        }
+        if (teep_frame_reader_consume(&connection->Reader, received, HandleTcpMessage, connection) != TEEP_ERR_SUCCESS ||
+            connection->Failed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void AcceptTcpConnections(void)
+{
+    for (;;) {
+        int s = accept4(g_TcpServer.ListenSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (s < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        int noDelay = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        TcpConnection* connection = new TcpConnection;
+        connection->Socket = s;
+        connection->PendingBytes = 0;
+        connection->Failed = false;
+        teep_frame_reader_init(&connection->Reader);
+        g_TcpServer.Connections.insert(connection);
+        WatchConnection(connection, EPOLL_CTL_ADD);
+    }
+}
+
+int StartTcpServer(_In_opt_z_ const char* port)
+{
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET6;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo* ai;
+    int err = getaddrinfo(nullptr, (port != nullptr) ? port : TEEP_TCP_PORT, &hints, &ai);
+    if (err != 0) {
+        return err;
+    }
+
+    // Accept IPv4 clients as well.
+    g_TcpServer.ListenSocket = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int off = 0;
+    int on = 1;
+    if (g_TcpServer.ListenSocket < 0 ||
+        setsockopt(g_TcpServer.ListenSocket, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) != 0 ||
+        setsockopt(g_TcpServer.ListenSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+        bind(g_TcpServer.ListenSocket, ai->ai_addr, ai->ai_addrlen) != 0 ||
+        listen(g_TcpServer.ListenSocket, SOMAXCONN) != 0) {
+        err = errno;
+        freeaddrinfo(ai);
+        if (g_TcpServer.ListenSocket >= 0) {
+            close(g_TcpServer.ListenSocket);
+            g_TcpServer.ListenSocket = -1;
+        }
+        return err;
+    }
+    freeaddrinfo(ai);
+
+    g_TcpServer.Epoll = epoll_create1(EPOLL_CLOEXEC);
+    g_TcpServer.StopEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_TcpServer.Epoll < 0 || g_TcpServer.StopEvent < 0) {
+        err = errno;
+        close(g_TcpServer.ListenSocket);
+        g_TcpServer.ListenSocket = -1;
+        if (g_TcpServer.Epoll >= 0) {
+            close(g_TcpServer.Epoll);
+            g_TcpServer.Epoll = -1;
+        }
+        if (g_TcpServer.StopEvent >= 0) {
+            close(g_TcpServer.StopEvent);
+            g_TcpServer.StopEvent = -1;
+        }
+        return err;
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &g_TcpServer.ListenSocket;
+    epoll_ctl(g_TcpServer.Epoll, EPOLL_CTL_ADD, g_TcpServer.ListenSocket, &event);
+    event.data.ptr = &g_TcpServer.StopEvent;
+    epoll_ctl(g_TcpServer.Epoll, EPOLL_CTL_ADD, g_TcpServer.StopEvent, &event);
+    return 0;
+}
+
+int RunTcpServer(void)
+{
+    bool stopping = false;
+    while (!stopping) {
+        struct epoll_event events[TCP_SERVER_MAX_EVENTS];
+        int count = epoll_wait(g_TcpServer.Epoll, events, TCP_SERVER_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == &g_TcpServer.StopEvent) {
+                stopping = true;
+                continue;
+            }
+            if (events[i].data.ptr == &g_TcpServer.ListenSocket) {
+                AcceptTcpConnections();
+                continue;
+            }
+
+            TcpConnection* connection = (TcpConnection*)events[i].data.ptr;
+            bool open = !(events[i].events & EPOLLERR);
+            if (open && (events[i].events & EPOLLOUT)) {
+                FlushPendingOutput(connection);
+            }
+            if (open && (events[i].events & (EPOLLIN | EPOLLHUP))) {
+                open = ReceiveTcpMessages(connection);
+            }
+            if (!open || connection->Failed) {
+                CloseConnection(connection);
+            }
+        }
+    }
+
+    while (!g_TcpServer.Connections.empty()) {
+        CloseConnection(*g_TcpServer.Connections.begin());
+    }
+    close(g_TcpServer.ListenSocket);
+    close(g_TcpServer.Epoll);
+    close(g_TcpServer.StopEvent);
+    g_TcpServer.ListenSocket = -1;
+    g_TcpServer.Epoll = -1;
+    g_TcpServer.StopEvent = -1;
+    return 0;
+}
+
+void StopTcpServer(void)
+{
+    uint64_t one = 1;
+    if (write(g_TcpServer.StopEvent, &one, sizeof(one)) < 0) {
+        printf("Error %d stopping TCP server\n", errno);
+    }
+}
+#endif
@@ -2,8 +2,22 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 
-int StartTcpServer(void);
-void StopTcpServer(void);
-void AcceptTcpSession(void);
-int HandleTcpMessage(void);
-void CloseTcpSession(void);
+// TEEP over TCP, framed as described in TeepTransport.h, served to any
+// number of connections by one epoll loop.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // Listen on a port, or TEEP_TCP_PORT if null.
+    int StartTcpServer(_In_opt_z_ const char* port);
+
+    // Serve connections until StopTcpServer is called.
+    int RunTcpServer(void);
+
+    // Make RunTcpServer return.  Any thread may call this.
+    void StopTcpServer(void);
+
+#ifdef __cplusplus
+};
+#endif
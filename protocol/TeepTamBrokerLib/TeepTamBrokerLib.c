@@ -1,50 +1,142 @@
 // Copyright (c) TEEP contributors
 // SPDX-License-Identifier: MIT
-#include <direct.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#define _mkdir(path) mkdir(path, 0700)
+#define sprintf_s snprintf
+#endif
+#include "PushChannel.h"
 #include "TeepTamBrokerLib.h"
-#ifdef USE_TCP
+#if defined(USE_TCP)
 #include "TcpServer.h"
+#elif defined(USE_UNIX_SOCKET)
+#include "UnixServer.h"
+#elif defined(USE_UNIX_FRONT_END)
+#include <unistd.h>
+#include "CoapServer.h"
+#include "UnixForwarder.h"
 #else
+#include "CoapServer.h"
 #include "HttpServer.h"
 #endif
 #ifndef TEEP_USE_TEE
 #include "TeepTamLib.h"
 #endif
 
+#ifdef USE_UNIX_FRONT_END
+// Written to by StopTamBroker to end TamBrokerProcess.
+static int g_StopPipe[2] = { -1, -1 };
+#endif
+
 int TamBrokerProcess(_In_z_ const wchar_t* tamUri)
 {
     int err;
 
-#ifdef USE_TCP
-    err = StartTcpServer();
+#if defined(USE_TCP)
+    TEEP_UNUSED(tamUri);
+    err = StartTcpServer(NULL);
     if (err != 0) {
         printf("Error %d starting transport\n", err);
         return err;
     }
 
-    for (;;) {
-        printf("Waiting for client...\n");
-
-        AcceptTcpSession();
-
-        printf("Accepted client connection...\n");
+    // Serve all agents until StopTamBroker() is called.
+    err = RunTcpServer();
+#elif defined(USE_UNIX_SOCKET)
+    // Serve as the back end of a front end on this host, which talks to
+    // the agents.
+    TEEP_UNUSED(tamUri);
+    err = StartUnixServer(NULL, NULL);
+    if (err != 0) {
+        printf("Error %d starting transport\n", err);
+        return err;
+    }
+    err = RunUnixServer();
+#elif defined(USE_UNIX_FRONT_END)
+    // Serve agents over CoAP, and hand each message to the back end on
+    // this host, which holds the keys and policy.
+    TEEP_UNUSED(tamUri);
+    err = StartCoapServer(NULL, ForwardToUnixBackend);
+    if (err != 0) {
+        printf("Error %d starting CoAP server\n", err);
+        return err;
+    }
 
-        while (HandleTcpMessage() == 0);
+    // Serve until StopTamBroker() is called.
+    char stopped;
+    (void)read(g_StopPipe[0], &stopped, 1);
 
-        CloseTcpSession();
+    StopCoapServer();
+    UnixForwarderCloseConnections();
+#else
+    // Serve CoAP alongside HTTP, for constrained agents.
+    err = StartCoapServer(NULL, NULL);
+    if (err != 0) {
+        printf("Error %d starting CoAP server\n", err);
     }
 
-    StopTcpServer();
-#else
     const wchar_t* myargv[2] = { NULL, tamUri };
     err = RunHttpServer(2, myargv);
+
+    StopCoapServer();
 #endif
 
     return err;
 }
 
+// Where the configuration was loaded from, and when the manifest
+// directories in it last changed.
+static char g_DataDirectory[256];
+static time_t g_ManifestsChanged;
+
+// Get when a manifest was last added to or removed from the policy.
+static time_t GetManifestsChangeTime(void)
+{
+    const char* subdirectories[] = { "required", "optional" };
+    time_t latest = 0;
+    for (size_t i = 0; i < sizeof(subdirectories) / sizeof(subdirectories[0]); i++) {
+        char directory[300];
+        sprintf_s(directory, sizeof(directory), "%s/manifests/%s", g_DataDirectory, subdirectories[i]);
+        struct stat status;
+        if (stat(directory, &status) == 0 && status.st_mtime > latest) {
+            latest = status.st_mtime;
+        }
+    }
+    return latest;
+}
+
+int TamBrokerReloadPolicy(void)
+{
+#ifndef TEEP_USE_TEE
+    teep_error_code_t result = TamLoadConfiguration(g_DataDirectory);
+    if (result != TEEP_ERR_SUCCESS) {
+        printf("Error %d reloading policy\n", result);
+        return result;
+    }
+#endif
+    // In a TEE, the TA holds the policy, and there is no call to reload
+    // it yet, but agents are still told to check.
+    int woken = TamWakeAllDevices();
+    printf("Policy changed, woke %d waiting agents\n", woken);
+    return 0;
+}
+
+int TamBrokerCheckForPolicyChange(void)
+{
+    time_t changed = GetManifestsChangeTime();
+    if (changed == g_ManifestsChanged) {
+        return 0;
+    }
+    g_ManifestsChanged = changed;
+    return TamBrokerReloadPolicy();
+}
+
 int StartTamBroker(_In_z_ const char* dataDirectory, int simulatedTee)
 {
     // Create data directory if it doesn't already exist.
@@ -59,22 +151,44 @@ int StartTamBroker(_In_z_ const char* dataDirectory, int simulatedTee)
     sprintf_s(directory, sizeof(directory), "%s/untrusted", dataDirectory);
     _mkdir(directory);
 
-#ifdef TEEP_USE_TEE
+    sprintf_s(g_DataDirectory, sizeof(g_DataDirectory), "%s", dataDirectory);
+    g_ManifestsChanged = GetManifestsChangeTime();
+
+#if defined(USE_UNIX_FRONT_END)
+    // The back end loads the configuration, so a front end needs none.
+    TEEP_UNUSED(simulatedTee);
+    if (g_StopPipe[0] == -1 && pipe(g_StopPipe) != 0) {
+        return 1;
+    }
+    return 0;
+#elif defined(TEEP_USE_TEE)
     int result = StartTamTABroker(dataDirectory, simulatedTee);
     return result;
 #else
-    teep_error_code_t result = TamLoadConfiguration(dataDirectory);
+    // Manifests are checked against the TAM's keys, so load those first.
+    teep_error_code_t result = TamInitializeKeys(dataDirectory);
     if (result != TEEP_ERR_SUCCESS) {
         return result;
     }
 
-    return TamInitializeKeys(dataDirectory);
+    return TamLoadConfiguration(dataDirectory);
 #endif
 }
 
 void StopTamBroker(void)
 {
+#if defined(USE_TCP)
+    StopTcpServer();
+#elif defined(USE_UNIX_SOCKET)
+    StopUnixServer();
+#elif defined(USE_UNIX_FRONT_END)
+    if (g_StopPipe[1] != -1) {
+        (void)write(g_StopPipe[1], "x", 1);
+    }
+#endif
 #ifdef TEEP_USE_TEE
     StopTamTABroker();
+#else
+    TamShutdown();
 #endif
 }
\ No newline at end of file
@@ -3,16 +3,42 @@
 #pragma once
 
 // Other prototypes are the same as in the TEE.
-#include "..\TeepTamLib\TeepTamLib.h"
+#include "../TeepTamLib/TeepTamLib.h"
+
+// The session handle a transport server passes to the TAM, in which
+// TamQueueOutboundTeepBuffer leaves the message to send back.  The
+// transport owns the buffer, and releases it once the message is sent.
+typedef struct {
+    char OutboundMediaType[80];
+    teep_buffer_t OutboundBuffer;
+    size_t OutboundMessageLength;
+} TamBrokerSession;
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+    // Handle a complete message, or a connect if the message is empty, by
+    // leaving any message to send back in the session, in a pooled buffer.
+    typedef teep_error_code_t (*TamBrokerMessageHandler)(
+        _Inout_ TamBrokerSession* session,
+        _In_z_ const char* mediaType,
+        _In_reads_(messageLength) const char* message,
+        size_t messageLength);
+
     int TamBrokerProcess(_In_z_ const wchar_t* tamUri);
     int StartTamBroker(_In_z_ const char* manifestDirectory, int simulated_tee);
     void StopTamBroker(void);
 
+    // Reload the policy, and wake every agent waiting on the push channel
+    // so that it runs a policy check.
+    int TamBrokerReloadPolicy(void);
+
+    // Reload the policy if a manifest was added to or removed from it
+    // since it was last loaded.  A transport server calls this now and
+    // then, between TEEP messages.
+    int TamBrokerCheckForPolicyChange(void);
+
 #ifdef __cplusplus
 };
 #endif
@@ -0,0 +1,186 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "UnixForwarder.h"
+
+static struct {
+    std::mutex Lock;
+    std::map<std::string, std::vector<teep_unix_channel_t*>> Idle; // By path.
+    std::string Path = TEEP_UNIX_SOCKET_PATH;
+    uint64_t ConnectionsOpened;
+    std::atomic<uint32_t> NextSessionId;
+} g_UnixForwarder;
+
+static void CloseConnection(_In_ teep_unix_channel_t* channel)
+{
+    teep_unix_channel_free(channel);
+    delete channel;
+}
+
+// An idle connection is readable only if the back end closed it, and
+// then it cannot be used.
+static bool IsConnectionStale(_In_ const teep_unix_channel_t* channel)
+{
+    struct pollfd readable = { channel->socket, POLLIN, 0 };
+    return poll(&readable, 1, 0) != 0;
+}
+
+// Get an idle connection to a path, or open one.  Sets reused if the
+// connection was idle, since the back end may have closed it since.
+static teep_unix_channel_t* GetConnection(_In_z_ const char* path, _Out_ bool* reused)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_UnixForwarder.Lock);
+        std::vector<teep_unix_channel_t*>& idle = g_UnixForwarder.Idle[path];
+        while (!idle.empty()) {
+            teep_unix_channel_t* channel = idle.back();
+            idle.pop_back();
+            if (!IsConnectionStale(channel)) {
+                *reused = true;
+                return channel;
+            }
+            CloseConnection(channel);
+        }
+        g_UnixForwarder.ConnectionsOpened++;
+    }
+
+    *reused = false;
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (s < 0) {
+        return nullptr;
+    }
+    if (connect(s, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(s);
+        return nullptr;
+    }
+    teep_unix_channel_t* channel = new teep_unix_channel_t;
+    teep_unix_channel_init(channel, s);
+    return channel;
+}
+
+teep_error_code_t UnixForwardMessage(
+    _In_z_ const char* path,
+    uint32_t sessionId,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength,
+    _Out_ UnixForwardResponse* response)
+{
+    memset(response, 0, sizeof(*response));
+    if (strlen(path) >= sizeof(response->Path)) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    strcpy(response->Path, path);
+    for (;;) {
+        bool reused;
+        teep_unix_channel_t* channel = GetConnection(path, &reused);
+        if (channel == nullptr) {
+            return TEEP_ERR_TEMPORARY_ERROR;
+        }
+        teep_error_code_t result = teep_unix_send(channel, sessionId, mediaType, message, messageLength);
+        if (result == TEEP_ERR_SUCCESS) {
+            result = teep_unix_receive(channel, &response->Message);
+        }
+        if (result == TEEP_ERR_SUCCESS && response->Message.session_id != sessionId) {
+            teep_unix_message_release(&response->Message);
+            result = TEEP_ERR_PERMANENT_ERROR;
+        }
+        if (result == TEEP_ERR_SUCCESS) {
+            response->SessionId = sessionId;
+            memcpy(response->MediaType, response->Message.media_type, sizeof(response->MediaType));
+            response->Body = response->Message.message;
+            response->BodyLength = response->Message.message_length;
+            response->Channel = channel;
+            return result;
+        }
+        CloseConnection(channel);
+
+        // A kept connection the back end closed, as when it restarts, is
+        // replaced by a new one.
+        if (!reused || result != TEEP_ERR_TEMPORARY_ERROR) {
+            return result;
+        }
+    }
+}
+
+void UnixForwarderFreeResponse(_Inout_ UnixForwardResponse* response)
+{
+    teep_unix_message_release(&response->Message);
+    if (response->Channel != nullptr) {
+        std::lock_guard<std::mutex> lock(g_UnixForwarder.Lock);
+        g_UnixForwarder.Idle[response->Path].push_back(response->Channel);
+    }
+    response->Channel = nullptr;
+    response->Body = nullptr;
+    response->BodyLength = 0;
+}
+
+void UnixForwarderSetPath(_In_z_ const char* path)
+{
+    std::lock_guard<std::mutex> lock(g_UnixForwarder.Lock);
+    g_UnixForwarder.Path = path;
+}
+
+teep_error_code_t ForwardToUnixBackend(
+    _Inout_ TamBrokerSession* session,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(g_UnixForwarder.Lock);
+        path = g_UnixForwarder.Path;
+    }
+    UnixForwardResponse response;
+    teep_error_code_t result = UnixForwardMessage(path.c_str(), ++g_UnixForwarder.NextSessionId, mediaType, message, messageLength, &response);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    // The session wants a pooled buffer, so the response is copied once
+    // out of wherever it was received.
+    if (response.BodyLength > 0) {
+        result = teep_buffer_acquire(response.BodyLength + 1, &session->OutboundBuffer);
+    }
+    if (response.BodyLength > 0 && result == TEEP_ERR_SUCCESS) {
+        memcpy(session->OutboundBuffer.data, response.Body, response.BodyLength + 1);
+        session->OutboundMessageLength = response.BodyLength;
+        snprintf(session->OutboundMediaType, sizeof(session->OutboundMediaType), "%s", response.MediaType);
+    }
+    UnixForwarderFreeResponse(&response);
+    return result;
+}
+
+void UnixForwarderCloseConnections(void)
+{
+    std::lock_guard<std::mutex> lock(g_UnixForwarder.Lock);
+    for (auto& entry : g_UnixForwarder.Idle) {
+        for (teep_unix_channel_t* channel : entry.second) {
+            CloseConnection(channel);
+        }
+    }
+    g_UnixForwarder.Idle.clear();
+}
+
+uint64_t UnixForwarderGetConnectionsOpened(void)
+{
+    std::lock_guard<std::mutex> lock(g_UnixForwarder.Lock);
+    return g_UnixForwarder.ConnectionsOpened;
+}
+#endif
@@ -0,0 +1,65 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "TeepTamBrokerLib.h"
+#include "unix_frame.h"
+
+// The TAM front end's end of the Unix-domain socket described in
+// TeepTransport.h.  Connections to each back end are kept and reused, one
+// per exchange in progress, so a front end serving many agents at once
+// never waits on another's exchange.  Linux only.
+
+#define UNIX_FORWARDER_MAX_PATH_LENGTH 108 // As in struct sockaddr_un.
+
+typedef struct {
+    uint32_t SessionId;
+    char MediaType[TEEP_UNIX_MEDIA_TYPE_SIZE];
+    const char* Body; // NUL-terminated, and never null on success.
+    size_t BodyLength;
+
+    // The connection stays in use, as the body may be in its shared
+    // region, until the response is freed.
+    teep_unix_channel_t* Channel;
+    teep_unix_message_t Message;
+    char Path[UNIX_FORWARDER_MAX_PATH_LENGTH];
+} UnixForwardResponse;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // Send a message, or an empty one to connect, to the back end listening
+    // on a path, and wait for the one it sends back.  On success the caller
+    // frees the response with UnixForwarderFreeResponse.
+    teep_error_code_t UnixForwardMessage(
+        _In_z_ const char* path,
+        uint32_t sessionId,
+        _In_z_ const char* mediaType,
+        _In_reads_(messageLength) const char* message,
+        size_t messageLength,
+        _Out_ UnixForwardResponse* response);
+
+    void UnixForwarderFreeResponse(_Inout_ UnixForwardResponse* response);
+
+    // Set the path ForwardToUnixBackend uses, which is otherwise
+    // TEEP_UNIX_SOCKET_PATH.
+    void UnixForwarderSetPath(_In_z_ const char* path);
+
+    // A message handler for a front-end server, such as StartCoapServer,
+    // that forwards each message to the back end and leaves its response
+    // in the session.
+    teep_error_code_t ForwardToUnixBackend(
+        _Inout_ TamBrokerSession* session,
+        _In_z_ const char* mediaType,
+        _In_reads_(messageLength) const char* message,
+        size_t messageLength);
+
+    // Close the connections kept to each back end.
+    void UnixForwarderCloseConnections(void);
+
+    // Get the number of connections opened so far.
+    uint64_t UnixForwarderGetConnectionsOpened(void);
+
+#ifdef __cplusplus
+};
+#endif
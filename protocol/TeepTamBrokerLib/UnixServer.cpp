@@ -0,0 +1,251 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#ifdef __linux__
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <set>
+#include "TeepTamBrokerLib.h"
+#include "UnixServer.h"
+#include "buffer_pool.h"
+#include "unix_frame.h"
+
+#define UNIX_SERVER_MAX_EVENTS 64
+
+// The session handle the TAM sees while it handles one message.  A reply
+// too large for one record is composed straight into the connection's
+// shared region.
+typedef struct {
+    TamBrokerSession Basic;
+    teep_unix_channel_t* Channel;
+} UnixSession;
+
+static struct {
+    int ListenSocket = -1;
+    int Epoll = -1;
+    int StopEvent = -1;
+    TamBrokerMessageHandler Handler;
+    std::set<teep_unix_channel_t*> Connections;
+    std::atomic<uint64_t> MessagesHandled;
+} g_UnixServer;
+
+static teep_error_code_t DispatchToTam(
+    _Inout_ TamBrokerSession* session,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    if (messageLength == 0) {
+        // An empty message is a connect.
+        return TamProcessConnect(session, mediaType);
+    }
+    return TamProcessTeepMessage(session, mediaType, message, messageLength);
+}
+
+#ifdef USE_UNIX_SOCKET
+teep_error_code_t TamAcquireOutboundTeepBuffer(
+    _In_ void* sessionHandle,
+    size_t size,
+    _Out_ teep_buffer_t* buffer)
+{
+    if (size <= TEEP_UNIX_MAX_INLINE_MESSAGE_SIZE) {
+        return teep_buffer_acquire(size, buffer);
+    }
+    UnixSession* session = (UnixSession*)sessionHandle;
+    teep_error_code_t result = teep_unix_reserve(session->Channel, size, &buffer->data);
+    buffer->capacity = (result == TEEP_ERR_SUCCESS) ? size : 0;
+    return result;
+}
+
+void TamReleaseOutboundTeepBuffer(_In_ void* sessionHandle, _Inout_ teep_buffer_t* buffer)
+{
+    UnixSession* session = (UnixSession*)sessionHandle;
+    if (buffer->data != nullptr && buffer->data == session->Channel->outbound.data) {
+        buffer->data = nullptr;
+        buffer->capacity = 0;
+        return;
+    }
+    teep_buffer_release(buffer);
+}
+
+// Keep the buffer, wherever it lives, until the reply is sent.
+teep_error_code_t TamQueueOutboundTeepBuffer(
+    _In_ void* sessionHandle,
+    _In_z_ const char* mediaType,
+    _Inout_ teep_buffer_t* buffer,
+    size_t messageLength)
+{
+    UnixSession* session = (UnixSession*)sessionHandle;
+    if (session->Basic.OutboundBuffer.data != nullptr) {
+        TamReleaseOutboundTeepBuffer(sessionHandle, buffer);
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    session->Basic.OutboundBuffer = *buffer;
+    session->Basic.OutboundMessageLength = messageLength;
+    buffer->data = nullptr;
+    buffer->capacity = 0;
+    snprintf(session->Basic.OutboundMediaType, sizeof(session->Basic.OutboundMediaType), "%s", mediaType);
+    return TEEP_ERR_SUCCESS;
+}
+#endif
+
+static void CloseConnection(_In_ teep_unix_channel_t* channel)
+{
+    teep_unix_channel_free(channel);
+    g_UnixServer.Connections.erase(channel);
+    delete channel;
+}
+
+// Hand one message to the TAM from wherever it was received, and send
+// back exactly one, empty if the TAM had nothing to say.  Returns false
+// once the connection is done.
+static bool HandleUnixMessage(_Inout_ teep_unix_channel_t* channel)
+{
+    teep_unix_message_t message;
+    teep_error_code_t result = teep_unix_receive(channel, &message);
+    if (result != TEEP_ERR_SUCCESS) {
+        return false;
+    }
+
+    UnixSession session = {};
+    session.Channel = channel;
+    TamBrokerMessageHandler handler = (g_UnixServer.Handler != nullptr) ? g_UnixServer.Handler : DispatchToTam;
+    result = handler(&session.Basic, message.media_type, message.message, message.message_length);
+    g_UnixServer.MessagesHandled++;
+    teep_unix_message_release(&message);
+    if (result != TEEP_ERR_SUCCESS) {
+        printf("Error %d handling message on session %u\n", result, message.session_id);
+    }
+
+    // A reply composed in the shared region goes from there.
+    teep_buffer_t* reply = &session.Basic.OutboundBuffer;
+    size_t replyLength = (result == TEEP_ERR_SUCCESS) ? session.Basic.OutboundMessageLength : 0;
+    const char* mediaType = (replyLength > 0) ? session.Basic.OutboundMediaType : TEEP_CBOR_MEDIA_TYPE;
+    result = teep_unix_send(channel, message.session_id, mediaType, reply->data, replyLength);
+    if (reply->data != channel->outbound.data) {
+        teep_buffer_release(reply);
+    }
+    return (result == TEEP_ERR_SUCCESS);
+}
+
+static void AcceptUnixConnections(void)
+{
+    for (;;) {
+        int s = accept4(g_UnixServer.ListenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (s < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        teep_unix_channel_t* channel = new teep_unix_channel_t;
+        teep_unix_channel_init(channel, s);
+        g_UnixServer.Connections.insert(channel);
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = channel;
+        epoll_ctl(g_UnixServer.Epoll, EPOLL_CTL_ADD, s, &event);
+    }
+}
+
+int StartUnixServer(_In_opt_z_ const char* path, _In_opt_ TamBrokerMessageHandler handler)
+{
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path == nullptr) {
+        path = TEEP_UNIX_SOCKET_PATH;
+    }
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return ENAMETOOLONG;
+    }
+    strcpy(address.sun_path, path);
+    unlink(path);
+
+    g_UnixServer.Handler = handler;
+    g_UnixServer.ListenSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (g_UnixServer.ListenSocket < 0 ||
+        bind(g_UnixServer.ListenSocket, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(g_UnixServer.ListenSocket, SOMAXCONN) != 0) {
+        int err = errno;
+        if (g_UnixServer.ListenSocket >= 0) {
+            close(g_UnixServer.ListenSocket);
+            g_UnixServer.ListenSocket = -1;
+        }
+        return err;
+    }
+
+    g_UnixServer.Epoll = epoll_create1(EPOLL_CLOEXEC);
+    g_UnixServer.StopEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_UnixServer.Epoll < 0 || g_UnixServer.StopEvent < 0) {
+        return errno;
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &g_UnixServer.ListenSocket;
+    epoll_ctl(g_UnixServer.Epoll, EPOLL_CTL_ADD, g_UnixServer.ListenSocket, &event);
+    event.data.ptr = &g_UnixServer.StopEvent;
+    epoll_ctl(g_UnixServer.Epoll, EPOLL_CTL_ADD, g_UnixServer.StopEvent, &event);
+    return 0;
+}
+
+int RunUnixServer(void)
+{
+    bool stopping = false;
+    while (!stopping) {
+        struct epoll_event events[UNIX_SERVER_MAX_EVENTS];
+        int count = epoll_wait(g_UnixServer.Epoll, events, UNIX_SERVER_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == &g_UnixServer.StopEvent) {
+                stopping = true;
+                continue;
+            }
+            if (events[i].data.ptr == &g_UnixServer.ListenSocket) {
+                AcceptUnixConnections();
+                continue;
+            }
+
+            teep_unix_channel_t* channel = (teep_unix_channel_t*)events[i].data.ptr;
+            if ((events[i].events & EPOLLERR) || !HandleUnixMessage(channel)) {
+                CloseConnection(channel);
+            }
+        }
+    }
+
+    while (!g_UnixServer.Connections.empty()) {
+        CloseConnection(*g_UnixServer.Connections.begin());
+    }
+    close(g_UnixServer.ListenSocket);
+    close(g_UnixServer.Epoll);
+    close(g_UnixServer.StopEvent);
+    g_UnixServer.ListenSocket = -1;
+    g_UnixServer.Epoll = -1;
+    g_UnixServer.StopEvent = -1;
+    return 0;
+}
+
+void StopUnixServer(void)
+{
+    uint64_t one = 1;
+    if (write(g_UnixServer.StopEvent, &one, sizeof(one)) < 0) {
+        printf("Error %d stopping Unix socket server\n", errno);
+    }
+}
+
+uint64_t GetUnixServerMessagesHandled(void)
+{
+    return g_UnixServer.MessagesHandled;
+}
+#endif
@@ -0,0 +1,30 @@
+// Copyright (c) TEEP contributors
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "TeepTamBrokerLib.h"
+
+// The TAM back end's end of the Unix-domain socket described in
+// TeepTransport.h, serving any number of front-end connections from one
+// poll loop.  Linux only.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // Listen on a path, or TEEP_UNIX_SOCKET_PATH if null, replacing any
+    // socket left there.  Messages go to the handler, or to the TAM if it
+    // is null.
+    int StartUnixServer(_In_opt_z_ const char* path, _In_opt_ TamBrokerMessageHandler handler);
+
+    // Serve connections until StopUnixServer is called.
+    int RunUnixServer(void);
+
+    // Make RunUnixServer return.  Any thread may call this.
+    void StopUnixServer(void);
+
+    // Get the number of messages handled.
+    uint64_t GetUnixServerMessagesHandled(void);
+
+#ifdef __cplusplus
+};
+#endif
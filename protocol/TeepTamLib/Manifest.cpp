@@ -2,11 +2,33 @@
 // SPDX-License-Identifier: MIT
 #include "UsefulBuf.h"
 #include "Manifest.h"
+#include "TamKeys.h"
+#include "compress.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
 #include <string.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <vector>
+#ifndef TEEP_USE_TEE
+#include <thread>
+#endif
+extern "C" {
+#include "suit_manifest.h"
+};
+#include "qcbor/qcbor_decode.h"
+#include "qcbor/qcbor_encode.h"
+#include "t_cose/t_cose_key.h"
+
+#define TOXDIGIT(x) ("0123456789abcdef"[x])
 
 Manifest* Manifest::g_FirstManifest = nullptr;
+Manifest* Manifest::g_FirstDeltaManifest = nullptr;
+
+static bool StripSeverableMembers(UsefulBufC envelope, _Out_ std::vector<uint8_t>& stripped);
+static void ParseManifestMetadata(UsefulBufC envelope, _Out_ ManifestMetadata& metadata);
 
 Manifest::Manifest(
     teep_uuid_t component_id,
@@ -26,6 +48,31 @@ Manifest::Manifest(
         memcpy(buffer, manifest, manifest_size);
         this->ManifestContents.len = manifest_size;
     }
+    ParseManifestMetadata(this->ManifestContents, this->Metadata);
+    this->BaseSequenceNumber = 0;
+
+    // Work out what to send once here, so that each Update costs nothing
+    // extra.  Agents that accept compressed manifests get the compressed
+    // form.
+    this->WireContents = this->ManifestContents;
+    std::vector<uint8_t> stripped;
+    if (StripSeverableMembers(this->ManifestContents, stripped)) {
+        void* strippedBuffer = malloc(stripped.size());
+        if (strippedBuffer != nullptr) {
+            memcpy(strippedBuffer, stripped.data(), stripped.size());
+            this->WireContents = { strippedBuffer, stripped.size() };
+        }
+    }
+    this->CompressedContents = NULLUsefulBufC;
+    std::vector<uint8_t> compressed;
+    if (teep_compress(this->WireContents, compressed) == TEEP_ERR_SUCCESS &&
+        compressed.size() < this->WireContents.len) {
+        void* compressedBuffer = malloc(compressed.size());
+        if (compressedBuffer != nullptr) {
+            memcpy(compressedBuffer, compressed.data(), compressed.size());
+            this->CompressedContents = { compressedBuffer, compressed.size() };
+        }
+    }
 }
 
 _Ret_maybenull_
@@ -45,6 +92,18 @@ void Manifest::AddManifest(
     g_FirstManifest = manifest;
 }
 
+void Manifest::AddDeltaManifest(
+    teep_uuid_t component_id,
+    uint64_t base_sequence_number,
+    _In_reads_(manifest_content_size) const char* manifest_content,
+    size_t manifest_content_size)
+{
+    Manifest* manifest = new Manifest(component_id, manifest_content, manifest_content_size, false);
+    manifest->BaseSequenceNumber = base_sequence_number;
+    manifest->Next = g_FirstDeltaManifest;
+    g_FirstDeltaManifest = manifest;
+}
+
 bool Manifest::HasComponentId(_In_ const UsefulBufC* component_id)
 {
     if (sizeof(_component_id) != component_id->len) {
@@ -67,6 +126,53 @@ Manifest* Manifest::FindManifest(_In_ const UsefulBufC* component_id)
     return nullptr;
 }
 
+_Ret_maybenull_
+Manifest* Manifest::FindDeltaManifest(uint64_t base_sequence_number)
+{
+    UsefulBufC component_id = { &_component_id, sizeof(_component_id) };
+    for (Manifest* delta = g_FirstDeltaManifest; delta != nullptr; delta = delta->Next) {
+        if (delta->BaseSequenceNumber == base_sequence_number &&
+            delta->Metadata.SequenceNumber == Metadata.SequenceNumber &&
+            delta->HasComponentId(&component_id)) {
+            return delta;
+        }
+    }
+    return nullptr;
+}
+
+// Append a manifest to sorted after the manifests it depends on.
+static void AppendAfterDependencies(
+    _In_ const std::vector<Manifest*>& manifests,
+    size_t index,
+    _Inout_ std::vector<char>& visited,
+    _Inout_ std::vector<Manifest*>& sorted)
+{
+    if (visited[index]) {
+        // Already placed, or part of a cycle that agents will reject.
+        return;
+    }
+    visited[index] = true;
+    for (UsefulBufC dependency : manifests[index]->Metadata.Dependencies) {
+        for (size_t i = 0; i < manifests.size(); i++) {
+            if (manifests[i]->HasComponentId(&dependency)) {
+                AppendAfterDependencies(manifests, i, visited, sorted);
+            }
+        }
+    }
+    sorted.push_back(manifests[index]);
+}
+
+void Manifest::SortByDependencies(_Inout_ std::vector<Manifest*>& manifests)
+{
+    std::vector<char> visited(manifests.size(), false);
+    std::vector<Manifest*> sorted;
+    sorted.reserve(manifests.size());
+    for (size_t i = 0; i < manifests.size(); i++) {
+        AppendAfterDependencies(manifests, i, visited, sorted);
+    }
+    manifests.swap(sorted);
+}
+
 void Manifest::ClearManifests(void)
 {
     while (g_FirstManifest != nullptr) {
@@ -74,12 +180,797 @@ void Manifest::ClearManifests(void)
         g_FirstManifest = manifest->Next;
         delete manifest;
     }
+    while (g_FirstDeltaManifest != nullptr) {
+        Manifest* manifest = g_FirstDeltaManifest;
+        g_FirstDeltaManifest = manifest->Next;
+        delete manifest;
+    }
+}
+
+// Size of the CBOR head that precedes a definite-length bstr.
+static size_t GetByteStringHeadSize(size_t length)
+{
+    return (length < 24) ? 1 : (length <= 0xff) ? 2 : (length <= 0xffff) ? 3 : (length <= 0xffffffff) ? 5 : 9;
+}
+
+// Get the SHA-256 digest that a SUIT_Digest holds.
+static bool GetSha256DigestBytes(UsefulBufC encoded, _Out_ UsefulBufC* digest)
+{
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, encoded, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount < 2) {
+        return false;
+    }
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_INT64 || item.val.int64 != SUIT_DIGEST_ALGORITHM_SHA256) {
+        return false;
+    }
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_BYTE_STRING || item.val.string.len != TEEP_SHA256_SIZE) {
+        return false;
+    }
+    *digest = item.val.string;
+    return true;
+}
+
+// Get the contents of a bstr member of a SUIT_Envelope.
+static bool GetEnvelopeMember(UsefulBufC envelope, int64_t label, _Out_ UsefulBufC* member)
+{
+    *member = NULLUsefulBufC;
+
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, envelope, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_MAP) {
+        return false;
+    }
+    uint16_t entryCount = item.val.uCount;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        QCBORDecode_GetNext(&context, &item);
+        uint8_t level = item.uNestingLevel;
+        if (item.uLabelType == QCBOR_TYPE_INT64 && item.label.int64 == label &&
+            item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+            *member = item.val.string;
+        }
+        while (item.uNextNestLevel > level) {
+            if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS) {
+                return false;
+            }
+        }
+    }
+    if (QCBORDecode_Finish(&context) != QCBOR_SUCCESS) {
+        return false;
+    }
+    return !UsefulBuf_IsNULLC(*member);
+}
+
+// Find the digest in a SUIT_Envelope's authentication wrapper and the
+// bstr-wrapped suit-manifest that it covers.
+static bool GetManifestDigestInput(UsefulBufC envelope, _Out_ UsefulBufC* digest, _Out_ UsefulBufC* wrappedManifest)
+{
+    *digest = NULLUsefulBufC;
+    *wrappedManifest = NULLUsefulBufC;
+
+    UsefulBufC authenticationWrapper;
+    UsefulBufC manifest;
+    if (!GetEnvelopeMember(envelope, SUIT_ENVELOPE_LABEL_AUTHENTICATION_WRAPPER, &authenticationWrapper) ||
+        !GetEnvelopeMember(envelope, SUIT_ENVELOPE_LABEL_MANIFEST, &manifest)) {
+        return false;
+    }
+
+    // The first entry is the bstr-wrapped SUIT_Digest.
+    QCBORDecodeContext wrapper;
+    QCBORItem entry;
+    QCBORDecode_Init(&wrapper, authenticationWrapper, QCBOR_DECODE_MODE_NORMAL);
+    QCBORDecode_GetNext(&wrapper, &entry);
+    if (entry.uDataType != QCBOR_TYPE_ARRAY || entry.val.uCount < 1) {
+        return false;
+    }
+    QCBORDecode_GetNext(&wrapper, &entry);
+    if (entry.uDataType != QCBOR_TYPE_BYTE_STRING ||
+        !GetSha256DigestBytes(entry.val.string, digest)) {
+        return false;
+    }
+
+    // The digest covers the bstr head as well as its contents.
+    size_t headSize = GetByteStringHeadSize(manifest.len);
+    wrappedManifest->ptr = (const uint8_t*)manifest.ptr - headSize;
+    wrappedManifest->len = manifest.len + headSize;
+    return true;
+}
+
+// Copy a SUIT_Envelope without the severable members that agents never
+// use, which is only suit-text.  Their digests stay in the manifest, so
+// the signature still holds.  Returns false if there is nothing to leave
+// out, or the envelope has a member that is not a bstr.
+static bool StripSeverableMembers(UsefulBufC envelope, _Out_ std::vector<uint8_t>& stripped)
+{
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, envelope, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_MAP) {
+        return false;
+    }
+    std::vector<QCBORItem> kept;
+    uint16_t entryCount = item.val.uCount;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS || item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+            return false;
+        }
+        if (item.uLabelType != QCBOR_TYPE_INT64 || item.label.int64 != SUIT_ENVELOPE_LABEL_TEXT) {
+            kept.push_back(item);
+        }
+    }
+    if (QCBORDecode_Finish(&context) != QCBOR_SUCCESS || kept.size() == entryCount) {
+        return false;
+    }
+
+    // Every member is a bstr, so re-encoding them leaves their contents,
+    // and anything signed within them, unchanged.
+    stripped.resize(envelope.len);
+    QCBOREncodeContext encoder;
+    QCBOREncode_Init(&encoder, UsefulBuf{ stripped.data(), stripped.size() });
+    QCBOREncode_OpenMap(&encoder);
+    for (const QCBORItem& member : kept) {
+        if (member.uLabelType == QCBOR_TYPE_INT64) {
+            QCBOREncode_AddBytesToMapN(&encoder, member.label.int64, member.val.string);
+        } else if (member.uLabelType == QCBOR_TYPE_TEXT_STRING) {
+            QCBOREncode_AddText(&encoder, member.label.string);
+            QCBOREncode_AddBytes(&encoder, member.val.string);
+        } else {
+            return false;
+        }
+    }
+    QCBOREncode_CloseMap(&encoder);
+    UsefulBufC encoded;
+    if (QCBOREncode_Finish(&encoder, &encoded) != QCBOR_SUCCESS) {
+        return false;
+    }
+    stripped.resize(encoded.len);
+    return true;
+}
+
+// Skip the rest of the item just read, including anything nested in it.
+static bool SkipNestedItems(_Inout_ QCBORDecodeContext* context, _Inout_ QCBORItem* item)
+{
+    uint8_t level = item->uNestingLevel;
+    while (item->uNextNestLevel > level) {
+        if (QCBORDecode_GetNext(context, item) != QCBOR_SUCCESS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Get the SHA-256 digest and size that a command sequence sets for
+// component 0.
+static void GetImageParameters(UsefulBufC sequence, _Inout_ ManifestMetadata& metadata)
+{
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, sequence, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_ARRAY) {
+        return;
+    }
+
+    // Commands come in pairs of a command and its argument.
+    bool selected = true;
+    uint16_t entryCount = item.val.uCount;
+    for (uint16_t i = 0; i + 1 < entryCount; i += 2) {
+        if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS || item.uDataType != QCBOR_TYPE_INT64) {
+            return;
+        }
+        int64_t command = item.val.int64;
+        if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS) {
+            return;
+        }
+        if (command == SUIT_DIRECTIVE_SET_COMPONENT_INDEX) {
+            selected = (item.uDataType == QCBOR_TYPE_TRUE) || (item.uDataType == QCBOR_TYPE_INT64 && item.val.int64 == 0);
+        } else if (selected && item.uDataType == QCBOR_TYPE_MAP &&
+                   (command == SUIT_DIRECTIVE_SET_PARAMETERS || command == SUIT_DIRECTIVE_OVERRIDE_PARAMETERS)) {
+            uint16_t parameterCount = item.val.uCount;
+            for (uint16_t p = 0; p < parameterCount; p++) {
+                if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS) {
+                    return;
+                }
+                int64_t label = (item.uLabelType == QCBOR_TYPE_INT64) ? item.label.int64 : 0;
+                if (label == SUIT_PARAMETER_IMAGE_DIGEST && item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+                    UsefulBufC imageDigest;
+                    if (GetSha256DigestBytes(item.val.string, &imageDigest)) {
+                        metadata.ImageDigest = imageDigest;
+                    }
+                } else if (label == SUIT_PARAMETER_IMAGE_SIZE && item.uDataType == QCBOR_TYPE_INT64 && item.val.int64 >= 0) {
+                    metadata.ImageSize = (uint64_t)item.val.int64;
+                } else if (label == SUIT_PARAMETER_IMAGE_SIZE && item.uDataType == QCBOR_TYPE_UINT64) {
+                    metadata.ImageSize = item.val.uint64;
+                }
+                if (!SkipNestedItems(&context, &item)) {
+                    return;
+                }
+            }
+            continue;
+        }
+        if (!SkipNestedItems(&context, &item)) {
+            return;
+        }
+    }
+}
+
+// Get the dependencies of a SUIT_Common, and the image parameters its
+// shared sequence sets.  suit-dependencies is keyed by index into
+// suit-components, and may come before it.
+static void GetCommonMetadata(UsefulBufC common, _Inout_ ManifestMetadata& metadata)
+{
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, common, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_MAP) {
+        return;
+    }
+    std::vector<int64_t> indices;
+    std::vector<UsefulBufC> componentIds;
+    uint16_t entryCount = item.val.uCount;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS) {
+            return;
+        }
+        int64_t label = (item.uLabelType == QCBOR_TYPE_INT64) ? item.label.int64 : 0;
+        if (label == SUIT_COMMON_LABEL_DEPENDENCIES && item.uDataType == QCBOR_TYPE_MAP) {
+            uint16_t dependencyCount = item.val.uCount;
+            for (uint16_t d = 0; d < dependencyCount; d++) {
+                if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS) {
+                    return;
+                }
+                if (item.uLabelType == QCBOR_TYPE_INT64) {
+                    indices.push_back(item.label.int64);
+                }
+                if (!SkipNestedItems(&context, &item)) {
+                    return;
+                }
+            }
+            continue;
+        }
+        if (label == SUIT_COMMON_LABEL_COMPONENTS && item.uDataType == QCBOR_TYPE_ARRAY) {
+            uint16_t componentCount = item.val.uCount;
+            for (uint16_t c = 0; c < componentCount; c++) {
+                if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS || item.uDataType != QCBOR_TYPE_ARRAY) {
+                    return;
+                }
+                UsefulBufC componentId = NULLUsefulBufC;
+                uint16_t partCount = item.val.uCount;
+                for (uint16_t p = 0; p < partCount; p++) {
+                    if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS || item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+                        return;
+                    }
+                    componentId = item.val.string;
+                }
+                componentIds.push_back(componentId);
+            }
+            continue;
+        }
+        if (label == SUIT_COMMON_LABEL_SEQUENCE && item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+            GetImageParameters(item.val.string, metadata);
+        }
+        if (!SkipNestedItems(&context, &item)) {
+            return;
+        }
+    }
+
+    // Component 0 is the one the manifest installs.
+    for (int64_t index : indices) {
+        if (index > 0 && (size_t)index < componentIds.size() && !UsefulBuf_IsNULLC(componentIds[(size_t)index])) {
+            metadata.Dependencies.push_back(componentIds[(size_t)index]);
+        }
+    }
+}
+
+// Decode the metadata of a manifest.  Anything missing or malformed is
+// left zero or empty, and ValidateManifests() drops such manifests.
+static void ParseManifestMetadata(UsefulBufC envelope, _Out_ ManifestMetadata& metadata)
+{
+    metadata.SequenceNumber = 0;
+    metadata.ImageSize = 0;
+    metadata.Digest = NULLUsefulBufC;
+    metadata.ImageDigest = NULLUsefulBufC;
+    metadata.Dependencies.clear();
+
+    UsefulBufC wrappedManifest;
+    GetManifestDigestInput(envelope, &metadata.Digest, &wrappedManifest);
+
+    UsefulBufC manifest;
+    if (!GetEnvelopeMember(envelope, SUIT_ENVELOPE_LABEL_MANIFEST, &manifest)) {
+        return;
+    }
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, manifest, QCBOR_DECODE_MODE_NORMAL);
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_MAP) {
+        return;
+    }
+    uint16_t entryCount = item.val.uCount;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS) {
+            return;
+        }
+        int64_t label = (item.uLabelType == QCBOR_TYPE_INT64) ? item.label.int64 : 0;
+        switch (label) {
+        case SUIT_MANIFEST_LABEL_SEQUENCE_NUMBER:
+            metadata.SequenceNumber = (item.uDataType == QCBOR_TYPE_INT64 && item.val.int64 >= 0) ? (uint64_t)item.val.int64 :
+                                      (item.uDataType == QCBOR_TYPE_UINT64) ? item.val.uint64 : 0;
+            break;
+        case SUIT_MANIFEST_LABEL_COMMON:
+            if (item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+                GetCommonMetadata(item.val.string, metadata);
+            }
+            break;
+        case SUIT_MANIFEST_LABEL_PAYLOAD_FETCH:
+        case SUIT_MANIFEST_LABEL_INSTALL:
+            // Severed members are not kept, so only those still in the
+            // manifest are looked at.
+            if (item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+                GetImageParameters(item.val.string, metadata);
+            }
+            break;
+        default:
+            break;
+        }
+        if (!SkipNestedItems(&context, &item)) {
+            return;
+        }
+    }
+}
+
+// Read a SUIT_Digest array that has just been started, getting its bytes
+// if it is SHA-256.
+static bool ReadSha256Digest(_Inout_ QCBORDecodeContext* context, _Inout_ QCBORItem* item, _Out_ UsefulBufC* digest)
+{
+    *digest = NULLUsefulBufC;
+    bool sha256 = false;
+    uint16_t entryCount = item->val.uCount;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        if (QCBORDecode_GetNext(context, item) != QCBOR_SUCCESS) {
+            return false;
+        }
+        if (i == 0) {
+            sha256 = (item->uDataType == QCBOR_TYPE_INT64 && item->val.int64 == SUIT_DIGEST_ALGORITHM_SHA256);
+        } else if (i == 1 && sha256 && item->uDataType == QCBOR_TYPE_BYTE_STRING && item->val.string.len == TEEP_SHA256_SIZE) {
+            *digest = item->val.string;
+        }
+        if (!SkipNestedItems(context, item)) {
+            return false;
+        }
+    }
+    return !UsefulBuf_IsNULLC(*digest);
+}
+
+// Check that a SUIT_Common lists at least one component.
+static bool CheckSuitCommon(UsefulBufC common)
+{
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, common, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_MAP) {
+        return false;
+    }
+    bool hasComponents = false;
+    uint16_t entryCount = item.val.uCount;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS) {
+            return false;
+        }
+        if (item.uLabelType == QCBOR_TYPE_INT64 && item.label.int64 == SUIT_COMMON_LABEL_COMPONENTS) {
+            hasComponents = (item.uDataType == QCBOR_TYPE_ARRAY && item.val.uCount > 0);
+        }
+        if (!SkipNestedItems(&context, &item)) {
+            return false;
+        }
+    }
+    return hasComponents && QCBORDecode_Finish(&context) == QCBOR_SUCCESS;
+}
+
+// Check that a suit-manifest has what agents need before they will
+// install it: a sequence number and components to install.  Also get the
+// digests that stand in for any severed members.
+static bool CheckSuitManifest(UsefulBufC manifest, _Out_ UsefulBufC* payloadFetchDigest, _Out_ UsefulBufC* installDigest)
+{
+    *payloadFetchDigest = NULLUsefulBufC;
+    *installDigest = NULLUsefulBufC;
+
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, manifest, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_MAP) {
+        return false;
+    }
+    bool hasSequenceNumber = false;
+    bool hasCommon = false;
+    uint16_t entryCount = item.val.uCount;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS) {
+            return false;
+        }
+        int64_t label = (item.uLabelType == QCBOR_TYPE_INT64) ? item.label.int64 : 0;
+        switch (label) {
+        case SUIT_MANIFEST_LABEL_VERSION:
+            if (item.uDataType != QCBOR_TYPE_INT64 || item.val.int64 != SUIT_MANIFEST_VERSION_VALUE) {
+                return false;
+            }
+            break;
+        case SUIT_MANIFEST_LABEL_SEQUENCE_NUMBER:
+            hasSequenceNumber = (item.uDataType == QCBOR_TYPE_UINT64) ||
+                                (item.uDataType == QCBOR_TYPE_INT64 && item.val.int64 >= 0);
+            break;
+        case SUIT_MANIFEST_LABEL_COMMON:
+            hasCommon = (item.uDataType == QCBOR_TYPE_BYTE_STRING && CheckSuitCommon(item.val.string));
+            break;
+        case SUIT_MANIFEST_LABEL_PAYLOAD_FETCH:
+        case SUIT_MANIFEST_LABEL_INSTALL:
+            if (item.uDataType == QCBOR_TYPE_ARRAY) {
+                // A severed member is replaced by its SUIT_Digest.
+                if (!ReadSha256Digest(&context, &item,
+                        (label == SUIT_MANIFEST_LABEL_PAYLOAD_FETCH) ? payloadFetchDigest : installDigest)) {
+                    return false;
+                }
+                continue;
+            }
+            break;
+        default:
+            break;
+        }
+        if (!SkipNestedItems(&context, &item)) {
+            return false;
+        }
+    }
+    return hasSequenceNumber && hasCommon && QCBORDecode_Finish(&context) == QCBOR_SUCCESS;
+}
+
+// Check a severed member carried in an envelope against the digest that
+// stands in for it in the manifest.
+static bool CheckSeveredMember(UsefulBufC member, UsefulBufC expectedDigest)
+{
+    if (UsefulBuf_IsNULLC(member)) {
+        return true;
+    }
+    if (UsefulBuf_IsNULLC(expectedDigest)) {
+        return false;
+    }
+
+    // The digest covers the bstr head as well as its contents.
+    size_t headSize = GetByteStringHeadSize(member.len);
+    UsefulBufC wrappedMember = { (const uint8_t*)member.ptr - headSize, member.len + headSize };
+    uint8_t digest[TEEP_SHA256_SIZE];
+    return teep_compute_sha256(wrappedMember, digest) == TEEP_ERR_SUCCESS &&
+           memcmp(digest, expectedDigest.ptr, TEEP_SHA256_SIZE) == 0;
+}
+
+// Check that each COSE_Sign1 in a SUIT_Envelope's authentication wrapper
+// signs its SUIT_Digest with one of the given keys.  Agents verify these
+// blocks against the TAM's keys, so a block signed by any other key would
+// get the manifest refused on every device.
+static bool CheckAuthenticationBlocks(UsefulBufC envelope, _In_ const std::vector<struct t_cose_key>& keys)
+{
+    UsefulBufC authenticationWrapper;
+    if (!GetEnvelopeMember(envelope, SUIT_ENVELOPE_LABEL_AUTHENTICATION_WRAPPER, &authenticationWrapper)) {
+        return false;
+    }
+
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, authenticationWrapper, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount < 1) {
+        return false;
+    }
+    uint16_t entryCount = item.val.uCount;
+    UsefulBufC suitDigest = NULLUsefulBufC;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS || item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+            return false;
+        }
+        if (i == 0) {
+            suitDigest = item.val.string;
+            continue;
+        }
+
+        // The payload of each COSE_Sign1 is the detached SUIT_Digest.
+        bool verified = false;
+        for (const struct t_cose_key& key : keys) {
+            if (teep_verify_sign1_detached(&key, item.val.string, suitDigest) == TEEP_ERR_SUCCESS) {
+                verified = true;
+                break;
+            }
+        }
+        if (!verified) {
+            return false;
+        }
+    }
+    return QCBORDecode_Finish(&context) == QCBOR_SUCCESS;
+}
+
+// Check a manifest the way agents will: the envelope they are sent holds
+// only members they accept, its suit-digest matches suit-manifest and is
+// signed by the TAM, the manifest has what they need to install it, and
+// any severed members match their digests.
+static bool ValidateEnvelope(_In_ const Manifest* manifest, _In_ const std::vector<struct t_cose_key>& keys)
+{
+    QCBORDecodeContext context;
+    QCBORDecode_Init(&context, manifest->WireContents, QCBOR_DECODE_MODE_NORMAL);
+
+    QCBORItem item;
+    QCBORDecode_GetNext(&context, &item);
+    if (item.uDataType != QCBOR_TYPE_MAP) {
+        return false;
+    }
+    UsefulBufC payloadFetch = NULLUsefulBufC;
+    UsefulBufC install = NULLUsefulBufC;
+    uint16_t entryCount = item.val.uCount;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        if (QCBORDecode_GetNext(&context, &item) != QCBOR_SUCCESS ||
+            item.uLabelType != QCBOR_TYPE_INT64 || item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+            return false;
+        }
+        switch (item.label.int64) {
+        case SUIT_ENVELOPE_LABEL_AUTHENTICATION_WRAPPER:
+        case SUIT_ENVELOPE_LABEL_MANIFEST:
+            break;
+        case SUIT_ENVELOPE_LABEL_PAYLOAD_FETCH:
+            payloadFetch = item.val.string;
+            break;
+        case SUIT_ENVELOPE_LABEL_INSTALL:
+            install = item.val.string;
+            break;
+        default:
+            return false;
+        }
+    }
+    if (QCBORDecode_Finish(&context) != QCBOR_SUCCESS) {
+        return false;
+    }
+
+    UsefulBufC expectedDigest;
+    UsefulBufC wrappedManifest;
+    uint8_t digest[TEEP_SHA256_SIZE];
+    if (!GetManifestDigestInput(manifest->WireContents, &expectedDigest, &wrappedManifest) ||
+        teep_compute_sha256(wrappedManifest, digest) != TEEP_ERR_SUCCESS ||
+        memcmp(digest, expectedDigest.ptr, TEEP_SHA256_SIZE) != 0 ||
+        !CheckAuthenticationBlocks(manifest->WireContents, keys)) {
+        return false;
+    }
+
+    UsefulBufC suitManifest;
+    UsefulBufC payloadFetchDigest;
+    UsefulBufC installDigest;
+    return GetEnvelopeMember(manifest->WireContents, SUIT_ENVELOPE_LABEL_MANIFEST, &suitManifest) &&
+           CheckSuitManifest(suitManifest, &payloadFetchDigest, &installDigest) &&
+           CheckSeveredMember(payloadFetch, payloadFetchDigest) &&
+           CheckSeveredMember(install, installDigest);
+}
+
+// Validate the given manifests, setting valid[i] for each index i listed
+// in pending.  A repository may hold many manifests, so they are spread
+// across a thread per core.
+static void ValidateEnvelopes(
+    _In_ const std::vector<Manifest*>& manifests,
+    _In_ const std::vector<struct t_cose_key>& keys,
+    _In_ const std::vector<size_t>& pending,
+    _Inout_ std::vector<char>& valid)
+{
+    size_t count = pending.size();
+#ifdef TEEP_USE_TEE
+    // Enclaves have no thread support, so validate serially.
+    for (size_t i : pending) {
+        valid[i] = ValidateEnvelope(manifests[i], keys);
+    }
+#else
+    size_t workerCount = std::min<size_t>(std::max<size_t>(std::thread::hardware_concurrency(), 1), count);
+    std::atomic<size_t> nextIndex(0);
+    auto worker = [&]() {
+        for (;;) {
+            size_t n = nextIndex++;
+            if (n >= count) {
+                break;
+            }
+            valid[pending[n]] = ValidateEnvelope(manifests[pending[n]], keys);
+        }
+    };
+
+    if (workerCount <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> workers;
+        for (size_t w = 1; w < workerCount; w++) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+#endif
+}
+
+// Results of earlier validation, keyed by the hex SHA-256 digest of each
+// envelope together with the TAM's public keys.
+typedef std::map<std::string, bool> ManifestValidationCache;
+
+static void LoadValidationCache(_In_z_ const char* filename, _Out_ ManifestValidationCache& cache)
+{
+    cache.clear();
+    FILE* fp = fopen(filename, "r");
+    if (fp == NULL) {
+        return;
+    }
+
+    // Each line is a digest and 1 if the manifest was valid, else 0.  A
+    // line cut short by a crash simply ends the cache.
+    char key[2 * TEEP_SHA256_SIZE + 1];
+    int valid;
+    while (fscanf(fp, "%64s %d", key, &valid) == 2) {
+        if (strlen(key) == 2 * TEEP_SHA256_SIZE) {
+            cache[key] = (valid != 0);
+        }
+    }
+    fclose(fp);
+}
+
+static void SaveValidationCache(_In_z_ const char* filename, _In_ const ManifestValidationCache& cache)
+{
+    FILE* fp = fopen(filename, "w");
+    if (fp == NULL) {
+        TeepLogMessage("TAM could not save manifest validation results\n");
+        return;
+    }
+    for (const auto& entry : cache) {
+        fprintf(fp, "%s %d\n", entry.first.c_str(), entry.second ? 1 : 0);
+    }
+    fclose(fp);
+}
+
+// Drop every manifest in a list that could not be checked.
+static void RefuseManifestList(_Inout_ Manifest** first, _In_ const std::vector<Manifest*>& manifests)
+{
+    TeepLogMessage("TAM could not validate manifests, refusing to serve them\n");
+    for (Manifest* manifest : manifests) {
+        delete manifest;
+    }
+    *first = nullptr;
+}
+
+// Remove any manifest in a list that agents would reject.  Results found
+// in previous are used as is, and every result is added to current.  If
+// the manifests cannot be checked, none of them is kept.
+static teep_error_code_t ValidateManifestList(
+    _Inout_ Manifest** first,
+    _In_ const std::vector<struct t_cose_key>& keys,
+    _In_ const std::vector<uint8_t>& signers,
+    _In_ const ManifestValidationCache& previous,
+    _Inout_ ManifestValidationCache& current)
+{
+    // Hash every envelope in one batch, which lets the SHA-256 engine
+    // work on several of them at once.
+    std::vector<Manifest*> manifests;
+    std::vector<UsefulBufC> envelopes;
+    for (Manifest* manifest = *first; manifest != nullptr; manifest = manifest->Next) {
+        manifests.push_back(manifest);
+        envelopes.push_back(manifest->ManifestContents);
+    }
+    std::vector<teep_sha256_digest_t> digests(envelopes.size());
+    teep_error_code_t result = teep_compute_sha256_many(envelopes.data(), envelopes.size(), digests.data());
+    if (result != TEEP_ERR_SUCCESS) {
+        RefuseManifestList(first, manifests);
+        return result;
+    }
+
+    std::vector<std::string> cacheKeys(manifests.size());
+    std::vector<char> valid(manifests.size(), false);
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < manifests.size(); i++) {
+        // A result only holds for the keys it was checked against, so
+        // replacing a TAM key has every manifest checked again.
+        std::vector<uint8_t> input(digests[i], digests[i] + TEEP_SHA256_SIZE);
+        input.insert(input.end(), signers.begin(), signers.end());
+        uint8_t key[TEEP_SHA256_SIZE];
+        result = teep_compute_sha256({ input.data(), input.size() }, key);
+        if (result != TEEP_ERR_SUCCESS) {
+            TeepLogMessage("TAM could not validate manifests, refusing to serve them\n");
+            for (Manifest* manifest : manifests) {
+                delete manifest;
+            }
+            *first = nullptr;
+            return result;
+        }
+        for (size_t j = 0; j < TEEP_SHA256_SIZE; j++) {
+            cacheKeys[i] += TOXDIGIT(key[j] >> 4);
+            cacheKeys[i] += TOXDIGIT(key[j] & 0xf);
+        }
+        auto found = previous.find(cacheKeys[i]);
+        if (found != previous.end()) {
+            valid[i] = found->second;
+        } else {
+            pending.push_back(i);
+        }
+    }
+    ValidateEnvelopes(manifests, keys, pending, valid);
+
+    Manifest** link = first;
+    for (size_t i = 0; i < manifests.size(); i++) {
+        Manifest* manifest = manifests[i];
+        current[cacheKeys[i]] = valid[i];
+        if (valid[i]) {
+            link = &manifest->Next;
+            continue;
+        }
+        TeepLogMessage("TAM refusing to serve an invalid manifest\n");
+        *link = manifest->Next;
+        delete manifest;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t Manifest::ValidateManifests(_In_opt_z_ const char* cache_filename)
+{
+    ManifestValidationCache previous;
+    ManifestValidationCache current;
+    if (cache_filename != nullptr) {
+        LoadValidationCache(cache_filename, previous);
+    }
+
+    // Authentication blocks must be signed by one of the TAM's keys, each
+    // identified by the digest of its public key.
+    std::map<teep_signature_kind_t, struct t_cose_key> key_pairs;
+    teep_error_code_t result = TamGetSigningKeyPairs(key_pairs);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    std::vector<struct t_cose_key> keys;
+    std::vector<uint8_t> signers;
+    for (const auto& [kind, key_pair] : key_pairs) {
+        uint8_t signer[TEEP_SHA256_SIZE];
+        if (teep_compute_public_key_digest(&key_pair, signer) == TEEP_ERR_SUCCESS) {
+            keys.push_back(key_pair);
+            signers.insert(signers.end(), signer, signer + sizeof(signer));
+        }
+    }
+
+    result = ValidateManifestList(&g_FirstManifest, keys, signers, previous, current);
+    teep_error_code_t deltaResult = ValidateManifestList(&g_FirstDeltaManifest, keys, signers, previous, current);
+    if (result == TEEP_ERR_SUCCESS) {
+        result = deltaResult;
+    }
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    // Only manifests still configured are kept, so the cache never
+    // outgrows the repository.
+    if (cache_filename != nullptr) {
+        SaveValidationCache(cache_filename, current);
+    }
+    return TEEP_ERR_SUCCESS;
 }
 
 static teep_error_code_t ConfigureManifest(
     _In_z_ const char* directory_name,
     _In_z_ const char* filename,
-    int is_required)
+    int is_required,
+    bool is_delta)
 {
     FILE* fp = NULL;
     char* manifest = NULL;
@@ -116,11 +1007,18 @@ static teep_error_code_t ConfigureManifest(
         teep_uuid_t component_id;
         result = GetUuidFromFilename(filename, &component_id);
         if (result == TEEP_ERR_SUCCESS) {
+            const char* content = manifest;
             if (manifest_size > 2 && manifest[0] == 0xd8 && manifest[1] == 0x6b) {
-                Manifest::AddManifest(component_id, manifest + 2, manifest_size - 2, is_required);
+                content += 2;
+                manifest_size -= 2;
+            }
+            if (is_delta) {
+                // The base sequence number follows the component id.
+                const char* base = strchr(filename, '.');
+                Manifest::AddDeltaManifest(component_id, strtoull(base + 1, nullptr, 10), content, manifest_size);
             }
             else {
-                Manifest::AddManifest(component_id, manifest, manifest_size, is_required);
+                Manifest::AddManifest(component_id, content, manifest_size, is_required);
             }
         }
     } while (0);
@@ -137,9 +1035,10 @@ static teep_error_code_t ConfigureManifest(
  * manifests from a trusted location, or use sealed storage
  * (decrypting the contents inside the TEE).
  */
-teep_error_code_t TamConfigureManifests(
+static teep_error_code_t ConfigureManifestDirectory(
     _In_z_ const char* directory_name,
-    int is_required)
+    int is_required,
+    bool is_delta)
 {
     teep_error_code_t result = TEEP_ERR_SUCCESS;
     DIR* dir = opendir(directory_name);
@@ -157,7 +1056,11 @@ teep_error_code_t TamConfigureManifests(
             strcmp(filename + filename_length - 5, ".cbor") != 0) {
             continue;
         }
-        result = ConfigureManifest(directory_name, filename, is_required);
+        if (is_delta && strchr(filename, '.') == filename + filename_length - 5) {
+            // No base sequence number.
+            continue;
+        }
+        result = ConfigureManifest(directory_name, filename, is_required, is_delta);
         if (result != TEEP_ERR_SUCCESS) {
             break;
         }
@@ -165,3 +1068,15 @@ teep_error_code_t TamConfigureManifests(
     closedir(dir);
     return result;
 }
+
+teep_error_code_t TamConfigureManifests(
+    _In_z_ const char* directory_name,
+    int is_required)
+{
+    return ConfigureManifestDirectory(directory_name, is_required, false);
+}
+
+teep_error_code_t TamConfigureDeltaManifests(_In_z_ const char* directory_name)
+{
+    return ConfigureManifestDirectory(directory_name, false, true);
+}
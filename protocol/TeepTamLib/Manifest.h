@@ -1,9 +1,22 @@
 // Copyright (c) TEEP contributors
 // SPDX-License-Identifier: MIT
 #pragma once
+#include <vector>
 #include "qcbor/UsefulBuf.h"
 #include "common.h"
 
+// Fields of a manifest that TAM policy needs, decoded once when the
+// manifest is loaded so that composing an Update never decodes CBOR.
+// Byte ranges point into the manifest's ManifestContents.
+struct ManifestMetadata
+{
+    uint64_t SequenceNumber;              // suit-manifest-sequence-number, or 0.
+    uint64_t ImageSize;                   // suit-parameter-image-size of the component, or 0.
+    UsefulBufC Digest;                    // SHA-256 suit-digest of suit-manifest.
+    UsefulBufC ImageDigest;               // SHA-256 suit-parameter-image-digest.
+    std::vector<UsefulBufC> Dependencies; // Component IDs in suit-dependencies.
+};
+
 class Manifest
 {
 public:
@@ -16,10 +29,39 @@ public:
     static _Ret_maybenull_ Manifest* First(void);
     static void ClearManifests(void);
 
+    // Add a manifest that upgrades a component from the version with the
+    // given sequence number by means of a delta payload.
+    static void AddDeltaManifest(
+        teep_uuid_t component_id,
+        uint64_t base_sequence_number,
+        _In_reads_(manifest_content_size) const char* manifest_content,
+        size_t manifest_content_size);
+
+    // Remove any manifest that agents would reject, such as one that is
+    // malformed or whose suit-digest does not match its contents.  If a
+    // cache file is given, results are kept there keyed by the digest of
+    // each envelope, so that only changed manifests are checked again.
+    // Fails, keeping no manifests, if they cannot be checked at all.
+    static teep_error_code_t ValidateManifests(_In_opt_z_ const char* cache_filename);
+
+    // Reorder manifests so that each comes after any others in the list
+    // that install a component it depends on, otherwise keeping their
+    // order.  Agents can then install each one as it arrives.
+    static void SortByDependencies(_Inout_ std::vector<Manifest*>& manifests);
+
     bool HasComponentId(_In_ const UsefulBufC* component_id);
+
+    // Find a delta manifest that upgrades this component from the given
+    // version to this one.
+    _Ret_maybenull_ Manifest* FindDeltaManifest(uint64_t base_sequence_number);
+
     Manifest* Next;
     int IsRequired;
     UsefulBufC ManifestContents;
+    UsefulBufC WireContents;       // ManifestContents less what agents don't use.
+    UsefulBufC CompressedContents; // WireContents compressed, or null if no smaller.
+    ManifestMetadata Metadata;
+    uint64_t BaseSequenceNumber; // Only for delta manifests.
 
 private:
     Manifest(
@@ -31,9 +73,13 @@ private:
     teep_uuid_t _component_id;
 
     static Manifest* g_FirstManifest;
+    static Manifest* g_FirstDeltaManifest;
 };
 
 teep_error_code_t TamConfigureManifests(
     _In_z_ const char* directory_name,
     int is_required);
 
+// Load delta manifests, named "<component id>.<base sequence number>.cbor".
+teep_error_code_t TamConfigureDeltaManifests(_In_z_ const char* directory_name);
+
@@ -12,6 +12,7 @@ RequestedComponentInfo::RequestedComponentInfo(_In_ const UsefulBufC* componentI
         this->ComponentId.ptr = nullptr;
     }
     this->ManifestSequenceNumber = 0;
+    this->HaveManifestSequenceNumber = false;
     this->HaveBinary = false;
     this->Next = nullptr;
 }
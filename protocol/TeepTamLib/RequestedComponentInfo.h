@@ -10,6 +10,7 @@ public:
     RequestedComponentInfo* Next;
     UsefulBufC ComponentId;
     uint64_t ManifestSequenceNumber;
+    bool HaveManifestSequenceNumber;
     bool HaveBinary;
 };
 
@@ -36,5 +36,10 @@ teep_error_code_t TamLoadConfiguration(_In_z_ const char* dataDirectory)
         return result;
     }
 
-    return TEEP_ERR_SUCCESS;
+    // Deltas are optional, so the directory need not exist.
+    std::string deltaManifestPath = std::string(dataDirectory) + "/manifests/deltas";
+    TamConfigureDeltaManifests(deltaManifestPath.c_str());
+
+    std::string validationCachePath = std::string(dataDirectory) + "/manifests/validation.cache";
+    return Manifest::ValidateManifests(validationCachePath.c_str());
 }
\ No newline at end of file
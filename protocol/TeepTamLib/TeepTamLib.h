@@ -2,6 +2,8 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 #include "common.h"
+#include "buffer_pool.h"
+#include "../TeepTransport.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,12 +20,37 @@ extern "C" {
         size_t messageLength);
     teep_error_code_t TamProcessConnect(_In_ void* sessionHandle, _In_z_ const char* acceptMediaType);
 
-    teep_error_code_t TamQueueOutboundTeepMessage(
+    // Check that a push request, described in TeepTransport.h, was signed
+    // by a trusted agent and is not a replay, and get the ID of the device
+    // to hold a wait for.
+    teep_error_code_t TamVerifyPushRequest(
+        _In_reads_(requestLength) const char* request,
+        size_t requestLength,
+        _Out_writes_z_(TEEP_PUSH_MAX_DEVICE_ID_LENGTH + 1) char* deviceId);
+
+    // Forget every QueryRequest sent, so agents must be asked again.
+    void TamShutdown(void);
+
+    // Outbound messages are composed straight into a buffer the transport
+    // provides, and then handed back to it to send without a copy.
+
+    // Get a buffer of at least the given size to compose a message in.
+    teep_error_code_t TamAcquireOutboundTeepBuffer(
+        _In_ void* sessionHandle,
+        size_t size,
+        _Out_ teep_buffer_t* buffer);
+
+    // Queue a message to send, passing ownership of the buffer holding it
+    // to the transport whether or not this succeeds.
+    teep_error_code_t TamQueueOutboundTeepBuffer(
         _In_ void* sessionHandle,
         _In_z_ const char* mediaType,
-        _In_reads_(messageLength) const char* message,
+        _Inout_ teep_buffer_t* buffer,
         size_t messageLength);
 
+    // Give back a buffer that will not be queued after all.
+    void TamReleaseOutboundTeepBuffer(_In_ void* sessionHandle, _Inout_ teep_buffer_t* buffer);
+
 #ifdef __cplusplus
 };
 #endif
@@ -1,12 +1,19 @@
 // Copyright (c) TEEP contributors
 // SPDX-License-Identifier: MIT
+#include <deque>
 #include <dirent.h>
 #include <map>
+#ifndef TEEP_USE_TEE
+#include <mutex>
+#endif
 #include <optional>
 #include <sstream>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <time.h>
+#include <vector>
 #include "common.h"
 #include "Manifest.h"
 #include "openssl/x509.h"
@@ -21,6 +28,152 @@
 #include "TeepTamEcallHandler.h"
 #include "TeepTamLib.h"
 
+// Every QueryRequest carries a token, which an agent may quote again later
+// in the first message of a new session.  The token holds when it was
+// issued and a MAC under a key only the TAM knows, so a QueryResponse
+// quoting one issued within the lifetime cannot have been composed before
+// then, and issuing one to an unauthenticated connect costs no memory.
+// The first agent to quote a token binds it to that agent's key, and only
+// that agent may quote it again.
+#define TAM_QUERY_TOKEN_TIME_SIZE 8
+#define TAM_QUERY_TOKEN_NONCE_SIZE 8
+#define TAM_QUERY_TOKEN_MAC_SIZE 16
+#define TAM_QUERY_TOKEN_SIZE (TAM_QUERY_TOKEN_TIME_SIZE + TAM_QUERY_TOKEN_NONCE_SIZE + TAM_QUERY_TOKEN_MAC_SIZE)
+#define TAM_QUERY_TOKEN_LIFETIME_SECONDS (60 * 60)
+#define TAM_MAX_QUERY_TOKENS 4096 // Tokens bound to an agent.
+
+typedef struct {
+    time_t IssueTime;
+    std::string DeviceId;
+} TamQueryTokenBinding;
+
+static struct {
+    uint8_t Key[TEEP_SHA256_SIZE];
+    bool HaveKey;
+    std::map<std::string, TamQueryTokenBinding> Bindings;
+    std::deque<std::string> Order; // Oldest first.
+    time_t ForgottenBefore; // Tokens issued before this may have been bound and forgotten.
+#ifndef TEEP_USE_TEE
+    std::mutex Lock;
+#endif
+} g_QueryTokens;
+
+#ifdef TEEP_USE_TEE
+#define LOCK_QUERY_TOKENS()
+#else
+#define LOCK_QUERY_TOKENS() std::lock_guard<std::mutex> lock(g_QueryTokens.Lock)
+#endif
+
+// Compute the MAC of a token's issue time and nonce.  The caller holds the
+// lock.
+static teep_error_code_t TamComputeQueryTokenMac(
+    _In_reads_(TAM_QUERY_TOKEN_TIME_SIZE + TAM_QUERY_TOKEN_NONCE_SIZE) const uint8_t* token,
+    _Out_writes_(TEEP_SHA256_SIZE) uint8_t* mac)
+{
+    if (!g_QueryTokens.HaveKey) {
+        teep_error_code_t result = teep_random(g_QueryTokens.Key, sizeof(g_QueryTokens.Key));
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+        g_QueryTokens.HaveKey = true;
+    }
+    return teep_hmac_sha256(
+        { g_QueryTokens.Key, sizeof(g_QueryTokens.Key) },
+        { token, TAM_QUERY_TOKEN_TIME_SIZE + TAM_QUERY_TOKEN_NONCE_SIZE },
+        mac);
+}
+
+static teep_error_code_t TamIssueQueryToken(_Out_writes_(TAM_QUERY_TOKEN_SIZE) uint8_t* token)
+{
+    uint64_t now = (uint64_t)time(nullptr);
+    for (int i = 0; i < TAM_QUERY_TOKEN_TIME_SIZE; i++) {
+        token[i] = (uint8_t)(now >> (8 * (TAM_QUERY_TOKEN_TIME_SIZE - 1 - i)));
+    }
+    teep_error_code_t result = teep_random(token + TAM_QUERY_TOKEN_TIME_SIZE, TAM_QUERY_TOKEN_NONCE_SIZE);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+
+    uint8_t mac[TEEP_SHA256_SIZE];
+    LOCK_QUERY_TOKENS();
+    result = TamComputeQueryTokenMac(token, mac);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    memcpy(token + TAM_QUERY_TOKEN_TIME_SIZE + TAM_QUERY_TOKEN_NONCE_SIZE, mac, TAM_QUERY_TOKEN_MAC_SIZE);
+    return TEEP_ERR_SUCCESS;
+}
+
+// Check whether a token is one this TAM issued, that is still fresh, and
+// that no other agent has quoted, and if so bind it to this agent.
+static bool TamUseQueryToken(UsefulBufC token, _In_ const std::string& deviceId)
+{
+    if (token.len != TAM_QUERY_TOKEN_SIZE || deviceId.empty()) {
+        return false;
+    }
+    const uint8_t* bytes = (const uint8_t*)token.ptr;
+    uint64_t issued = 0;
+    for (int i = 0; i < TAM_QUERY_TOKEN_TIME_SIZE; i++) {
+        issued = (issued << 8) | bytes[i];
+    }
+    time_t issueTime = (time_t)issued;
+    time_t now = time(nullptr);
+    if (issueTime > now || now - issueTime > TAM_QUERY_TOKEN_LIFETIME_SECONDS) {
+        return false;
+    }
+
+    LOCK_QUERY_TOKENS();
+    uint8_t mac[TEEP_SHA256_SIZE];
+    if (!g_QueryTokens.HaveKey || TamComputeQueryTokenMac(bytes, mac) != TEEP_ERR_SUCCESS) {
+        return false;
+    }
+    uint8_t difference = 0;
+    for (int i = 0; i < TAM_QUERY_TOKEN_MAC_SIZE; i++) {
+        difference |= mac[i] ^ bytes[TAM_QUERY_TOKEN_TIME_SIZE + TAM_QUERY_TOKEN_NONCE_SIZE + i];
+    }
+    if (difference != 0) {
+        return false;
+    }
+
+    std::string key((const char*)token.ptr, token.len);
+    auto it = g_QueryTokens.Bindings.find(key);
+    if (it != g_QueryTokens.Bindings.end()) {
+        return it->second.DeviceId == deviceId;
+    }
+    if (issueTime < g_QueryTokens.ForgottenBefore) {
+        // It may have been bound to another agent.
+        return false;
+    }
+
+    // Forget bindings that have expired, or the oldest if there are too
+    // many.
+    while (!g_QueryTokens.Order.empty()) {
+        auto oldest = g_QueryTokens.Bindings.find(g_QueryTokens.Order.front());
+        if ((g_QueryTokens.Order.size() < TAM_MAX_QUERY_TOKENS) &&
+            (now - oldest->second.IssueTime <= TAM_QUERY_TOKEN_LIFETIME_SECONDS)) {
+            break;
+        }
+        if (oldest->second.IssueTime + 1 > g_QueryTokens.ForgottenBefore) {
+            g_QueryTokens.ForgottenBefore = oldest->second.IssueTime + 1;
+        }
+        g_QueryTokens.Bindings.erase(oldest);
+        g_QueryTokens.Order.pop_front();
+    }
+    g_QueryTokens.Bindings[key] = { issueTime, deviceId };
+    g_QueryTokens.Order.push_back(key);
+    return true;
+}
+
+void TamShutdown(void)
+{
+    LOCK_QUERY_TOKENS();
+    memset(g_QueryTokens.Key, 0, sizeof(g_QueryTokens.Key));
+    g_QueryTokens.HaveKey = false;
+    g_QueryTokens.Bindings.clear();
+    g_QueryTokens.Order.clear();
+    g_QueryTokens.ForgottenBefore = 0;
+}
+
 /* Compose a raw QueryRequest message to be signed. */
 teep_error_code_t TamComposeQueryRequest(
     std::optional<int> minVersion,
@@ -38,8 +191,14 @@ teep_error_code_t TamComposeQueryRequest(
 
         QCBOREncode_OpenMap(&context);
         {
-            // Create a random token only if the attestation bit will be clear,
-            // but we always set the attestation bit so we never add a token.
+            // Add a token, which the attestation bit does not require, so
+            // that the agent can answer this QueryRequest again later.
+            uint8_t token[TAM_QUERY_TOKEN_SIZE];
+            teep_error_code_t result = TamIssueQueryToken(token);
+            if (result != TEEP_ERR_SUCCESS) {
+                return result;
+            }
+            QCBOREncode_AddBytesToMapN(&context, TEEP_LABEL_TOKEN, { token, sizeof(token) });
 
             // Add supported freshness mechanisms (defaults to nonce only).
             QCBOREncode_OpenArrayInMapN(&context, TEEP_LABEL_SUPPORTED_FRESHNESS_MECHANISMS);
@@ -116,7 +275,7 @@ teep_error_code_t TamComposeQueryRequest(
         QCBOREncode_CloseArray(&context);
 
         // Add data-item-requested.
-        QCBOREncode_AddUInt64(&context, TEEP_ATTESTATION | TEEP_TRUSTED_COMPONENTS);
+        QCBOREncode_AddUInt64(&context, TEEP_ATTESTATION | TEEP_TRUSTED_COMPONENTS | TEEP_EXTENSIONS);
     }
     QCBOREncode_CloseArray(&context);
 
@@ -151,39 +310,62 @@ TamSendMessage(
     _In_ const UsefulBufC* unsignedMessage,
     teep_signature_kind_t signatureKind)
 {
-    UsefulBufC signedMessage;
-    const char* output_buffer;
-    size_t output_buffer_length;
+    teep_buffer_t buffer;
+    size_t messageLength;
 
 #ifdef TEEP_USE_COSE
     if (signatureKind != TEEP_SIGNATURE_NONE) {
         const size_t max_cose_message_size = 3000;
-        Q_USEFUL_BUF_MAKE_STACK_UB(signed_cose_buffer, max_cose_message_size);
-        teep_error_code_t error = TamSignMessage(unsignedMessage, signed_cose_buffer, signatureKind, &signedMessage);
+#ifdef TEEP_USE_TEE
+        // In a TEE the transport's buffer is host memory, which the host
+        // could change while t_cose reads back what it encoded there, so
+        // sign in enclave memory and copy only the finished message out.
+        std::vector<uint8_t> signingBuffer(max_cose_message_size);
+        UsefulBufC signedMessage;
+        teep_error_code_t error = TamSignMessage(unsignedMessage, { signingBuffer.data(), signingBuffer.size() }, signatureKind, &signedMessage);
         if (error != TEEP_ERR_SUCCESS) {
             return error;
         }
-
-        output_buffer = (const char*)signedMessage.ptr;
-        output_buffer_length = signedMessage.len;
+        error = TamAcquireOutboundTeepBuffer(sessionHandle, signedMessage.len, &buffer);
+        if (error != TEEP_ERR_SUCCESS) {
+            return error;
+        }
+        memcpy(buffer.data, signedMessage.ptr, signedMessage.len);
+#else
+        // Sign straight into the buffer the transport will send from.
+        teep_error_code_t error = TamAcquireOutboundTeepBuffer(sessionHandle, max_cose_message_size, &buffer);
+        if (error != TEEP_ERR_SUCCESS) {
+            return error;
+        }
+        UsefulBufC signedMessage;
+        error = TamSignMessage(unsignedMessage, { buffer.data, buffer.capacity }, signatureKind, &signedMessage);
+        if (error != TEEP_ERR_SUCCESS) {
+            TamReleaseOutboundTeepBuffer(sessionHandle, &buffer);
+            return error;
+        }
+#endif
+        messageLength = signedMessage.len;
     } else {
 #endif
-        output_buffer = (const char*)unsignedMessage->ptr;
-        output_buffer_length = unsignedMessage->len;
+        teep_error_code_t error = TamAcquireOutboundTeepBuffer(sessionHandle, unsignedMessage->len, &buffer);
+        if (error != TEEP_ERR_SUCCESS) {
+            return error;
+        }
+        if (unsignedMessage->len > 0) {
+            memcpy(buffer.data, unsignedMessage->ptr, unsignedMessage->len);
+        }
+        messageLength = unsignedMessage->len;
 #ifdef TEEP_USE_COSE
     }
 #endif
 
-    return TamQueueOutboundTeepMessage(sessionHandle, mediaType, output_buffer, output_buffer_length);
+    return TamQueueOutboundTeepBuffer(sessionHandle, mediaType, &buffer, messageLength);
 }
 
-/* Handle a new incoming connection from a device. */
-static teep_error_code_t TamProcessTeepConnect(
+static teep_error_code_t TamSendQueryRequest(
     _In_ void* sessionHandle,
     _In_z_ const char* mediaType)
 {
-    TeepLogMessage("Received client connection\n");
-
     teep_error_code_t teep_error = TEEP_ERR_SUCCESS;
     Q_USEFUL_BUF_MAKE_STACK_UB(encoded, 4096);
     UsefulBufC encodedC = UsefulBuf_Const(encoded);
@@ -204,6 +386,16 @@ static teep_error_code_t TamProcessTeepConnect(
     return teep_error;
 }
 
+/* Handle a new incoming connection from a device. */
+static teep_error_code_t TamProcessTeepConnect(
+    _In_ void* sessionHandle,
+    _In_z_ const char* mediaType)
+{
+    TeepLogMessage("Received client connection\n");
+
+    return TamSendQueryRequest(sessionHandle, mediaType);
+}
+
 teep_error_code_t TamProcessConnect(_In_ void* sessionHandle, _In_z_ const char* acceptMediaType)
 {
     if (strncmp(acceptMediaType, TEEP_CBOR_MEDIA_TYPE, strlen(TEEP_CBOR_MEDIA_TYPE)) == 0) {
@@ -230,6 +422,7 @@ static teep_error_code_t TamComposeUpdate(
     _In_opt_ const RequestedComponentInfo* currentComponentList,
     _In_opt_ const RequestedComponentInfo* requestedComponentList,
     _In_opt_ const RequestedComponentInfo* unneededComponentList,
+    bool compressManifests,
     _In_ teep_error_code_t errorCode,
     _In_ const std::string& errorMessage,
     _Out_ int* count) // Returns non-zero if we actually have something to update.
@@ -295,7 +488,8 @@ static teep_error_code_t TamComposeUpdate(
             }
             QCBOREncode_CloseArray(&context);
 
-            QCBOREncode_OpenArrayInMapN(&context, TEEP_LABEL_MANIFEST_LIST);
+            // Choose the manifests to send.
+            std::vector<Manifest*> manifests;
             {
                 // Any SUIT manifest for any required components that aren't reported to be present.
                 for (Manifest* manifest = Manifest::First(); manifest != nullptr; manifest = manifest->Next) {
@@ -310,9 +504,20 @@ static teep_error_code_t TamComposeUpdate(
                         }
                     }
                     if (!found) {
-                        QCBOREncode_AddBytes(&context, manifest->ManifestContents);
-                        (*count)++;
+                        manifests.push_back(manifest);
+                    }
+                }
+
+                // Upgrade any installed component that reports an older
+                // version, with a delta from that version if there is one.
+                for (const RequestedComponentInfo* cci = currentComponentList; cci != nullptr; cci = cci->Next) {
+                    Manifest* manifest = Manifest::FindManifest(&cci->ComponentId);
+                    if ((manifest == nullptr) || !cci->HaveManifestSequenceNumber ||
+                        (cci->ManifestSequenceNumber >= manifest->Metadata.SequenceNumber)) {
+                        continue;
                     }
+                    Manifest* delta = manifest->FindDeltaManifest(cci->ManifestSequenceNumber);
+                    manifests.push_back((delta != nullptr) ? delta : manifest);
                 }
 
                 // Add SUIT manifest for any optional components that were requested.
@@ -323,11 +528,50 @@ static teep_error_code_t TamComposeUpdate(
                     }
 
                     // The component is allowed and optional, so ok to install on request.
-                    QCBOREncode_AddBytes(&context, manifest->ManifestContents);
-                    (*count)++;
+                    manifests.push_back(manifest);
+                }
+            }
+            *count += (int)manifests.size();
+
+            // List dependencies ahead of the manifests that need them.
+            Manifest::SortByDependencies(manifests);
+
+            // Send each manifest in the compressed-manifest-list if it has
+            // a compressed form that the agent accepts, and otherwise in
+            // the manifest-list.  The manifest-list is processed first, so
+            // anything a manifest in it depends on must be sent there too.
+            std::vector<bool> sendCompressed(manifests.size());
+            for (size_t i = 0; i < manifests.size(); i++) {
+                sendCompressed[i] = compressManifests && !UsefulBuf_IsNULLC(manifests[i]->CompressedContents);
+            }
+            for (size_t i = manifests.size(); i-- > 0;) {
+                if (sendCompressed[i]) {
+                    continue;
+                }
+                for (UsefulBufC dependency : manifests[i]->Metadata.Dependencies) {
+                    for (size_t j = 0; j < i; j++) {
+                        if (manifests[j]->HasComponentId(&dependency)) {
+                            sendCompressed[j] = false;
+                        }
+                    }
+                }
+            }
+            QCBOREncode_OpenArrayInMapN(&context, TEEP_LABEL_MANIFEST_LIST);
+            for (size_t i = 0; i < manifests.size(); i++) {
+                if (!sendCompressed[i]) {
+                    QCBOREncode_AddBytes(&context, manifests[i]->WireContents);
                 }
             }
             QCBOREncode_CloseArray(&context);
+            if (compressManifests) {
+                QCBOREncode_OpenArrayInMapN(&context, TEEP_LABEL_COMPRESSED_MANIFEST_LIST);
+                for (size_t i = 0; i < manifests.size(); i++) {
+                    if (sendCompressed[i]) {
+                        QCBOREncode_AddBytes(&context, manifests[i]->CompressedContents);
+                    }
+                }
+                QCBOREncode_CloseArray(&context);
+            }
 
             // TODO: TEEP_LABEL_ATTESTATION_PAYLOAD_FORMAT
             // TODO: TEEP_LABEL_ATTESTATION_PAYLOAD
@@ -383,7 +627,7 @@ static teep_error_code_t TamSendErrorUpdateMessage(_In_ void* sessionHandle, tee
     // Compose an Update message.
     UsefulBufC update;
     int count;
-    teep_error_code_t err = TamComposeUpdate(&update, nullptr, nullptr, nullptr, errorCode, errorMessage.c_str(), &count);
+    teep_error_code_t err = TamComposeUpdate(&update, nullptr, nullptr, nullptr, false, errorCode, errorMessage.c_str(), &count);
     if (err != 0) {
         return err;
     }
@@ -408,6 +652,7 @@ static teep_error_code_t TamSendErrorUpdateMessage(_In_ void* sessionHandle, tee
 
 static teep_error_code_t TamHandleQueryResponse(
     _In_ void* sessionHandle,
+    _In_ const std::string& deviceId,
     _Inout_ QCBORDecodeContext* context)
 {
     TeepLogMessage("TamHandleQueryResponse\n");
@@ -425,6 +670,8 @@ static teep_error_code_t TamHandleQueryResponse(
     RequestedComponentInfo currentComponentList(nullptr);
     RequestedComponentInfo requestedComponentList(nullptr);
     RequestedComponentInfo unneededComponentList(nullptr);
+    bool compressManifests = false;
+    bool isStale = false;
     uint16_t mapEntryCount = item.val.uCount;
     for (int mapEntryIndex = 0; mapEntryIndex < mapEntryCount; mapEntryIndex++) {
         QCBORDecode_GetNext(context, &item);
@@ -436,11 +683,12 @@ static teep_error_code_t TamHandleQueryResponse(
                 return TamSendErrorUpdateMessage(sessionHandle, TEEP_ERR_PERMANENT_ERROR, errorMessage.str());
             }
 
-            // Since we always send QueryRequest with the attestation bit set,
-            // and don't include a token in the QueryRequest, we should never
-            // get a token in response.  If we do, it indicates a bug in the
-            // TEEP Agent that sent the QueryResponse.
-            return TamSendErrorUpdateMessage(sessionHandle, TEEP_ERR_PERMANENT_ERROR, "Unexpected token");
+            // The agent may be answering a QueryRequest it kept from an
+            // earlier exchange, which is only fresh enough for a while.
+            if (!TamUseQueryToken(item.val.string, deviceId)) {
+                isStale = true;
+            }
+            break;
 
         case TEEP_LABEL_SELECTED_VERSION:
             if (item.uDataType != QCBOR_TYPE_INT64) {
@@ -536,6 +784,7 @@ static teep_error_code_t TamHandleQueryResponse(
                             return TamSendErrorUpdateMessage(sessionHandle, TEEP_ERR_PERMANENT_ERROR, "No current component");
                         }
                         currentRci->ManifestSequenceNumber = item.val.uint64;
+                        currentRci->HaveManifestSequenceNumber = true;
                         break;
                     case TEEP_LABEL_HAVE_BINARY:
                         if (item.uDataType != QCBOR_TYPE_UINT64) {
@@ -618,6 +867,7 @@ static teep_error_code_t TamHandleQueryResponse(
                             return TamSendErrorUpdateMessage(sessionHandle, TEEP_ERR_PERMANENT_ERROR, "No current component");
                         }
                         currentRci->ManifestSequenceNumber = item.val.uint64;
+                        currentRci->HaveManifestSequenceNumber = true;
                         break;
                     default:
                         errorMessage << "Unrecognized option label " << label << std::endl;
@@ -628,6 +878,27 @@ static teep_error_code_t TamHandleQueryResponse(
             }
             break;
         }
+        case TEEP_LABEL_EXT_LIST:
+        {
+            if (item.uDataType != QCBOR_TYPE_ARRAY) {
+                REPORT_TYPE_ERROR(errorMessage, "ext-list", QCBOR_TYPE_ARRAY, item);
+                return TamSendErrorUpdateMessage(sessionHandle, TEEP_ERR_PERMANENT_ERROR, errorMessage.str());
+            }
+            uint16_t arrayEntryCount = item.val.uCount;
+            for (int arrayEntryIndex = 0; arrayEntryIndex < arrayEntryCount; arrayEntryIndex++) {
+                QCBORDecode_GetNext(context, &item);
+                if (item.uDataType != QCBOR_TYPE_INT64) {
+                    REPORT_TYPE_ERROR(errorMessage, "ext-info", QCBOR_TYPE_INT64, item);
+                    return TamSendErrorUpdateMessage(sessionHandle, TEEP_ERR_PERMANENT_ERROR, errorMessage.str());
+                }
+
+                // Extensions we don't know are of no use to us, so ignore them.
+                if (item.val.int64 == TEEP_EXTENSION_COMPRESSED_MANIFESTS) {
+                    compressManifests = true;
+                }
+            }
+            break;
+        }
         case TEEP_LABEL_ATTESTATION_PAYLOAD_FORMAT: {
             if (item.uDataType != QCBOR_TYPE_TEXT_STRING) {
                 REPORT_TYPE_ERROR(errorMessage, "attestation-payload-format", QCBOR_TYPE_TEXT_STRING, item);
@@ -656,11 +927,17 @@ static teep_error_code_t TamHandleQueryResponse(
         }
     }
 
+    if (isStale) {
+        // Ask again rather than act on what may no longer be true.
+        TeepLogMessage("QueryResponse token is not fresh, sending a new QueryRequest...\n");
+        return TamSendQueryRequest(sessionHandle, TEEP_CBOR_MEDIA_TYPE);
+    }
+
     {
         // Compose an Update message.
         UsefulBufC update;
         int count;
-        teep_error_code_t err = TamComposeUpdate(&update, currentComponentList.Next, requestedComponentList.Next, unneededComponentList.Next, TEEP_ERR_SUCCESS, errorMessage.str(), &count);
+        teep_error_code_t err = TamComposeUpdate(&update, currentComponentList.Next, requestedComponentList.Next, unneededComponentList.Next, compressManifests, TEEP_ERR_SUCCESS, errorMessage.str(), &count);
         if (err != 0) {
             return err;
         }
@@ -764,11 +1041,29 @@ static teep_error_code_t TamHandleError(
     return TEEP_ERR_SUCCESS;
 }
 
+// Name a device by the hex digest of its key.
+static teep_error_code_t TamGetDeviceId(_In_ struct t_cose_key* key_pair, _Out_ std::string* deviceId)
+{
+    uint8_t digest[TEEP_SHA256_SIZE];
+    teep_error_code_t result = teep_compute_public_key_digest(key_pair, digest);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    deviceId->clear();
+    for (uint8_t b : digest) {
+        char hex[3];
+        snprintf(hex, sizeof(hex), "%02x", b);
+        *deviceId += hex;
+    }
+    return TEEP_ERR_SUCCESS;
+}
+
 static teep_error_code_t TamVerifyMessageSignature(
     _In_ void* sessionHandle,
     _In_reads_(messageLength) const char* message,
     size_t messageLength,
-    _Out_ UsefulBufC* pencoded)
+    _Out_ UsefulBufC* pencoded,
+    _Out_ std::string* deviceId)
 {
     UsefulBufC signed_cose;
     signed_cose.ptr = message;
@@ -777,7 +1072,7 @@ static teep_error_code_t TamVerifyMessageSignature(
         teep_error_code_t teeperr = teep_verify_cbor_message(kind, &key_pair, &signed_cose, pencoded);
         if (teeperr == TEEP_ERR_SUCCESS) {
             // TODO(#114): save key_pair in session
-            return TEEP_ERR_SUCCESS;
+            return TamGetDeviceId(&key_pair, deviceId);
         }
     }
     TeepLogMessage("TAM failed verification of agent key\n");
@@ -795,7 +1090,8 @@ static teep_error_code_t TamHandleMessage(
 
     // Verify signature and save which signing key was used.
     UsefulBufC encoded;
-    teep_error_code_t teeperr = TamVerifyMessageSignature(sessionHandle, message, messageLength, &encoded);
+    std::string deviceId;
+    teep_error_code_t teeperr = TamVerifyMessageSignature(sessionHandle, message, messageLength, &encoded, &deviceId);
     if (teeperr != TEEP_ERR_SUCCESS) {
         return teeperr;
     }
@@ -823,7 +1119,7 @@ static teep_error_code_t TamHandleMessage(
     TeepLogMessage("Received CBOR TEEP message type=%d\n", messageType);
     switch (messageType) {
     case TEEP_MESSAGE_QUERY_RESPONSE:
-        teeperr = TamHandleQueryResponse(sessionHandle, &context);
+        teeperr = TamHandleQueryResponse(sessionHandle, deviceId, &context);
         break;
     case TEEP_MESSAGE_SUCCESS:
         teeperr = TamHandleSuccess(sessionHandle, &context);
@@ -865,3 +1161,57 @@ teep_error_code_t TamProcessTeepMessage(
 
     return err;
 }
+
+// The highest sequence number accepted in a push request from each agent,
+// by device ID, so that an old request cannot be replayed.
+static struct {
+    std::map<std::string, uint64_t> Sequences;
+#ifndef TEEP_USE_TEE
+    std::mutex Lock;
+#endif
+} g_PushRequests;
+
+teep_error_code_t TamVerifyPushRequest(
+    _In_reads_(requestLength) const char* request,
+    size_t requestLength,
+    _Out_writes_z_(TEEP_PUSH_MAX_DEVICE_ID_LENGTH + 1) char* deviceId)
+{
+    deviceId[0] = 0;
+    UsefulBufC signed_cose = { request, requestLength };
+    for (auto [kind, key_pair] : TamGetTeepAgentKeys()) {
+        UsefulBufC payload;
+        if (teep_verify_cbor_message(kind, &key_pair, &signed_cose, &payload) != TEEP_ERR_SUCCESS) {
+            continue;
+        }
+
+        QCBORDecodeContext context;
+        QCBORDecode_Init(&context, payload, QCBOR_DECODE_MODE_NORMAL);
+        QCBORItem item;
+        QCBORDecode_GetNext(&context, &item);
+        if (QCBORDecode_Finish(&context) != QCBOR_SUCCESS ||
+            item.uDataType != QCBOR_TYPE_INT64 || item.val.int64 < 0) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        uint64_t sequence = (uint64_t)item.val.int64;
+
+        std::string name;
+        teep_error_code_t result = TamGetDeviceId(&key_pair, &name);
+        if (result != TEEP_ERR_SUCCESS) {
+            return result;
+        }
+
+#ifndef TEEP_USE_TEE
+        std::lock_guard<std::mutex> lock(g_PushRequests.Lock);
+#endif
+        auto it = g_PushRequests.Sequences.find(name);
+        if (it != g_PushRequests.Sequences.end() && sequence <= it->second) {
+            TeepLogMessage("TAM rejected a replayed push request\n");
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        g_PushRequests.Sequences[name] = sequence;
+        snprintf(deviceId, TEEP_PUSH_MAX_DEVICE_ID_LENGTH + 1, "%s", name.c_str());
+        return TEEP_ERR_SUCCESS;
+    }
+    TeepLogMessage("TAM failed verification of a push request\n");
+    return TEEP_ERR_PERMANENT_ERROR;
+}
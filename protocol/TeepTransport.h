@@ -3,3 +3,65 @@
 #pragma once
 
 #define TEEP_TCP_PORT "12345" /* This is just a placeholder for now */
+
+/* Each TEEP message on a TCP connection is preceded by a header of a
+ * 32-bit message length and then a 32-bit session ID, both in network
+ * byte order, so many sessions can share one connection.  An agent starts
+ * a session with an empty message, and every message it sends gets
+ * exactly one back, which is empty if the TAM has nothing more to say.
+ * Messages are always application/teep+cbor. */
+#define TEEP_TCP_FRAME_HEADER_SIZE 8
+#define TEEP_TCP_MAX_MESSAGE_SIZE (64 * 1024 * 1024)
+
+#define TEEP_COAP_PORT "5683"
+#define TEEP_COAP_PATH "teep"
+
+/* CoAP Content-Format for application/teep+cbor, taken from the range for
+ * experimental use until one is assigned. */
+#define TEEP_COAP_CONTENT_FORMAT 65000
+#define TEEP_COAP_MAX_MESSAGE_SIZE (16 * 1024 * 1024)
+
+/* An agent broker holds a push channel open to its TAM by POSTing a push
+ * request to TEEP_PUSH_PATH under the TAM URI.  The request is a
+ * COSE_Sign1 (RFC 9052) made with the agent's signing key, whose payload
+ * is a CBOR unsigned integer that grows with every request, so that an
+ * old request cannot be replayed.  The TAM names the device by the
+ * SHA-256 digest of that key, in hex, and answers 200 as soon as the
+ * device's policy changes, or 204 after TEEP_PUSH_WAIT_SECONDS with
+ * nothing to report, and the broker asks again.  A request not signed by
+ * an agent the TAM trusts gets 403, and one the TAM has no room to hold
+ * gets 503.  An idle agent thus costs the TAM an open connection rather
+ * than a TEEP exchange per poll. */
+#define TEEP_PUSH_PATH "/wait"
+#define TEEP_PUSH_MEDIA_TYPE "application/cose; cose-type=\"cose-sign1\""
+#define TEEP_PUSH_WAIT_SECONDS 20
+#define TEEP_PUSH_MAX_REQUEST_SIZE 512
+#define TEEP_PUSH_MAX_DEVICE_ID_LENGTH 128
+
+/* A TAM front end, such as an HTTP or CoAP server, can hand TEEP messages
+ * to a TAM back end on the same host over an AF_UNIX SOCK_SEQPACKET
+ * socket.  Each message is one record: a header of a 32-bit session ID,
+ * 32-bit flags, and a 64-bit message length, in host byte order, then the
+ * NUL-padded media type, then the message.  A message larger than
+ * TEEP_UNIX_MAX_INLINE_MESSAGE_SIZE instead goes in shared memory, a
+ * memfd the sender passes with SCM_RIGHTS the first time and then reuses,
+ * which the receiver maps once and copies each message out of, since the
+ * sender can still write to it.  Every message gets exactly one back,
+ * with the same session ID.  A TAM broker built with USE_UNIX_FRONT_END
+ * is such a front end, serving CoAP, and one built with USE_UNIX_SOCKET
+ * is the back end. */
+#define TEEP_UNIX_SOCKET_PATH "/run/teep-tam.sock"
+#define TEEP_UNIX_MEDIA_TYPE_SIZE 80
+#define TEEP_UNIX_MAX_INLINE_MESSAGE_SIZE (60 * 1024)
+#define TEEP_UNIX_MAX_MESSAGE_SIZE (64 * 1024 * 1024)
+
+/* A gateway that hosts many agents can bundle their messages for the same
+ * TAM into one HTTP POST of TEEP_BUNDLE_MEDIA_TYPE (RFC 2046), one part
+ * per message, each with a Content-ID naming the agent's device.  An
+ * empty part starts a session.  The TAM answers 200 with a bundle of its
+ * own, holding exactly one part per part received, in order and with the
+ * same Content-ID, which is empty if the TAM has nothing more to say to
+ * that device. */
+#define TEEP_BUNDLE_MEDIA_TYPE "multipart/mixed"
+#define TEEP_BUNDLE_MAX_PARTS 256
+#define TEEP_BUNDLE_MAX_DEVICE_ID_LENGTH 128
@@ -95,6 +95,21 @@ teep_error_code_t TeepAgentQueueOutboundTeepMessage(
     return TEEP_ERR_SUCCESS;
 }
 
+// Start a session with a POST carrying the given message, which is sent
+// once the ECALL returns.
+teep_error_code_t TeepAgentConnectWithMessage(
+    _In_z_ const char* tamUri,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    // Create session state.
+    TeepAgentSession* session = &g_Session;
+    strcpy_s(session->TamUri, tamUri);
+
+    return TeepAgentQueueOutboundTeepMessage(&session->Basic, mediaType, message, messageLength);
+}
+
 // The caller is responsible for freeing the returned buffer if non-null.
 const char* TeepAgentSendMessage(TeepAgentSession* session, char** pResponseMediaType, int* pResponseLength)
 {
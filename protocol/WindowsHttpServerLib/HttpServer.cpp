@@ -8,35 +8,47 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "AdmissionControl.h"
+#include "buffer_pool.h"
+#include "bundle.h"
+#include "BundleServer.h"
 #include "HttpServer.h"
+#include "PushChannel.h"
 #include "TeepTamBrokerLib.h"
 
 #pragma comment(lib, "httpapi.lib")
 
 #define ASSERT(x) if (!(x)) { DebugBreak(); }
 
-typedef struct {
-    char OutboundMediaType[80];
-    const char* OutboundMessage;
-    size_t OutboundMessageLength;
-} TeepBasicSession;
+TamBrokerSession g_Session = {};
 
-TeepBasicSession g_Session = { NULL, 0 };
+teep_error_code_t TamAcquireOutboundTeepBuffer(void* sessionHandle, size_t size, teep_buffer_t* buffer)
+{
+    return teep_buffer_acquire(size, buffer);
+}
 
-teep_error_code_t TamQueueOutboundTeepMessage(void* sessionHandle, const char* mediaType, const char* message, size_t messageLength)
+void TamReleaseOutboundTeepBuffer(void* sessionHandle, teep_buffer_t* buffer)
 {
-    TeepBasicSession* session = (TeepBasicSession*)sessionHandle;
+    teep_buffer_release(buffer);
+}
 
-    assert(session->OutboundMessage == nullptr);
+teep_error_code_t TamQueueOutboundTeepBuffer(void* sessionHandle, const char* mediaType, teep_buffer_t* buffer, size_t messageLength)
+{
+    TamBrokerSession* session = (TamBrokerSession*)sessionHandle;
 
-    // Save message for later transmission.
-    char* data = (char*)malloc(messageLength);
-    if (data == nullptr) {
-        return TEEP_ERR_TEMPORARY_ERROR;
-    }
-    memcpy(data, message, messageLength);
-    session->OutboundMessage = data;
+    assert(session->OutboundBuffer.data == nullptr);
+
+    // Keep the buffer for later transmission.
+    session->OutboundBuffer = *buffer;
     session->OutboundMessageLength = messageLength;
+    buffer->data = nullptr;
+    buffer->capacity = 0;
     printf("Sending %zd bytes...\n", messageLength);
 
     strcpy_s(session->OutboundMediaType, sizeof(session->OutboundMediaType), mediaType);
@@ -64,9 +76,6 @@ teep_error_code_t TamQueueOutboundTeepMessage(void* sessionHandle, const char* m
             (USHORT) strlen(RawValue);                               \
     } while(FALSE)
 
-#define ALLOC_MEM(cb) HeapAlloc(GetProcessHeap(), 0, (cb))
-#define FREE_MEM(ptr) HeapFree(GetProcessHeap(), 0, (ptr))
-
 #define MAX_ULONG_STR ((ULONG) sizeof("4294967295"))
 
 // The following functions are based on code from https://docs.microsoft.com/en-us/windows/desktop/Http/http-server-sample-application
@@ -141,61 +150,132 @@ DWORD SendHttpResponse(
     return result;
 }
 
-// Handle an incoming POST request, which might be for any session.
-DWORD HandleHttpPost(
-    _In_ HANDLE        hReqQueue,
-    _In_ HTTP_REQUEST* pRequest)
+static size_t g_MaxBodySize = TAM_HTTP_DEFAULT_MAX_BODY_SIZE;
+
+void SetHttpServerMaxBodySize(size_t maxBodySize)
 {
-    TeepBasicSession* session = &g_Session;
-    int result = 0;
+    g_MaxBodySize = maxBodySize;
+}
 
-    // Allocate a buffer for the content.
-    int inputBufferSize = 4096;
-    char* inputBuffer = (PCHAR)ALLOC_MEM(inputBufferSize);
-    if (inputBuffer == nullptr) {
-        return ERROR_NOT_ENOUGH_MEMORY;
+// Copy a header value into a NUL-terminated string, which is empty if the
+// header is absent or does not fit.
+static void GetHeaderValue(_In_ const HTTP_KNOWN_HEADER* header, _Out_writes_z_(valueSize) char* value, size_t valueSize)
+{
+    value[0] = 0;
+    if (header->RawValueLength > 0 && header->RawValueLength < valueSize) {
+        memcpy(value, header->pRawValue, header->RawValueLength);
+        value[header->RawValueLength] = 0;
+    }
+}
+
+// Read the entire body of a request into pooled buffers.  Returns
+// ERROR_BUFFER_OVERFLOW if the body is larger than the maximum allowed.
+static DWORD ReceiveRequestBody(
+    _In_ HANDLE hReqQueue,
+    _In_ HTTP_REQUEST* pRequest,
+    _Out_ teep_buffer_t* body,
+    _Out_ size_t* bodyLength)
+{
+    *bodyLength = 0;
+
+    // A body whose length is known up front is received into one buffer.
+    char contentLength[MAX_ULONG_STR * 2];
+    GetHeaderValue(&pRequest->Headers.KnownHeaders[HttpHeaderContentLength], contentLength, sizeof(contentLength));
+    unsigned long long expectedLength = strtoull(contentLength, nullptr, 10);
+    if (expectedLength > g_MaxBodySize) {
+        body->data = nullptr;
+        body->capacity = 0;
+        return ERROR_BUFFER_OVERFLOW;
     }
-    int totalBytesRead = 0;
 
-    // Read the entire body into a buffer.
+    teep_buffer_chain_t chain;
+    teep_buffer_chain_init(&chain);
+    DWORD result = NO_ERROR;
     if (pRequest->Flags & HTTP_REQUEST_FLAG_MORE_ENTITY_BODY_EXISTS) {
         do {
+            char* space;
+            size_t spaceLength;
+            if (chain.length > g_MaxBodySize ||
+                teep_buffer_chain_reserve(&chain, (size_t)expectedLength + 1, &space, &spaceLength) != TEEP_ERR_SUCCESS) {
+                result = ERROR_BUFFER_OVERFLOW;
+                break;
+            }
             DWORD bytesRead = 0;
             result = HttpReceiveRequestEntityBody(
                 hReqQueue,
                 pRequest->RequestId,
                 HTTP_RECEIVE_REQUEST_ENTITY_BODY_FLAG_FILL_BUFFER,
-                inputBuffer + totalBytesRead,
-                inputBufferSize - totalBytesRead,
+                space,
+                (ULONG)((spaceLength < ULONG_MAX) ? spaceLength : ULONG_MAX),
                 &bytesRead,
                 NULL);
 
             if (result == NO_ERROR || result == ERROR_HANDLE_EOF) {
-                totalBytesRead += bytesRead;
+                teep_buffer_chain_commit(&chain, bytesRead);
             }
         } while (result == NO_ERROR);
+        if (result == ERROR_HANDLE_EOF) {
+            result = NO_ERROR;
+        }
     }
-    if (totalBytesRead < inputBufferSize) {
-        inputBuffer[totalBytesRead] = 0; // Add null termination for debugging ease.
+    if (result == NO_ERROR && chain.length > g_MaxBodySize) {
+        result = ERROR_BUFFER_OVERFLOW;
     }
+    if (result != NO_ERROR) {
+        teep_buffer_chain_release(&chain);
+        body->data = nullptr;
+        body->capacity = 0;
+        return result;
+    }
+
+    // Keep the length, which flattening resets.
+    *bodyLength = chain.length;
+    if (teep_buffer_chain_flatten(&chain, body) != TEEP_ERR_SUCCESS) {
+        teep_buffer_chain_release(&chain);
+        *bodyLength = 0;
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    return NO_ERROR;
+}
 
+// Handle an incoming POST request, which might be for any session.
+DWORD HandleHttpPost(
+    _In_ HANDLE        hReqQueue,
+    _In_ HTTP_REQUEST* pRequest)
+{
+    TamBrokerSession* session = &g_Session;
+    DWORD result = 0;
+
+    // Read the entire body into a pooled buffer, which is NUL-terminated
+    // for debugging ease.
+    teep_buffer_t inputBuffer;
+    size_t totalBytesRead;
+    result = ReceiveRequestBody(hReqQueue, pRequest, &inputBuffer, &totalBytesRead);
+    if (result == ERROR_BUFFER_OVERFLOW) {
+        return SendHttpResponse(
+            hReqQueue,
+            pRequest,
+            413,
+            "Payload Too Large",
+            nullptr,
+            nullptr,
+            0);
+    }
+    if (result != NO_ERROR) {
+        return result;
+    }
+
+    char mediaType[256];
     if (totalBytesRead == 0) {
         // A 0-byte post is a connect.
-        FREE_MEM(inputBuffer);
+        teep_buffer_release(&inputBuffer);
 
         // Get the Accept header value, if any.
-        HTTP_KNOWN_HEADER* acceptHeader = &pRequest->Headers.KnownHeaders[HttpHeaderAccept];
-        int mediaTypeLength = acceptHeader->RawValueLength;
-        char* mediaType = nullptr;
-        if (mediaTypeLength > 0) {
-            mediaType = new char[mediaTypeLength + 1];
-            memcpy(mediaType, acceptHeader->pRawValue, mediaTypeLength);
-            mediaType[mediaTypeLength] = 0;
-        }
+        GetHeaderValue(&pRequest->Headers.KnownHeaders[HttpHeaderAccept], mediaType, sizeof(mediaType));
 
-        int connectResult = TamProcessConnect(session, mediaType);
-        delete mediaType;
+        int connectResult = TamProcessConnect(session, (mediaType[0] != 0) ? mediaType : nullptr);
         if (connectResult != 0) {
+            teep_buffer_release(&session->OutboundBuffer);
             return SendHttpResponse(
                 hReqQueue,
                 pRequest,
@@ -212,27 +292,40 @@ DWORD HandleHttpPost(
                 200,
                 "OK",
                 session->OutboundMediaType,
-                session->OutboundMessage,
+                session->OutboundBuffer.data,
                 session->OutboundMessageLength);
 
-        free((char*)session->OutboundMessage);
-        session->OutboundMessage = nullptr;
+        teep_buffer_release(&session->OutboundBuffer);
         session->OutboundMessageLength = 0;
 
         return result;
     }
 
     // Get the Content-Type header value, if any.
-    HTTP_KNOWN_HEADER* contentTypeHeader = &pRequest->Headers.KnownHeaders[HttpHeaderContentType];
-    int mediaTypeLength = contentTypeHeader->RawValueLength;
-    char* mediaType = nullptr;
-    if (mediaTypeLength > 0) {
-        mediaType = new char[mediaTypeLength + 1];
-        memcpy(mediaType, contentTypeHeader->pRawValue, mediaTypeLength);
-        mediaType[mediaTypeLength] = 0;
-    }
+    GetHeaderValue(&pRequest->Headers.KnownHeaders[HttpHeaderContentType], mediaType, sizeof(mediaType));
 
-    if (TamProcessTeepMessage(session, mediaType, inputBuffer, totalBytesRead) != 0) {
+    if (teep_bundle_is_media_type(mediaType)) {
+        // A gateway sent messages from many devices at once.
+        if (TamProcessBundle(session, mediaType, inputBuffer.data, totalBytesRead, nullptr) != TEEP_ERR_SUCCESS) {
+            result = SendHttpResponse(
+                hReqQueue,
+                pRequest,
+                400,
+                "Bad Request",
+                nullptr,
+                nullptr,
+                0);
+        } else {
+            result = SendHttpResponse(
+                hReqQueue,
+                pRequest,
+                200,
+                "OK",
+                session->OutboundMediaType,
+                session->OutboundBuffer.data,
+                session->OutboundMessageLength);
+        }
+    } else if (TamProcessTeepMessage(session, (mediaType[0] != 0) ? mediaType : nullptr, inputBuffer.data, totalBytesRead) != 0) {
         result = SendHttpResponse(
             hReqQueue,
             pRequest,
@@ -241,6 +334,17 @@ DWORD HandleHttpPost(
             nullptr,
             nullptr,
             0);
+    } else if (session->OutboundMessageLength == 0) {
+        // The TAM has nothing to say, such as when a QueryResponse
+        // shows nothing has changed.
+        result = SendHttpResponse(
+            hReqQueue,
+            pRequest,
+            204,
+            "No Content",
+            nullptr,
+            nullptr,
+            0);
     } else {
         result = SendHttpResponse(
             hReqQueue,
@@ -248,20 +352,168 @@ DWORD HandleHttpPost(
             200,
             "OK",
             session->OutboundMediaType,
-            session->OutboundMessage,
+            session->OutboundBuffer.data,
             session->OutboundMessageLength);
     }
 
-    delete mediaType;
+    teep_buffer_release(&session->OutboundBuffer);
+    session->OutboundMessageLength = 0;
 
-    if (session->OutboundMessage != nullptr) {
-        free((char*)session->OutboundMessage);
-        session->OutboundMessage = nullptr;
-        session->OutboundMessageLength = 0;
+    teep_buffer_release(&inputBuffer);
+    return 0;
+}
+
+// Turn a request away for now, saying when to try again.
+static DWORD SendServiceUnavailable(
+    _In_ HANDLE        hReqQueue,
+    _In_ HTTP_REQUEST* pRequest,
+    uint32_t           retryAfterSeconds)
+{
+    HTTP_RESPONSE response;
+    char retryAfter[MAX_ULONG_STR];
+    INITIALIZE_HTTP_RESPONSE(&response, 503, "Service Unavailable");
+    sprintf_s(retryAfter, sizeof(retryAfter), "%u", retryAfterSeconds);
+    ADD_KNOWN_HEADER(response, HttpHeaderRetryAfter, retryAfter);
+    ULONG result = HttpSendHttpResponse(hReqQueue, pRequest->RequestId, 0, &response, NULL, NULL, NULL, 0, NULL, NULL);
+    if (result != NO_ERROR) {
+        wprintf(L"HttpSendHttpResponse failed with %lu\n", result);
     }
+    return result;
+}
 
-    FREE_MEM(inputBuffer);
-    return 0;
+// A push request held open until its wait completes.
+typedef struct {
+    HANDLE RequestQueue;
+    HTTP_REQUEST_ID RequestId;
+} PendingPushRequest;
+
+static void CompletePushRequest(void* context, int changed)
+{
+    PendingPushRequest* pending = (PendingPushRequest*)context;
+    HTTP_RESPONSE response;
+    if (changed) {
+        INITIALIZE_HTTP_RESPONSE(&response, 200, "OK");
+    } else {
+        INITIALIZE_HTTP_RESPONSE(&response, 204, "No Content");
+    }
+    ULONG result = HttpSendHttpResponse(pending->RequestQueue, pending->RequestId, 0, &response, NULL, NULL, NULL, 0, NULL, NULL);
+    if (result != NO_ERROR) {
+        wprintf(L"HttpSendHttpResponse failed with %lu\n", result);
+    }
+    delete pending;
+}
+
+// Handle a push request by holding it open until the agent that signed it
+// is woken, or the wait times out.
+DWORD HandlePushRequest(
+    _In_ HANDLE        hReqQueue,
+    _In_ HTTP_REQUEST* pRequest)
+{
+    teep_buffer_t body;
+    size_t bodyLength;
+    DWORD result = ReceiveRequestBody(hReqQueue, pRequest, &body, &bodyLength);
+    if (result != NO_ERROR && result != ERROR_BUFFER_OVERFLOW) {
+        return result;
+    }
+    char deviceId[TEEP_PUSH_MAX_DEVICE_ID_LENGTH + 1];
+    teep_error_code_t verified = TEEP_ERR_PERMANENT_ERROR;
+    if (result == NO_ERROR && bodyLength <= TEEP_PUSH_MAX_REQUEST_SIZE) {
+        verified = TamVerifyPushRequest(body.data, bodyLength, deviceId);
+    }
+    teep_buffer_release(&body);
+    if (verified != TEEP_ERR_SUCCESS) {
+        return SendHttpResponse(
+            hReqQueue,
+            pRequest,
+            403,
+            "Forbidden",
+            nullptr,
+            nullptr,
+            0);
+    }
+
+    PendingPushRequest* pending = new PendingPushRequest{ hReqQueue, pRequest->RequestId };
+    if (TamPushAddWaiter(deviceId, CompletePushRequest, pending) != TEEP_ERR_SUCCESS) {
+        // Too many waits are held already.
+        delete pending;
+        return SendServiceUnavailable(hReqQueue, pRequest, TEEP_PUSH_WAIT_SECONDS);
+    }
+    return NO_ERROR;
+}
+
+// TEEP POSTs admitted for the TAM, which handles them one at a time, in
+// order, on a thread of its own so that requests arriving meanwhile can
+// be turned away at once.
+typedef struct {
+    teep_buffer_t Request; // Holds the HTTP_REQUEST.
+    TamAdmissionTicket Ticket;
+} QueuedHttpPost;
+
+static struct {
+    std::mutex Lock;
+    std::condition_variable Ready;
+    std::deque<QueuedHttpPost> Posts;
+    bool Stopping;
+} g_HttpPostQueue;
+
+// Admit a POST to the TAM's queue, taking over the buffer holding it, or
+// turn it away.
+static DWORD QueueHttpPost(
+    _In_ HANDLE           hReqQueue,
+    _Inout_ teep_buffer_t* requestBuffer)
+{
+    QueuedHttpPost post;
+    uint32_t retryAfterSeconds;
+    if (TamAdmitRequest(&post.Ticket, &retryAfterSeconds) != TEEP_ERR_SUCCESS) {
+        return SendServiceUnavailable(hReqQueue, (HTTP_REQUEST*)requestBuffer->data, retryAfterSeconds);
+    }
+    post.Request = *requestBuffer;
+    requestBuffer->data = nullptr;
+    requestBuffer->capacity = 0;
+
+    std::lock_guard<std::mutex> lock(g_HttpPostQueue.Lock);
+    g_HttpPostQueue.Posts.push_back(post);
+    g_HttpPostQueue.Ready.notify_one();
+    return NO_ERROR;
+}
+
+// Hand queued POSTs to the TAM until stopped and none are left.  Between
+// POSTs, look about once a second for a change in policy, so that the TAM
+// never reloads it while handling one.
+static void RunHttpPostWorker(_In_ HANDLE hReqQueue)
+{
+    auto lastPolicyCheck = std::chrono::steady_clock::now();
+    for (;;) {
+        if (std::chrono::steady_clock::now() - lastPolicyCheck >= std::chrono::seconds(1)) {
+            TamBrokerCheckForPolicyChange();
+            lastPolicyCheck = std::chrono::steady_clock::now();
+        }
+        QueuedHttpPost post;
+        {
+            std::unique_lock<std::mutex> lock(g_HttpPostQueue.Lock);
+            if (!g_HttpPostQueue.Ready.wait_for(lock, std::chrono::seconds(1), [] { return !g_HttpPostQueue.Posts.empty() || g_HttpPostQueue.Stopping; })) {
+                continue;
+            }
+            if (g_HttpPostQueue.Posts.empty()) {
+                return;
+            }
+            post = g_HttpPostQueue.Posts.front();
+            g_HttpPostQueue.Posts.pop_front();
+        }
+
+        HTTP_REQUEST* pRequest = (HTTP_REQUEST*)post.Request.data;
+        uint32_t retryAfterSeconds;
+        if (TamStartAdmittedRequest(&post.Ticket, &retryAfterSeconds) != TEEP_ERR_SUCCESS) {
+            SendServiceUnavailable(hReqQueue, pRequest, retryAfterSeconds);
+        } else {
+            DWORD result = HandleHttpPost(hReqQueue, pRequest);
+            if (result != NO_ERROR) {
+                wprintf(L"HandleHttpPost failed with %lu\n", result);
+            }
+            TamFinishAdmittedRequest(&post.Ticket);
+        }
+        teep_buffer_release(&post.Request);
+    }
 }
 
 // Handle a series of incoming requests, which might be for different sessions.
@@ -272,25 +524,25 @@ DWORD DoReceiveRequests(
     HTTP_REQUEST_ID    requestId;
     DWORD              totalBytesRead;
     PHTTP_REQUEST      pRequest;
-    PCHAR              pRequestBuffer;
+    teep_buffer_t      requestBuffer;
     ULONG              RequestBufferLength;
     char               responseBuffer[1024];
     const char        *pResponseString = responseBuffer;
 
     //
-    // Allocate a 2 KB buffer. This size should work for most
-    // requests. The buffer size can be increased if required. Space
-    // is also required for an HTTP_REQUEST structure.
+    // Get a pooled buffer with room for an HTTP_REQUEST structure and
+    // 2 KB of headers. This size should work for most requests. The
+    // buffer grows if required, and is kept at its new size for the
+    // requests that follow, unless a TEEP POST queued for the TAM takes
+    // it over.
     //
-    RequestBufferLength = sizeof(HTTP_REQUEST) + 2048;
-    pRequestBuffer = (PCHAR)ALLOC_MEM(RequestBufferLength);
-
-    if (pRequestBuffer == NULL)
+    if (teep_buffer_acquire(sizeof(HTTP_REQUEST) + 2048, &requestBuffer) != TEEP_ERR_SUCCESS)
     {
         return ERROR_NOT_ENOUGH_MEMORY;
     }
 
-    pRequest = (PHTTP_REQUEST)pRequestBuffer;
+    RequestBufferLength = (ULONG)requestBuffer.capacity;
+    pRequest = (PHTTP_REQUEST)requestBuffer.data;
 
     //
     // Wait for a new request. This is indicated by a NULL
@@ -314,7 +566,7 @@ DWORD DoReceiveRequests(
 
         if (NO_ERROR == result)
         {
-            TeepBasicSession* session = &g_Session;
+            TamBrokerSession* session = &g_Session;
 
             //
             // Worked!
@@ -342,7 +594,9 @@ DWORD DoReceiveRequests(
                     pRequest->CookedUrl.pFullUrl);
 
                 if (wcscmp(pRequest->CookedUrl.pAbsPath, TEEP_PATH) == 0) {
-                    result = HandleHttpPost(hReqQueue, pRequest);
+                    result = QueueHttpPost(hReqQueue, &requestBuffer);
+                } else if (wcscmp(pRequest->CookedUrl.pAbsPath, TEEP_PATH TEEP_PUSH_PATH) == 0) {
+                    result = HandlePushRequest(hReqQueue, pRequest);
                 } else {
                     result = SendHttpResponse(
                         hReqQueue,
@@ -373,6 +627,16 @@ DWORD DoReceiveRequests(
             {
                 break;
             }
+            if (requestBuffer.data == nullptr)
+            {
+                if (teep_buffer_acquire(sizeof(HTTP_REQUEST) + 2048, &requestBuffer) != TEEP_ERR_SUCCESS)
+                {
+                    result = ERROR_NOT_ENOUGH_MEMORY;
+                    break;
+                }
+                RequestBufferLength = (ULONG)requestBuffer.capacity;
+                pRequest = (PHTTP_REQUEST)requestBuffer.data;
+            }
 
             //
             // Reset the Request ID to handle the next request.
@@ -394,19 +658,17 @@ DWORD DoReceiveRequests(
             requestId = pRequest->RequestId;
 
             //
-            // Free the old buffer and allocate a new buffer.
+            // Release the old buffer and get a larger one.
             //
-            RequestBufferLength = totalBytesRead;
-            FREE_MEM(pRequestBuffer);
-            pRequestBuffer = (PCHAR)ALLOC_MEM(RequestBufferLength);
-
-            if (pRequestBuffer == nullptr)
+            teep_buffer_release(&requestBuffer);
+            if (teep_buffer_acquire(totalBytesRead, &requestBuffer) != TEEP_ERR_SUCCESS)
             {
                 result = ERROR_NOT_ENOUGH_MEMORY;
                 break;
             }
 
-            pRequest = (PHTTP_REQUEST)pRequestBuffer;
+            RequestBufferLength = (ULONG)requestBuffer.capacity;
+            pRequest = (PHTTP_REQUEST)requestBuffer.data;
 
         }
         else if (ERROR_CONNECTION_INVALID == result &&
@@ -425,10 +687,7 @@ DWORD DoReceiveRequests(
 
     }
 
-    if (pRequestBuffer)
-    {
-        FREE_MEM(pRequestBuffer);
-    }
+    teep_buffer_release(&requestBuffer);
 
     return result;
 }
@@ -505,7 +764,32 @@ int RunHttpServer(int argc, const wchar_t** argv)
         }
     }
 
-    DoReceiveRequests(hReqQueue);
+    {
+        // Push requests still waiting when their time is up are answered
+        // from a thread of their own.
+        std::atomic<bool> stopping{ false };
+        std::thread expiry([&stopping] {
+            while (!stopping) {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                TamPushExpireWaiters();
+            }
+        });
+
+        g_HttpPostQueue.Stopping = false;
+        std::thread worker(RunHttpPostWorker, hReqQueue);
+
+        DoReceiveRequests(hReqQueue);
+
+        TamPushCancelAll();
+        stopping = true;
+        expiry.join();
+        {
+            std::lock_guard<std::mutex> lock(g_HttpPostQueue.Lock);
+            g_HttpPostQueue.Stopping = true;
+            g_HttpPostQueue.Ready.notify_one();
+        }
+        worker.join();
+    }
 
 CleanUp:
 
@@ -40,6 +40,31 @@ int ecall_TeepAgentProcessTeepMessage(
         messageLength);
 }
 
+int ecall_TeepAgentProcessTeepMessageChunk(
+    void* sessionHandle,
+    const char* mediaType,
+    const char* chunk,
+    size_t chunkLength,
+    int isFinalChunk)
+{
+    return TeepAgentProcessTeepMessageChunk(
+        sessionHandle,
+        mediaType,
+        chunk,
+        chunkLength,
+        isFinalChunk);
+}
+
+int ecall_TeepAgentVerifyInstalledComponents(size_t maxBytes, int* complete)
+{
+    return TeepAgentVerifyInstalledComponents(maxBytes, complete);
+}
+
+int ecall_TeepAgentComposePushRequest(char* buffer, size_t bufferSize, size_t* requestLength)
+{
+    return TeepAgentComposePushRequest(buffer, bufferSize, requestLength);
+}
+
 int ecall_TeepAgentLoadConfiguration(const char* dataDirectory)
 {
     return TeepAgentLoadConfiguration(dataDirectory);
@@ -82,4 +107,42 @@ teep_error_code_t TeepAgentQueueOutboundTeepMessage(
         return TEEP_ERR_TEMPORARY_ERROR;
     }
     return TEEP_ERR_SUCCESS;
+}
+
+teep_error_code_t TeepAgentConnectWithMessage(
+    _In_z_ const char* tamUri,
+    _In_z_ const char* mediaType,
+    _In_reads_(messageLength) const char* message,
+    size_t messageLength)
+{
+    teep_error_code_t err;
+    oe_result_t result = ocall_TeepAgentConnectWithMessage((int*)&err, tamUri, mediaType, message, messageLength);
+    if (result != OE_OK) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    return err;
+}
+
+teep_error_code_t TeepAgentFetchPayload(
+    _In_z_ const char* uri,
+    uint64_t offset,
+    _Out_writes_bytes_to_(bufferSize, *bytesRead) uint8_t* buffer,
+    size_t bufferSize,
+    _Out_ size_t* bytesRead)
+{
+    *bytesRead = 0;
+    teep_error_code_t err;
+    size_t hostBytesRead = 0;
+    oe_result_t result = ocall_TeepAgentFetchPayload((int*)&err, uri, offset, buffer, bufferSize, &hostBytesRead);
+    if (result != OE_OK) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    if (err == TEEP_ERR_SUCCESS) {
+        // The host says how much it wrote, so check it.
+        if (hostBytesRead > bufferSize) {
+            return TEEP_ERR_PERMANENT_ERROR;
+        }
+        *bytesRead = hostBytesRead;
+    }
+    return err;
 }
\ No newline at end of file
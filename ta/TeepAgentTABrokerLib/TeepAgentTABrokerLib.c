@@ -59,7 +59,56 @@ teep_error_code_t TeepAgentProcessTeepMessage(
     return err;
 }
 
-teep_error_code_t TeepAgentLoadConfiguration(_In_z_ const char* dataDirectory)
+teep_error_code_t TeepAgentProcessTeepMessageChunk(
+    _In_ void* sessionHandle,
+    _In_z_ const char* mediaType,
+    _In_reads_(chunkLength) const char* chunk,
+    size_t chunkLength,
+    int isFinalChunk)
+{
+    teep_error_code_t err;
+    oe_result_t result = ecall_TeepAgentProcessTeepMessageChunk(
+        g_ta_eid,
+        (int*)&err,
+        sessionHandle,
+        mediaType,
+        chunk,
+        chunkLength,
+        isFinalChunk);
+    if (result != OE_OK) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    return err;
+}
+
+teep_error_code_t TeepAgentVerifyInstalledComponents(size_t maxBytes, _Out_ int* complete)
+{
+    teep_error_code_t err;
+    oe_result_t result = ecall_TeepAgentVerifyInstalledComponents(g_ta_eid, (int*)&err, maxBytes, complete);
+    if (result != OE_OK) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    return err;
+}
+
+teep_error_code_t TeepAgentComposePushRequest(
+    _Out_writes_bytes_to_(bufferSize, *requestLength) char* buffer,
+    size_t bufferSize,
+    _Out_ size_t* requestLength)
+{
+    teep_error_code_t err;
+    *requestLength = 0;
+    oe_result_t result = ecall_TeepAgentComposePushRequest(g_ta_eid, (int*)&err, buffer, bufferSize, requestLength);
+    if (result != OE_OK) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    if (*requestLength > bufferSize) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    return err;
+}
+
+_In_z_ const char* dataDirectory)
 {
     teep_error_code_t err;
     oe_result_t result = ecall_TeepAgentLoadConfiguration(g_ta_eid, (int*)&err, dataDirectory);
@@ -99,3 +148,13 @@ int ocall_TeepAgentQueueOutboundTeepMessage(void* sessionHandle, const char* med
 {
     return TeepAgentQueueOutboundTeepMessage(sessionHandle, mediaType, message, messageLength);
 }
+
+int ocall_TeepAgentConnectWithMessage(const char* tamUri, const char* mediaType, const char* message, size_t messageLength)
+{
+    return TeepAgentConnectWithMessage(tamUri, mediaType, message, messageLength);
+}
+
+int ocall_TeepAgentFetchPayload(const char* uri, uint64_t offset, uint8_t* buffer, size_t bufferSize, size_t* bytesRead)
+{
+    return TeepAgentFetchPayload(uri, offset, buffer, bufferSize, bytesRead);
+}
@@ -1,5 +1,6 @@
 // Copyright (c) TEEP contributors
 // SPDX-License-Identifier: MIT
+#include <string.h>
 #include "Manifest.h"
 #include "TeepTamLib.h"
 #include "TeepTam_t.h"
@@ -22,19 +23,68 @@ int ecall_TamProcessTeepMessage(
         messageLength);
 }
 
-teep_error_code_t TamQueueOutboundTeepMessage(
+int ecall_TamVerifyPushRequest(
+    const char* request,
+    size_t requestLength,
+    char* deviceId,
+    size_t deviceIdSize)
+{
+    char id[TEEP_PUSH_MAX_DEVICE_ID_LENGTH + 1];
+    teep_error_code_t result = TamVerifyPushRequest(request, requestLength, id);
+    if (result != TEEP_ERR_SUCCESS) {
+        return result;
+    }
+    size_t length = strlen(id);
+    if (length >= deviceIdSize) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    memcpy(deviceId, id, length + 1);
+    return TEEP_ERR_SUCCESS;
+}
+
+// The host provides the buffer an outbound message is sent from, so the
+// broker need not copy it again.  The host can change this memory at any
+// time, so messages are signed in enclave memory and only then copied in.
+teep_error_code_t TamAcquireOutboundTeepBuffer(
+    void* sessionHandle,
+    size_t size,
+    teep_buffer_t* buffer)
+{
+    void* data = nullptr;
+    size_t capacity = 0;
+    oe_result_t result = ocall_TamAcquireOutboundTeepBuffer(&data, sessionHandle, size, &capacity);
+    if (result != OE_OK || data == nullptr) {
+        return TEEP_ERR_TEMPORARY_ERROR;
+    }
+    if (capacity < size || !oe_is_outside_enclave(data, capacity)) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    buffer->data = (char*)data;
+    buffer->capacity = capacity;
+    return TEEP_ERR_SUCCESS;
+}
+
+void TamReleaseOutboundTeepBuffer(void* sessionHandle, teep_buffer_t* buffer)
+{
+    if (buffer->data != nullptr) {
+        (void)ocall_TamReleaseOutboundTeepBuffer(sessionHandle, buffer->data, buffer->capacity);
+    }
+    buffer->data = nullptr;
+    buffer->capacity = 0;
+}
+
+teep_error_code_t TamQueueOutboundTeepBuffer(
     void* sessionHandle,
     const char* mediaType,
-    const char* output_buffer,
-    size_t output_buffer_length)
+    teep_buffer_t* buffer,
+    size_t messageLength)
 {
     int err;
-    oe_result_t result = ocall_TamQueueOutboundTeepMessage((int*)&err, sessionHandle, mediaType, output_buffer, output_buffer_length);
+    oe_result_t result = ocall_TamQueueOutboundTeepBuffer(&err, sessionHandle, mediaType, buffer->data, buffer->capacity, messageLength);
+    buffer->data = nullptr;
+    buffer->capacity = 0;
     if (result != OE_OK) {
         return TEEP_ERR_TEMPORARY_ERROR;
     }
-    if (err != OE_OK) {
-        return TEEP_ERR_TEMPORARY_ERROR;
-    }
-    return TEEP_ERR_SUCCESS;
-}
\ No newline at end of file
+    return (teep_error_code_t)err;
+}
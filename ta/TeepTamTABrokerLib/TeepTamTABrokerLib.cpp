@@ -35,12 +35,45 @@ teep_error_code_t TamProcessConnect(_In_ void* sessionHandle, _In_z_ const char*
     return err;
 }
 
+teep_error_code_t TamVerifyPushRequest(
+    _In_reads_(requestLength) const char* request,
+    size_t requestLength,
+    _Out_writes_z_(TEEP_PUSH_MAX_DEVICE_ID_LENGTH + 1) char* deviceId)
+{
+    teep_error_code_t err;
+    deviceId[0] = 0;
+    oe_result_t result = ecall_TamVerifyPushRequest(g_ta_eid, (int*)&err, request, requestLength, deviceId, TEEP_PUSH_MAX_DEVICE_ID_LENGTH + 1);
+    if (result != OE_OK) {
+        return TEEP_ERR_PERMANENT_ERROR;
+    }
+    deviceId[TEEP_PUSH_MAX_DEVICE_ID_LENGTH] = 0;
+    return err;
+}
+
 int TeepInitialize(void)
 {
     return ecall_Initialize(g_ta_eid);
 }
 
-int ocall_TamQueueOutboundTeepMessage(void* sessionHandle, const char* mediaType, const char* message, size_t messageLength)
+void* ocall_TamAcquireOutboundTeepBuffer(void* sessionHandle, size_t size, size_t* capacity)
+{
+    teep_buffer_t buffer;
+    if (TamAcquireOutboundTeepBuffer(sessionHandle, size, &buffer) != TEEP_ERR_SUCCESS) {
+        *capacity = 0;
+        return NULL;
+    }
+    *capacity = buffer.capacity;
+    return buffer.data;
+}
+
+int ocall_TamQueueOutboundTeepBuffer(void* sessionHandle, const char* mediaType, char* data, size_t capacity, size_t messageLength)
+{
+    teep_buffer_t buffer = { data, capacity };
+    return TamQueueOutboundTeepBuffer(sessionHandle, mediaType, &buffer, messageLength);
+}
+
+void ocall_TamReleaseOutboundTeepBuffer(void* sessionHandle, char* data, size_t capacity)
 {
-    return TamQueueOutboundTeepMessage(sessionHandle, mediaType, message, messageLength);
+    teep_buffer_t buffer = { data, capacity };
+    TamReleaseOutboundTeepBuffer(sessionHandle, &buffer);
 }
\ No newline at end of file